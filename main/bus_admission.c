@@ -0,0 +1,156 @@
+#include "bus_admission.h"
+#include "modbus_manager.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <inttypes.h>
+
+static const char *TAG = "BUS_ADMISSION";
+
+// Refill rates in microseconds of bus time per millisecond of real time
+#define API_RATE (10 * (100 - BUS_POLL_RESERVE_PERCENT))
+#define CLIENT_RATE (API_RATE * BUS_CLIENT_SHARE_PERCENT / 100)
+#define API_DEPTH (API_RATE * 1000)
+#define CLIENT_DEPTH (CLIENT_RATE * 1000)
+
+typedef struct {
+    int32_t tokens;             // Bus time in microseconds; negative while in debt
+    int64_t updated_ms;
+} bucket_t;
+
+typedef struct {
+    bool used;
+    uint32_t client;
+    uint32_t last_used;
+    bucket_t bucket;
+} client_bucket_t;
+
+static bucket_t api_bucket;
+static client_bucket_t clients[BUS_ADMISSION_MAX_CLIENTS];
+static uint32_t use_clock = 0;
+static bus_admission_stats_t stats;
+static portMUX_TYPE admission_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static void refill(bucket_t *bucket, int32_t rate, int32_t depth, int64_t now_ms)
+{
+    int64_t tokens = bucket->tokens + (now_ms - bucket->updated_ms) * rate;
+    bucket->tokens = tokens > depth ? depth : (int32_t)tokens;
+    bucket->updated_ms = now_ms;
+}
+
+// Milliseconds until the bucket holds need
+static uint32_t wait_for(const bucket_t *bucket, int32_t need, int32_t rate)
+{
+    return bucket->tokens >= need ? 0 : (uint32_t)((need - bucket->tokens + rate - 1) / rate);
+}
+
+// The client's bucket; an unknown client takes over the least recently used
+// one with a full bucket, whose owner had nothing left to pay back. If every
+// bucket is still refilling, it takes over the least recently used one with
+// its debt, so cycling through addresses doesn't buy fresh buckets. Called
+// with admission_mux held.
+static client_bucket_t* find_client(uint32_t client, int64_t now_ms)
+{
+    client_bucket_t *oldest = NULL;
+    client_bucket_t *oldest_full = NULL;
+    for (int i = 0; i < BUS_ADMISSION_MAX_CLIENTS; i++) {
+        client_bucket_t *entry = &clients[i];
+        if (entry->used && entry->client == client) {
+            entry->last_used = ++use_clock;
+            return entry;
+        }
+        // A free entry beats any eviction; keep looking only for a match
+        if (oldest_full != NULL && !oldest_full->used) {
+            continue;
+        }
+        if (!entry->used) {
+            oldest = oldest_full = entry;
+            continue;
+        }
+        refill(&entry->bucket, CLIENT_RATE, CLIENT_DEPTH, now_ms);
+        if (entry->bucket.tokens == CLIENT_DEPTH &&
+            (oldest_full == NULL || entry->last_used < oldest_full->last_used)) {
+            oldest_full = entry;
+        }
+        if (oldest == NULL || entry->last_used < oldest->last_used) {
+            oldest = entry;
+        }
+    }
+
+    client_bucket_t *taken = oldest_full != NULL ? oldest_full : oldest;
+    if (!taken->used) {
+        stats.clients++;
+    }
+    if (taken == oldest_full) {
+        taken->bucket.tokens = CLIENT_DEPTH;
+        taken->bucket.updated_ms = now_ms;
+    }
+    taken->used = true;
+    taken->client = client;
+    taken->last_used = ++use_clock;
+    return taken;
+}
+
+bus_admit_t bus_admission_acquire(uint32_t client, uint16_t transactions, uint32_t *retry_after_ms)
+{
+    int64_t cost = (int64_t)transactions * modbus_manager_transaction_time_us();
+    if (cost > INT32_MAX / 2) {
+        cost = INT32_MAX / 2;
+    }
+    // A request larger than a bucket only waits for a full one and leaves it
+    // in debt, which later requests then wait out
+    int32_t api_need = cost < API_DEPTH ? cost : API_DEPTH;
+    int32_t client_need = cost < CLIENT_DEPTH ? cost : CLIENT_DEPTH;
+    int64_t start_ms = esp_timer_get_time() / 1000;
+    bool waited = false;
+
+    for (;;) {
+        int64_t now_ms = esp_timer_get_time() / 1000;
+        bus_admit_t verdict = BUS_ADMIT_OK;
+
+        portENTER_CRITICAL(&admission_mux);
+        client_bucket_t *entry = find_client(client, now_ms);
+        refill(&api_bucket, API_RATE, API_DEPTH, now_ms);
+        refill(&entry->bucket, CLIENT_RATE, CLIENT_DEPTH, now_ms);
+        uint32_t client_wait = wait_for(&entry->bucket, client_need, CLIENT_RATE);
+        uint32_t api_wait = wait_for(&api_bucket, api_need, API_RATE);
+        uint32_t wait = client_wait > api_wait ? client_wait : api_wait;
+        if (wait == 0) {
+            api_bucket.tokens -= cost;
+            entry->bucket.tokens -= cost;
+            stats.admitted++;
+            stats.delayed += waited;
+        } else if (now_ms - start_ms + wait > BUS_ADMISSION_DEADLINE_MS) {
+            verdict = client_wait > api_wait ? BUS_ADMIT_CLIENT_LIMITED : BUS_ADMIT_BUSY;
+            if (verdict == BUS_ADMIT_CLIENT_LIMITED) {
+                stats.client_limited++;
+            } else {
+                stats.busy++;
+            }
+        }
+        portEXIT_CRITICAL(&admission_mux);
+
+        if (wait == 0) {
+            return BUS_ADMIT_OK;
+        }
+        if (verdict != BUS_ADMIT_OK) {
+            ESP_LOGW(TAG, "Refused %u transaction(s) for client %08" PRIx32 ": %s, retry in %" PRIu32 " ms",
+                     transactions, client, verdict == BUS_ADMIT_BUSY ? "bus busy" : "client over share", wait);
+            *retry_after_ms = wait;
+            return verdict;
+        }
+        // Within the deadline: wait, then check again since other requests
+        // may have taken the tokens meanwhile
+        vTaskDelay(pdMS_TO_TICKS(wait) + 1);
+        waited = true;
+    }
+}
+
+void bus_admission_get_stats(bus_admission_stats_t *out)
+{
+    portENTER_CRITICAL(&admission_mux);
+    *out = stats;
+    portEXIT_CRITICAL(&admission_mux);
+    out->transaction_us = modbus_manager_transaction_time_us();
+}
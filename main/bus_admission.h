@@ -0,0 +1,45 @@
+#ifndef BUS_ADMISSION_H
+#define BUS_ADMISSION_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+// Admission control for bus work requested through the web API. The budget
+// is bus time: each transaction costs the measured average transaction time
+// (modbus_manager_transaction_time_us()), so the limits follow the real
+// capacity of the bus at its baud rate and error rate.
+//
+// The API as a whole may use (100 - BUS_POLL_RESERVE_PERCENT)% of the bus;
+// the rest is left to scheduled polling. Each client, identified by its
+// address, may use BUS_CLIENT_SHARE_PERCENT of the API share. Buckets hold one
+// second of their rate, so short bursts pass and sustained load is paced.
+#define BUS_POLL_RESERVE_PERCENT 40
+#define BUS_CLIENT_SHARE_PERCENT 50
+#define BUS_ADMISSION_MAX_CLIENTS 8
+// A request that would have to wait longer than this is refused instead
+#define BUS_ADMISSION_DEADLINE_MS 2000
+
+typedef enum {
+    BUS_ADMIT_OK,
+    BUS_ADMIT_CLIENT_LIMITED,   // This client is over its share: 429
+    BUS_ADMIT_BUSY,             // The API share of the bus is used up: 503
+} bus_admit_t;
+
+typedef struct {
+    uint32_t transaction_us;    // Current cost of one transaction
+    uint32_t admitted;
+    uint32_t delayed;           // Admitted after waiting for tokens
+    uint32_t client_limited;
+    uint32_t busy;
+    uint8_t clients;
+} bus_admission_stats_t;
+
+// Takes bus time for transactions on behalf of client, waiting up to
+// BUS_ADMISSION_DEADLINE_MS for it. On refusal retry_after_ms is when the
+// same request would be admitted.
+bus_admit_t bus_admission_acquire(uint32_t client, uint16_t transactions, uint32_t *retry_after_ms);
+
+void bus_admission_get_stats(bus_admission_stats_t *stats);
+
+#endif
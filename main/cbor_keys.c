@@ -0,0 +1,11 @@
+#include "cbor_keys.h"
+
+const char *const cbor_keys[] = {
+    "device_id", "name", "description", "poll_interval_ms", "baudrate", "enabled", "profile",
+    "status", "last_error", "poll_count", "error_count", "register_count", "registers",
+    "address", "type", "unit", "scale", "offset", "writable", "format", "word_order", "bit_mask",
+    "expression", "last_value", "value", "decimals", "last_update",
+    "config", "devices", "version", "values", "now", "columns", "rows", "deadband", "history",
+};
+
+const uint8_t cbor_key_count = sizeof(cbor_keys) / sizeof(cbor_keys[0]);
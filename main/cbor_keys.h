@@ -0,0 +1,11 @@
+#ifndef CBOR_KEYS_H
+#define CBOR_KEYS_H
+
+#include <stdint.h>
+
+// CBOR responses send these keys as their index in this table. Append only:
+// clients decode by index.
+extern const char *const cbor_keys[];
+extern const uint8_t cbor_key_count;
+
+#endif
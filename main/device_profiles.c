@@ -0,0 +1,54 @@
+#include "device_profiles.h"
+#include <string.h>
+
+const modbus_profile_t* device_profile_find(const char *id)
+{
+    if (id == NULL || id[0] == '\0') {
+        return NULL;
+    }
+
+    for (size_t i = 0; i < modbus_profile_count; i++) {
+        if (strcmp(modbus_profiles[i].id, id) == 0) {
+            return &modbus_profiles[i];
+        }
+    }
+    return NULL;
+}
+
+const modbus_profile_register_t* device_profile_find_register(const modbus_profile_t *profile,
+                                                              register_type_t type, uint16_t address)
+{
+    uint32_t key = ((uint32_t)type << 16) | address;
+    size_t lo = 0;
+    size_t hi = profile->register_count;
+
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        const modbus_profile_register_t *entry = &profile->registers[mid];
+        uint32_t mid_key = ((uint32_t)entry->type << 16) | entry->address;
+        if (mid_key == key) {
+            return entry;
+        }
+        if (mid_key < key) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return NULL;
+}
+
+void device_profile_make_register(const modbus_profile_register_t *entry, modbus_register_t *reg)
+{
+    memset(reg, 0, sizeof(modbus_register_t));
+    reg->address = entry->address;
+    reg->type = entry->type;
+    // The vendor lists give no field masks, so a bitfield is read as the
+    // whole register until a mask is configured
+    reg->format = entry->format == REGISTER_FORMAT_BITFIELD ? REGISTER_FORMAT_UINT16 : entry->format;
+    reg->scale = 1.0f / entry->divisor;
+    reg->writable = entry->writable;
+    strncpy(reg->name, entry->name, sizeof(reg->name) - 1);
+    strncpy(reg->unit, entry->unit, sizeof(reg->unit) - 1);
+    reg->description = entry->symbol;
+}
@@ -0,0 +1,39 @@
+#ifndef DEVICE_PROFILES_H
+#define DEVICE_PROFILES_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "modbus_devices.h"
+
+// Register metadata compiled from the vendor lists in docs/devices at build
+// time (tools/gen_device_profiles.py). The tables are const and stay in flash.
+typedef struct {
+    uint16_t address;
+    register_type_t type;
+    register_format_t format;
+    uint16_t divisor;           // Engineering value = raw / divisor
+    bool writable;
+    const char *symbol;
+    const char *name;
+    const char *unit;
+} modbus_profile_register_t;
+
+typedef struct {
+    const char *id;
+    const char *name;
+    uint32_t baudrate;
+    size_t register_count;
+    const modbus_profile_register_t *registers;   // Sorted by type, then address
+} modbus_profile_t;
+
+extern const modbus_profile_t modbus_profiles[];
+extern const size_t modbus_profile_count;
+
+const modbus_profile_t* device_profile_find(const char *id);
+const modbus_profile_register_t* device_profile_find_register(const modbus_profile_t *profile,
+                                                              register_type_t type, uint16_t address);
+void device_profile_make_register(const modbus_profile_register_t *entry, modbus_register_t *reg);
+
+#endif
@@ -0,0 +1,171 @@
+#include "gzip_fixed.h"
+#include "esp_rom_crc.h"
+#include <string.h>
+#include <stdbool.h>
+
+#define MIN_MATCH 3
+#define MAX_MATCH 258
+#define END_OF_BLOCK 256
+#define GZIP_HEADER_SIZE 10
+#define GZIP_TRAILER_SIZE 8
+
+static const uint16_t length_base[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const uint8_t length_extra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const uint16_t distance_base[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+static const uint8_t distance_extra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+typedef struct {
+    uint8_t *out;
+    size_t size;
+    size_t pos;
+    uint32_t bits;
+    uint8_t count;
+    bool overflow;
+} bit_writer_t;
+
+// Deflate packs values least significant bit first
+static void put_bits(bit_writer_t *bw, uint32_t value, uint8_t n)
+{
+    bw->bits |= value << bw->count;
+    bw->count += n;
+    while (bw->count >= 8) {
+        if (bw->pos < bw->size) {
+            bw->out[bw->pos++] = (uint8_t)bw->bits;
+        } else {
+            bw->overflow = true;
+        }
+        bw->bits >>= 8;
+        bw->count -= 8;
+    }
+}
+
+// ...but Huffman codes most significant bit first
+static void put_code(bit_writer_t *bw, uint32_t code, uint8_t n)
+{
+    uint32_t reversed = 0;
+    for (uint8_t i = 0; i < n; i++) {
+        reversed = (reversed << 1) | (code & 1);
+        code >>= 1;
+    }
+    put_bits(bw, reversed, n);
+}
+
+// Fixed literal/length code (RFC 1951, 3.2.6)
+static void put_symbol(bit_writer_t *bw, uint16_t symbol)
+{
+    if (symbol < 144) {
+        put_code(bw, 0x30 + symbol, 8);
+    } else if (symbol < 256) {
+        put_code(bw, 0x190 + symbol - 144, 9);
+    } else if (symbol < 280) {
+        put_code(bw, symbol - 256, 7);
+    } else {
+        put_code(bw, 0xC0 + symbol - 280, 8);
+    }
+}
+
+static void put_match(bit_writer_t *bw, size_t length, size_t distance)
+{
+    uint8_t code = 28;
+    while (length_base[code] > length) {
+        code--;
+    }
+    put_symbol(bw, 257 + code);
+    put_bits(bw, length - length_base[code], length_extra[code]);
+
+    code = 29;
+    while (distance_base[code] > distance) {
+        code--;
+    }
+    put_code(bw, code, 5);
+    put_bits(bw, distance - distance_base[code], distance_extra[code]);
+}
+
+static inline uint32_t hash3(const uint8_t *p)
+{
+    uint32_t v = ((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | p[2];
+    return (v * 2654435761u) >> (32 - GZIP_FIXED_HASH_BITS);
+}
+
+static void put_le32(uint8_t *out, uint32_t value)
+{
+    out[0] = (uint8_t)value;
+    out[1] = (uint8_t)(value >> 8);
+    out[2] = (uint8_t)(value >> 16);
+    out[3] = (uint8_t)(value >> 24);
+}
+
+size_t gzip_fixed_compress(const uint8_t *in, size_t len, uint8_t *out, size_t out_size, uint16_t *hash)
+{
+    if (len > GZIP_FIXED_MAX_INPUT || out_size < GZIP_HEADER_SIZE + GZIP_TRAILER_SIZE + 2) {
+        return 0;
+    }
+
+    // No file name or time; OS unknown
+    static const uint8_t header[GZIP_HEADER_SIZE] = { 0x1F, 0x8B, 8, 0, 0, 0, 0, 0, 0, 0xFF };
+    memcpy(out, header, sizeof(header));
+
+    bit_writer_t bw = {
+        .out = out + GZIP_HEADER_SIZE,
+        .size = out_size - GZIP_HEADER_SIZE - GZIP_TRAILER_SIZE,
+    };
+    // One final block with the fixed codes
+    put_bits(&bw, 1, 1);
+    put_bits(&bw, 1, 2);
+
+    // Entries are position + 1, so 0 means empty
+    memset(hash, 0, GZIP_FIXED_HASH_SIZE * sizeof(uint16_t));
+    size_t i = 0;
+    while (i < len && !bw.overflow) {
+        size_t best = 0;
+        size_t candidate = 0;
+        if (i + MIN_MATCH <= len) {
+            uint32_t h = hash3(in + i);
+            candidate = hash[h];
+            hash[h] = (uint16_t)(i + 1);
+            if (candidate != 0) {
+                candidate--;
+                size_t max = len - i < MAX_MATCH ? len - i : MAX_MATCH;
+                while (best < max && in[candidate + best] == in[i + best]) {
+                    best++;
+                }
+            }
+        }
+
+        if (best >= MIN_MATCH) {
+            put_match(&bw, best, i - candidate);
+            // Index the positions skipped over so later matches can start there
+            for (size_t k = i + 1; k < i + best && k + MIN_MATCH <= len; k++) {
+                hash[hash3(in + k)] = (uint16_t)(k + 1);
+            }
+            i += best;
+        } else {
+            put_symbol(&bw, in[i]);
+            i++;
+        }
+    }
+    put_symbol(&bw, END_OF_BLOCK);
+    if (bw.count > 0) {
+        put_bits(&bw, 0, 8 - bw.count);     // Pad out the last byte
+    }
+    if (bw.overflow) {
+        return 0;
+    }
+
+    uint8_t *trailer = bw.out + bw.pos;
+    put_le32(trailer, esp_rom_crc32_le(0, in, len));
+    put_le32(trailer + 4, (uint32_t)len);
+    return GZIP_HEADER_SIZE + bw.pos + GZIP_TRAILER_SIZE;
+}
@@ -0,0 +1,22 @@
+#ifndef GZIP_FIXED_H
+#define GZIP_FIXED_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Small gzip encoder for request bodies: greedy LZ77 over the whole input
+// with a one-entry-per-bucket hash table, emitted as a single deflate block
+// with the fixed Huffman codes. It needs no state beyond the hash table, at
+// the price of a somewhat worse ratio than zlib; on repetitive text such as
+// line protocol it still shrinks bodies four- to eightfold.
+#define GZIP_FIXED_HASH_BITS 10
+#define GZIP_FIXED_HASH_SIZE (1 << GZIP_FIXED_HASH_BITS)
+// Input up to this size; positions are kept in 16 bits
+#define GZIP_FIXED_MAX_INPUT 32768
+
+// Compresses in[0, len) into a gzip member in out. hash is scratch space of
+// GZIP_FIXED_HASH_SIZE entries. Returns the compressed size, or 0 if it
+// would not fit in out_size (send the data uncompressed then).
+size_t gzip_fixed_compress(const uint8_t *in, size_t len, uint8_t *out, size_t out_size, uint16_t *hash);
+
+#endif
@@ -85,8 +85,15 @@ function formatTimestamp(ms) {
     return date.toLocaleTimeString();
 }
 
-function scaledValue(raw, scale, offset) {
-    return (raw * scale + offset).toFixed(2);
+function registerValue(reg) {
+    // The firmware decodes the register and reports the value in fixed point
+    if (reg.value !== undefined) {
+        return Number(reg.value).toFixed(reg.decimals);
+    }
+    if (reg.last_value === undefined) {
+        return '--';
+    }
+    return (reg.last_value * reg.scale + reg.offset).toFixed(2);
 }
 
 function getRegisterTypeName(type) {
@@ -95,6 +102,7 @@ function getRegisterTypeName(type) {
         case 2: return 'Discrete';
         case 3: return 'Holding';
         case 4: return 'Input';
+        case 5: return 'Virtual';
         default: return 'Unknown';
     }
 }
@@ -107,9 +115,72 @@ function showTab(tabName) {
     document.getElementById(`${tabName}-tab`).classList.add('active');
 }
 
-function openModal(deviceId) {
+const profileCache = {};
+
+async function loadProfiles() {
+    const select = document.getElementById('device-profile');
+    if (!select) return;
+
+    try {
+        const profiles = await apiCall('/profiles');
+        select.innerHTML = '<option value="">None</option>' + profiles.map(p =>
+            `<option value="${p.id}" data-baudrate="${p.baudrate}">${p.name} (${p.register_count} registers)</option>`
+        ).join('');
+        select.addEventListener('change', () => {
+            const option = select.selectedOptions[0];
+            if (option && option.dataset.baudrate) {
+                document.getElementById('baudrate').value = option.dataset.baudrate;
+            }
+        });
+    } catch (error) {
+        console.error('Failed to load profiles:', error);
+    }
+}
+
+async function getProfileRegisters(profileId) {
+    if (!profileCache[profileId]) {
+        profileCache[profileId] = await apiCall(`/profiles?id=${encodeURIComponent(profileId)}`);
+    }
+    return profileCache[profileId];
+}
+
+function applyProfileRegister(entry) {
+    document.getElementById('register-address').value = entry.address;
+    document.getElementById('register-type').value = entry.type;
+    document.getElementById('register-name').value = entry.name.substring(0, 31);
+    document.getElementById('register-unit').value = entry.unit;
+    document.getElementById('register-scale').value = 1 / entry.divisor;
+    document.getElementById('register-offset').value = 0;
+    // Vendor lists don't give field masks, so bitfields start out as the
+    // whole register; pick Bitfield and a mask to read a single field
+    document.getElementById('register-format').value = entry.format === 5 ? 0 : entry.format;
+    document.getElementById('register-bit-mask').value = '';
+    document.getElementById('register-writable').checked = entry.writable;
+    document.getElementById('register-desc').value = entry.symbol;
+}
+
+async function openModal(deviceId) {
     document.getElementById('add-register-modal').style.display = 'block';
     document.getElementById('register-device-id').value = deviceId;
+
+    const group = document.getElementById('register-profile-group');
+    const select = document.getElementById('register-profile');
+    const device = modelDevices.get(deviceId);
+    group.style.display = 'none';
+    if (!device || !device.profile) return;
+
+    try {
+        const entries = await getProfileRegisters(device.profile);
+        select.innerHTML = '<option value="">Custom register</option>' + entries.map((e, i) =>
+            `<option value="${i}">${getRegisterTypeName(e.type)} ${e.address} - ${e.symbol}</option>`
+        ).join('');
+        select.onchange = () => {
+            if (select.value !== '') applyProfileRegister(entries[parseInt(select.value)]);
+        };
+        group.style.display = 'block';
+    } catch (error) {
+        console.error('Failed to load profile registers:', error);
+    }
 }
 
 function closeModal() {
@@ -117,27 +188,30 @@ function closeModal() {
     document.getElementById('add-register-form').reset();
 }
 
+// Rebuilds the device list from the current configuration; called on load
+// and after every change made from this page
 async function loadDevices() {
     try {
-        const devices = await apiCall('/devices');
-        renderDevices(devices);
+        modelConfig = null;
+        await updateView();
     } catch (error) {
         console.error('Failed to load devices:', error);
         alert('Failed to load devices. Please refresh the page.');
     }
 }
 
-function renderDevices(devices) {
+function renderDevices() {
     const container = document.getElementById('devices-list');
-    if (!container) return;
+    if (!container || !modelConfig) return;
 
+    const devices = modelConfig.devices;
     if (devices.length === 0) {
         container.innerHTML = '<div class="card"><p>No devices configured. Add a device above or use presets.</p></div>';
         return;
     }
 
     container.innerHTML = devices.map(device => `
-        <div class="device-card">
+        <div class="device-card" id="device-${device.device_id}">
             <div class="device-header">
                 <div>
                     <div class="device-title">${device.name}</div>
@@ -145,15 +219,13 @@ function renderDevices(devices) {
                         ID: ${device.device_id} | ${device.description || 'No description'}
                     </div>
                 </div>
-                <div class="status-badge ${getStatusClass(device.status)}">
-                    ${getStatusText(device.status)}
-                </div>
+                <div class="status-badge" data-cell="status"></div>
             </div>
             <div style="margin-bottom: 15px; font-size: 0.9em; color: #6b7280;">
                 <span>Baudrate: ${device.baudrate}</span> |
                 <span>Poll Interval: ${device.poll_interval_ms}ms</span> |
-                <span>Polls: ${device.poll_count}</span> |
-                <span>Errors: ${device.error_count}</span>
+                <span>Polls: <span data-cell="polls">--</span></span> |
+                <span>Errors: <span data-cell="errors">--</span></span>
             </div>
             <div>
                 <button class="btn btn-sm btn-secondary" onclick="openModal(${device.device_id})">
@@ -164,48 +236,80 @@ function renderDevices(devices) {
                 </button>
             </div>
             ${device.registers.length > 0 ? `
-                <table class="register-table">
-                    <thead>
-                        <tr>
-                            <th>Addr</th>
-                            <th>Type</th>
-                            <th>Name</th>
-                            <th>Value</th>
-                            <th>Unit</th>
-                            <th>Actions</th>
-                        </tr>
-                    </thead>
-                    <tbody>
-                        ${device.registers.map(reg => `
-                            <tr>
-                                <td>${reg.address}</td>
-                                <td>${getRegisterTypeName(reg.type)}</td>
-                                <td>${reg.name}</td>
-                                <td>${reg.writable ? `
-                                    <input type="number" class="write-input" 
-                                           id="write-${device.device_id}-${reg.address}"
-                                           value="${scaledValue(reg.last_value, reg.scale, reg.offset)}"
-                                           ${reg.writable ? '' : 'disabled'}>
-                                    <button class="btn btn-sm btn-primary" 
-                                            onclick="writeRegister(${device.device_id}, ${reg.address})">
-                                        Write
-                                    </button>
-                                ` : scaledValue(reg.last_value, reg.scale, reg.offset)}
-                                </td>
-                                <td>${reg.unit || ''}</td>
-                                <td>
-                                    <button class="btn btn-sm btn-secondary" 
-                                            onclick="deleteRegister(${device.device_id}, ${reg.address})">
-                                        Delete
-                                    </button>
-                                </td>
-                            </tr>
-                        `).join('')}
-                    </tbody>
-                </table>
+                <div class="register-table">
+                    <div class="register-row register-head">
+                        <span>Addr</span>
+                        <span>Type</span>
+                        <span>Name</span>
+                        <span>Value</span>
+                        <span>Unit</span>
+                        <span>Actions</span>
+                    </div>
+                    <div data-cell="registers"></div>
+                </div>
             ` : '<p style="color: #6b7280; margin-top: 10px;">No registers configured.</p>'}
         </div>
     `).join('');
+
+    for (const device of devices) {
+        const card = document.getElementById(`device-${device.device_id}`);
+        const cells = {
+            badge: card.querySelector('[data-cell="status"]'),
+            polls: card.querySelector('[data-cell="polls"]'),
+            errors: card.querySelector('[data-cell="errors"]'),
+        };
+        deviceCells.set(device.device_id, cells);
+        showDeviceStatus(cells, device);
+
+        const list = card.querySelector('[data-cell="registers"]');
+        if (list) {
+            new VirtualList(list, device.registers, reg => renderRegisterRow(device, reg),
+                            reg => registerCells.delete(registerKey(device.device_id, reg.type, reg.address)));
+        }
+    }
+}
+
+function renderRegisterRow(device, reg) {
+    const row = elementFromHtml(`
+        <div class="register-row virtual-row">
+            <span>${reg.address}</span>
+            <span>${getRegisterTypeName(reg.type)}</span>
+            <span>${reg.name}</span>
+            <span>${reg.writable ? `
+                <input type="number" class="write-input"
+                       id="write-${device.device_id}-${reg.type}-${reg.address}">
+                <button class="btn btn-sm btn-primary"
+                        onclick="writeRegister(${device.device_id}, ${reg.type}, ${reg.address})">
+                    Write
+                </button>
+            ` : '<span data-cell="value"></span>'}
+            </span>
+            <span>${reg.unit || ''}</span>
+            <span>
+                <button class="btn btn-sm btn-secondary"
+                        onclick="deleteRegister(${device.device_id}, ${reg.type}, ${reg.address})">
+                    Delete
+                </button>
+            </span>
+        </div>
+    `);
+    trackRegisterCells(device, reg, row);
+    return row;
+}
+
+// Poll and error counters change with every poll, so they aren't part of the
+// value deltas; this fetches just them, for the device list only
+async function refreshDeviceCounters() {
+    if (deviceCells.size === 0) return;
+
+    const counters = await apiCall('/devices?fields=device_id,poll_count,error_count');
+    for (const device of counters) {
+        const cells = deviceCells.get(device.device_id);
+        if (cells && cells.polls) {
+            cells.polls.textContent = device.poll_count;
+            cells.errors.textContent = device.error_count;
+        }
+    }
 }
 
 async function addDevice(event) {
@@ -219,7 +323,8 @@ async function addDevice(event) {
         description: formData.get('description'),
         poll_interval_ms: parseInt(formData.get('poll_interval')),
         baudrate: parseInt(formData.get('baudrate')),
-        enabled: formData.get('enabled') === 'on'
+        enabled: formData.get('enabled') === 'on',
+        profile: formData.get('profile') || ''
     };
 
     try {
@@ -259,9 +364,17 @@ async function addRegister(event) {
         unit: formData.get('unit'),
         scale: parseFloat(formData.get('scale')),
         offset: parseFloat(formData.get('offset')),
+        format: parseInt(formData.get('format')),
+        word_order: parseInt(formData.get('word_order')),
+        bit_mask: parseInt(formData.get('bit_mask') || '0'),
+        deadband: parseFloat(formData.get('deadband') || '0'),
         writable: formData.get('writable') === 'on',
+        history: formData.get('history') === 'on',
         description: formData.get('description')
     };
+    if (register.type === 5) {
+        register.expression = formData.get('expression');
+    }
 
     try {
         await apiCall('/registers', 'POST', register);
@@ -273,13 +386,13 @@ async function addRegister(event) {
     }
 }
 
-async function deleteRegister(deviceId, address) {
+async function deleteRegister(deviceId, type, address) {
     if (!confirm('Are you sure you want to delete this register?')) {
         return;
     }
 
     try {
-        await apiCall(`/registers?device_id=${deviceId}&address=${address}`, 'DELETE');
+        await apiCall(`/registers?device_id=${deviceId}&type=${type}&address=${address}`, 'DELETE');
         loadDevices();
         alert('Register deleted successfully!');
     } catch (error) {
@@ -287,11 +400,11 @@ async function deleteRegister(deviceId, address) {
     }
 }
 
-async function writeRegister(deviceId, address) {
+async function writeRegister(deviceId, type, address) {
     // Try dashboard ID first, fall back to device list ID
-    let input = document.getElementById(`dash-write-${deviceId}-${address}`);
+    let input = document.getElementById(`dash-write-${deviceId}-${type}-${address}`);
     if (!input) {
-        input = document.getElementById(`write-${deviceId}-${address}`);
+        input = document.getElementById(`write-${deviceId}-${type}-${address}`);
     }
 
     if (!input) {
@@ -307,9 +420,9 @@ async function writeRegister(deviceId, address) {
     }
 
     try {
-        await apiCall(`/write?device_id=${deviceId}&address=${address}`, 'POST', { value });
+        await apiCall(`/write?device_id=${deviceId}&type=${type}&address=${address}`, 'POST', { value });
         alert('Register written successfully!');
-        loadDevices();
+        refreshView();
     } catch (error) {
         alert('Failed to write register: ' + error.message);
     }
@@ -325,15 +438,16 @@ function addPreset(presetType) {
             description: 'Enervent eAirMD ventilation unit',
             poll_interval_ms: 5000,
             baudrate: 19200,
-            enabled: true
+            enabled: true,
+            profile: 'eairmd'
         };
         registers = [
-            { address: 1, type: 3, name: 'Room Temp TE20', unit: '°C', scale: 0.1, offset: 0, writable: false, description: 'Room temperature sensor TE20' },
-            { address: 6, type: 3, name: 'Fresh Air', unit: '°C', scale: 0.1, offset: 0, writable: false, description: 'Fresh air temperature TE01' },
-            { address: 8, type: 3, name: 'Supply Air', unit: '°C', scale: 0.1, offset: 0, writable: false, description: 'Supply air temperature TE10' },
+            { address: 1, type: 3, name: 'Room Temp TE20', unit: '°C', scale: 0.1, offset: 0, format: 1, writable: false, description: 'Room temperature sensor TE20' },
+            { address: 6, type: 3, name: 'Fresh Air', unit: '°C', scale: 0.1, offset: 0, format: 1, writable: false, description: 'Fresh air temperature TE01' },
+            { address: 8, type: 3, name: 'Supply Air', unit: '°C', scale: 0.1, offset: 0, format: 1, writable: false, description: 'Supply air temperature TE10' },
             { address: 13, type: 3, name: 'Exhaust Humidity', unit: '%RH', scale: 1, offset: 0, writable: false, description: 'Exhaust air relative humidity' },
-            { address: 44, type: 3, name: 'Mode Status', unit: '', scale: 1, offset: 0, writable: false, description: 'Current operating mode' },
-            { address: 135, type: 3, name: 'Setpoint', unit: '°C', scale: 0.1, offset: 0, writable: true, description: 'Supply air temperature setpoint' }
+            { address: 44, type: 3, name: 'Mode Status', unit: '', scale: 1, offset: 0, format: 0, writable: false, description: 'Current operating mode flags' },
+            { address: 135, type: 3, name: 'Setpoint', unit: '°C', scale: 0.1, offset: 0, format: 1, writable: true, description: 'Supply air temperature setpoint' }
         ];
     } else if (presetType === 'ewind') {
         device = {
@@ -342,14 +456,15 @@ function addPreset(presetType) {
             description: 'Enervent eWind ventilation unit',
             poll_interval_ms: 5000,
             baudrate: 9600,
-            enabled: true
+            enabled: true,
+            profile: 'ewind'
         };
         registers = [
-            { address: 6, type: 3, name: 'Fresh Air', unit: '°C', scale: 0.1, offset: 0, writable: false, description: 'Fresh air temperature' },
-            { address: 8, type: 3, name: 'Supply Air', unit: '°C', scale: 0.1, offset: 0, writable: false, description: 'Supply air temperature' },
+            { address: 6, type: 3, name: 'Fresh Air', unit: '°C', scale: 0.1, offset: 0, format: 1, writable: false, description: 'Fresh air temperature' },
+            { address: 8, type: 3, name: 'Supply Air', unit: '°C', scale: 0.1, offset: 0, format: 1, writable: false, description: 'Supply air temperature' },
             { address: 13, type: 3, name: 'Exhaust Humidity', unit: '%RH', scale: 1, offset: 0, writable: false, description: 'Exhaust air relative humidity' },
-            { address: 48, type: 3, name: 'Display Setpoint', unit: '°C', scale: 0.1, offset: 0, writable: false, description: 'Temperature controller setpoint' },
-            { address: 135, type: 3, name: 'Setpoint', unit: '°C', scale: 0.1, offset: 0, writable: true, description: 'Supply air temperature setpoint' }
+            { address: 48, type: 3, name: 'Display Setpoint', unit: '°C', scale: 0.1, offset: 0, format: 1, writable: false, description: 'Temperature controller setpoint' },
+            { address: 135, type: 3, name: 'Setpoint', unit: '°C', scale: 0.1, offset: 0, format: 1, writable: true, description: 'Supply air temperature setpoint' }
         ];
     }
 
@@ -371,72 +486,376 @@ async function addPresetDevice(device, registers) {
     }
 }
 
-async function refreshDashboard() {
-    const container = document.getElementById('dashboard-content');
-    if (!container) return;
+// Client-side model shared by both pages: the configuration from /config
+// (revalidated by ETag, so the browser serves it from cache until it
+// changes) with values merged in from /values, which only returns what
+// changed since the last poll. Registers are looked up by registerKey().
+let modelConfig = null;
+let modelVersion = 0;
+let modelDevices = new Map();
+let modelRegisters = new Map();
+
+function registerKey(deviceId, type, address) {
+    return `${deviceId}:${type}:${address}`;
+}
 
-    try {
-        const devices = await apiCall('/devices');
-        
-        if (devices.length === 0) {
-            container.innerHTML = '<div class="card"><p>No devices configured. <a href="/modbus.html">Configure devices</a></p></div>';
-            document.getElementById('dashboard-status').className = 'status-indicator status-unknown';
-            return;
+async function loadModelConfig() {
+    modelConfig = await apiCall('/config');
+    modelVersion = 0;
+    modelDevices = new Map();
+    modelRegisters = new Map();
+    for (const device of modelConfig.devices) {
+        device.status = 0;
+        modelDevices.set(device.device_id, device);
+        for (const reg of device.registers) {
+            modelRegisters.set(registerKey(device.device_id, reg.type, reg.address), reg);
         }
+    }
+}
 
-        let anyOnline = false;
-        container.innerHTML = devices.map(device => `
-            <h3 style="margin: 20px 0 15px 0; display: flex; align-items: center;">
-                <span class="status-indicator ${getStatusClass(device.status)}"></span>
-                ${device.name} (ID: ${device.device_id})
-            </h3>
-            <div class="dashboard-grid">
-                ${device.registers.map(reg => `
-                    <div class="value-card">
-                        <div class="value-label">${reg.name}</div>
-                        <div class="value-display">
-                            ${scaledValue(reg.last_value, reg.scale, reg.offset)}
-                            <span class="value-unit">${reg.unit || ''}</span>
-                        </div>
-                        ${reg.writable ? `
-                            <div style="margin-top: 10px;">
-                                <input type="number" class="write-input" 
-                                       id="dash-write-${device.device_id}-${reg.address}"
-                                       value="${scaledValue(reg.last_value, reg.scale, reg.offset)}"
-                                       placeholder="New value">
-                                <button class="btn btn-sm btn-primary" 
-                                        onclick="writeRegister(${device.device_id}, ${reg.address})">
-                                    Write
-                                </button>
-                            </div>
-                        ` : ''}
-                        <div class="value-timestamp">
-                            Updated: ${formatTimestamp(reg.last_update)}
-                        </div>
-                    </div>
-                `).join('')}
-            </div>
-        `).join('');
+// Brings the model up to date. Returns what changed, or null when the
+// configuration was (re)loaded and the views must be rebuilt.
+async function pollModelValues() {
+    let reloaded = false;
+    if (!modelConfig) {
+        await loadModelConfig();
+        reloaded = true;
+    }
+    let delta = await apiCall(`/values?since=${modelVersion}`);
+    if (delta.config !== modelConfig.config) {
+        await loadModelConfig();
+        reloaded = true;
+        delta = await apiCall('/values?since=0');
+    }
+
+    const changes = applyValuesDelta(delta);
+    return reloaded ? null : changes;
+}
+
+// Merges a /values delta (polled or pushed) into the model; returns the ids
+// of the devices and the keys of the registers that changed
+function applyValuesDelta(delta) {
+    const changes = { devices: [], registers: [] };
+    for (const [id, status] of delta.devices || []) {
+        const device = modelDevices.get(id);
+        if (device) {
+            device.status = status;
+            changes.devices.push(id);
+        }
+    }
+    for (const [id, type, address, value, lastUpdate] of delta.values || []) {
+        const key = registerKey(id, type, address);
+        const reg = modelRegisters.get(key);
+        if (reg) {
+            reg.value = value;
+            reg.last_update = lastUpdate;
+            changes.registers.push(key);
+        }
+    }
+    modelVersion = delta.version;
+    return changes;
+}
+
+// Elements that show model state, so a delta only touches the cells that
+// changed. Rows of a VirtualList come and go as they scroll in and out.
+const registerCells = new Map();    // register key -> { value, updated, input }
+const deviceCells = new Map();      // device id -> { badge, indicator, polls, errors }
+
+function elementFromHtml(html) {
+    const template = document.createElement('template');
+    template.innerHTML = html.trim();
+    return template.content.firstElementChild;
+}
+
+function trackRegisterCells(device, reg, element) {
+    const cells = {
+        value: element.querySelector('[data-cell="value"]'),
+        updated: element.querySelector('[data-cell="updated"]'),
+        input: element.querySelector('input'),
+    };
+    registerCells.set(registerKey(device.device_id, reg.type, reg.address), cells);
+    showRegisterValue(cells, reg);
+}
+
+function showRegisterValue(cells, reg) {
+    const text = registerValue(reg);
+    if (cells.value && cells.value.textContent !== text) {
+        cells.value.textContent = text;
+    }
+    if (cells.updated) {
+        cells.updated.textContent = `Updated: ${formatTimestamp(reg.last_update)}`;
+    }
+    // Leave alone what the user is typing
+    if (cells.input && document.activeElement !== cells.input && text !== '--') {
+        cells.input.value = text;
+    }
+}
+
+function showDeviceStatus(cells, device) {
+    if (cells.badge) {
+        cells.badge.className = `status-badge ${getStatusClass(device.status)}`;
+        cells.badge.textContent = getStatusText(device.status);
+    }
+    if (cells.indicator) {
+        cells.indicator.className = `status-indicator ${getStatusClass(device.status)}`;
+    }
+}
+
+function patchView(changes) {
+    for (const id of changes.devices) {
+        const cells = deviceCells.get(id);
+        if (cells) showDeviceStatus(cells, modelDevices.get(id));
+    }
+    for (const key of changes.registers) {
+        const cells = registerCells.get(key);
+        if (cells) showRegisterValue(cells, modelRegisters.get(key));
+    }
+    if (changes.devices.length > 0) {
+        showOverallStatus();
+    }
+}
+
+function renderView() {
+    registerCells.clear();
+    deviceCells.clear();
+    renderDevices();
+    renderDashboard();
+}
+
+// Windowed list: only the rows in and near the viewport are in the DOM, so a
+// device with a full profile of several hundred registers costs a few dozen
+// elements. Rows have a fixed height, which places them by index alone.
+const VIRTUAL_ROW_HEIGHT = 44;      // Matches .virtual-row in style.css
+const VIRTUAL_VISIBLE_ROWS = 12;
+const VIRTUAL_OVERSCAN = 6;
+
+class VirtualList {
+    // renderRow(item) returns a row element; releaseRow(item) is called when
+    // its row leaves the DOM
+    constructor(container, items, renderRow, releaseRow) {
+        this.items = items;
+        this.renderRow = renderRow;
+        this.releaseRow = releaseRow;
+        this.rows = new Map();      // item index -> row element
+        this.scheduled = false;
+
+        this.viewport = document.createElement('div');
+        this.viewport.className = 'virtual-list';
+        this.viewport.style.height = `${Math.min(items.length, VIRTUAL_VISIBLE_ROWS) * VIRTUAL_ROW_HEIGHT}px`;
+        this.content = document.createElement('div');
+        this.content.className = 'virtual-content';
+        this.content.style.height = `${items.length * VIRTUAL_ROW_HEIGHT}px`;
+        this.viewport.appendChild(this.content);
+        container.appendChild(this.viewport);
+
+        this.viewport.addEventListener('scroll', () => {
+            if (this.scheduled) return;
+            this.scheduled = true;
+            requestAnimationFrame(() => {
+                this.scheduled = false;
+                this.update();
+            });
+        }, { passive: true });
+        this.update();
+    }
+
+    update() {
+        const top = this.viewport.scrollTop;
+        // A hidden list (inactive tab) has no height yet; assume the default
+        const height = this.viewport.clientHeight || VIRTUAL_VISIBLE_ROWS * VIRTUAL_ROW_HEIGHT;
+        const first = Math.max(0, Math.floor(top / VIRTUAL_ROW_HEIGHT) - VIRTUAL_OVERSCAN);
+        const last = Math.min(this.items.length, Math.ceil((top + height) / VIRTUAL_ROW_HEIGHT) + VIRTUAL_OVERSCAN);
+
+        for (const [index, row] of this.rows) {
+            if (index < first || index >= last) {
+                row.remove();
+                this.rows.delete(index);
+                this.releaseRow(this.items[index]);
+            }
+        }
+        for (let index = first; index < last; index++) {
+            if (!this.rows.has(index)) {
+                const row = this.renderRow(this.items[index]);
+                row.style.top = `${index * VIRTUAL_ROW_HEIGHT}px`;
+                this.content.appendChild(row);
+                this.rows.set(index, row);
+            }
+        }
+    }
+}
 
-        const overallStatus = devices.some(d => d.status === 1) ? 'status-online' :
-                              devices.some(d => d.status === 3) ? 'status-error' : 'status-offline';
-        document.getElementById('dashboard-status').className = `status-indicator ${overallStatus}`;
+// Push channel: while the socket is open the gateway sends each delta as it
+// happens and polling is skipped. If it drops (or WebSockets are unavailable)
+// the page falls back to polling /values and reconnects later.
+let valuesSocket = null;
+
+function connectValuesSocket() {
+    if (!window.WebSocket || valuesSocket) return;
+
+    const scheme = location.protocol === 'https:' ? 'wss:' : 'ws:';
+    const socket = new WebSocket(`${scheme}//${location.host}${API_BASE}/ws`);
+    valuesSocket = socket;
+
+    socket.onmessage = async (event) => {
+        try {
+            const delta = JSON.parse(event.data);
+            if (!modelConfig || delta.config !== modelConfig.config) {
+                // Configuration changed: reload it and subscribe again, which
+                // makes the gateway resend every value
+                await loadModelConfig();
+                socket.send('{}');
+                renderView();
+                return;
+            }
+            patchView(applyValuesDelta(delta));
+        } catch (error) {
+            console.error('Failed to apply pushed values:', error);
+        }
+    };
+    socket.onclose = () => {
+        valuesSocket = null;
+        setTimeout(connectValuesSocket, 10000);
+    };
+}
+
+function valuesSocketOpen() {
+    return valuesSocket !== null && valuesSocket.readyState === WebSocket.OPEN;
+}
+
+// Polls for changes and patches them in, rebuilding only when the
+// configuration changed
+async function updateView() {
+    const changes = await pollModelValues();
+    if (changes === null) {
+        renderView();
+    } else {
+        patchView(changes);
+    }
+    if (document.getElementById('devices-list')) {
+        await refreshDeviceCounters();
+    }
+}
+
+async function refreshView() {
+    try {
+        await updateView();
     } catch (error) {
-        console.error('Failed to refresh dashboard:', error);
-        container.innerHTML = '<div class="card"><p style="color: #ef4444;">Failed to load data. Please refresh.</p></div>';
+        console.error('Failed to refresh values:', error);
+        const container = document.getElementById('dashboard-content');
+        if (container) {
+            container.innerHTML = '<div class="card"><p style="color: #ef4444;">Failed to load data. Please refresh.</p></div>';
+            // Rebuild from scratch once the gateway answers again
+            modelConfig = null;
+        }
     }
 }
 
+// Devices with more registers than this are listed as windowed rows rather
+// than a grid of cards
+const DASHBOARD_CARD_LIMIT = 24;
+
+function renderDashboard() {
+    const container = document.getElementById('dashboard-content');
+    if (!container || !modelConfig) return;
+
+    const devices = modelConfig.devices;
+    if (devices.length === 0) {
+        container.innerHTML = '<div class="card"><p>No devices configured. <a href="/modbus.html">Configure devices</a></p></div>';
+        document.getElementById('dashboard-status').className = 'status-indicator status-unknown';
+        return;
+    }
+
+    container.innerHTML = devices.map(device => `
+        <h3 style="margin: 20px 0 15px 0; display: flex; align-items: center;">
+            <span class="status-indicator" id="dash-status-${device.device_id}"></span>
+            ${device.name} (ID: ${device.device_id})
+        </h3>
+        <div id="dash-registers-${device.device_id}"
+             class="${device.registers.length > DASHBOARD_CARD_LIMIT ? 'value-list' : 'dashboard-grid'}"></div>
+    `).join('');
+
+    for (const device of devices) {
+        const cells = { indicator: document.getElementById(`dash-status-${device.device_id}`) };
+        deviceCells.set(device.device_id, cells);
+        showDeviceStatus(cells, device);
+
+        const holder = document.getElementById(`dash-registers-${device.device_id}`);
+        if (device.registers.length > DASHBOARD_CARD_LIMIT) {
+            new VirtualList(holder, device.registers, reg => renderValueRow(device, reg),
+                            reg => registerCells.delete(registerKey(device.device_id, reg.type, reg.address)));
+        } else {
+            holder.append(...device.registers.map(reg => renderValueCard(device, reg)));
+        }
+    }
+    showOverallStatus();
+}
+
+function writeControls(device, reg) {
+    return reg.writable ? `
+        <input type="number" class="write-input"
+               id="dash-write-${device.device_id}-${reg.type}-${reg.address}"
+               placeholder="New value">
+        <button class="btn btn-sm btn-primary"
+                onclick="writeRegister(${device.device_id}, ${reg.type}, ${reg.address})">
+            Write
+        </button>
+    ` : '';
+}
+
+function renderValueCard(device, reg) {
+    const card = elementFromHtml(`
+        <div class="value-card">
+            <div class="value-label">${reg.name}</div>
+            <div class="value-display">
+                <span data-cell="value"></span>
+                <span class="value-unit">${reg.unit || ''}</span>
+            </div>
+            ${reg.writable ? `<div style="margin-top: 10px;">${writeControls(device, reg)}</div>` : ''}
+            <div class="value-timestamp" data-cell="updated"></div>
+        </div>
+    `);
+    trackRegisterCells(device, reg, card);
+    return card;
+}
+
+function renderValueRow(device, reg) {
+    const row = elementFromHtml(`
+        <div class="value-row virtual-row">
+            <span class="value-label">${reg.name}</span>
+            <span class="value-display">
+                <span data-cell="value"></span>
+                <span class="value-unit">${reg.unit || ''}</span>
+            </span>
+            <span class="value-timestamp" data-cell="updated"></span>
+            <span>${writeControls(device, reg)}</span>
+        </div>
+    `);
+    trackRegisterCells(device, reg, row);
+    return row;
+}
+
+function showOverallStatus() {
+    const indicator = document.getElementById('dashboard-status');
+    if (!indicator || !modelConfig || modelConfig.devices.length === 0) return;
+
+    const devices = modelConfig.devices;
+    const overallStatus = devices.some(d => d.status === 1) ? 'status-online' :
+                          devices.some(d => d.status === 3) ? 'status-error' : 'status-offline';
+    indicator.className = `status-indicator ${overallStatus}`;
+}
+
 function refreshData() {
     const btn = event ? event.target : document.querySelector('.refresh-btn');
     if (btn) {
         btn.classList.add('loading');
     }
     
-    if (document.getElementById('dashboard-content')) {
-        refreshDashboard();
+    // Pushed values keep the page current while the socket is open; the
+    // device list still polls for its counters
+    if (event || !valuesSocketOpen()) {
+        refreshView();
     } else if (document.getElementById('devices-list')) {
-        loadDevices();
+        refreshDeviceCounters().catch(error => console.error('Failed to refresh counters:', error));
     }
     
     if (btn) {
@@ -473,11 +892,14 @@ document.addEventListener('DOMContentLoaded', function() {
     }
 
     if (document.getElementById('devices-list')) {
+        loadProfiles();
         loadDevices();
+        connectValuesSocket();
     }
 
     if (document.getElementById('dashboard-content')) {
         loadLoggingConfig();
-        refreshDashboard();
+        refreshView();
+        connectValuesSocket();
     }
 });
\ No newline at end of file
@@ -0,0 +1,113 @@
+#include "http_workers.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+
+static const char *TAG = "HTTP_WORKERS";
+
+typedef struct {
+    httpd_req_t *req;
+    http_workers_handler_t handler;
+} http_job_t;
+
+static QueueHandle_t job_queue = NULL;
+static TaskHandle_t workers[HTTP_WORKERS_COUNT];
+static http_workers_stats_t stats;
+static portMUX_TYPE workers_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static void worker_task(void *arg)
+{
+    http_job_t job;
+
+    for (;;) {
+        if (xQueueReceive(job_queue, &job, portMAX_DELAY) != pdTRUE) {
+            continue;
+        }
+        portENTER_CRITICAL(&workers_mux);
+        stats.active++;
+        portEXIT_CRITICAL(&workers_mux);
+
+        esp_err_t ret = job.handler(job.req);
+        httpd_handle_t handle = job.req->handle;
+        int sockfd = httpd_req_to_sockfd(job.req);
+        httpd_req_async_handler_complete(job.req);
+        if (ret != ESP_OK) {
+            // As the server does for a failing handler: the request body may
+            // not have been read, so the connection can't be reused
+            httpd_sess_trigger_close(handle, sockfd);
+        }
+
+        portENTER_CRITICAL(&workers_mux);
+        stats.active--;
+        portEXIT_CRITICAL(&workers_mux);
+    }
+}
+
+esp_err_t http_workers_start(void)
+{
+    if (job_queue != NULL) {
+        return ESP_OK;
+    }
+
+    job_queue = xQueueCreate(HTTP_WORKERS_QUEUE_LEN, sizeof(http_job_t));
+    if (job_queue == NULL) {
+        ESP_LOGE(TAG, "Failed to create job queue");
+        return ESP_ERR_NO_MEM;
+    }
+    for (int i = 0; i < HTTP_WORKERS_COUNT; i++) {
+        // Same priority as the httpd task, so neither starves the other
+        if (xTaskCreate(worker_task, "http_worker", HTTP_WORKERS_STACK_SIZE, NULL, 5, &workers[i]) != pdPASS) {
+            ESP_LOGE(TAG, "Failed to start worker %d", i);
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    ESP_LOGI(TAG, "Started %d HTTP workers", HTTP_WORKERS_COUNT);
+    return ESP_OK;
+}
+
+bool http_workers_on_worker(void)
+{
+    TaskHandle_t current = xTaskGetCurrentTaskHandle();
+    for (int i = 0; i < HTTP_WORKERS_COUNT; i++) {
+        if (workers[i] != NULL && workers[i] == current) {
+            return true;
+        }
+    }
+    return false;
+}
+
+esp_err_t http_workers_submit(httpd_req_t *req, http_workers_handler_t handler)
+{
+    if (job_queue == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    http_job_t job = { .handler = handler };
+    esp_err_t err = httpd_req_async_handler_begin(req, &job.req);
+    if (err == ESP_OK && xQueueSend(job_queue, &job, 0) != pdTRUE) {
+        httpd_req_async_handler_complete(job.req);
+        err = ESP_ERR_NO_MEM;
+    }
+
+    portENTER_CRITICAL(&workers_mux);
+    if (err == ESP_OK) {
+        stats.submitted++;
+    } else {
+        stats.rejected++;
+    }
+    portEXIT_CRITICAL(&workers_mux);
+
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "No worker free for %s: %s", req->uri, esp_err_to_name(err));
+    }
+    return err;
+}
+
+void http_workers_get_stats(http_workers_stats_t *out)
+{
+    portENTER_CRITICAL(&workers_mux);
+    *out = stats;
+    portEXIT_CRITICAL(&workers_mux);
+    out->queued = job_queue != NULL ? uxQueueMessagesWaiting(job_queue) : 0;
+}
@@ -0,0 +1,39 @@
+#ifndef HTTP_WORKERS_H
+#define HTTP_WORKERS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "esp_http_server.h"
+
+// Worker tasks for handlers that wait on the Modbus bus. Such a request is
+// detached from the httpd task (httpd_req_async_handler_begin()) and run to
+// completion on a worker, so the server keeps answering static files, status
+// and other clients meanwhile. The bus is serial, so a few workers suffice;
+// requests beyond them wait in a short queue, and beyond that are refused.
+#define HTTP_WORKERS_COUNT 2
+#define HTTP_WORKERS_QUEUE_LEN 4
+#define HTTP_WORKERS_STACK_SIZE 8192
+
+typedef esp_err_t (*http_workers_handler_t)(httpd_req_t *req);
+
+typedef struct {
+    uint32_t submitted;
+    uint32_t rejected;          // Workers and queue full
+    uint8_t active;             // Requests being handled right now
+    uint8_t queued;
+} http_workers_stats_t;
+
+esp_err_t http_workers_start(void);
+
+// True when called from a worker, i.e. the request is already detached
+bool http_workers_on_worker(void);
+
+// Runs handler on a worker with a detached copy of req, completing the copy
+// when it returns. On error nothing was queued and req is still the caller's
+// to answer.
+esp_err_t http_workers_submit(httpd_req_t *req, http_workers_handler_t handler);
+
+void http_workers_get_stats(http_workers_stats_t *stats);
+
+#endif
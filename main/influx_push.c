@@ -0,0 +1,787 @@
+#include "influx_push.h"
+#include "gzip_fixed.h"
+#include "ts_log.h"
+#include "modbus_devices.h"
+#include "nvs_storage.h"
+#include "nvs.h"
+#include "esp_http_client.h"
+#include "esp_sntp.h"
+#include "esp_random.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <sys/time.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+
+static const char *TAG = "INFLUX";
+
+#define INFLUX_CONFIG_KEY "influx_config"
+#define INFLUX_STATE_KEY "influx_spool"
+#define INFLUX_BOOTS_KEY "influx_boots"
+#define INFLUX_BLOB_MAGIC 0x4649
+#define INFLUX_BLOB_VERSION 1
+#define INFLUX_TASK_STACK_SIZE 6144
+#define INFLUX_TICK_MS 200
+#define INFLUX_HTTP_TIMEOUT_MS 10000
+// In live mode the pushed-up-to position is saved this often; after a
+// restart up to this much is sent again, which the database deduplicates
+#define INFLUX_SAVE_INTERVAL_MS 600000
+// Boots whose clock offset is remembered for reading back older log blocks
+#define INFLUX_BOOT_EPOCHS 8
+// The clock counts as set once past 2024-01-01
+#define INFLUX_MIN_EPOCH_S 1704067200
+#define INFLUX_NTP_SERVER "pool.ntp.org"
+
+typedef struct {
+    uint16_t magic;
+    uint8_t version;
+    uint8_t reserved;
+} influx_blob_header_t;
+
+// Read-back position: everything before cursor in the log, and every sample
+// up to the watermark, has been pushed
+typedef struct {
+    ts_log_cursor_t cursor;
+    uint16_t watermark_boot;
+    uint16_t reserved;
+    uint32_t watermark_ms;
+} influx_state_t;
+
+typedef struct {
+    uint16_t boot;
+    uint16_t reserved;
+    int64_t epoch_ms;           // Wall clock at that boot's tick 0
+} influx_boot_epoch_t;
+
+typedef struct {
+    uint32_t timestamp;
+    uint32_t raw;
+    uint16_t address;
+    uint8_t device_id;
+    uint8_t type;
+} ring_sample_t;
+
+typedef struct {
+    uint32_t key;
+    uint32_t raw;
+    uint32_t recorded_at;
+    bool valid;
+} slot_state_t;
+
+typedef enum {
+    PUSH_LIVE,                  // Sending from the RAM batch
+    PUSH_SPOOL,                 // Reading back from the log; nothing batched
+    PUSH_SPOOL_TAIL,            // Reading the last log blocks; batching again
+} push_mode_t;
+
+typedef enum {
+    POST_OK,
+    POST_RETRY,
+    POST_REJECTED,
+} post_result_t;
+
+// Buffers for building a request, allocated when first enabled
+typedef struct {
+    char body[INFLUX_BODY_BYTES];
+    uint8_t gzip[INFLUX_GZIP_BYTES];
+    uint16_t hash[GZIP_FIXED_HASH_SIZE];
+} influx_buffers_t;
+
+// A log read back into one request body
+typedef struct {
+    const modbus_snapshot_t *snapshot;
+    size_t len;
+    uint32_t lines;
+    uint32_t unmapped;
+    ts_log_cursor_t next;
+    uint16_t last_boot;
+    uint32_t last_ms;
+    bool full;
+} spool_read_t;
+
+static influx_config_t config = {
+    .gzip = true,
+    .batch_samples = INFLUX_DEFAULT_BATCH,
+    .max_age_ms = INFLUX_DEFAULT_MAX_AGE_MS,
+};
+static influx_config_t active;
+static bool config_changed = false;
+static influx_stats_t stats;
+static portMUX_TYPE influx_mux = portMUX_INITIALIZER_UNLOCKED;
+static TaskHandle_t task_handle = NULL;
+
+// Shared with influx_push_record(), under influx_mux. Samples are numbered;
+// ring_start is the number of the oldest one held.
+static bool recording = false;
+static push_mode_t mode = PUSH_LIVE;
+static ring_sample_t ring[INFLUX_RING_SAMPLES];
+static uint32_t ring_start = 0;
+static uint16_t ring_count = 0;
+static bool can_spool = false;
+static slot_state_t slots[MODBUS_MAX_VALUE_SLOTS];
+
+// Owned by the task
+static influx_buffers_t *buffers = NULL;
+static esp_http_client_handle_t http = NULL;
+static influx_state_t state;
+static bool state_valid = false;
+static bool state_dirty = false;
+static uint32_t state_saved_ms = 0;
+static uint32_t backoff_ms = 0;
+static uint32_t retry_at_ms = 0;
+static influx_boot_epoch_t boot_epochs[INFLUX_BOOT_EPOCHS];
+static bool epoch_known = false;
+static int64_t epoch_ms = 0;
+
+static uint32_t now_ms(void)
+{
+    return xTaskGetTickCount() * portTICK_PERIOD_MS;
+}
+
+static bool cursor_equal(const ts_log_cursor_t *a, const ts_log_cursor_t *b)
+{
+    return a->seq == b->seq && a->offset == b->offset;
+}
+
+static esp_err_t load_blob(const char *key, void *data, size_t size)
+{
+    nvs_handle_t nvs_handle;
+    esp_err_t err = nvs_open(NVS_MODBUS_NAMESPACE, NVS_READONLY, &nvs_handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+    uint8_t buf[sizeof(influx_blob_header_t) + sizeof(influx_config_t)];
+    size_t len = sizeof(buf);
+    err = nvs_get_blob(nvs_handle, key, buf, &len);
+    nvs_close(nvs_handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    influx_blob_header_t header;
+    memcpy(&header, buf, sizeof(header));
+    if (len != sizeof(header) + size || header.magic != INFLUX_BLOB_MAGIC || header.version != INFLUX_BLOB_VERSION) {
+        return ESP_ERR_INVALID_VERSION;
+    }
+    memcpy(data, buf + sizeof(header), size);
+    return ESP_OK;
+}
+
+static esp_err_t save_blob(const char *key, const void *data, size_t size)
+{
+    uint8_t buf[sizeof(influx_blob_header_t) + sizeof(influx_config_t)];
+    influx_blob_header_t header = { INFLUX_BLOB_MAGIC, INFLUX_BLOB_VERSION, 0 };
+    memcpy(buf, &header, sizeof(header));
+    memcpy(buf + sizeof(header), data, size);
+
+    nvs_handle_t nvs_handle;
+    esp_err_t err = nvs_open(NVS_MODBUS_NAMESPACE, NVS_READWRITE, &nvs_handle);
+    if (err == ESP_OK) {
+        err = nvs_set_blob(nvs_handle, key, buf, sizeof(header) + size);
+        if (err == ESP_OK) {
+            err = nvs_commit(nvs_handle);
+        }
+        nvs_close(nvs_handle);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to save %s: %s", key, esp_err_to_name(err));
+    }
+    return err;
+}
+
+_Static_assert(sizeof(influx_state_t) <= sizeof(influx_config_t), "blob buffer size");
+_Static_assert(sizeof(boot_epochs) <= sizeof(influx_config_t), "blob buffer size");
+
+static void save_state(void)
+{
+    if (save_blob(INFLUX_STATE_KEY, &state, sizeof(state)) == ESP_OK) {
+        state_dirty = false;
+        state_saved_ms = now_ms();
+    }
+}
+
+static bool boot_epoch(uint16_t boot, int64_t *out)
+{
+    for (int i = 0; i < INFLUX_BOOT_EPOCHS; i++) {
+        if (boot_epochs[i].epoch_ms != 0 && boot_epochs[i].boot == boot) {
+            *out = boot_epochs[i].epoch_ms;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Ties this boot's tick count to the wall clock once SNTP has set it, and
+// remembers the offset so its log blocks can be read back after a restart
+static bool clock_ready(void)
+{
+    if (epoch_known) {
+        return true;
+    }
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    if (tv.tv_sec < INFLUX_MIN_EPOCH_S) {
+        return false;
+    }
+
+    epoch_ms = (int64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000 - now_ms();
+    epoch_known = true;
+    uint16_t boot = ts_log_boot();
+    int slot = 0;
+    for (int i = 0; i < INFLUX_BOOT_EPOCHS; i++) {
+        if (boot_epochs[i].boot == boot || boot_epochs[i].epoch_ms == 0) {
+            slot = i;
+            break;
+        }
+        if (boot_epochs[i].epoch_ms < boot_epochs[slot].epoch_ms) {
+            slot = i;
+        }
+    }
+    boot_epochs[slot].boot = boot;
+    boot_epochs[slot].epoch_ms = epoch_ms;
+    save_blob(INFLUX_BOOTS_KEY, boot_epochs, sizeof(boot_epochs));
+
+    portENTER_CRITICAL(&influx_mux);
+    stats.time_synced = true;
+    portEXIT_CRITICAL(&influx_mux);
+    ESP_LOGI(TAG, "Clock set, boot %u started at %" PRId64 " ms", boot, epoch_ms);
+    return true;
+}
+
+// Appends one line of line protocol; returns its length, 0 if it didn't fit
+static size_t format_line(char *out, size_t size, const modbus_snapshot_t *snapshot, uint8_t device_id,
+                          uint8_t type, uint16_t address, uint32_t raw, int64_t timestamp_ms)
+{
+    char fields[48] = "";
+    const modbus_register_t *reg = modbus_snapshot_find_register(snapshot, device_id, type, address);
+    if (reg != NULL) {
+        modbus_decoded_t decoded;
+        modbus_decode_run(&reg->decode, raw, &decoded);
+        snprintf(fields, sizeof(fields), "value=%" PRId64 "i,decimals=%ui,", decoded.value, decoded.decimals);
+    }
+
+    // Milliseconds are all there is; the database expects nanoseconds
+    int len = snprintf(out, size, "modbus,device=%u,type=%u,address=%u %sraw=%" PRIu32 "i %" PRId64 "000000\n",
+                       device_id, type, address, fields, raw, timestamp_ms);
+    return len > 0 && (size_t)len < size ? (size_t)len : 0;
+}
+
+static bool before_watermark(uint16_t boot, uint32_t timestamp)
+{
+    if (!state_valid) {
+        return false;
+    }
+    if (boot != state.watermark_boot) {
+        return (int16_t)(boot - state.watermark_boot) < 0;
+    }
+    // Equal timestamps go out again; rewriting a point is harmless
+    return timestamp < state.watermark_ms;
+}
+
+static void open_http(void)
+{
+    esp_http_client_config_t http_config = {
+        .url = active.url,
+        .method = HTTP_METHOD_POST,
+        .timeout_ms = INFLUX_HTTP_TIMEOUT_MS,
+        .keep_alive_enable = true,
+    };
+    http = esp_http_client_init(&http_config);
+    if (http == NULL) {
+        ESP_LOGE(TAG, "Failed to create HTTP client for %s", active.url);
+        return;
+    }
+    esp_http_client_set_header(http, "Content-Type", "text/plain; charset=utf-8");
+    if (active.token[0] != '\0') {
+        char auth[INFLUX_TOKEN_MAX_LEN + 8];
+        snprintf(auth, sizeof(auth), "Token %s", active.token);
+        esp_http_client_set_header(http, "Authorization", auth);
+    }
+}
+
+static void schedule_retry(void)
+{
+    backoff_ms = backoff_ms == 0 ? INFLUX_BACKOFF_MIN_MS : backoff_ms * 2;
+    if (backoff_ms > INFLUX_BACKOFF_MAX_MS) {
+        backoff_ms = INFLUX_BACKOFF_MAX_MS;
+    }
+    // Jittered, so gateways that lost the same server don't return in step
+    retry_at_ms = now_ms() + backoff_ms / 2 + esp_random() % (backoff_ms / 2 + 1);
+}
+
+// Sends len bytes of body, compressed if configured and worthwhile
+static post_result_t post_body(size_t len, uint32_t lines)
+{
+    const char *data = buffers->body;
+    size_t size = len;
+    if (active.gzip) {
+        size_t packed = gzip_fixed_compress((const uint8_t *)buffers->body, len, buffers->gzip,
+                                            sizeof(buffers->gzip), buffers->hash);
+        if (packed > 0) {
+            data = (const char *)buffers->gzip;
+            size = packed;
+        }
+    }
+
+    if (http == NULL) {
+        open_http();
+    }
+    int status = 0;
+    if (http != NULL) {
+        if (data != buffers->body) {
+            esp_http_client_set_header(http, "Content-Encoding", "gzip");
+        } else {
+            esp_http_client_delete_header(http, "Content-Encoding");
+        }
+        esp_http_client_set_post_field(http, data, size);
+        esp_err_t err = esp_http_client_perform(http);
+        if (err == ESP_OK) {
+            status = esp_http_client_get_status_code(http);
+        } else {
+            ESP_LOGW(TAG, "POST failed: %s", esp_err_to_name(err));
+            esp_http_client_close(http);
+        }
+    }
+
+    post_result_t result;
+    if (status >= 200 && status < 300) {
+        result = POST_OK;
+        backoff_ms = 0;
+    } else if (status == 400 || status == 413 || status == 422) {
+        // The data itself was refused; sending it again won't help
+        ESP_LOGW(TAG, "Endpoint rejected %" PRIu32 " samples with HTTP %d", lines, status);
+        result = POST_REJECTED;
+        backoff_ms = 0;
+    } else {
+        if (status != 0) {
+            ESP_LOGW(TAG, "Endpoint answered HTTP %d, retrying", status);
+        }
+        result = POST_RETRY;
+        schedule_retry();
+    }
+
+    portENTER_CRITICAL(&influx_mux);
+    stats.posts++;
+    stats.last_status = status;
+    stats.backoff_ms = backoff_ms;
+    if (result == POST_OK) {
+        stats.samples += lines;
+        stats.bytes_raw += len;
+        stats.bytes_sent += size;
+    } else if (result == POST_REJECTED) {
+        stats.rejected++;
+    } else {
+        stats.failures++;
+    }
+    portEXIT_CRITICAL(&influx_mux);
+    return result;
+}
+
+// Current end of the flash log, if there is one
+static bool log_position(ts_log_cursor_t *position)
+{
+    ts_log_cursor_t start;
+    bool gap;
+    return ts_log_begin(NULL, &start, position, &gap) == ESP_OK;
+}
+
+static void push_live(void)
+{
+    // Whatever is recorded after this point is in the log after it too
+    ts_log_cursor_t position;
+    bool have_position = log_position(&position);
+
+    const modbus_snapshot_t *snapshot = modbus_snapshot_acquire();
+    uint32_t seq;
+    portENTER_CRITICAL(&influx_mux);
+    seq = ring_start;
+    portEXIT_CRITICAL(&influx_mux);
+
+    size_t len = 0;
+    uint32_t lines = 0;
+    uint32_t last_ms = 0;
+    bool exhausted = false;
+    for (;;) {
+        ring_sample_t sample;
+        bool have;
+        portENTER_CRITICAL(&influx_mux);
+        if ((int32_t)(seq - ring_start) < 0) {
+            seq = ring_start;       // Oldest ones were pushed out meanwhile
+        }
+        have = seq - ring_start < ring_count;
+        if (have) {
+            sample = ring[seq % INFLUX_RING_SAMPLES];
+        }
+        portEXIT_CRITICAL(&influx_mux);
+        if (!have) {
+            exhausted = true;
+            break;
+        }
+        size_t n = format_line(buffers->body + len, sizeof(buffers->body) - len, snapshot, sample.device_id,
+                               sample.type, sample.address, sample.raw, epoch_ms + sample.timestamp);
+        if (n == 0) {
+            break;
+        }
+        len += n;
+        lines++;
+        last_ms = sample.timestamp;
+        seq++;
+    }
+    modbus_snapshot_release(snapshot);
+    if (lines == 0) {
+        return;
+    }
+
+    post_result_t result = post_body(len, lines);
+    if (result == POST_RETRY) {
+        return;
+    }
+
+    portENTER_CRITICAL(&influx_mux);
+    if (mode != PUSH_SPOOL && (int32_t)(seq - ring_start) > 0) {
+        uint32_t done = seq - ring_start;
+        done = done < ring_count ? done : ring_count;
+        ring_start += done;
+        ring_count -= done;
+    }
+    portEXIT_CRITICAL(&influx_mux);
+
+    if (result == POST_OK && have_position && exhausted) {
+        state.cursor = position;
+        state.watermark_boot = ts_log_boot();
+        state.watermark_ms = last_ms;
+        state_valid = true;
+        state_dirty = true;
+        portENTER_CRITICAL(&influx_mux);
+        can_spool = true;
+        portEXIT_CRITICAL(&influx_mux);
+    }
+}
+
+static esp_err_t spool_block(void *ctx, const ts_log_sample_t *samples, size_t count, const ts_log_cursor_t *next)
+{
+    spool_read_t *read = ctx;
+    size_t len = read->len;
+    uint32_t lines = 0;
+    uint32_t unmapped = 0;
+    uint16_t last_boot = read->last_boot;
+    uint32_t last_ms = read->last_ms;
+
+    for (size_t i = 0; i < count; i++) {
+        const ts_log_sample_t *sample = &samples[i];
+        int64_t base;
+        if (before_watermark(sample->boot, sample->timestamp)) {
+            continue;
+        }
+        if (!boot_epoch(sample->boot, &base)) {
+            unmapped++;
+            continue;
+        }
+        size_t n = format_line(buffers->body + len, sizeof(buffers->body) - len, read->snapshot,
+                               sample->device_id, sample->type, sample->address, sample->raw,
+                               base + sample->timestamp);
+        if (n == 0) {
+            // Blocks go out whole, so the cursor stays on block boundaries
+            read->full = true;
+            return ESP_FAIL;
+        }
+        len += n;
+        lines++;
+        last_boot = sample->boot;
+        last_ms = sample->timestamp;
+    }
+
+    read->len = len;
+    read->lines += lines;
+    read->unmapped += unmapped;
+    read->next = *next;
+    read->last_boot = last_boot;
+    read->last_ms = last_ms;
+    return ESP_OK;
+}
+
+static void set_mode(push_mode_t new_mode)
+{
+    portENTER_CRITICAL(&influx_mux);
+    mode = new_mode;
+    stats.spooling = new_mode != PUSH_LIVE;
+    portEXIT_CRITICAL(&influx_mux);
+}
+
+static void push_spool(push_mode_t current)
+{
+    ts_log_cursor_t start, end;
+    bool gap;
+    esp_err_t err = ts_log_begin(&state.cursor, &start, &end, &gap);
+    if (err == ESP_ERR_INVALID_ARG) {
+        // Not a position of this log, e.g. it was erased
+        ESP_LOGW(TAG, "Saved log position %" PRIu32 ":%" PRIu32 " is gone, continuing from the end",
+                 state.cursor.seq, state.cursor.offset);
+        err = ts_log_begin(NULL, &start, &end, &gap);
+        state.cursor = end;
+        start = end;
+        gap = true;
+    }
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Flash log unavailable, back to live samples");
+        set_mode(PUSH_LIVE);
+        return;
+    }
+    if (gap) {
+        portENTER_CRITICAL(&influx_mux);
+        stats.spool_gaps++;
+        portEXIT_CRITICAL(&influx_mux);
+    }
+
+    if (cursor_equal(&start, &end)) {
+        if (current == PUSH_SPOOL) {
+            // Batch new samples again, then push out the log's pending block
+            // so nothing recorded before the switch is left behind
+            set_mode(PUSH_SPOOL_TAIL);
+            ts_log_flush();
+            return;
+        }
+        state.cursor = end;
+        state_valid = true;
+        save_state();
+        set_mode(PUSH_LIVE);
+        ESP_LOGI(TAG, "Caught up with the flash log");
+        return;
+    }
+
+    spool_read_t read = {
+        .snapshot = modbus_snapshot_acquire(),
+        .next = state.cursor,
+        .last_boot = state.watermark_boot,
+        .last_ms = state.watermark_ms,
+    };
+    err = ts_log_read(&start, &end, spool_block, &read);
+    modbus_snapshot_release(read.snapshot);
+    if (err != ESP_OK && !read.full) {
+        // Overwritten under the reader; the next attempt notices the gap
+        ESP_LOGW(TAG, "Reading back the flash log failed: %s", esp_err_to_name(err));
+        return;
+    }
+    if (read.unmapped > 0) {
+        portENTER_CRITICAL(&influx_mux);
+        stats.unmapped += read.unmapped;
+        portEXIT_CRITICAL(&influx_mux);
+    }
+
+    post_result_t result = read.lines > 0 ? post_body(read.len, read.lines) : POST_OK;
+    if (result == POST_RETRY) {
+        return;
+    }
+    state.cursor = read.next;
+    state.watermark_boot = read.last_boot;
+    state.watermark_ms = read.last_ms;
+    state_valid = true;
+    save_state();
+}
+
+static void apply_config(void)
+{
+    if (http != NULL) {
+        esp_http_client_cleanup(http);
+        http = NULL;
+    }
+    backoff_ms = 0;
+    retry_at_ms = now_ms();
+
+    if (active.enabled && buffers == NULL) {
+        buffers = malloc(sizeof(influx_buffers_t));
+        if (buffers == NULL) {
+            ESP_LOGE(TAG, "No memory for the push buffers");
+        }
+    }
+    if (active.enabled && !esp_sntp_enabled()) {
+        esp_sntp_setoperatingmode(ESP_SNTP_OPMODE_POLL);
+        esp_sntp_setservername(0, INFLUX_NTP_SERVER);
+        esp_sntp_init();
+    }
+
+    bool enabled = active.enabled && buffers != NULL;
+    if (enabled && !state_valid) {
+        // Starting afresh: the log from here on backs the batch
+        state_valid = log_position(&state.cursor);
+        state.watermark_boot = ts_log_boot();
+        state.watermark_ms = now_ms();
+    }
+    portENTER_CRITICAL(&influx_mux);
+    recording = enabled;
+    can_spool = state_valid;
+    if (!enabled) {
+        ring_count = 0;
+    }
+    portEXIT_CRITICAL(&influx_mux);
+    if (enabled) {
+        ESP_LOGI(TAG, "Pushing to %s", active.url);
+    }
+}
+
+static void influx_task(void *arg)
+{
+    for (;;) {
+        vTaskDelay(pdMS_TO_TICKS(INFLUX_TICK_MS));
+
+        bool restart;
+        portENTER_CRITICAL(&influx_mux);
+        restart = config_changed;
+        if (restart) {
+            active = config;
+            config_changed = false;
+        }
+        portEXIT_CRITICAL(&influx_mux);
+        if (restart) {
+            apply_config();
+        }
+        if (!active.enabled || buffers == NULL || !clock_ready()) {
+            continue;
+        }
+
+        uint32_t now = now_ms();
+        if ((int32_t)(now - retry_at_ms) < 0) {
+            continue;
+        }
+
+        push_mode_t current;
+        uint16_t count;
+        uint32_t oldest = 0;
+        portENTER_CRITICAL(&influx_mux);
+        current = mode;
+        count = ring_count;
+        if (count > 0) {
+            oldest = ring[ring_start % INFLUX_RING_SAMPLES].timestamp;
+        }
+        stats.buffered = count;
+        portEXIT_CRITICAL(&influx_mux);
+
+        if (current != PUSH_LIVE) {
+            push_spool(current);
+        } else if (count >= active.batch_samples || (count > 0 && now - oldest >= active.max_age_ms)) {
+            push_live();
+        } else if (state_dirty && now - state_saved_ms >= INFLUX_SAVE_INTERVAL_MS) {
+            save_state();
+        }
+    }
+}
+
+void influx_push_record(uint8_t device_id, uint8_t type, uint16_t address, uint16_t slot,
+                        uint32_t timestamp_ms, uint32_t raw)
+{
+    if (slot >= MODBUS_MAX_VALUE_SLOTS) {
+        return;
+    }
+
+    uint32_t key = ((uint32_t)device_id << 24) | ((uint32_t)type << 16) | address;
+    portENTER_CRITICAL(&influx_mux);
+    slot_state_t *slot_state = &slots[slot];
+    if (!recording || (slot_state->valid && slot_state->key == key && slot_state->raw == raw &&
+                       timestamp_ms - slot_state->recorded_at < INFLUX_HEARTBEAT_MS)) {
+        portEXIT_CRITICAL(&influx_mux);
+        return;
+    }
+    slot_state->key = key;
+    slot_state->raw = raw;
+    slot_state->recorded_at = timestamp_ms;
+    slot_state->valid = true;
+
+    if (mode != PUSH_SPOOL) {
+        if (ring_count == INFLUX_RING_SAMPLES) {
+            if (can_spool) {
+                // The log holds these samples too; read them back from there
+                mode = PUSH_SPOOL;
+                stats.spooling = true;
+                ring_count = 0;
+            } else {
+                ring_start++;
+                ring_count--;
+                stats.dropped++;
+            }
+        }
+        if (mode != PUSH_SPOOL) {
+            ring_sample_t *sample = &ring[(ring_start + ring_count) % INFLUX_RING_SAMPLES];
+            sample->timestamp = timestamp_ms;
+            sample->raw = raw;
+            sample->address = address;
+            sample->device_id = device_id;
+            sample->type = type;
+            ring_count++;
+        }
+    }
+    portEXIT_CRITICAL(&influx_mux);
+}
+
+static esp_err_t validate_config(const influx_config_t *c)
+{
+    if (c->batch_samples < 1 || c->batch_samples > INFLUX_RING_SAMPLES ||
+        c->max_age_ms < INFLUX_MIN_MAX_AGE_MS || c->max_age_ms > 3600000) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (c->enabled && strncmp(c->url, "http://", 7) != 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return ESP_OK;
+}
+
+esp_err_t influx_push_init(void)
+{
+    if (task_handle != NULL) {
+        return ESP_OK;
+    }
+
+    influx_config_t loaded;
+    if (load_blob(INFLUX_CONFIG_KEY, &loaded, sizeof(loaded)) == ESP_OK && validate_config(&loaded) == ESP_OK) {
+        config = loaded;
+    }
+    load_blob(INFLUX_BOOTS_KEY, boot_epochs, sizeof(boot_epochs));
+    // A saved position means samples may not have gone out before the
+    // restart: read the log back from there first
+    state_valid = load_blob(INFLUX_STATE_KEY, &state, sizeof(state)) == ESP_OK;
+    if (state_valid) {
+        mode = PUSH_SPOOL;
+        stats.spooling = true;
+    }
+
+    config_changed = true;
+    if (xTaskCreate(influx_task, "influx_push", INFLUX_TASK_STACK_SIZE, NULL, 3, &task_handle) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to start push task");
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+void influx_push_get_config(influx_config_t *out)
+{
+    portENTER_CRITICAL(&influx_mux);
+    *out = config;
+    portEXIT_CRITICAL(&influx_mux);
+}
+
+esp_err_t influx_push_set_config(const influx_config_t *new_config)
+{
+    esp_err_t err = validate_config(new_config);
+    if (err != ESP_OK) {
+        return err;
+    }
+    err = save_blob(INFLUX_CONFIG_KEY, new_config, sizeof(*new_config));
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    portENTER_CRITICAL(&influx_mux);
+    config = *new_config;
+    config_changed = true;
+    portEXIT_CRITICAL(&influx_mux);
+    return ESP_OK;
+}
+
+void influx_push_get_stats(influx_stats_t *out)
+{
+    portENTER_CRITICAL(&influx_mux);
+    *out = stats;
+    portEXIT_CRITICAL(&influx_mux);
+}
@@ -0,0 +1,76 @@
+#ifndef INFLUX_PUSH_H
+#define INFLUX_PUSH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+// Pushes polled values to an InfluxDB or VictoriaMetrics write endpoint over
+// HTTP as line protocol, one line per sample:
+//   modbus,device=1,type=3,address=135 value=215i,decimals=1i,raw=215i 1760000000123000000
+// value is the decoded value in fixed point with decimals digits, the
+// timestamp nanoseconds since the epoch. Samples are batched in RAM and sent
+// gzipped, one POST per batch, when the batch is full or its oldest sample
+// is old enough. Failed POSTs are retried with exponential backoff.
+//
+// While the endpoint is unreachable and the batch overflows, the flash log
+// (ts_log) serves as the spool: the exporter remembers the log position it
+// had pushed up to and, once the endpoint answers again, reads back from
+// there before returning to live samples. The position is kept in NVS, so a
+// restart resumes from it too.
+#define INFLUX_URL_MAX_LEN 128
+#define INFLUX_TOKEN_MAX_LEN 96
+#define INFLUX_RING_SAMPLES 256
+#define INFLUX_BODY_BYTES 16384
+#define INFLUX_GZIP_BYTES 8192
+#define INFLUX_DEFAULT_BATCH 200
+#define INFLUX_DEFAULT_MAX_AGE_MS 10000
+#define INFLUX_MIN_MAX_AGE_MS 1000
+// An unchanged value is still sent this often
+#define INFLUX_HEARTBEAT_MS 60000
+#define INFLUX_BACKOFF_MIN_MS 1000
+#define INFLUX_BACKOFF_MAX_MS 300000
+
+typedef struct {
+    bool enabled;
+    bool gzip;
+    uint16_t batch_samples;     // Flush once this many samples are waiting
+    uint32_t max_age_ms;        // ...or the oldest has waited this long
+    char url[INFLUX_URL_MAX_LEN];       // e.g. http://host:8086/api/v2/write?org=o&bucket=b
+    char token[INFLUX_TOKEN_MAX_LEN];   // Sent as "Authorization: Token <token>"; empty for none
+} influx_config_t;
+
+typedef struct {
+    bool time_synced;
+    bool spooling;              // Catching up from the flash log
+    uint32_t posts;
+    uint32_t samples;           // Lines accepted by the endpoint
+    uint32_t bytes_raw;
+    uint32_t bytes_sent;        // After compression
+    uint32_t failures;          // Network errors and 5xx/429, retried
+    uint32_t rejected;          // Other 4xx; the batch is dropped
+    uint32_t dropped;           // Overflowed with no flash log to fall back on
+    uint32_t spool_gaps;        // Log overwritten before it was read back
+    uint32_t unmapped;          // Logged in a boot whose clock is unknown
+    uint16_t buffered;
+    uint16_t last_status;       // HTTP status of the last POST, 0 if it failed
+    uint32_t backoff_ms;
+} influx_stats_t;
+
+// Loads the configuration and starts the exporter task. Timestamps need the
+// wall clock, so this also starts SNTP; nothing is sent before the first
+// sync.
+esp_err_t influx_push_init(void);
+
+void influx_push_get_config(influx_config_t *config);
+// Validates, saves and applies config
+esp_err_t influx_push_set_config(const influx_config_t *config);
+
+void influx_push_get_stats(influx_stats_t *stats);
+
+// Queues a polled value, if it changed or the heartbeat is due; called for
+// every stored value like ts_log_record()
+void influx_push_record(uint8_t device_id, uint8_t type, uint16_t address, uint16_t slot,
+                        uint32_t timestamp_ms, uint32_t raw);
+
+#endif
@@ -0,0 +1,320 @@
+#include "json_reader.h"
+#include <string.h>
+
+void json_reader_init(json_reader_t *r, json_reader_read_cb read, void *ctx)
+{
+    r->read = read;
+    r->ctx = ctx;
+    r->err = ESP_OK;
+    r->state = JSON_READER_EXPECT_VALUE;
+    r->depth = 0;
+    r->in_object = 0;
+    r->eof = false;
+    r->pos = 0;
+    r->len = 0;
+    r->text_len = 0;
+    r->text[0] = '\0';
+}
+
+static json_token_t fail(json_reader_t *r, esp_err_t err)
+{
+    if (r->err == ESP_OK) {
+        r->err = err;
+    }
+    return JSON_TOKEN_ERROR;
+}
+
+// Next input byte without consuming it, or -1 at the end of the input
+static int peek(json_reader_t *r)
+{
+    if (r->pos == r->len && !r->eof && r->err == ESP_OK) {
+        int n = r->read(r->ctx, r->buf, sizeof(r->buf));
+        if (n < 0) {
+            r->err = ESP_FAIL;
+        } else if (n == 0) {
+            r->eof = true;
+        }
+        r->pos = 0;
+        r->len = n > 0 ? n : 0;
+    }
+    return r->pos < r->len ? (unsigned char)r->buf[r->pos] : -1;
+}
+
+static int take(json_reader_t *r)
+{
+    int c = peek(r);
+    if (c >= 0) {
+        r->pos++;
+    }
+    return c;
+}
+
+static int skip_space(json_reader_t *r)
+{
+    int c = peek(r);
+    while (c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+        r->pos++;
+        c = peek(r);
+    }
+    return c;
+}
+
+static bool put_text(json_reader_t *r, char c)
+{
+    if (r->text_len + 1 >= sizeof(r->text)) {
+        fail(r, ESP_ERR_INVALID_SIZE);
+        return false;
+    }
+    r->text[r->text_len++] = c;
+    return true;
+}
+
+static bool put_utf8(json_reader_t *r, uint32_t cp)
+{
+    if (cp < 0x80) {
+        return put_text(r, cp);
+    }
+    if (cp < 0x800) {
+        return put_text(r, 0xC0 | (cp >> 6)) && put_text(r, 0x80 | (cp & 0x3F));
+    }
+    if (cp < 0x10000) {
+        return put_text(r, 0xE0 | (cp >> 12)) && put_text(r, 0x80 | ((cp >> 6) & 0x3F)) &&
+               put_text(r, 0x80 | (cp & 0x3F));
+    }
+    return put_text(r, 0xF0 | (cp >> 18)) && put_text(r, 0x80 | ((cp >> 12) & 0x3F)) &&
+           put_text(r, 0x80 | ((cp >> 6) & 0x3F)) && put_text(r, 0x80 | (cp & 0x3F));
+}
+
+static int read_hex4(json_reader_t *r)
+{
+    int value = 0;
+    for (int i = 0; i < 4; i++) {
+        int c = take(r);
+        int digit = c >= '0' && c <= '9' ? c - '0' :
+                    c >= 'a' && c <= 'f' ? c - 'a' + 10 :
+                    c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+        if (digit < 0) {
+            return -1;
+        }
+        value = value << 4 | digit;
+    }
+    return value;
+}
+
+// Reads a string (the opening quote already consumed) into text
+static bool read_string(json_reader_t *r)
+{
+    r->text_len = 0;
+    for (;;) {
+        int c = take(r);
+        if (c < 0x20) {
+            // End of input or an unescaped control character
+            fail(r, ESP_ERR_INVALID_ARG);
+            return false;
+        }
+        if (c == '"') {
+            break;
+        }
+        if (c != '\\') {
+            if (!put_text(r, c)) {
+                return false;
+            }
+            continue;
+        }
+
+        c = take(r);
+        static const char escapes[] = "\"\"\\\\//b\bf\fn\nr\rt\t";
+        const char *e = c > 0 ? strchr(escapes, c) : NULL;
+        if (e != NULL && (e - escapes) % 2 == 0) {
+            if (!put_text(r, e[1])) {
+                return false;
+            }
+            continue;
+        }
+        if (c != 'u') {
+            fail(r, ESP_ERR_INVALID_ARG);
+            return false;
+        }
+        int cp = read_hex4(r);
+        if (cp >= 0xD800 && cp < 0xDC00) {
+            // High surrogate: must be followed by the low half
+            int low = take(r) == '\\' && take(r) == 'u' ? read_hex4(r) : -1;
+            cp = low >= 0xDC00 && low < 0xE000 ? 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00) : -1;
+        } else if (cp >= 0xDC00 && cp < 0xE000) {
+            cp = -1;
+        }
+        if (cp <= 0) {
+            // \u0000 would truncate the text, so it's rejected with the rest
+            fail(r, ESP_ERR_INVALID_ARG);
+            return false;
+        }
+        if (!put_utf8(r, cp)) {
+            return false;
+        }
+    }
+    r->text[r->text_len] = '\0';
+    return true;
+}
+
+static bool read_number(json_reader_t *r)
+{
+    r->text_len = 0;
+    int c = peek(r);
+    while ((c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E') {
+        if (!put_text(r, c)) {
+            return false;
+        }
+        r->pos++;
+        c = peek(r);
+    }
+    r->text[r->text_len] = '\0';
+    return true;
+}
+
+static bool read_literal(json_reader_t *r, const char *literal)
+{
+    for (const char *p = literal; *p != '\0'; p++) {
+        if (take(r) != *p) {
+            fail(r, ESP_ERR_INVALID_ARG);
+            return false;
+        }
+    }
+    return true;
+}
+
+static void after_value(json_reader_t *r)
+{
+    r->state = r->depth == 0 ? JSON_READER_DONE : JSON_READER_EXPECT_SEPARATOR;
+}
+
+static json_token_t begin_container(json_reader_t *r, bool object)
+{
+    if (r->depth + 1 >= JSON_READER_MAX_DEPTH) {
+        return fail(r, ESP_ERR_INVALID_SIZE);
+    }
+    r->pos++;
+    r->depth++;
+    if (object) {
+        r->in_object |= 1u << r->depth;
+        r->state = JSON_READER_EXPECT_KEY_OR_END;
+        return JSON_TOKEN_BEGIN_OBJECT;
+    }
+    r->in_object &= ~(1u << r->depth);
+    r->state = JSON_READER_EXPECT_VALUE_OR_END;
+    return JSON_TOKEN_BEGIN_ARRAY;
+}
+
+static json_token_t end_container(json_reader_t *r, int c)
+{
+    bool object = r->in_object & (1u << r->depth);
+    if (r->depth == 0 || c != (object ? '}' : ']')) {
+        return fail(r, ESP_ERR_INVALID_ARG);
+    }
+    r->pos++;
+    r->depth--;
+    after_value(r);
+    return object ? JSON_TOKEN_END_OBJECT : JSON_TOKEN_END_ARRAY;
+}
+
+static json_token_t read_value(json_reader_t *r, int c)
+{
+    switch (c) {
+        case '{':
+            return begin_container(r, true);
+        case '[':
+            return begin_container(r, false);
+        case '"':
+            r->pos++;
+            if (!read_string(r)) {
+                return JSON_TOKEN_ERROR;
+            }
+            after_value(r);
+            return JSON_TOKEN_STRING;
+        case 't':
+        case 'f':
+        case 'n':
+            if (!read_literal(r, c == 't' ? "true" : c == 'f' ? "false" : "null")) {
+                return JSON_TOKEN_ERROR;
+            }
+            after_value(r);
+            return c == 't' ? JSON_TOKEN_TRUE : c == 'f' ? JSON_TOKEN_FALSE : JSON_TOKEN_NULL;
+        default:
+            if (c != '-' && (c < '0' || c > '9')) {
+                return fail(r, ESP_ERR_INVALID_ARG);
+            }
+            if (!read_number(r)) {
+                return JSON_TOKEN_ERROR;
+            }
+            after_value(r);
+            return JSON_TOKEN_NUMBER;
+    }
+}
+
+static json_token_t read_key(json_reader_t *r, int c)
+{
+    if (c != '"') {
+        return fail(r, ESP_ERR_INVALID_ARG);
+    }
+    r->pos++;
+    if (!read_string(r)) {
+        return JSON_TOKEN_ERROR;
+    }
+    if (skip_space(r) != ':') {
+        return fail(r, ESP_ERR_INVALID_ARG);
+    }
+    r->pos++;
+    r->state = JSON_READER_EXPECT_VALUE;
+    return JSON_TOKEN_KEY;
+}
+
+json_token_t json_reader_next(json_reader_t *r)
+{
+    if (r->err != ESP_OK) {
+        return JSON_TOKEN_ERROR;
+    }
+
+    int c = skip_space(r);
+    if (r->err != ESP_OK) {
+        return JSON_TOKEN_ERROR;
+    }
+
+    switch (r->state) {
+        case JSON_READER_EXPECT_KEY_OR_END:
+            return c == '}' ? end_container(r, c) : read_key(r, c);
+        case JSON_READER_EXPECT_KEY:
+            return read_key(r, c);
+        case JSON_READER_EXPECT_VALUE_OR_END:
+            return c == ']' ? end_container(r, c) : read_value(r, c);
+        case JSON_READER_EXPECT_VALUE:
+            return read_value(r, c);
+        case JSON_READER_EXPECT_SEPARATOR:
+            if (c == ',') {
+                r->pos++;
+                bool object = r->in_object & (1u << r->depth);
+                r->state = object ? JSON_READER_EXPECT_KEY : JSON_READER_EXPECT_VALUE;
+                return json_reader_next(r);
+            }
+            return end_container(r, c);
+        case JSON_READER_DONE:
+        default:
+            return c < 0 ? JSON_TOKEN_END : fail(r, ESP_ERR_INVALID_ARG);
+    }
+}
+
+esp_err_t json_reader_skip(json_reader_t *r, json_token_t token)
+{
+    if (token == JSON_TOKEN_ERROR) {
+        return r->err;
+    }
+    if (token != JSON_TOKEN_BEGIN_OBJECT && token != JSON_TOKEN_BEGIN_ARRAY) {
+        return ESP_OK;
+    }
+
+    uint8_t depth = r->depth - 1;
+    while (r->depth > depth) {
+        if (json_reader_next(r) == JSON_TOKEN_ERROR) {
+            return r->err;
+        }
+    }
+    return ESP_OK;
+}
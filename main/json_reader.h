@@ -0,0 +1,66 @@
+#ifndef JSON_READER_H
+#define JSON_READER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+#define JSON_READER_BUF_SIZE 256
+#define JSON_READER_TEXT_MAX 96
+#define JSON_READER_MAX_DEPTH 32
+
+// Fills buf with up to len bytes of input; returns the count, 0 at the end of
+// the input or a negative value on error
+typedef int (*json_reader_read_cb)(void *ctx, char *buf, size_t len);
+
+typedef enum {
+    JSON_TOKEN_BEGIN_OBJECT,
+    JSON_TOKEN_END_OBJECT,
+    JSON_TOKEN_BEGIN_ARRAY,
+    JSON_TOKEN_END_ARRAY,
+    JSON_TOKEN_KEY,             // text holds the member name
+    JSON_TOKEN_STRING,          // text holds the unescaped value
+    JSON_TOKEN_NUMBER,          // text holds the number as written
+    JSON_TOKEN_TRUE,
+    JSON_TOKEN_FALSE,
+    JSON_TOKEN_NULL,
+    JSON_TOKEN_END,             // Input complete after one top-level value
+    JSON_TOKEN_ERROR,           // See err; every later call returns it again
+} json_token_t;
+
+typedef enum {
+    JSON_READER_EXPECT_VALUE,
+    JSON_READER_EXPECT_VALUE_OR_END,
+    JSON_READER_EXPECT_KEY,
+    JSON_READER_EXPECT_KEY_OR_END,
+    JSON_READER_EXPECT_SEPARATOR,
+    JSON_READER_DONE,
+} json_reader_state_t;
+
+// Pull parser over a fixed buffer, the counterpart of json_writer: input of
+// any size is read in JSON_READER_BUF_SIZE pieces and handed out one token
+// at a time, so a document never has to be held in memory. Strings longer
+// than JSON_READER_TEXT_MAX - 1 bytes are rejected with ESP_ERR_INVALID_SIZE.
+typedef struct {
+    json_reader_read_cb read;
+    void *ctx;
+    esp_err_t err;
+    json_reader_state_t state;
+    uint8_t depth;
+    uint32_t in_object;         // Bit per nesting level: the container is an object
+    bool eof;
+    size_t pos;
+    size_t len;
+    char buf[JSON_READER_BUF_SIZE];
+    size_t text_len;
+    char text[JSON_READER_TEXT_MAX];
+} json_reader_t;
+
+void json_reader_init(json_reader_t *r, json_reader_read_cb read, void *ctx);
+json_token_t json_reader_next(json_reader_t *r);
+
+// Skips the value that token started, including everything nested in it
+esp_err_t json_reader_skip(json_reader_t *r, json_token_t token);
+
+#endif
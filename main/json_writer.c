@@ -0,0 +1,279 @@
+#include "json_writer.h"
+#include <string.h>
+#include <stdio.h>
+#include <inttypes.h>
+
+// CBOR major types
+#define CBOR_UINT 0
+#define CBOR_NEGINT 1
+#define CBOR_TEXT 3
+#define CBOR_ARRAY 4
+#define CBOR_MAP 5
+
+#define CBOR_INDEFINITE 31
+#define CBOR_FALSE 0xF4
+#define CBOR_TRUE 0xF5
+#define CBOR_NULL 0xF6
+#define CBOR_BREAK 0xFF
+
+void json_writer_init(json_writer_t *w, json_writer_flush_cb flush, void *ctx)
+{
+    w->flush = flush;
+    w->ctx = ctx;
+    w->err = ESP_OK;
+    w->format = JSON_WRITER_JSON;
+    w->keys = NULL;
+    w->key_count = 0;
+    w->depth = 0;
+    w->after_key = false;
+    w->has_items = 0;
+    w->len = 0;
+}
+
+static void writer_flush(json_writer_t *w)
+{
+    if (w->err == ESP_OK && w->len > 0) {
+        w->err = w->flush(w->ctx, w->buf, w->len);
+    }
+    w->len = 0;
+}
+
+static void writer_put(json_writer_t *w, const char *data, size_t len)
+{
+    while (len > 0 && w->err == ESP_OK) {
+        if (w->len == sizeof(w->buf)) {
+            writer_flush(w);
+        }
+        size_t n = sizeof(w->buf) - w->len < len ? sizeof(w->buf) - w->len : len;
+        memcpy(w->buf + w->len, data, n);
+        w->len += n;
+        data += n;
+        len -= n;
+    }
+}
+
+static inline void writer_putc(json_writer_t *w, char c)
+{
+    writer_put(w, &c, 1);
+}
+
+void json_writer_init_cbor(json_writer_t *w, json_writer_flush_cb flush, void *ctx,
+                           const char *const *keys, uint8_t key_count)
+{
+    json_writer_init(w, flush, ctx);
+    w->format = JSON_WRITER_CBOR;
+    w->keys = keys;
+    w->key_count = key_count;
+}
+
+// Initial byte and argument of a CBOR data item, in the shortest encoding
+static void cbor_head(json_writer_t *w, uint8_t major, uint64_t value)
+{
+    char head[9];
+    size_t len;
+    major <<= 5;
+    if (value < 24) {
+        head[0] = major | value;
+        len = 1;
+    } else if (value <= UINT8_MAX) {
+        head[0] = major | 24;
+        head[1] = value;
+        len = 2;
+    } else if (value <= UINT16_MAX) {
+        head[0] = major | 25;
+        head[1] = value >> 8;
+        head[2] = value;
+        len = 3;
+    } else if (value <= UINT32_MAX) {
+        head[0] = major | 26;
+        for (int i = 0; i < 4; i++) {
+            head[1 + i] = value >> (24 - 8 * i);
+        }
+        len = 5;
+    } else {
+        head[0] = major | 27;
+        for (int i = 0; i < 8; i++) {
+            head[1 + i] = value >> (56 - 8 * i);
+        }
+        len = 9;
+    }
+    writer_put(w, head, len);
+}
+
+static void cbor_text(json_writer_t *w, const char *value)
+{
+    size_t len = strlen(value);
+    cbor_head(w, CBOR_TEXT, len);
+    writer_put(w, value, len);
+}
+
+// Writes the separator due before a value or key at the current level
+static void begin_item(json_writer_t *w)
+{
+    if (w->format == JSON_WRITER_CBOR) {
+        return;
+    }
+    if (w->after_key) {
+        w->after_key = false;
+        return;
+    }
+    uint32_t bit = 1u << w->depth;
+    if (w->has_items & bit) {
+        writer_putc(w, ',');
+    }
+    w->has_items |= bit;
+}
+
+esp_err_t json_writer_finish(json_writer_t *w)
+{
+    writer_flush(w);
+    return w->err;
+}
+
+static void begin_container(json_writer_t *w, char open)
+{
+    begin_item(w);
+    if (w->format == JSON_WRITER_CBOR) {
+        writer_putc(w, (char)(((open == '{' ? CBOR_MAP : CBOR_ARRAY) << 5) | CBOR_INDEFINITE));
+    } else {
+        writer_putc(w, open);
+    }
+    if (w->depth + 1 >= JSON_WRITER_MAX_DEPTH) {
+        w->err = ESP_ERR_INVALID_STATE;
+        return;
+    }
+    w->depth++;
+    w->has_items &= ~(1u << w->depth);
+}
+
+static void end_container(json_writer_t *w, char close)
+{
+    if (w->depth > 0) {
+        w->depth--;
+    }
+    writer_putc(w, w->format == JSON_WRITER_CBOR ? (char)CBOR_BREAK : close);
+}
+
+void json_begin_object(json_writer_t *w)
+{
+    begin_container(w, '{');
+}
+
+void json_end_object(json_writer_t *w)
+{
+    end_container(w, '}');
+}
+
+void json_begin_array(json_writer_t *w)
+{
+    begin_container(w, '[');
+}
+
+void json_end_array(json_writer_t *w)
+{
+    end_container(w, ']');
+}
+
+static void put_escaped(json_writer_t *w, const char *value)
+{
+    static const char hex[] = "0123456789abcdef";
+    const char *run = value;
+
+    writer_putc(w, '"');
+    for (const char *p = value; *p != '\0'; p++) {
+        unsigned char c = (unsigned char)*p;
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            continue;
+        }
+        writer_put(w, run, p - run);
+        run = p + 1;
+        if (c == '"' || c == '\\') {
+            char esc[2] = { '\\', (char)c };
+            writer_put(w, esc, 2);
+        } else {
+            char esc[6] = { '\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xF] };
+            writer_put(w, esc, 6);
+        }
+    }
+    writer_put(w, run, strlen(run));
+    writer_putc(w, '"');
+}
+
+void json_key(json_writer_t *w, const char *key)
+{
+    if (w->format == JSON_WRITER_CBOR) {
+        for (uint8_t i = 0; i < w->key_count; i++) {
+            if (w->keys[i][0] == key[0] && strcmp(w->keys[i], key) == 0) {
+                cbor_head(w, CBOR_UINT, i);
+                return;
+            }
+        }
+        cbor_text(w, key);
+        return;
+    }
+    begin_item(w);
+    put_escaped(w, key);
+    writer_putc(w, ':');
+    w->after_key = true;
+}
+
+void json_string(json_writer_t *w, const char *value)
+{
+    if (w->format == JSON_WRITER_CBOR) {
+        cbor_text(w, value);
+        return;
+    }
+    begin_item(w);
+    put_escaped(w, value);
+}
+
+void json_uint(json_writer_t *w, uint64_t value)
+{
+    if (w->format == JSON_WRITER_CBOR) {
+        cbor_head(w, CBOR_UINT, value);
+        return;
+    }
+    char num[24];
+    int len = snprintf(num, sizeof(num), "%" PRIu64, value);
+    begin_item(w);
+    writer_put(w, num, len);
+}
+
+void json_int(json_writer_t *w, int64_t value)
+{
+    if (w->format == JSON_WRITER_CBOR) {
+        // Negative n is encoded as -1 - n, which can't overflow
+        cbor_head(w, value < 0 ? CBOR_NEGINT : CBOR_UINT, value < 0 ? (uint64_t)(-1 - value) : (uint64_t)value);
+        return;
+    }
+    char num[24];
+    int len = snprintf(num, sizeof(num), "%" PRId64, value);
+    begin_item(w);
+    writer_put(w, num, len);
+}
+
+void json_bool(json_writer_t *w, bool value)
+{
+    if (w->format == JSON_WRITER_CBOR) {
+        writer_putc(w, (char)(value ? CBOR_TRUE : CBOR_FALSE));
+        return;
+    }
+    begin_item(w);
+    writer_put(w, value ? "true" : "false", value ? 4 : 5);
+}
+
+void json_null(json_writer_t *w)
+{
+    if (w->format == JSON_WRITER_CBOR) {
+        writer_putc(w, (char)CBOR_NULL);
+        return;
+    }
+    begin_item(w);
+    writer_put(w, "null", 4);
+}
+
+void json_raw(json_writer_t *w, const char *text, size_t len)
+{
+    begin_item(w);
+    writer_put(w, text, len);
+}
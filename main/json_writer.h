@@ -0,0 +1,64 @@
+#ifndef JSON_WRITER_H
+#define JSON_WRITER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+#define JSON_WRITER_BUF_SIZE 512
+#define JSON_WRITER_MAX_DEPTH 32
+
+// Receives each full buffer and the remainder on json_writer_finish()
+typedef esp_err_t (*json_writer_flush_cb)(void *ctx, const char *data, size_t len);
+
+typedef enum {
+    JSON_WRITER_JSON = 0,
+    JSON_WRITER_CBOR,           // RFC 8949, containers of indefinite length
+} json_writer_format_t;
+
+// Streaming JSON writer over a fixed buffer, for responses too large to build
+// as a cJSON tree. Separators are inserted by the writer, numbers are
+// formatted from integers only, and the first flush error is kept: later
+// writes are dropped and json_writer_finish() returns it.
+//
+// The same calls can produce CBOR instead, for machine clients: containers
+// are opened without a count so nothing needs to be known in advance, and
+// keys found in the writer's key table are sent as their index.
+typedef struct {
+    json_writer_flush_cb flush;
+    void *ctx;
+    esp_err_t err;
+    json_writer_format_t format;
+    const char *const *keys;    // CBOR only: key names sent as integers
+    uint8_t key_count;
+    uint8_t depth;
+    bool after_key;
+    uint32_t has_items;         // Bit per nesting level: a separator is due
+    size_t len;
+    char buf[JSON_WRITER_BUF_SIZE];
+} json_writer_t;
+
+void json_writer_init(json_writer_t *w, json_writer_flush_cb flush, void *ctx);
+void json_writer_init_cbor(json_writer_t *w, json_writer_flush_cb flush, void *ctx,
+                           const char *const *keys, uint8_t key_count);
+esp_err_t json_writer_finish(json_writer_t *w);
+
+void json_begin_object(json_writer_t *w);
+void json_end_object(json_writer_t *w);
+void json_begin_array(json_writer_t *w);
+void json_end_array(json_writer_t *w);
+
+// Object member name; the next call writes its value
+void json_key(json_writer_t *w, const char *key);
+
+void json_string(json_writer_t *w, const char *value);
+void json_uint(json_writer_t *w, uint64_t value);
+void json_int(json_writer_t *w, int64_t value);
+void json_bool(json_writer_t *w, bool value);
+void json_null(json_writer_t *w);
+// Preformatted value in the writer's format, e.g. a number from
+// modbus_decode_format() for JSON
+void json_raw(json_writer_t *w, const char *text, size_t len);
+
+#endif
@@ -8,6 +8,10 @@
 #include "web_server.h"
 #include "modbus_devices.h"
 #include "modbus_manager.h"
+#include "ts_log.h"
+#include "modbus_alarms.h"
+#include "mqtt_publisher.h"
+#include "influx_push.h"
 
 static const char *TAG = "APP";
 
@@ -24,6 +28,15 @@ void app_main(void)
     ESP_ERROR_CHECK(modbus_devices_load());
     ESP_LOGI(TAG, "Modbus devices loaded from NVS");
 
+    ESP_ERROR_CHECK(modbus_alarms_load());
+    ESP_ERROR_CHECK(modbus_alarms_init());
+    ESP_LOGI(TAG, "Alarm rules loaded");
+
+    // The flash log is optional; polling and the web UI work without it
+    if (ts_log_init() == ESP_OK) {
+        ESP_LOGI(TAG, "Flash time-series log opened");
+    }
+
     ESP_ERROR_CHECK(modbus_manager_init(NULL));
     ESP_LOGI(TAG, "Modbus manager initialized");
 
@@ -39,6 +52,15 @@ void app_main(void)
     ESP_ERROR_CHECK(web_server_start());
     ESP_LOGI(TAG, "Web server started");
 
+    // Optional like the flash log; the client keeps retrying until the
+    // station is connected
+    if (mqtt_publisher_init() == ESP_OK) {
+        ESP_LOGI(TAG, "MQTT publisher started");
+    }
+    if (influx_push_init() == ESP_OK) {
+        ESP_LOGI(TAG, "Influx push started");
+    }
+
     ESP_LOGI(TAG, "ESP32 WiFi Manager with Modbus is running");
 
     while (1) {
@@ -0,0 +1,384 @@
+#include "modbus_alarms.h"
+#include "nvs_storage.h"
+#include "nvs.h"
+#include <string.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+static const char *TAG = "MODBUS_ALARMS";
+
+#define ALARM_RULES_KEY "alarm_rules"
+#define ALARM_BLOB_MAGIC 0x4C41
+#define ALARM_BLOB_VERSION 1
+#define NO_RULE 0xFF
+
+typedef struct {
+    uint16_t magic;
+    uint8_t version;
+    uint8_t count;
+} alarm_blob_header_t;
+
+// Runtime state, kept apart from the rule definitions so the table being
+// scanned on every change stays small
+typedef struct {
+    bool active;
+    bool has_prev;
+    uint32_t since;
+    uint32_t prev_ts;
+    int64_t prev_value;
+    modbus_decoded_t value;
+} alarm_state_t;
+
+typedef struct {
+    uint8_t id;
+    bool raised;
+} alarm_transition_t;
+
+static alarm_rule_t rules[MAX_ALARM_RULES];
+static alarm_state_t states[MAX_ALARM_RULES];
+static uint8_t rule_count = 0;
+
+// Rules chained per value slot, rebuilt when the configuration snapshot or
+// the rule table changes
+static uint8_t slot_head[MODBUS_MAX_VALUE_SLOTS];
+static uint8_t rule_next[MAX_ALARM_RULES];
+static uint32_t indexed_version = 0;
+static bool index_dirty = true;
+
+static portMUX_TYPE alarm_mux = portMUX_INITIALIZER_UNLOCKED;
+static esp_timer_handle_t stale_timer = NULL;
+
+static const int64_t pow10_table[ALARM_DECIMALS + 1] = {
+    1, 10, 100, 1000, 10000, 100000, 1000000
+};
+
+static int64_t to_alarm_units(const modbus_decoded_t *value)
+{
+    uint8_t decimals = value->decimals > ALARM_DECIMALS ? ALARM_DECIMALS : value->decimals;
+    return value->value * pow10_table[ALARM_DECIMALS - decimals];
+}
+
+static void rebuild_index(const modbus_snapshot_t *snapshot)
+{
+    memset(slot_head, NO_RULE, sizeof(slot_head));
+    for (int i = rule_count - 1; i >= 0; i--) {
+        rule_next[i] = NO_RULE;
+        if (rules[i].kind == ALARM_KIND_STALE) {
+            continue;
+        }
+        const modbus_register_t *reg = modbus_snapshot_find_register(snapshot, rules[i].device_id,
+                                                                     rules[i].type, rules[i].address);
+        if (reg != NULL) {
+            rule_next[i] = slot_head[reg->value_slot];
+            slot_head[reg->value_slot] = i;
+        }
+    }
+    indexed_version = snapshot->version;
+    index_dirty = false;
+}
+
+// Updates one rule's state; returns true if it changed between raised and cleared
+static bool evaluate_rule(const alarm_rule_t *rule, alarm_state_t *state, uint32_t raw,
+                          const modbus_decoded_t *value, uint32_t timestamp_ms)
+{
+    int64_t v = to_alarm_units(value);
+    bool active = state->active;
+
+    switch (rule->kind) {
+        case ALARM_KIND_HIGH:
+            active = active ? v >= rule->threshold - rule->hysteresis : v > rule->threshold;
+            break;
+        case ALARM_KIND_LOW:
+            active = active ? v <= rule->threshold + rule->hysteresis : v < rule->threshold;
+            break;
+        case ALARM_KIND_RATE:
+            if (state->has_prev && timestamp_ms > state->prev_ts) {
+                int64_t rate = (v - state->prev_value) * 1000 / (int64_t)(timestamp_ms - state->prev_ts);
+                int64_t magnitude = rate < 0 ? -rate : rate;
+                active = active ? magnitude > rule->threshold - rule->hysteresis : magnitude > rule->threshold;
+            }
+            state->has_prev = true;
+            state->prev_value = v;
+            state->prev_ts = timestamp_ms;
+            break;
+        case ALARM_KIND_BIT:
+            active = (raw & rule->mask) != 0;
+            break;
+    }
+
+    if (active == state->active) {
+        return false;
+    }
+    state->active = active;
+    if (active) {
+        state->since = timestamp_ms;
+        state->value = *value;
+    }
+    return true;
+}
+
+static void log_transition(uint8_t id, uint8_t device_id, uint16_t address, bool raised)
+{
+    if (raised) {
+        ESP_LOGW(TAG, "Alarm %u raised (device %u, address %u)", id, device_id, address);
+    } else {
+        ESP_LOGI(TAG, "Alarm %u cleared (device %u, address %u)", id, device_id, address);
+    }
+}
+
+void modbus_alarms_evaluate(const modbus_snapshot_t *snapshot, const modbus_register_t *reg,
+                            uint8_t device_id, uint32_t raw, const modbus_decoded_t *value,
+                            uint32_t timestamp_ms)
+{
+    alarm_transition_t transitions[MAX_ALARM_RULES];
+    size_t count = 0;
+
+    portENTER_CRITICAL(&alarm_mux);
+    if (index_dirty || indexed_version != snapshot->version) {
+        rebuild_index(snapshot);
+    }
+    for (uint8_t i = slot_head[reg->value_slot]; i != NO_RULE; i = rule_next[i]) {
+        if (rules[i].device_id != device_id || rules[i].type != reg->type || rules[i].address != reg->address) {
+            continue;
+        }
+        if (evaluate_rule(&rules[i], &states[i], raw, value, timestamp_ms)) {
+            transitions[count].id = rules[i].id;
+            transitions[count].raised = states[i].active;
+            count++;
+        }
+    }
+    portEXIT_CRITICAL(&alarm_mux);
+
+    // Logging is not allowed inside the critical section
+    for (size_t i = 0; i < count; i++) {
+        log_transition(transitions[i].id, device_id, reg->address, transitions[i].raised);
+    }
+}
+
+// Stale rules can't wait for a value change, so they are checked on a timer
+// against the register's last update time
+static void stale_timer_callback(void *arg)
+{
+    const modbus_snapshot_t *snapshot = modbus_snapshot_acquire();
+    uint32_t now = xTaskGetTickCount() * portTICK_PERIOD_MS;
+
+    for (uint8_t i = 0; i < MAX_ALARM_RULES; i++) {
+        portENTER_CRITICAL(&alarm_mux);
+        bool stale_rule = i < rule_count && rules[i].kind == ALARM_KIND_STALE;
+        alarm_rule_t rule;
+        if (stale_rule) {
+            rule = rules[i];
+        }
+        portEXIT_CRITICAL(&alarm_mux);
+        if (!stale_rule) {
+            continue;
+        }
+
+        const modbus_register_t *reg = modbus_snapshot_find_register(snapshot, rule.device_id,
+                                                                     rule.type, rule.address);
+        modbus_value_t value = {0};
+        if (reg != NULL) {
+            modbus_read_value(reg, &value);
+        }
+        // A register that never reported counts from boot
+        uint32_t age = now - value.last_update;
+        bool active = (int64_t)age > rule.threshold;
+
+        bool changed = false;
+        portENTER_CRITICAL(&alarm_mux);
+        if (i < rule_count && rules[i].id == rule.id && states[i].active != active) {
+            states[i].active = active;
+            states[i].since = now;
+            states[i].value.value = age;
+            states[i].value.decimals = 0;
+            changed = true;
+        }
+        portEXIT_CRITICAL(&alarm_mux);
+        if (changed) {
+            log_transition(rule.id, rule.device_id, rule.address, active);
+        }
+    }
+
+    modbus_snapshot_release(snapshot);
+}
+
+esp_err_t modbus_alarms_init(void)
+{
+    if (stale_timer == NULL) {
+        const esp_timer_create_args_t timer_args = {
+            .callback = stale_timer_callback,
+            .name = "alarm_stale",
+        };
+        esp_err_t err = esp_timer_create(&timer_args, &stale_timer);
+        if (err != ESP_OK) {
+            return err;
+        }
+        err = esp_timer_start_periodic(stale_timer, ALARM_STALE_CHECK_MS * 1000ULL);
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+    return ESP_OK;
+}
+
+static esp_err_t save_rules(void)
+{
+    uint8_t *buf = malloc(sizeof(alarm_blob_header_t) + sizeof(rules));
+    if (buf == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    alarm_blob_header_t header = { ALARM_BLOB_MAGIC, ALARM_BLOB_VERSION, 0 };
+
+    portENTER_CRITICAL(&alarm_mux);
+    header.count = rule_count;
+    memcpy(buf + sizeof(header), rules, rule_count * sizeof(alarm_rule_t));
+    portEXIT_CRITICAL(&alarm_mux);
+    memcpy(buf, &header, sizeof(header));
+
+    nvs_handle_t nvs_handle;
+    esp_err_t err = nvs_open(NVS_MODBUS_NAMESPACE, NVS_READWRITE, &nvs_handle);
+    if (err == ESP_OK) {
+        err = nvs_set_blob(nvs_handle, ALARM_RULES_KEY, buf, sizeof(header) + header.count * sizeof(alarm_rule_t));
+        if (err == ESP_OK) {
+            err = nvs_commit(nvs_handle);
+        }
+        nvs_close(nvs_handle);
+    }
+    free(buf);
+
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to save alarm rules: %s", esp_err_to_name(err));
+    }
+    return err;
+}
+
+esp_err_t modbus_alarms_load(void)
+{
+    nvs_handle_t nvs_handle;
+    esp_err_t err = nvs_open(NVS_MODBUS_NAMESPACE, NVS_READONLY, &nvs_handle);
+    if (err != ESP_OK) {
+        return err == ESP_ERR_NVS_NOT_FOUND ? ESP_OK : err;
+    }
+
+    size_t len = sizeof(alarm_blob_header_t) + sizeof(rules);
+    uint8_t *buf = malloc(len);
+    if (buf == NULL) {
+        nvs_close(nvs_handle);
+        return ESP_ERR_NO_MEM;
+    }
+    err = nvs_get_blob(nvs_handle, ALARM_RULES_KEY, buf, &len);
+    nvs_close(nvs_handle);
+    if (err != ESP_OK) {
+        free(buf);
+        return err == ESP_ERR_NVS_NOT_FOUND ? ESP_OK : err;
+    }
+
+    alarm_blob_header_t header;
+    memcpy(&header, buf, sizeof(header));
+    if (len < sizeof(header) || header.magic != ALARM_BLOB_MAGIC || header.version != ALARM_BLOB_VERSION ||
+        header.count > MAX_ALARM_RULES || len != sizeof(header) + header.count * sizeof(alarm_rule_t)) {
+        ESP_LOGW(TAG, "Ignoring invalid alarm rule blob");
+        free(buf);
+        return ESP_OK;
+    }
+
+    portENTER_CRITICAL(&alarm_mux);
+    memcpy(rules, buf + sizeof(header), header.count * sizeof(alarm_rule_t));
+    memset(states, 0, sizeof(states));
+    rule_count = header.count;
+    index_dirty = true;
+    portEXIT_CRITICAL(&alarm_mux);
+    free(buf);
+
+    ESP_LOGI(TAG, "Loaded %u alarm rule(s)", header.count);
+    return ESP_OK;
+}
+
+esp_err_t modbus_alarms_set_rule(alarm_rule_t *rule)
+{
+    if (rule->kind > ALARM_KIND_BIT || rule->type < REGISTER_TYPE_COIL || rule->type > REGISTER_TYPE_VIRTUAL ||
+        rule->hysteresis < 0 || (rule->kind == ALARM_KIND_BIT && rule->mask == 0)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    esp_err_t err = ESP_OK;
+    portENTER_CRITICAL(&alarm_mux);
+    int index = -1;
+    bool used[256] = {0};
+    for (uint8_t i = 0; i < rule_count; i++) {
+        used[rules[i].id] = true;
+        if (rule->id != 0 && rules[i].id == rule->id) {
+            index = i;
+        }
+    }
+    if (rule->id == 0) {
+        for (int id = 1; id < 256; id++) {
+            if (!used[id]) {
+                rule->id = id;
+                break;
+            }
+        }
+    }
+
+    if (index < 0 && rule_count >= MAX_ALARM_RULES) {
+        err = ESP_ERR_NO_MEM;
+    } else {
+        if (index < 0) {
+            index = rule_count++;
+        }
+        rules[index] = *rule;
+        memset(&states[index], 0, sizeof(alarm_state_t));
+        index_dirty = true;
+    }
+    portEXIT_CRITICAL(&alarm_mux);
+
+    return err == ESP_OK ? save_rules() : err;
+}
+
+esp_err_t modbus_alarms_remove_rule(uint8_t id)
+{
+    esp_err_t err = ESP_ERR_NOT_FOUND;
+    portENTER_CRITICAL(&alarm_mux);
+    for (uint8_t i = 0; i < rule_count; i++) {
+        if (rules[i].id == id) {
+            memmove(&rules[i], &rules[i + 1], (rule_count - i - 1) * sizeof(alarm_rule_t));
+            memmove(&states[i], &states[i + 1], (rule_count - i - 1) * sizeof(alarm_state_t));
+            rule_count--;
+            index_dirty = true;
+            err = ESP_OK;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&alarm_mux);
+
+    return err == ESP_OK ? save_rules() : err;
+}
+
+size_t modbus_alarms_get_rules(alarm_rule_t *out, size_t max)
+{
+    portENTER_CRITICAL(&alarm_mux);
+    size_t count = rule_count < max ? rule_count : max;
+    memcpy(out, rules, count * sizeof(alarm_rule_t));
+    portEXIT_CRITICAL(&alarm_mux);
+    return count;
+}
+
+size_t modbus_alarms_get_active(alarm_active_t *out, size_t max)
+{
+    size_t count = 0;
+    portENTER_CRITICAL(&alarm_mux);
+    for (uint8_t i = 0; i < rule_count && count < max; i++) {
+        if (states[i].active) {
+            out[count].rule = rules[i];
+            out[count].since = states[i].since;
+            out[count].value = states[i].value;
+            count++;
+        }
+    }
+    portEXIT_CRITICAL(&alarm_mux);
+    return count;
+}
@@ -0,0 +1,59 @@
+#ifndef MODBUS_ALARMS_H
+#define MODBUS_ALARMS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "modbus_devices.h"
+
+#define MAX_ALARM_RULES 32
+#define ALARM_NAME_MAX_LEN 32
+#define ALARM_STALE_CHECK_MS 1000
+
+typedef enum {
+    ALARM_KIND_HIGH = 0,        // value > threshold, clears below threshold - hysteresis
+    ALARM_KIND_LOW = 1,         // value < threshold, clears above threshold + hysteresis
+    ALARM_KIND_RATE = 2,        // |change per second| > threshold
+    ALARM_KIND_STALE = 3,       // no update for threshold milliseconds
+    ALARM_KIND_BIT = 4          // any bit of mask set in the raw value
+} alarm_kind_t;
+
+// Thresholds are fixed point with ALARM_DECIMALS decimals so evaluation
+// never touches floats, whatever the register's own scale
+#define ALARM_DECIMALS 6
+
+typedef struct {
+    uint8_t id;                 // 1-255
+    uint8_t device_id;
+    uint8_t type;               // register_type_t
+    uint8_t kind;               // alarm_kind_t
+    uint16_t address;
+    uint16_t mask;
+    uint8_t severity;           // 0 = info, 1 = warning, 2 = critical
+    char name[ALARM_NAME_MAX_LEN];
+    int64_t threshold;
+    int64_t hysteresis;
+} alarm_rule_t;
+
+typedef struct {
+    alarm_rule_t rule;
+    uint32_t since;             // Milliseconds since boot when raised
+    modbus_decoded_t value;     // Value that raised it (age in ms for stale alarms)
+} alarm_active_t;
+
+esp_err_t modbus_alarms_init(void);
+esp_err_t modbus_alarms_load(void);
+
+esp_err_t modbus_alarms_set_rule(alarm_rule_t *rule);
+esp_err_t modbus_alarms_remove_rule(uint8_t id);
+size_t modbus_alarms_get_rules(alarm_rule_t *rules, size_t max);
+size_t modbus_alarms_get_active(alarm_active_t *active, size_t max);
+
+// Called from modbus_update_register_value() for values that changed; only
+// the rules attached to that register are evaluated
+void modbus_alarms_evaluate(const modbus_snapshot_t *snapshot, const modbus_register_t *reg,
+                            uint8_t device_id, uint32_t raw, const modbus_decoded_t *value,
+                            uint32_t timestamp_ms);
+
+#endif
@@ -0,0 +1,237 @@
+#include "modbus_batch.h"
+#include "modbus_protocol.h"
+#include "esp_log.h"
+#include <string.h>
+
+static const char *TAG = "MODBUS_BATCH";
+
+// Read responses carry at most MODBUS_MAX_DATA_LEN bytes
+#define MAX_READ_REGISTERS (MODBUS_MAX_DATA_LEN / 2)
+#define MAX_BITS (MODBUS_MAX_DATA_LEN * 8)
+
+// Transaction order: by device, writes before reads, then by type and
+// address; equal keys keep their request order
+static bool item_before(const modbus_batch_item_t *items, uint8_t a, uint8_t b)
+{
+    const modbus_batch_item_t *x = &items[a];
+    const modbus_batch_item_t *y = &items[b];
+    if (x->device_id != y->device_id) {
+        return x->device_id < y->device_id;
+    }
+    if (x->write != y->write) {
+        return x->write;
+    }
+    if (x->type != y->type) {
+        return x->type < y->type;
+    }
+    if (x->address != y->address) {
+        return x->address < y->address;
+    }
+    return a < b;
+}
+
+static bool is_bit_type(register_type_t type)
+{
+    return type == REGISTER_TYPE_COIL || type == REGISTER_TYPE_DISCRETE;
+}
+
+static bool can_execute(const modbus_batch_item_t *item)
+{
+    if (item->write) {
+        return item->type == REGISTER_TYPE_HOLDING || item->type == REGISTER_TYPE_COIL;
+    }
+    return item->type >= REGISTER_TYPE_COIL && item->type <= REGISTER_TYPE_INPUT;
+}
+
+static uint8_t item_span(const modbus_batch_item_t *item)
+{
+    return is_bit_type(item->type) || item->words < 1 ? 1 : item->words;
+}
+
+// True if next can join the transaction covering [start, end). Writes must
+// continue the run exactly, so a repeated address starts a new transaction
+// and both are written in request order; reads may overlap.
+static bool extends_run(const modbus_batch_item_t *first, const modbus_batch_item_t *next,
+                        uint16_t start, uint32_t end)
+{
+    if (next->device_id != first->device_id || next->write != first->write || next->type != first->type ||
+        !can_execute(next)) {
+        return false;
+    }
+    uint32_t next_end = (uint32_t)next->address + item_span(next);
+    uint32_t new_end = next_end > end ? next_end : end;
+    uint32_t limit = is_bit_type(first->type) ? MAX_BITS :
+                     first->write ? MODBUS_MAX_WRITE_REGISTERS : MAX_READ_REGISTERS;
+    if (first->write ? next->address != end : next->address > end) {
+        return false;
+    }
+    return new_end - start <= limit;
+}
+
+static modbus_result_t run_write(modbus_batch_item_t *items, const uint8_t *order, size_t n,
+                                 uint16_t start, uint16_t span)
+{
+    const modbus_batch_item_t *first = &items[order[0]];
+
+    if (first->type == REGISTER_TYPE_COIL) {
+        if (span == 1) {
+            return modbus_write_single_coil(first->device_id, start, first->raw != 0);
+        }
+        uint8_t bits[MAX_BITS / 8] = {0};
+        for (size_t i = 0; i < n; i++) {
+            uint16_t offset = items[order[i]].address - start;
+            if (items[order[i]].raw != 0) {
+                bits[offset / 8] |= 1u << (offset % 8);
+            }
+        }
+        return modbus_write_multiple_coils(first->device_id, start, bits, span);
+    }
+
+    uint16_t words[MODBUS_MAX_WRITE_REGISTERS];
+    for (size_t i = 0; i < n; i++) {
+        const modbus_batch_item_t *item = &items[order[i]];
+        uint16_t offset = item->address - start;
+        if (item_span(item) == 2) {
+            words[offset] = item->raw >> 16;
+            words[offset + 1] = item->raw & 0xFFFF;
+        } else {
+            words[offset] = item->raw & 0xFFFF;
+        }
+    }
+    if (span == 1) {
+        return modbus_write_single_register(first->device_id, start, words[0]);
+    }
+    return modbus_write_multiple_registers(first->device_id, start, words, span);
+}
+
+static modbus_result_t run_read(modbus_batch_item_t *items, const uint8_t *order, size_t n,
+                                uint16_t start, uint16_t span)
+{
+    const modbus_batch_item_t *first = &items[order[0]];
+    modbus_result_t result;
+
+    if (is_bit_type(first->type)) {
+        uint8_t bits[MAX_BITS / 8] = {0};
+        result = first->type == REGISTER_TYPE_COIL ?
+                 modbus_read_coils(first->device_id, start, span, bits) :
+                 modbus_read_discrete_inputs(first->device_id, start, span, bits);
+        for (size_t i = 0; i < n && result == MODBUS_RESULT_OK; i++) {
+            uint16_t offset = items[order[i]].address - start;
+            items[order[i]].raw = (bits[offset / 8] >> (offset % 8)) & 1;
+        }
+        return result;
+    }
+
+    uint16_t regs[MAX_READ_REGISTERS];
+    result = first->type == REGISTER_TYPE_HOLDING ?
+             modbus_read_holding_registers(first->device_id, start, span, regs) :
+             modbus_read_input_registers(first->device_id, start, span, regs);
+    for (size_t i = 0; i < n && result == MODBUS_RESULT_OK; i++) {
+        modbus_batch_item_t *item = &items[order[i]];
+        uint16_t offset = item->address - start;
+        item->raw = item_span(item) == 2 ? ((uint32_t)regs[offset] << 16) | regs[offset + 1] : regs[offset];
+    }
+    return result;
+}
+
+// Puts the items in transaction order; returns the count actually planned
+static size_t sort_items(const modbus_batch_item_t *items, size_t count, uint8_t *order)
+{
+    if (count > MODBUS_BATCH_MAX_ITEMS) {
+        count = MODBUS_BATCH_MAX_ITEMS;
+    }
+
+    // Insertion sort: batches are small and mostly arrive in address order
+    for (size_t i = 0; i < count; i++) {
+        size_t j = i;
+        while (j > 0 && item_before(items, i, order[j - 1])) {
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = i;
+    }
+    return count;
+}
+
+// Number of items from order[0] on that share its transaction; end is set
+// past the last address they cover
+static size_t run_length(const modbus_batch_item_t *items, const uint8_t *order, size_t left, uint32_t *end)
+{
+    const modbus_batch_item_t *first = &items[order[0]];
+    uint16_t start = first->address;
+    *end = (uint32_t)start + item_span(first);
+    size_t n = 1;
+    while (n < left && extends_run(first, &items[order[n]], start, *end)) {
+        uint32_t next_end = (uint32_t)items[order[n]].address + item_span(&items[order[n]]);
+        *end = next_end > *end ? next_end : *end;
+        n++;
+    }
+    return n;
+}
+
+size_t modbus_batch_count_transactions(const modbus_batch_item_t *items, size_t count)
+{
+    uint8_t order[MODBUS_BATCH_MAX_ITEMS];
+    count = sort_items(items, count, order);
+
+    size_t transactions = 0;
+    for (size_t i = 0; i < count;) {
+        if (!can_execute(&items[order[i]])) {
+            i++;
+            continue;
+        }
+        uint32_t end;
+        i += run_length(items, &order[i], count - i, &end);
+        transactions++;
+    }
+    return transactions;
+}
+
+size_t modbus_batch_execute(modbus_batch_item_t *items, size_t count)
+{
+    uint8_t order[MODBUS_BATCH_MAX_ITEMS];
+    count = sort_items(items, count, order);
+
+    uint32_t timed_out[(UINT8_MAX + 1) / 32] = {0};
+    size_t transactions = 0;
+
+    modbus_manager_lock_bus();
+    for (size_t i = 0; i < count;) {
+        modbus_batch_item_t *first = &items[order[i]];
+        if (!can_execute(first)) {
+            first->result = MODBUS_RESULT_INVALID_RESPONSE;
+            first->exception = 0;
+            i++;
+            continue;
+        }
+
+        uint16_t start = first->address;
+        uint32_t end;
+        size_t n = run_length(items, &order[i], count - i, &end);
+
+        modbus_result_t result;
+        uint8_t exception = 0;
+        if (timed_out[first->device_id / 32] & (1u << (first->device_id % 32))) {
+            result = MODBUS_RESULT_TIMEOUT;
+        } else {
+            transactions++;
+            result = first->write ? run_write(items, &order[i], n, start, end - start) :
+                                    run_read(items, &order[i], n, start, end - start);
+            if (result == MODBUS_RESULT_EXCEPTION) {
+                exception = modbus_manager_get_last_error();
+            } else if (result == MODBUS_RESULT_TIMEOUT) {
+                timed_out[first->device_id / 32] |= 1u << (first->device_id % 32);
+            }
+        }
+
+        for (size_t k = 0; k < n; k++) {
+            items[order[i + k]].result = result;
+            items[order[i + k]].exception = exception;
+        }
+        i += n;
+    }
+    modbus_manager_unlock_bus();
+
+    ESP_LOGI(TAG, "Batch of %u items sent in %u transactions", (unsigned)count, (unsigned)transactions);
+    return transactions;
+}
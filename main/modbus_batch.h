@@ -0,0 +1,39 @@
+#ifndef MODBUS_BATCH_H
+#define MODBUS_BATCH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "modbus_devices.h"
+#include "modbus_manager.h"
+
+#define MODBUS_BATCH_MAX_ITEMS 128
+
+// One register read or write of a batch. Values are raw: register words in
+// wire order with the first word in the upper half (as modbus_value_t.raw),
+// or 0/1 for coils and discrete inputs.
+typedef struct {
+    uint8_t device_id;
+    register_type_t type;
+    uint16_t address;
+    uint8_t words;              // Registers spanned, 1 or 2; 1 for bits
+    bool write;
+    uint32_t raw;               // Value to write, or the value read
+    modbus_result_t result;     // Set by modbus_batch_execute()
+    uint8_t exception;          // Exception code if result is MODBUS_RESULT_EXCEPTION
+} modbus_batch_item_t;
+
+// Plans the items into as few transactions as possible and runs them with the
+// bus held, so the poller can't interleave. Per device, writes run before
+// reads; contiguous addresses of one type share a transaction (FC15/FC16 for
+// writes, FC01-FC04 for reads) and a lone item uses FC05/FC06. Once a device
+// times out its remaining transactions fail without touching the bus.
+// Returns the number of transactions sent.
+size_t modbus_batch_execute(modbus_batch_item_t *items, size_t count);
+
+// Transactions modbus_batch_execute() would send for these items, at most;
+// fewer if a device times out
+size_t modbus_batch_count_transactions(const modbus_batch_item_t *items, size_t count);
+
+#endif
@@ -0,0 +1,224 @@
+#include "modbus_decode.h"
+#include <stdbool.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+
+typedef enum {
+    DECODE_OP_SWAP_WORDS = 1,
+    DECODE_OP_UNSIGNED,
+    DECODE_OP_SIGNED16,
+    DECODE_OP_SIGNED32,
+    DECODE_OP_BITS,
+    DECODE_OP_FLOAT,
+    DECODE_OP_SCALE
+} decode_op_t;
+
+static const int32_t pow10_table[MODBUS_DECODE_MAX_DECIMALS + 1] = {
+    1, 10, 100, 1000, 10000, 100000, 1000000
+};
+
+uint8_t modbus_format_word_count(register_format_t format)
+{
+    switch (format) {
+        case REGISTER_FORMAT_UINT32:
+        case REGISTER_FORMAT_INT32:
+        case REGISTER_FORMAT_FLOAT32:
+            return 2;
+        default:
+            return 1;
+    }
+}
+
+// Converts x to a fixed-point integer with the given number of decimals.
+// Fails if it doesn't fit, or if exact is set and the conversion would round.
+static bool to_fixed(double x, uint8_t decimals, bool exact, int32_t *out)
+{
+    double scaled = x * pow10_table[decimals];
+    double rounded = round(scaled);
+    if (rounded > INT32_MAX || rounded < INT32_MIN) {
+        return false;
+    }
+    // Configured values arrive as floats, so 0.1 is really 0.100000001
+    if (exact && fabs(scaled - rounded) > 1e-6 * fmax(1.0, fabs(scaled))) {
+        return false;
+    }
+    *out = (int32_t)rounded;
+    return true;
+}
+
+esp_err_t modbus_decode_compile(register_format_t format, register_word_order_t word_order,
+                                uint16_t bit_mask, float scale, float offset,
+                                modbus_decode_t *decode)
+{
+    memset(decode, 0, sizeof(modbus_decode_t));
+
+    if (format > REGISTER_FORMAT_BITFIELD || word_order > WORD_ORDER_LOW_FIRST) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (format == REGISTER_FORMAT_BITFIELD && bit_mask == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    // Pick the fewest decimals that represent both scale and offset exactly,
+    // falling back to the maximum precision with rounding. Floats on the wire
+    // carry their own fraction, so they always keep a few decimals.
+    uint8_t decimals = format == REGISTER_FORMAT_FLOAT32 ? MODBUS_DECODE_FLOAT_DECIMALS : 0;
+    while (decimals < MODBUS_DECODE_MAX_DECIMALS &&
+           !(to_fixed(scale, decimals, true, &decode->mul) && to_fixed(offset, decimals, true, &decode->add))) {
+        decimals++;
+    }
+    if (!to_fixed(scale, decimals, false, &decode->mul) || !to_fixed(offset, decimals, false, &decode->add)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    decode->decimals = decimals;
+
+    if (modbus_format_word_count(format) == 2 && word_order == WORD_ORDER_LOW_FIRST) {
+        decode->ops[decode->op_count++] = DECODE_OP_SWAP_WORDS;
+    }
+
+    switch (format) {
+        case REGISTER_FORMAT_UINT16:
+        case REGISTER_FORMAT_UINT32:
+            decode->ops[decode->op_count++] = DECODE_OP_UNSIGNED;
+            break;
+        case REGISTER_FORMAT_INT16:
+            decode->ops[decode->op_count++] = DECODE_OP_SIGNED16;
+            break;
+        case REGISTER_FORMAT_INT32:
+            decode->ops[decode->op_count++] = DECODE_OP_SIGNED32;
+            break;
+        case REGISTER_FORMAT_BITFIELD:
+            decode->mask = bit_mask;
+            decode->shift = __builtin_ctz(bit_mask);
+            decode->ops[decode->op_count++] = DECODE_OP_BITS;
+            break;
+        case REGISTER_FORMAT_FLOAT32:
+            // Scale and offset are folded into the float conversion
+            decode->ops[decode->op_count++] = DECODE_OP_FLOAT;
+            return ESP_OK;
+    }
+
+    if (decode->mul != 1 || decode->add != 0) {
+        decode->ops[decode->op_count++] = DECODE_OP_SCALE;
+    }
+    return ESP_OK;
+}
+
+void modbus_decode_run(const modbus_decode_t *decode, uint32_t raw, modbus_decoded_t *out)
+{
+    int64_t acc = 0;
+
+    for (uint8_t i = 0; i < decode->op_count; i++) {
+        switch (decode->ops[i]) {
+            case DECODE_OP_SWAP_WORDS:
+                raw = (raw << 16) | (raw >> 16);
+                break;
+            case DECODE_OP_UNSIGNED:
+                acc = raw;
+                break;
+            case DECODE_OP_SIGNED16:
+                acc = (int16_t)(raw & 0xFFFF);
+                break;
+            case DECODE_OP_SIGNED32:
+                acc = (int32_t)raw;
+                break;
+            case DECODE_OP_BITS:
+                acc = (raw & decode->mask) >> decode->shift;
+                break;
+            case DECODE_OP_FLOAT:
+                {
+                    float f;
+                    memcpy(&f, &raw, sizeof(f));
+                    float scaled = f * (float)decode->mul + (float)decode->add;
+                    if (isnan(scaled)) {
+                        acc = 0;
+                    } else if (scaled >= 9.2e18f) {
+                        acc = INT64_MAX;
+                    } else if (scaled <= -9.2e18f) {
+                        acc = INT64_MIN;
+                    } else {
+                        acc = llroundf(scaled);
+                    }
+                }
+                break;
+            case DECODE_OP_SCALE:
+                acc = acc * decode->mul + decode->add;
+                break;
+        }
+    }
+
+    out->value = acc;
+    out->decimals = decode->decimals;
+}
+
+static double clamp(double x, double lo, double hi)
+{
+    return x < lo ? lo : x > hi ? hi : x;
+}
+
+uint32_t modbus_encode_run(const modbus_decode_t *decode, register_format_t format,
+                           register_word_order_t word_order, double value, uint32_t current)
+{
+    // Undo the fixed-point scaling; a zero scale leaves nothing to invert
+    double x = decode->mul == 0 ? 0.0 : (value * pow10_table[decode->decimals] - decode->add) / decode->mul;
+    uint32_t raw;
+
+    switch (format) {
+        case REGISTER_FORMAT_INT16:
+            raw = (uint16_t)(int16_t)lround(clamp(x, INT16_MIN, INT16_MAX));
+            break;
+        case REGISTER_FORMAT_UINT32:
+            raw = (uint32_t)llround(clamp(x, 0, UINT32_MAX));
+            break;
+        case REGISTER_FORMAT_INT32:
+            raw = (uint32_t)(int32_t)llround(clamp(x, INT32_MIN, INT32_MAX));
+            break;
+        case REGISTER_FORMAT_FLOAT32:
+            {
+                float f = (float)x;
+                memcpy(&raw, &f, sizeof(raw));
+            }
+            break;
+        case REGISTER_FORMAT_BITFIELD:
+            {
+                uint32_t field = (uint32_t)lround(clamp(x, 0, decode->mask >> decode->shift));
+                raw = (current & 0xFFFF & ~(uint32_t)decode->mask) | ((field << decode->shift) & decode->mask);
+            }
+            break;
+        default:
+            raw = (uint16_t)lround(clamp(x, 0, UINT16_MAX));
+            break;
+    }
+
+    if (modbus_format_word_count(format) == 2 && word_order == WORD_ORDER_LOW_FIRST) {
+        raw = (raw << 16) | (raw >> 16);
+    }
+    return raw;
+}
+
+int modbus_decode_format(const modbus_decoded_t *value, char *buf, size_t len)
+{
+    char digits[MODBUS_DECODE_STR_LEN];
+    char *p = digits + sizeof(digits);
+    uint64_t mag = value->value < 0 ? -(uint64_t)value->value : (uint64_t)value->value;
+    uint8_t count = 0;
+
+    // Emit digits right to left, inserting the decimal point and a leading
+    // zero for values below one
+    do {
+        *--p = '0' + (char)(mag % 10);
+        mag /= 10;
+        if (++count == value->decimals) {
+            *--p = '.';
+        }
+    } while (mag > 0 || count <= value->decimals);
+
+    return snprintf(buf, len, "%s%.*s", value->value < 0 ? "-" : "",
+                    (int)(digits + sizeof(digits) - p), p);
+}
+
+float modbus_decoded_to_float(const modbus_decoded_t *value)
+{
+    return (float)value->value / (float)pow10_table[value->decimals];
+}
@@ -0,0 +1,68 @@
+#ifndef MODBUS_DECODE_H
+#define MODBUS_DECODE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+#define MODBUS_DECODE_MAX_OPS 3
+#define MODBUS_DECODE_MAX_DECIMALS 6
+#define MODBUS_DECODE_FLOAT_DECIMALS 3
+#define MODBUS_DECODE_STR_LEN 24
+
+typedef enum {
+    REGISTER_FORMAT_UINT16 = 0,
+    REGISTER_FORMAT_INT16 = 1,
+    REGISTER_FORMAT_UINT32 = 2,
+    REGISTER_FORMAT_INT32 = 3,
+    REGISTER_FORMAT_FLOAT32 = 4,
+    REGISTER_FORMAT_BITFIELD = 5
+} register_format_t;
+
+typedef enum {
+    WORD_ORDER_HIGH_FIRST = 0,      // Modbus convention: most significant word at the lower address
+    WORD_ORDER_LOW_FIRST = 1
+} register_word_order_t;
+
+// Decode program compiled once per register when the configuration changes.
+// Values are carried as fixed-point integers (value * 10^decimals) so the
+// poll and serve paths never touch the soft-float library, except for
+// registers that are IEEE floats on the wire.
+typedef struct {
+    uint8_t ops[MODBUS_DECODE_MAX_OPS];
+    uint8_t op_count;
+    uint8_t decimals;
+    uint8_t shift;
+    uint16_t mask;
+    int32_t mul;
+    int32_t add;
+} modbus_decode_t;
+
+typedef struct {
+    int64_t value;
+    uint8_t decimals;
+} modbus_decoded_t;
+
+// Number of 16-bit registers a value of this format spans on the wire
+uint8_t modbus_format_word_count(register_format_t format);
+
+esp_err_t modbus_decode_compile(register_format_t format, register_word_order_t word_order,
+                                uint16_t bit_mask, float scale, float offset,
+                                modbus_decode_t *decode);
+
+// raw holds the words in wire order, first word in the upper half
+void modbus_decode_run(const modbus_decode_t *decode, uint32_t raw, modbus_decoded_t *out);
+
+// Inverse of the decode program: the wire value (first word in the upper half)
+// that decodes to value, given in engineering units. Values outside the
+// format's range are clamped. Bits outside a bitfield's mask are taken from
+// current, the register's last known wire value.
+uint32_t modbus_encode_run(const modbus_decode_t *decode, register_format_t format,
+                           register_word_order_t word_order, double value, uint32_t current);
+
+// Writes the decimal representation of a decoded value; returns its length
+int modbus_decode_format(const modbus_decoded_t *value, char *buf, size_t len);
+
+float modbus_decoded_to_float(const modbus_decoded_t *value);
+
+#endif
@@ -1,104 +1,1271 @@
 #include "modbus_devices.h"
+#include "modbus_history.h"
+#include "modbus_rollup.h"
+#include "modbus_alarms.h"
+#include "ts_log.h"
+#include "influx_push.h"
 #include "nvs_flash.h"
 #include "nvs.h"
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <inttypes.h>
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_rom_crc.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/semphr.h"
 
 static const char *TAG = "MODBUS_DEVICES";
 static const char *NVS_NAMESPACE = "modbus_config";
+static const char *DEVICE_LIST_KEY = "dev_ids";
+
+// Each device is persisted as one blob under "dev_<id>": a header followed by
+// the device fields and its registers, strings stored length-prefixed.
+#define DEVICE_BLOB_MAGIC 0x424D
+#define DEVICE_BLOB_VERSION 7
+
+#define REGISTER_FLAG_WRITABLE 0x01
+#define REGISTER_FLAG_HISTORY 0x02
+
+typedef struct __attribute__((packed)) {
+    uint16_t magic;
+    uint8_t version;
+    uint8_t reserved;
+    uint16_t length;
+    uint32_t crc;
+} device_blob_header_t;
+
+static uint32_t dirty_devices[(UINT8_MAX + 1) / 32];
+static bool device_list_dirty = false;
+static esp_timer_handle_t save_timer = NULL;
+
+// Configuration is published as immutable snapshots. snapshot_mux guards only
+// the pointer swap and reference counts (the C3 has no atomic instructions, so
+// a short critical section is the cheapest correct primitive); writer_lock
+// serialises writers against each other and never blocks readers.
+static modbus_snapshot_t *current_snapshot = NULL;
+static portMUX_TYPE snapshot_mux = portMUX_INITIALIZER_UNLOCKED;
+static SemaphoreHandle_t writer_lock = NULL;
+
+// Runtime values and device statistics, addressed by the slots assigned in
+// the snapshot so they survive configuration edits.
+static modbus_value_t values[MODBUS_MAX_VALUE_SLOTS];
+static modbus_device_state_t device_states[MAX_MODBUS_DEVICES];
+static uint32_t values_version = 0;
+static portMUX_TYPE value_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static inline uint32_t register_key(register_type_t type, uint16_t address)
+{
+    return ((uint32_t)type << 16) | address;
+}
+
+// Position of a device's first register in the snapshot's pools
+static inline uint16_t register_base(const modbus_snapshot_t *snapshot, const modbus_device_t *device)
+{
+    return (uint16_t)(device->registers - snapshot->registers);
+}
+
+#define REGISTER_BITMAP_WORDS ((MAX_REGISTERS_PER_DEVICE + 31) / 32)
+#define VALUE_BITMAP_WORDS ((MODBUS_MAX_VALUE_SLOTS + 31) / 32)
+
+static inline void bitmap_set(uint32_t *bitmap, uint16_t index)
+{
+    bitmap[index / 32] |= 1u << (index % 32);
+}
+
+static inline bool bitmap_test(const uint32_t *bitmap, uint16_t index)
+{
+    return (bitmap[index / 32] >> (index % 32)) & 1u;
+}
+
+// Replaced snapshots still pinned by readers, newest first, under
+// snapshot_mux. A value slot an edit drops may still be written through them,
+// so it stays in retired_slots, and is not handed out again, until every
+// snapshot that held it has been released.
+static modbus_snapshot_t *retired_snapshots = NULL;
+static uint32_t retired_slots[VALUE_BITMAP_WORDS];
+
+static int compare_register_keys(const void *a, const void *b)
+{
+    uint32_t ka = ((const modbus_register_index_t *)a)->key;
+    uint32_t kb = ((const modbus_register_index_t *)b)->key;
+    return ka < kb ? -1 : ka > kb;
+}
+
+static void rebuild_register_index(modbus_snapshot_t *snapshot, uint8_t slot)
+{
+    const modbus_device_t *device = &snapshot->devices[slot];
+    modbus_register_index_t *index = &snapshot->register_index[register_base(snapshot, device)];
+
+    for (uint16_t i = 0; i < device->register_count; i++) {
+        index[i].key = register_key(device->registers[i].type, device->registers[i].address);
+        index[i].reg_index = i;
+    }
+    qsort(index, device->register_count, sizeof(modbus_register_index_t), compare_register_keys);
+}
+
+static void rebuild_index(modbus_snapshot_t *snapshot)
+{
+    memset(snapshot->device_slots, 0, sizeof(snapshot->device_slots));
+    for (uint8_t i = 0; i < snapshot->device_count; i++) {
+        snapshot->device_slots[snapshot->devices[i].device_id] = i + 1;
+        rebuild_register_index(snapshot, i);
+    }
+}
+
+static int find_register_index(const modbus_snapshot_t *snapshot, uint8_t slot,
+                               register_type_t type, uint16_t address)
+{
+    const modbus_device_t *device = &snapshot->devices[slot];
+    const modbus_register_index_t *index = &snapshot->register_index[register_base(snapshot, device)];
+    uint32_t key = register_key(type, address);
+    int lo = 0;
+    int hi = (int)device->register_count - 1;
+
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        if (index[mid].key == key) {
+            return index[mid].reg_index;
+        }
+        if (index[mid].key < key) {
+            lo = mid + 1;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return -1;
+}
+
+static int find_device_slot(const modbus_snapshot_t *snapshot, uint8_t device_id)
+{
+    return (int)snapshot->device_slots[device_id] - 1;
+}
+
+const modbus_device_t* modbus_snapshot_find_device(const modbus_snapshot_t *snapshot, uint8_t device_id)
+{
+    int slot = find_device_slot(snapshot, device_id);
+    return slot < 0 ? NULL : &snapshot->devices[slot];
+}
+
+const modbus_register_t* modbus_snapshot_find_register(const modbus_snapshot_t *snapshot, uint8_t device_id,
+                                                       register_type_t type, uint16_t address)
+{
+    int slot = find_device_slot(snapshot, device_id);
+    if (slot < 0) {
+        return NULL;
+    }
+
+    int i = find_register_index(snapshot, slot, type, address);
+    return i < 0 ? NULL : &snapshot->devices[slot].registers[i];
+}
+
+const modbus_snapshot_t* modbus_snapshot_acquire(void)
+{
+    portENTER_CRITICAL(&snapshot_mux);
+    modbus_snapshot_t *snapshot = current_snapshot;
+    snapshot->refs++;
+    portEXIT_CRITICAL(&snapshot_mux);
+    return snapshot;
+}
+
+void modbus_snapshot_release(const modbus_snapshot_t *snapshot)
+{
+    if (snapshot == NULL) {
+        return;
+    }
+
+    modbus_snapshot_t *s = (modbus_snapshot_t *)snapshot;
+    bool released = false;
+    portENTER_CRITICAL(&snapshot_mux);
+    bool last = --s->refs == 0;
+    if (last) {
+        // The slots it kept from reuse now wait on the next older snapshot,
+        // which may hold them too, or are free once no older one is left
+        modbus_snapshot_t **link = &retired_snapshots;
+        while (*link != NULL && *link != s) {
+            link = &(*link)->older;
+        }
+        if (*link == s) {
+            *link = s->older;
+        }
+        released = s->older == NULL;
+        for (size_t i = 0; s->older != NULL && i < VALUE_BITMAP_WORDS; i++) {
+            s->older->freed_slots[i] |= s->freed_slots[i];
+        }
+    }
+    portEXIT_CRITICAL(&snapshot_mux);
+
+    if (released) {
+        // Nothing records into these slots any more: their history and
+        // rollup rings go back to the pools before the slots can be handed
+        // out again
+        for (uint16_t slot = 0; slot < MODBUS_MAX_VALUE_SLOTS; slot++) {
+            if (bitmap_test(s->freed_slots, slot)) {
+                modbus_history_reset(slot);
+                modbus_rollup_reset(slot);
+            }
+        }
+        portENTER_CRITICAL(&snapshot_mux);
+        for (size_t i = 0; i < VALUE_BITMAP_WORDS; i++) {
+            retired_slots[i] &= ~s->freed_slots[i];
+        }
+        portEXIT_CRITICAL(&snapshot_mux);
+    }
+    if (last) {
+        free(s);
+    }
+}
+
+#define ALIGN8(n) (((n) + 7) & ~(size_t)7)
+
+// Room in each of a snapshot's pools
+typedef struct {
+    uint8_t devices;
+    uint16_t registers;
+    uint16_t exprs;
+    uint32_t strings;
+} snapshot_size_t;
+
+// One allocation holding the header and the device, register, index,
+// evaluation order, program and string pools, registers first since they
+// need 8-byte alignment
+static modbus_snapshot_t* alloc_snapshot(const snapshot_size_t *capacity)
+{
+    size_t registers_at = ALIGN8(sizeof(modbus_snapshot_t));
+    size_t devices_at = ALIGN8(registers_at + capacity->registers * sizeof(modbus_register_t));
+    size_t index_at = ALIGN8(devices_at + capacity->devices * sizeof(modbus_device_t));
+    size_t order_at = index_at + capacity->registers * sizeof(modbus_register_index_t);
+    size_t exprs_at = ALIGN8(order_at + capacity->registers * sizeof(uint16_t));
+    size_t strings_at = exprs_at + capacity->exprs * sizeof(modbus_expr_t);
+    size_t size = strings_at + capacity->strings;
+
+    uint8_t *block = calloc(1, size);
+    if (block == NULL) {
+        ESP_LOGE(TAG, "No memory for a configuration of %d device(s) and %d register(s)",
+                 capacity->devices, capacity->registers);
+        return NULL;
+    }
+
+    modbus_snapshot_t *snapshot = (modbus_snapshot_t *)block;
+    snapshot->device_capacity = capacity->devices;
+    snapshot->register_capacity = capacity->registers;
+    snapshot->expr_capacity = capacity->exprs;
+    snapshot->string_capacity = capacity->strings;
+    snapshot->registers = (modbus_register_t *)(block + registers_at);
+    snapshot->devices = (modbus_device_t *)(block + devices_at);
+    snapshot->register_index = (modbus_register_index_t *)(block + index_at);
+    snapshot->virtual_order = (uint16_t *)(block + order_at);
+    snapshot->exprs = (modbus_expr_t *)(block + exprs_at);
+    snapshot->strings = (char *)(block + strings_at);
+    return snapshot;
+}
+
+// Room the snapshot's contents take, as an upper bound: strings replaced
+// during an edit still count until the next copy
+static void used_size(const modbus_snapshot_t *snapshot, snapshot_size_t *size)
+{
+    size->devices = snapshot->device_count;
+    size->registers = snapshot->register_count;
+    size->exprs = snapshot->expr_count;
+    size->strings = snapshot->string_size;
+}
+
+static size_t string_need(const char *str, size_t max_len)
+{
+    size_t len = str != NULL ? strnlen(str, max_len - 1) : 0;
+    return len > 0 ? len + 1 : 0;
+}
+
+// Adds the room registers take once copied into a snapshot
+static void size_registers(snapshot_size_t *size, const modbus_register_t *registers, uint16_t count)
+{
+    size->registers += count;
+    for (uint16_t j = 0; j < count; j++) {
+        size->strings += string_need(registers[j].description, REGISTER_DESC_MAX_LEN);
+        if (registers[j].type == REGISTER_TYPE_VIRTUAL) {
+            size->strings += string_need(registers[j].expression, MODBUS_EXPR_MAX_LEN);
+            size->exprs++;
+        }
+    }
+}
+
+// Copies str into the string pool, which must have room; empty strings all
+// share one constant
+static const char* copy_string(modbus_snapshot_t *snapshot, const char *str, size_t max_len)
+{
+    size_t need = string_need(str, max_len);
+    if (need == 0) {
+        return "";
+    }
+    char *copy = &snapshot->strings[snapshot->string_size];
+    memcpy(copy, str, need - 1);
+    copy[need - 1] = '\0';
+    snapshot->string_size += need;
+    return copy;
+}
+
+// Copies registers into dst in the snapshot's register pool and their strings
+// into its string pool, giving each virtual register a program to compile
+// into. The pools must have room.
+static void copy_registers(modbus_snapshot_t *snapshot, modbus_register_t *dst,
+                           const modbus_register_t *src, uint16_t count)
+{
+    for (uint16_t j = 0; j < count; j++) {
+        dst[j] = src[j];
+        dst[j].description = copy_string(snapshot, src[j].description, REGISTER_DESC_MAX_LEN);
+        if (src[j].type == REGISTER_TYPE_VIRTUAL) {
+            dst[j].expression = copy_string(snapshot, src[j].expression, MODBUS_EXPR_MAX_LEN);
+            dst[j].expr = &snapshot->exprs[snapshot->expr_count++];
+        } else {
+            dst[j].expression = "";
+            dst[j].expr = NULL;
+        }
+    }
+}
+
+// Copies src into dst, which must have room for used_size(src); strings left
+// behind by edits are dropped on the way
+static void copy_snapshot(modbus_snapshot_t *dst, const modbus_snapshot_t *src)
+{
+    dst->version = src->version;
+    dst->device_count = src->device_count;
+    dst->register_count = src->register_count;
+    memcpy(dst->device_slots, src->device_slots, sizeof(dst->device_slots));
+    memcpy(dst->devices, src->devices, src->device_count * sizeof(modbus_device_t));
+    copy_registers(dst, dst->registers, src->registers, src->register_count);
+    memcpy(dst->register_index, src->register_index, src->register_count * sizeof(modbus_register_index_t));
+    memcpy(dst->virtual_order, src->virtual_order, src->register_count * sizeof(uint16_t));
+    for (uint8_t i = 0; i < dst->device_count; i++) {
+        dst->devices[i].registers = dst->registers + register_base(src, &src->devices[i]);
+    }
+}
+
+// Starts an edit: takes the writer lock and returns a private copy of the
+// current configuration. Must be finished with publish_edit() or abort_edit().
+static modbus_snapshot_t* begin_edit(void)
+{
+    xSemaphoreTake(writer_lock, portMAX_DELAY);
+
+    snapshot_size_t size;
+    used_size(current_snapshot, &size);
+    modbus_snapshot_t *next = alloc_snapshot(&size);
+    if (next == NULL) {
+        xSemaphoreGive(writer_lock);
+        return NULL;
+    }
+    copy_snapshot(next, current_snapshot);
+    return next;
+}
+
+// Starts an edit that replaces the whole configuration, with the given room
+static modbus_snapshot_t* begin_replace(const snapshot_size_t *capacity)
+{
+    xSemaphoreTake(writer_lock, portMAX_DELAY);
+
+    modbus_snapshot_t *next = alloc_snapshot(capacity);
+    if (next == NULL) {
+        xSemaphoreGive(writer_lock);
+    }
+    return next;
+}
+
+static void abort_edit(modbus_snapshot_t *next)
+{
+    free(next);
+    xSemaphoreGive(writer_lock);
+}
+
+// Makes room in an edit for more devices, registers, programs and strings,
+// moving it to a larger allocation if needed. Fails without touching the edit
+// if the result would exceed the configuration limits or memory runs out.
+static bool reserve_edit(modbus_snapshot_t **next, const snapshot_size_t *more)
+{
+    modbus_snapshot_t *edit = *next;
+    if (edit->device_count + more->devices > MAX_MODBUS_DEVICES ||
+        edit->register_count + more->registers > MODBUS_MAX_VALUE_SLOTS) {
+        ESP_LOGE(TAG, "Configuration limit reached (%d devices, %d registers)",
+                 MAX_MODBUS_DEVICES, MODBUS_MAX_VALUE_SLOTS);
+        return false;
+    }
+
+    snapshot_size_t need;
+    used_size(edit, &need);
+    need.devices += more->devices;
+    need.registers += more->registers;
+    need.exprs += more->exprs;
+    need.strings += more->strings;
+    if (need.devices <= edit->device_capacity && need.registers <= edit->register_capacity &&
+        need.exprs <= edit->expr_capacity && need.strings <= edit->string_capacity) {
+        return true;
+    }
+
+    modbus_snapshot_t *larger = alloc_snapshot(&need);
+    if (larger == NULL) {
+        return false;
+    }
+    copy_snapshot(larger, edit);
+    free(edit);
+    *next = larger;
+    return true;
+}
+
+// Grows or shrinks the register run of the device in slot to count entries,
+// keeping the first min(old, new) registers; the rest of the pool moves along.
+// The edit must have room for any growth.
+static void resize_registers(modbus_snapshot_t *next, uint8_t slot, uint16_t count)
+{
+    modbus_device_t *device = &next->devices[slot];
+    uint16_t tail = register_base(next, device) + device->register_count;
+    int delta = (int)count - (int)device->register_count;
+
+    memmove(&next->registers[tail + delta], &next->registers[tail],
+            (next->register_count - tail) * sizeof(modbus_register_t));
+    for (uint8_t i = slot + 1; i < next->device_count; i++) {
+        next->devices[i].registers += delta;
+    }
+    device->register_count = count;
+    next->register_count += delta;
+}
+
+// Appends a copy of device and its registers; the edit must have room
+static void append_device(modbus_snapshot_t *next, const modbus_device_t *device)
+{
+    modbus_device_t *added = &next->devices[next->device_count++];
+    memcpy(added, device, sizeof(modbus_device_t));
+    added->registers = &next->registers[next->register_count];
+    added->register_count = 0;
+    resize_registers(next, next->device_count - 1, device->register_count);
+    copy_registers(next, added->registers, device->registers, device->register_count);
+}
+
+static uint16_t count_history(const modbus_register_t *registers, uint16_t count)
+{
+    uint16_t history = 0;
+    for (uint16_t j = 0; j < count; j++) {
+        history += registers[j].history;
+    }
+    return history;
+}
+
+// History rings are a fixed pool, so an edit may flag no more registers than
+// there are rings
+static bool history_fits(const modbus_snapshot_t *next)
+{
+    if (count_history(next->registers, next->register_count) > MODBUS_HISTORY_RINGS) {
+        ESP_LOGE(TAG, "History is kept for at most %d registers", MODBUS_HISTORY_RINGS);
+        return false;
+    }
+    return true;
+}
+
+// Marks the retired slots used as well, first waiting for readers to release
+// old snapshots until count slots are left
+static void wait_for_free_slots(uint32_t *used, uint16_t count)
+{
+    uint32_t taken[VALUE_BITMAP_WORDS];
+    for (int attempt = 0;; attempt++) {
+        portENTER_CRITICAL(&snapshot_mux);
+        memcpy(taken, retired_slots, sizeof(taken));
+        portEXIT_CRITICAL(&snapshot_mux);
+
+        uint16_t free_count = 0;
+        for (size_t i = 0; i < VALUE_BITMAP_WORDS; i++) {
+            taken[i] |= used[i];
+        }
+        for (uint16_t slot = 0; slot < MODBUS_MAX_VALUE_SLOTS; slot++) {
+            free_count += !bitmap_test(taken, slot);
+        }
+        if (free_count >= count) {
+            break;
+        }
+        // Readers hold a snapshot for one poll or request
+        if (attempt == 0) {
+            ESP_LOGW(TAG, "Waiting for %d value slot(s) still in use by readers", count - free_count);
+        }
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+    memcpy(used, taken, sizeof(taken));
+}
+
+// Keeps the value and state slots of registers and devices that survive the
+// edit, and hands out free slots (cleared) to new ones. The slots of prev's
+// registers that are dropped are set in freed; they are not reused before
+// prev is released.
+static void assign_slots(modbus_snapshot_t *next, const modbus_snapshot_t *prev, uint32_t *freed)
+{
+    uint32_t value_used[VALUE_BITMAP_WORDS] = {0};
+    bool state_used[MAX_MODBUS_DEVICES] = {0};
+    uint32_t value_kept[VALUE_BITMAP_WORDS] = {0};
+    bool state_kept[MAX_MODBUS_DEVICES] = {0};
+
+    for (uint8_t i = 0; i < next->device_count; i++) {
+        modbus_device_t *device = &next->devices[i];
+        const modbus_device_t *old = prev ? modbus_snapshot_find_device(prev, device->device_id) : NULL;
+        if (old != NULL) {
+            device->state_slot = old->state_slot;
+            state_used[device->state_slot] = true;
+            state_kept[i] = true;
+        }
+
+        for (uint16_t j = 0; j < device->register_count; j++) {
+            modbus_register_t *reg = &device->registers[j];
+            const modbus_register_t *old_reg = old ? modbus_snapshot_find_register(prev, device->device_id,
+                                                                                  reg->type, reg->address) : NULL;
+            if (old_reg != NULL) {
+                reg->value_slot = old_reg->value_slot;
+                bitmap_set(value_used, reg->value_slot);
+                bitmap_set(value_kept, (uint16_t)(reg - next->registers));
+                if (old_reg->history && !reg->history) {
+                    modbus_history_reset(reg->value_slot);
+                    modbus_rollup_reset(reg->value_slot);
+                }
+            }
+        }
+    }
 
-static modbus_device_t devices[MAX_MODBUS_DEVICES];
-static uint8_t device_count = 0;
+    memset(freed, 0, VALUE_BITMAP_WORDS * sizeof(uint32_t));
+    for (uint16_t j = 0; prev != NULL && j < prev->register_count; j++) {
+        if (!bitmap_test(value_used, prev->registers[j].value_slot)) {
+            bitmap_set(freed, prev->registers[j].value_slot);
+        }
+    }
+
+    uint16_t added = 0;
+    for (uint16_t j = 0; j < next->register_count; j++) {
+        added += !bitmap_test(value_kept, j);
+    }
+    wait_for_free_slots(value_used, added);
+
+    uint16_t next_value = 0;
+    uint8_t next_state = 0;
+    for (uint8_t i = 0; i < next->device_count; i++) {
+        modbus_device_t *device = &next->devices[i];
+        if (!state_kept[i]) {
+            while (state_used[next_state]) {
+                next_state++;
+            }
+            device->state_slot = next_state;
+            state_used[next_state] = true;
+            portENTER_CRITICAL(&value_mux);
+            memset(&device_states[next_state], 0, sizeof(modbus_device_state_t));
+            portEXIT_CRITICAL(&value_mux);
+        }
+
+        for (uint16_t j = 0; j < device->register_count; j++) {
+            if (bitmap_test(value_kept, (uint16_t)(&device->registers[j] - next->registers))) {
+                continue;
+            }
+            while (bitmap_test(value_used, next_value)) {
+                next_value++;
+            }
+            device->registers[j].value_slot = next_value;
+            bitmap_set(value_used, next_value);
+            portENTER_CRITICAL(&value_mux);
+            memset(&values[next_value], 0, sizeof(modbus_value_t));
+            portEXIT_CRITICAL(&value_mux);
+            modbus_history_reset(next_value);
+            modbus_rollup_reset(next_value);
+        }
+    }
+}
+
+typedef struct {
+    const modbus_snapshot_t *snapshot;
+    uint8_t slot;
+} expr_resolve_ctx_t;
+
+static int resolve_expr_register(void *ctx, uint8_t type, uint16_t address)
+{
+    const expr_resolve_ctx_t *resolve = ctx;
+    return find_register_index(resolve->snapshot, resolve->slot, (register_type_t)type, address);
+}
+
+// Whether every virtual register reg reads has been placed already
+static bool virtual_inputs_placed(const modbus_register_t *reg, const uint32_t *virtuals, const uint32_t *placed)
+{
+    for (uint8_t d = 0; d < reg->expr->dep_count; d++) {
+        if (bitmap_test(virtuals, reg->expr->deps[d]) && !bitmap_test(placed, reg->expr->deps[d])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Compiles the expressions of a device's virtual registers and orders them so
+// each one is evaluated after the virtual registers it reads. Registers with
+// invalid expressions or dependency cycles are left without a program and
+// never get a value.
+static void compile_virtual_registers(modbus_snapshot_t *snapshot, uint8_t slot)
+{
+    modbus_device_t *device = &snapshot->devices[slot];
+    uint16_t *order = &snapshot->virtual_order[register_base(snapshot, device)];
+    expr_resolve_ctx_t ctx = { snapshot, slot };
+    uint32_t virtuals[REGISTER_BITMAP_WORDS] = {0};
+    uint32_t placed[REGISTER_BITMAP_WORDS] = {0};
+    uint16_t virtual_total = 0;
+
+    device->virtual_count = 0;
+    for (uint16_t j = 0; j < device->register_count; j++) {
+        modbus_register_t *reg = &device->registers[j];
+        if (reg->type != REGISTER_TYPE_VIRTUAL) {
+            continue;
+        }
+        if (modbus_expr_compile(reg->expression, resolve_expr_register, &ctx, reg->expr) != ESP_OK) {
+            ESP_LOGW(TAG, "Virtual register %d of device %d has an invalid expression",
+                     reg->address, device->device_id);
+            continue;
+        }
+        bitmap_set(virtuals, j);
+        virtual_total++;
+    }
+
+    // Kahn's algorithm over the virtual-to-virtual edges; devices have few
+    // virtual registers, so rescanning beats keeping in-degree counts
+    bool progress = virtual_total > 0;
+    while (progress) {
+        progress = false;
+        for (uint16_t j = 0; j < device->register_count; j++) {
+            if (bitmap_test(virtuals, j) && !bitmap_test(placed, j) &&
+                virtual_inputs_placed(&device->registers[j], virtuals, placed)) {
+                order[device->virtual_count++] = j;
+                bitmap_set(placed, j);
+                progress = true;
+            }
+        }
+    }
+
+    for (uint16_t j = 0; device->virtual_count < virtual_total && j < device->register_count; j++) {
+        if (bitmap_test(virtuals, j) && !bitmap_test(placed, j)) {
+            ESP_LOGW(TAG, "Virtual register %d of device %d depends on itself",
+                     device->registers[j].address, device->device_id);
+            memset(device->registers[j].expr, 0, sizeof(modbus_expr_t));
+        }
+    }
+}
+
+static void compile_registers(modbus_snapshot_t *snapshot)
+{
+    for (uint8_t i = 0; i < snapshot->device_count; i++) {
+        modbus_device_t *device = &snapshot->devices[i];
+        for (uint16_t j = 0; j < device->register_count; j++) {
+            modbus_register_t *reg = &device->registers[j];
+            if (reg->type == REGISTER_TYPE_VIRTUAL) {
+                // Results are stored as signed fixed point with the
+                // expression's decimals, so they decode like any register
+                reg->format = REGISTER_FORMAT_INT32;
+                reg->word_order = WORD_ORDER_HIGH_FIRST;
+                reg->scale = 0.001f;
+                reg->offset = 0.0f;
+                reg->writable = false;
+            }
+            if (modbus_decode_compile(reg->format, reg->word_order, reg->bit_mask,
+                                      reg->scale, reg->offset, &reg->decode) != ESP_OK) {
+                // Only reachable for configurations stored before validation
+                ESP_LOGW(TAG, "Register %d of device %d has an invalid format, reading as uint16",
+                         reg->address, device->device_id);
+                reg->format = REGISTER_FORMAT_UINT16;
+                modbus_decode_compile(REGISTER_FORMAT_UINT16, WORD_ORDER_HIGH_FIRST, 0, 1.0f, 0.0f, &reg->decode);
+            }
+            // Compared against decoded values, so held at the same fixed point
+            float band = reg->deadband;
+            for (uint8_t d = 0; d < reg->decode.decimals; d++) {
+                band *= 10.0f;
+            }
+            reg->deadband_fixed = band > 0.0f ? (int64_t)(band + 0.5f) : 0;
+        }
+        compile_virtual_registers(snapshot, i);
+    }
+}
+
+// Rebuilds the index and decode programs of an edited copy and atomically
+// makes it current
+static void publish_edit(modbus_snapshot_t *next)
+{
+    rebuild_index(next);
+    compile_registers(next);
+    assign_slots(next, current_snapshot, current_snapshot->freed_slots);
+    next->version = current_snapshot->version + 1;
+    next->refs = 1;
+
+    portENTER_CRITICAL(&snapshot_mux);
+    modbus_snapshot_t *prev = current_snapshot;
+    current_snapshot = next;
+    for (size_t i = 0; i < VALUE_BITMAP_WORDS; i++) {
+        retired_slots[i] |= prev->freed_slots[i];
+    }
+    prev->older = retired_snapshots;
+    retired_snapshots = prev;
+    portEXIT_CRITICAL(&snapshot_mux);
+
+    modbus_snapshot_release(prev);
+    xSemaphoreGive(writer_lock);
+}
+
+static void save_timer_callback(void *arg);
 
 esp_err_t modbus_devices_init(void)
 {
-    memset(devices, 0, sizeof(devices));
-    device_count = 0;
+    if (writer_lock == NULL) {
+        writer_lock = xSemaphoreCreateMutex();
+        if (writer_lock == NULL) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    snapshot_size_t none = {0};
+    modbus_snapshot_t *empty = alloc_snapshot(&none);
+    if (empty == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    empty->refs = 1;
+    modbus_history_init();
+
+    portENTER_CRITICAL(&snapshot_mux);
+    modbus_snapshot_t *prev = current_snapshot;
+    current_snapshot = empty;
+    portEXIT_CRITICAL(&snapshot_mux);
+    modbus_snapshot_release(prev);
+
+    if (save_timer == NULL) {
+        const esp_timer_create_args_t timer_args = {
+            .callback = save_timer_callback,
+            .name = "modbus_save",
+        };
+        esp_err_t err = esp_timer_create(&timer_args, &save_timer);
+        if (err != ESP_OK) {
+            ESP_LOGW(TAG, "Failed to create save timer, saving synchronously: %s", esp_err_to_name(err));
+        }
+    }
+
     ESP_LOGI(TAG, "Modbus devices manager initialized");
     return ESP_OK;
 }
 
+static void mark_device_dirty(uint8_t device_id)
+{
+    dirty_devices[device_id / 32] |= 1u << (device_id % 32);
+}
+
+static bool any_device_dirty(void)
+{
+    for (size_t i = 0; i < sizeof(dirty_devices) / sizeof(dirty_devices[0]); i++) {
+        if (dirty_devices[i] != 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Writes through p, or with buf NULL only measures the blob
+typedef struct {
+    uint8_t *p;
+    size_t len;
+} blob_writer_t;
+
+static void blob_put(blob_writer_t *w, const void *value, size_t len)
+{
+    if (w->p != NULL) {
+        memcpy(w->p, value, len);
+        w->p += len;
+    }
+    w->len += len;
+}
+
+static void blob_put_str(blob_writer_t *w, const char *str, size_t max_len)
+{
+    uint8_t len = (uint8_t)strnlen(str, max_len - 1);
+    blob_put(w, &len, sizeof(len));
+    blob_put(w, str, len);
+}
+
+static bool blob_get_str(const uint8_t **p, const uint8_t *end, char *str, size_t max_len)
+{
+    if (*p >= end) {
+        return false;
+    }
+    size_t len = *(*p)++;
+    if (len >= max_len || *p + len > end) {
+        return false;
+    }
+    memcpy(str, *p, len);
+    str[len] = '\0';
+    *p += len;
+    return true;
+}
+
+static bool blob_get(const uint8_t **p, const uint8_t *end, void *value, size_t len)
+{
+    if (*p + len > end) {
+        return false;
+    }
+    memcpy(value, *p, len);
+    *p += len;
+    return true;
+}
+
+// Returns the blob length; with buf NULL nothing is written, so callers can
+// size the buffer first
+static size_t serialize_device(const modbus_device_t *device, uint8_t *buf)
+{
+    blob_writer_t w = { buf ? buf + sizeof(device_blob_header_t) : NULL, 0 };
+    uint8_t enabled = device->enabled;
+
+    blob_put(&w, &device->device_id, sizeof(device->device_id));
+    blob_put(&w, &enabled, sizeof(enabled));
+    blob_put(&w, &device->baudrate, sizeof(device->baudrate));
+    blob_put(&w, &device->poll_interval_ms, sizeof(device->poll_interval_ms));
+    blob_put_str(&w, device->name, sizeof(device->name));
+    blob_put_str(&w, device->description, sizeof(device->description));
+    blob_put_str(&w, device->profile, sizeof(device->profile));
+    blob_put(&w, &device->register_count, sizeof(device->register_count));
+
+    for (uint16_t j = 0; j < device->register_count; j++) {
+        const modbus_register_t *reg = &device->registers[j];
+        uint8_t type = reg->type;
+        uint8_t flags = (reg->writable ? REGISTER_FLAG_WRITABLE : 0) | (reg->history ? REGISTER_FLAG_HISTORY : 0);
+
+        blob_put(&w, &reg->address, sizeof(reg->address));
+        blob_put(&w, &type, sizeof(type));
+        blob_put(&w, &flags, sizeof(flags));
+        blob_put(&w, &reg->scale, sizeof(reg->scale));
+        blob_put(&w, &reg->offset, sizeof(reg->offset));
+        blob_put_str(&w, reg->name, sizeof(reg->name));
+        blob_put_str(&w, reg->unit, sizeof(reg->unit));
+        blob_put_str(&w, reg->description, REGISTER_DESC_MAX_LEN);
+
+        uint8_t format = reg->format;
+        uint8_t word_order = reg->word_order;
+        blob_put(&w, &format, sizeof(format));
+        blob_put(&w, &word_order, sizeof(word_order));
+        blob_put(&w, &reg->bit_mask, sizeof(reg->bit_mask));
+        blob_put_str(&w, reg->expression, MODBUS_EXPR_MAX_LEN);
+        blob_put(&w, &reg->deadband, sizeof(reg->deadband));
+    }
+
+    if (buf != NULL) {
+        device_blob_header_t header = {
+            .magic = DEVICE_BLOB_MAGIC,
+            .version = DEVICE_BLOB_VERSION,
+            .length = (uint16_t)w.len,
+        };
+        header.crc = esp_rom_crc32_le(0, buf + sizeof(header), header.length);
+        memcpy(buf, &header, sizeof(header));
+    }
+    return sizeof(device_blob_header_t) + w.len;
+}
+
+// With edit NULL the blob is only checked and the room its device takes is
+// added to *size, so the caller can make room before reading it again into an
+// edit: the registers then go to the end of its pools
+static esp_err_t deserialize_device(const uint8_t *buf, size_t len, modbus_device_t *device,
+                                    modbus_snapshot_t *edit, snapshot_size_t *size)
+{
+    device_blob_header_t header;
+    if (len < sizeof(header)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(&header, buf, sizeof(header));
+
+    if (header.magic != DEVICE_BLOB_MAGIC || header.length != len - sizeof(header)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (header.version == 0 || header.version > DEVICE_BLOB_VERSION) {
+        return ESP_ERR_INVALID_VERSION;
+    }
+    if (esp_rom_crc32_le(0, buf + sizeof(header), header.length) != header.crc) {
+        return ESP_ERR_INVALID_CRC;
+    }
+
+    const uint8_t *p = buf + sizeof(header);
+    const uint8_t *end = buf + len;
+    uint8_t enabled = 0;
+    bool ok = true;
+
+    memset(device, 0, sizeof(modbus_device_t));
+    ok = ok && blob_get(&p, end, &device->device_id, sizeof(device->device_id));
+    ok = ok && blob_get(&p, end, &enabled, sizeof(enabled));
+    ok = ok && blob_get(&p, end, &device->baudrate, sizeof(device->baudrate));
+    ok = ok && blob_get(&p, end, &device->poll_interval_ms, sizeof(device->poll_interval_ms));
+    ok = ok && blob_get_str(&p, end, device->name, sizeof(device->name));
+    ok = ok && blob_get_str(&p, end, device->description, sizeof(device->description));
+    if (header.version >= 3) {
+        ok = ok && blob_get_str(&p, end, device->profile, sizeof(device->profile));
+    }
+    // Version 6 widened the register count to 16 bits
+    if (header.version >= 6) {
+        ok = ok && blob_get(&p, end, &device->register_count, sizeof(device->register_count));
+    } else {
+        uint8_t count = 0;
+        ok = ok && blob_get(&p, end, &count, sizeof(count));
+        device->register_count = count;
+    }
+    ok = ok && device->register_count <= MAX_REGISTERS_PER_DEVICE;
+    device->enabled = enabled != 0;
+    if (size != NULL) {
+        size->devices++;
+    }
+    if (edit != NULL) {
+        device->registers = &edit->registers[edit->register_count];
+    }
+
+    for (uint16_t j = 0; ok && j < device->register_count; j++) {
+        modbus_register_t reg;
+        char description[REGISTER_DESC_MAX_LEN] = "";
+        char expression[MODBUS_EXPR_MAX_LEN] = "";
+        uint8_t type = 0;
+        uint8_t flags = 0;
+
+        memset(&reg, 0, sizeof(reg));
+        reg.description = description;
+        reg.expression = expression;
+        ok = ok && blob_get(&p, end, &reg.address, sizeof(reg.address));
+        ok = ok && blob_get(&p, end, &type, sizeof(type));
+        ok = ok && blob_get(&p, end, &flags, sizeof(flags));
+        ok = ok && blob_get(&p, end, &reg.scale, sizeof(reg.scale));
+        ok = ok && blob_get(&p, end, &reg.offset, sizeof(reg.offset));
+        ok = ok && blob_get_str(&p, end, reg.name, sizeof(reg.name));
+        ok = ok && blob_get_str(&p, end, reg.unit, sizeof(reg.unit));
+        ok = ok && blob_get_str(&p, end, description, sizeof(description));
+        reg.type = (register_type_t)type;
+        // Before version 7 the flags byte was a writable bool
+        if (header.version >= 7) {
+            reg.writable = (flags & REGISTER_FLAG_WRITABLE) != 0;
+            reg.history = (flags & REGISTER_FLAG_HISTORY) != 0;
+        } else {
+            reg.writable = flags != 0;
+        }
+
+        // Version 1 blobs predate data formats and decode as uint16
+        if (header.version >= 2) {
+            uint8_t format = 0;
+            uint8_t word_order = 0;
+            ok = ok && blob_get(&p, end, &format, sizeof(format));
+            ok = ok && blob_get(&p, end, &word_order, sizeof(word_order));
+            ok = ok && blob_get(&p, end, &reg.bit_mask, sizeof(reg.bit_mask));
+            reg.format = (register_format_t)format;
+            reg.word_order = (register_word_order_t)word_order;
+        }
+        if (header.version >= 4) {
+            ok = ok && blob_get_str(&p, end, expression, sizeof(expression));
+        }
+        if (header.version >= 5) {
+            ok = ok && blob_get(&p, end, &reg.deadband, sizeof(reg.deadband));
+        }
+
+        if (!ok) {
+            break;
+        }
+        if (edit != NULL) {
+            copy_registers(edit, &device->registers[j], &reg, 1);
+        }
+        if (size != NULL) {
+            size_registers(size, &reg, 1);
+        }
+    }
+
+    return ok ? ESP_OK : ESP_ERR_INVALID_SIZE;
+}
+
+static void device_blob_key(char *key, size_t len, uint8_t device_id)
+{
+    snprintf(key, len, "dev_%u", device_id);
+}
+
 esp_err_t modbus_devices_save(void)
 {
     nvs_handle_t nvs_handle;
     esp_err_t err;
 
+    // Claim the dirty set under the writer lock, then do the slow NVS work
+    // against a pinned snapshot without holding up configuration edits.
+    xSemaphoreTake(writer_lock, portMAX_DELAY);
+    uint32_t dirty[sizeof(dirty_devices) / sizeof(dirty_devices[0])];
+    bool list_dirty = device_list_dirty;
+    bool anything_dirty = list_dirty || any_device_dirty();
+    memcpy(dirty, dirty_devices, sizeof(dirty));
+    memset(dirty_devices, 0, sizeof(dirty_devices));
+    device_list_dirty = false;
+    const modbus_snapshot_t *snapshot = modbus_snapshot_acquire();
+    xSemaphoreGive(writer_lock);
+
+    if (!anything_dirty) {
+        modbus_snapshot_release(snapshot);
+        return ESP_OK;
+    }
+
     err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs_handle);
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "Failed to open NVS: %s", esp_err_to_name(err));
-        return err;
+    } else {
+        char key[16];
+        uint8_t written = 0;
+        for (uint16_t id = 0; id <= UINT8_MAX && err == ESP_OK; id++) {
+            if (!((dirty[id / 32] >> (id % 32)) & 1u)) {
+                continue;
+            }
+
+            device_blob_key(key, sizeof(key), id);
+            const modbus_device_t *device = modbus_snapshot_find_device(snapshot, id);
+            if (device != NULL) {
+                // Sized per device: a large register list would make a
+                // worst-case buffer too big to allocate
+                size_t len = serialize_device(device, NULL);
+                uint8_t *buf = malloc(len);
+                if (buf == NULL) {
+                    err = ESP_ERR_NO_MEM;
+                    break;
+                }
+                serialize_device(device, buf);
+                err = nvs_set_blob(nvs_handle, key, buf, len);
+                free(buf);
+                written++;
+            } else {
+                err = nvs_erase_key(nvs_handle, key);
+                if (err == ESP_ERR_NVS_NOT_FOUND) {
+                    err = ESP_OK;
+                }
+            }
+        }
+
+        if (err == ESP_OK && list_dirty) {
+            uint8_t ids[MAX_MODBUS_DEVICES];
+            for (uint8_t i = 0; i < snapshot->device_count; i++) {
+                ids[i] = snapshot->devices[i].device_id;
+            }
+            err = nvs_set_blob(nvs_handle, DEVICE_LIST_KEY, ids, snapshot->device_count);
+        }
+
+        if (err == ESP_OK) {
+            err = nvs_commit(nvs_handle);
+        }
+        nvs_close(nvs_handle);
+
+        if (err == ESP_OK) {
+            ESP_LOGI(TAG, "Saved %d changed device(s) to NVS", written);
+        } else {
+            ESP_LOGE(TAG, "Failed to save devices: %s", esp_err_to_name(err));
+        }
     }
+    modbus_snapshot_release(snapshot);
 
-    err = nvs_set_u8(nvs_handle, "device_count", device_count);
     if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to save device count: %s", esp_err_to_name(err));
-        nvs_close(nvs_handle);
-        return err;
+        // Put the claimed changes back so the next save retries them
+        xSemaphoreTake(writer_lock, portMAX_DELAY);
+        for (size_t i = 0; i < sizeof(dirty_devices) / sizeof(dirty_devices[0]); i++) {
+            dirty_devices[i] |= dirty[i];
+        }
+        device_list_dirty |= list_dirty;
+        xSemaphoreGive(writer_lock);
+    }
+
+    return err;
+}
+
+static void save_timer_callback(void *arg)
+{
+    modbus_devices_save();
+}
+
+esp_err_t modbus_devices_schedule_save(void)
+{
+    if (save_timer == NULL) {
+        return modbus_devices_save();
     }
 
+    esp_timer_stop(save_timer);
+    return esp_timer_start_once(save_timer, MODBUS_SAVE_DEBOUNCE_MS * 1000ULL);
+}
+
+// Reads the pre-blob layout (one NVS key per field) into the edit. Several of
+// those keys exceed the 15-character NVS key limit and were never stored, so
+// missing fields fall back to defaults.
+static void load_legacy_devices(nvs_handle_t nvs_handle, modbus_snapshot_t **next, uint8_t count)
+{
     char key[32];
-    for (uint8_t i = 0; i < device_count; i++) {
+    for (uint8_t i = 0; i < count; i++) {
+        uint8_t register_count = 0;
+        snprintf(key, sizeof(key), "device_%d_reg_count", i);
+        nvs_get_u8(nvs_handle, key, &register_count);
+        snapshot_size_t more = {
+            .devices = 1,
+            .registers = register_count,
+            .exprs = register_count,
+            .strings = (uint32_t)register_count * REGISTER_DESC_MAX_LEN,
+        };
+        if (!reserve_edit(next, &more)) {
+            return;
+        }
+
+        modbus_snapshot_t *edit = *next;
+        modbus_device_t *device = &edit->devices[edit->device_count];
+        memset(device, 0, sizeof(modbus_device_t));
+        device->poll_interval_ms = 5000;
+        device->baudrate = 9600;
+        device->enabled = true;
+        device->registers = &edit->registers[edit->register_count];
+        device->register_count = register_count;
+
         snprintf(key, sizeof(key), "device_%d_id", i);
-        nvs_set_u8(nvs_handle, key, devices[i].device_id);
+        nvs_get_u8(nvs_handle, key, &device->device_id);
 
         snprintf(key, sizeof(key), "device_%d_name", i);
-        nvs_set_str(nvs_handle, key, devices[i].name);
+        size_t len = sizeof(device->name);
+        nvs_get_str(nvs_handle, key, device->name, &len);
 
         snprintf(key, sizeof(key), "device_%d_desc", i);
-        nvs_set_str(nvs_handle, key, devices[i].description);
+        len = sizeof(device->description);
+        nvs_get_str(nvs_handle, key, device->description, &len);
 
         snprintf(key, sizeof(key), "device_%d_poll_interval", i);
-        nvs_set_u32(nvs_handle, key, devices[i].poll_interval_ms);
+        nvs_get_u32(nvs_handle, key, &device->poll_interval_ms);
 
         snprintf(key, sizeof(key), "device_%d_enabled", i);
-        nvs_set_u8(nvs_handle, key, devices[i].enabled);
+        nvs_get_u8(nvs_handle, key, (uint8_t*)&device->enabled);
 
         snprintf(key, sizeof(key), "device_%d_baudrate", i);
-        nvs_set_u16(nvs_handle, key, devices[i].baudrate);
+        nvs_get_u16(nvs_handle, key, &device->baudrate);
 
-        snprintf(key, sizeof(key), "device_%d_reg_count", i);
-        nvs_set_u8(nvs_handle, key, devices[i].register_count);
+        for (uint16_t j = 0; j < device->register_count; j++) {
+            modbus_register_t stored;
+            modbus_register_t *reg = &stored;
+            char description[REGISTER_DESC_MAX_LEN] = "";
+            memset(reg, 0, sizeof(modbus_register_t));
 
-        for (uint8_t j = 0; j < devices[i].register_count; j++) {
             snprintf(key, sizeof(key), "device_%d_reg_%d_addr", i, j);
-            nvs_set_u16(nvs_handle, key, devices[i].registers[j].address);
+            nvs_get_u16(nvs_handle, key, &reg->address);
 
             snprintf(key, sizeof(key), "device_%d_reg_%d_type", i, j);
-            nvs_set_u8(nvs_handle, key, devices[i].registers[j].type);
+            uint8_t type = REGISTER_TYPE_HOLDING;
+            nvs_get_u8(nvs_handle, key, &type);
+            reg->type = (register_type_t)type;
 
             snprintf(key, sizeof(key), "device_%d_reg_%d_name", i, j);
-            nvs_set_str(nvs_handle, key, devices[i].registers[j].name);
+            len = sizeof(reg->name);
+            nvs_get_str(nvs_handle, key, reg->name, &len);
 
             snprintf(key, sizeof(key), "device_%d_reg_%d_unit", i, j);
-            nvs_set_str(nvs_handle, key, devices[i].registers[j].unit);
+            len = sizeof(reg->unit);
+            nvs_get_str(nvs_handle, key, reg->unit, &len);
 
             snprintf(key, sizeof(key), "device_%d_reg_%d_scale", i, j);
-            nvs_set_u32(nvs_handle, key, *(uint32_t*)&devices[i].registers[j].scale);
+            uint32_t scale_val;
+            if (nvs_get_u32(nvs_handle, key, &scale_val) == ESP_OK) {
+                memcpy(&reg->scale, &scale_val, sizeof(reg->scale));
+            } else {
+                reg->scale = 1.0f;
+            }
 
             snprintf(key, sizeof(key), "device_%d_reg_%d_offset", i, j);
-            nvs_set_u32(nvs_handle, key, *(uint32_t*)&devices[i].registers[j].offset);
+            uint32_t offset_val;
+            if (nvs_get_u32(nvs_handle, key, &offset_val) == ESP_OK) {
+                memcpy(&reg->offset, &offset_val, sizeof(reg->offset));
+            }
 
             snprintf(key, sizeof(key), "device_%d_reg_%d_writable", i, j);
-            nvs_set_u8(nvs_handle, key, devices[i].registers[j].writable);
+            nvs_get_u8(nvs_handle, key, (uint8_t*)&reg->writable);
 
             snprintf(key, sizeof(key), "device_%d_reg_%d_desc", i, j);
-            nvs_set_str(nvs_handle, key, devices[i].registers[j].description);
+            len = sizeof(description);
+            nvs_get_str(nvs_handle, key, description, &len);
+            reg->description = description;
+            copy_registers(edit, &device->registers[j], reg, 1);
         }
+
+        edit->device_count++;
+        edit->register_count += register_count;
+    }
+}
+
+static void erase_legacy_keys(uint8_t count)
+{
+    nvs_handle_t nvs_handle;
+    if (nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs_handle) != ESP_OK) {
+        return;
     }
 
-    err = nvs_commit(nvs_handle);
+    static const char *device_fields[] = { "id", "name", "desc", "enabled", "baudrate" };
+    char key[32];
+    for (uint8_t i = 0; i < count; i++) {
+        for (size_t f = 0; f < sizeof(device_fields) / sizeof(device_fields[0]); f++) {
+            snprintf(key, sizeof(key), "device_%d_%s", i, device_fields[f]);
+            if (strlen(key) < 16) {
+                nvs_erase_key(nvs_handle, key);
+            }
+        }
+    }
+    nvs_erase_key(nvs_handle, "device_count");
+    nvs_commit(nvs_handle);
     nvs_close(nvs_handle);
+}
 
-    if (err == ESP_OK) {
-        ESP_LOGI(TAG, "Saved %d device(s) to NVS", device_count);
-    } else {
-        ESP_LOGE(TAG, "Failed to commit NVS: %s", esp_err_to_name(err));
+
+static esp_err_t migrate_legacy_devices(nvs_handle_t nvs_handle, modbus_snapshot_t *next)
+{
+    uint8_t count;
+    if (nvs_get_u8(nvs_handle, "device_count", &count) != ESP_OK) {
+        abort_edit(next);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    uint8_t legacy_count = count;
+    if (count > MAX_MODBUS_DEVICES) {
+        count = MAX_MODBUS_DEVICES;
+        ESP_LOGW(TAG, "Device count exceeds maximum, limiting to %d", MAX_MODBUS_DEVICES);
+    }
+
+    load_legacy_devices(nvs_handle, &next, count);
+    for (uint8_t i = 0; i < next->device_count; i++) {
+        mark_device_dirty(next->devices[i].device_id);
+    }
+    device_list_dirty = true;
+    count = next->device_count;
+    publish_edit(next);
+
+    if (modbus_devices_save() == ESP_OK) {
+        erase_legacy_keys(legacy_count);
+        ESP_LOGI(TAG, "Migrated %d device(s) to binary NVS layout", count);
+    }
+    return ESP_OK;
+}
+
+// Reads one device blob and appends it to the edit
+static esp_err_t load_device(nvs_handle_t nvs_handle, uint8_t device_id, modbus_snapshot_t **next)
+{
+    char key[16];
+    size_t len = 0;
+    device_blob_key(key, sizeof(key), device_id);
+    esp_err_t err = nvs_get_blob(nvs_handle, key, NULL, &len);
+    if (err != ESP_OK) {
+        return err;
     }
 
+    uint8_t *buf = malloc(len);
+    if (buf == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    err = nvs_get_blob(nvs_handle, key, buf, &len);
+
+    // A first pass tells how much room to make
+    modbus_device_t device;
+    snapshot_size_t more = {0};
+    if (err == ESP_OK) {
+        err = deserialize_device(buf, len, &device, NULL, &more);
+    }
+    if (err == ESP_OK && !reserve_edit(next, &more)) {
+        err = ESP_ERR_NO_MEM;
+    }
+    if (err == ESP_OK) {
+        modbus_snapshot_t *edit = *next;
+        modbus_device_t *added = &edit->devices[edit->device_count];
+        err = deserialize_device(buf, len, added, edit, NULL);
+        if (err == ESP_OK) {
+            edit->device_count++;
+            edit->register_count += added->register_count;
+        }
+    }
+    free(buf);
     return err;
 }
 
@@ -113,311 +1280,641 @@ esp_err_t modbus_devices_load(void)
         return ESP_OK;
     }
 
-    err = nvs_get_u8(nvs_handle, "device_count", &device_count);
+    // Grown device by device as the blobs are read
+    snapshot_size_t empty = {0};
+    modbus_snapshot_t *next = begin_replace(&empty);
+    if (next == NULL) {
+        nvs_close(nvs_handle);
+        return ESP_ERR_NO_MEM;
+    }
+
+    uint8_t ids[MAX_MODBUS_DEVICES];
+    size_t id_count = sizeof(ids);
+    err = nvs_get_blob(nvs_handle, DEVICE_LIST_KEY, ids, &id_count);
+    if (err == ESP_ERR_NVS_NOT_FOUND) {
+        err = migrate_legacy_devices(nvs_handle, next);
+        nvs_close(nvs_handle);
+        if (err != ESP_OK) {
+            ESP_LOGI(TAG, "No devices found in NVS");
+        }
+        return ESP_OK;
+    }
     if (err != ESP_OK) {
-        ESP_LOGI(TAG, "No devices found in NVS");
+        ESP_LOGW(TAG, "Failed to read device list: %s", esp_err_to_name(err));
+        abort_edit(next);
         nvs_close(nvs_handle);
         return ESP_OK;
     }
 
-    if (device_count > MAX_MODBUS_DEVICES) {
-        device_count = MAX_MODBUS_DEVICES;
-        ESP_LOGW(TAG, "Device count exceeds maximum, limiting to %d", MAX_MODBUS_DEVICES);
+    for (size_t i = 0; i < id_count; i++) {
+        err = load_device(nvs_handle, ids[i], &next);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Skipping device %d: %s", ids[i], esp_err_to_name(err));
+        }
     }
+    nvs_close(nvs_handle);
 
-    char key[32];
-    for (uint8_t i = 0; i < device_count; i++) {
-        snprintf(key, sizeof(key), "device_%d_id", i);
-        nvs_get_u8(nvs_handle, key, &devices[i].device_id);
+    uint8_t loaded = next->device_count;
+    uint16_t registers = next->register_count;
+    publish_edit(next);
+    ESP_LOGI(TAG, "Loaded %d device(s), %d register(s) from NVS", loaded, registers);
+    return ESP_OK;
+}
 
-        snprintf(key, sizeof(key), "device_%d_name", i);
-        size_t len = sizeof(devices[i].name);
-        nvs_get_str(nvs_handle, key, devices[i].name, &len);
+esp_err_t modbus_add_device(const modbus_device_t *device)
+{
+    if (device->register_count > MAX_REGISTERS_PER_DEVICE) {
+        return ESP_ERR_NO_MEM;
+    }
 
-        snprintf(key, sizeof(key), "device_%d_desc", i);
-        len = sizeof(devices[i].description);
-        nvs_get_str(nvs_handle, key, devices[i].description, &len);
+    modbus_snapshot_t *next = begin_edit();
+    if (next == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
 
-        snprintf(key, sizeof(key), "device_%d_poll_interval", i);
-        nvs_get_u32(nvs_handle, key, &devices[i].poll_interval_ms);
+    if (find_device_slot(next, device->device_id) >= 0) {
+        ESP_LOGE(TAG, "Device ID %d already exists", device->device_id);
+        abort_edit(next);
+        return ESP_ERR_INVALID_ARG;
+    }
 
-        snprintf(key, sizeof(key), "device_%d_enabled", i);
-        nvs_get_u8(nvs_handle, key, (uint8_t*)&devices[i].enabled);
+    snapshot_size_t more = { .devices = 1 };
+    size_registers(&more, device->registers, device->register_count);
+    if (!reserve_edit(&next, &more)) {
+        abort_edit(next);
+        return ESP_ERR_NO_MEM;
+    }
 
-        snprintf(key, sizeof(key), "device_%d_baudrate", i);
-        nvs_get_u16(nvs_handle, key, &devices[i].baudrate);
+    append_device(next, device);
+    if (!history_fits(next)) {
+        abort_edit(next);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    mark_device_dirty(device->device_id);
+    device_list_dirty = true;
+    publish_edit(next);
 
-        snprintf(key, sizeof(key), "device_%d_reg_count", i);
-        nvs_get_u8(nvs_handle, key, &devices[i].register_count);
+    ESP_LOGI(TAG, "Added device: ID=%d, Name=%s", device->device_id, device->name);
+    return ESP_OK;
+}
 
-        if (devices[i].register_count > MAX_REGISTERS_PER_DEVICE) {
-            devices[i].register_count = MAX_REGISTERS_PER_DEVICE;
-        }
+esp_err_t modbus_update_device(uint8_t device_id, const modbus_device_t *device)
+{
+    if (device->register_count > MAX_REGISTERS_PER_DEVICE) {
+        return ESP_ERR_NO_MEM;
+    }
 
-        for (uint8_t j = 0; j < devices[i].register_count; j++) {
-            snprintf(key, sizeof(key), "device_%d_reg_%d_addr", i, j);
-            nvs_get_u16(nvs_handle, key, &devices[i].registers[j].address);
+    modbus_snapshot_t *next = begin_edit();
+    if (next == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
 
-            snprintf(key, sizeof(key), "device_%d_reg_%d_type", i, j);
-            uint8_t type;
-            nvs_get_u8(nvs_handle, key, &type);
-            devices[i].registers[j].type = (register_type_t)type;
+    int slot = find_device_slot(next, device_id);
+    if (slot < 0) {
+        abort_edit(next);
+        return ESP_ERR_NOT_FOUND;
+    }
 
-            snprintf(key, sizeof(key), "device_%d_reg_%d_name", i, j);
-            len = sizeof(devices[i].registers[j].name);
-            nvs_get_str(nvs_handle, key, devices[i].registers[j].name, &len);
+    if (device->device_id != device_id && find_device_slot(next, device->device_id) >= 0) {
+        ESP_LOGE(TAG, "Device ID %d already exists", device->device_id);
+        abort_edit(next);
+        return ESP_ERR_INVALID_ARG;
+    }
 
-            snprintf(key, sizeof(key), "device_%d_reg_%d_unit", i, j);
-            len = sizeof(devices[i].registers[j].unit);
-            nvs_get_str(nvs_handle, key, devices[i].registers[j].unit, &len);
+    uint16_t current = next->devices[slot].register_count;
+    snapshot_size_t more = {0};
+    size_registers(&more, device->registers, device->register_count);
+    more.registers = device->register_count > current ? device->register_count - current : 0;
+    if (!reserve_edit(&next, &more)) {
+        abort_edit(next);
+        return ESP_ERR_NO_MEM;
+    }
 
-            snprintf(key, sizeof(key), "device_%d_reg_%d_scale", i, j);
-            uint32_t scale_val;
-            nvs_get_u32(nvs_handle, key, &scale_val);
-            devices[i].registers[j].scale = *(float*)&scale_val;
+    resize_registers(next, slot, device->register_count);
+    modbus_register_t *registers = next->devices[slot].registers;
+    memcpy(&next->devices[slot], device, sizeof(modbus_device_t));
+    next->devices[slot].registers = registers;
+    copy_registers(next, registers, device->registers, device->register_count);
+    if (!history_fits(next)) {
+        abort_edit(next);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    mark_device_dirty(device_id);
+    if (device->device_id != device_id) {
+        mark_device_dirty(device->device_id);
+        device_list_dirty = true;
+    }
+    publish_edit(next);
+    ESP_LOGI(TAG, "Updated device: ID=%d", device_id);
+    return ESP_OK;
+}
 
-            snprintf(key, sizeof(key), "device_%d_reg_%d_offset", i, j);
-            uint32_t offset_val;
-            nvs_get_u32(nvs_handle, key, &offset_val);
-            devices[i].registers[j].offset = *(float*)&offset_val;
+esp_err_t modbus_remove_device(uint8_t device_id)
+{
+    modbus_snapshot_t *next = begin_edit();
+    if (next == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
 
-            snprintf(key, sizeof(key), "device_%d_reg_%d_writable", i, j);
-            nvs_get_u8(nvs_handle, key, (uint8_t*)&devices[i].registers[j].writable);
+    int slot = find_device_slot(next, device_id);
+    if (slot < 0) {
+        abort_edit(next);
+        return ESP_ERR_NOT_FOUND;
+    }
 
-            snprintf(key, sizeof(key), "device_%d_reg_%d_desc", i, j);
-            len = sizeof(devices[i].registers[j].description);
-            nvs_get_str(nvs_handle, key, devices[i].registers[j].description, &len);
+    resize_registers(next, slot, 0);
+    if (slot < next->device_count - 1) {
+        memmove(&next->devices[slot], &next->devices[slot + 1],
+                (next->device_count - 1 - slot) * sizeof(modbus_device_t));
+    }
+    next->device_count--;
+    mark_device_dirty(device_id);
+    device_list_dirty = true;
+    publish_edit(next);
+    ESP_LOGI(TAG, "Removed device ID=%d", device_id);
+    return ESP_OK;
+}
 
-            devices[i].registers[j].last_value = 0;
-            devices[i].registers[j].last_update = 0;
+esp_err_t modbus_replace_devices(const modbus_device_t *devices, uint8_t count)
+{
+    if (count > MAX_MODBUS_DEVICES) {
+        return ESP_ERR_NO_MEM;
+    }
+    // Check everything before the edit so a bad import changes nothing
+    snapshot_size_t size = { .devices = count };
+    uint16_t history = 0;
+    for (uint8_t i = 0; i < count; i++) {
+        const modbus_device_t *device = &devices[i];
+        if (device->register_count > MAX_REGISTERS_PER_DEVICE) {
+            return ESP_ERR_NO_MEM;
+        }
+        size_registers(&size, device->registers, device->register_count);
+        history += count_history(device->registers, device->register_count);
+        for (uint8_t k = 0; k < i; k++) {
+            if (devices[k].device_id == device->device_id) {
+                return ESP_ERR_INVALID_ARG;
+            }
+        }
+        for (uint16_t j = 0; j < device->register_count; j++) {
+            if (modbus_validate_register(&device->registers[j]) != ESP_OK) {
+                return ESP_ERR_INVALID_ARG;
+            }
+        }
+        // Sorted copy of the keys finds duplicates in O(n log n)
+        if (device->register_count > 1) {
+            modbus_register_index_t *keys = malloc(device->register_count * sizeof(modbus_register_index_t));
+            if (keys == NULL) {
+                return ESP_ERR_NO_MEM;
+            }
+            for (uint16_t j = 0; j < device->register_count; j++) {
+                keys[j].key = register_key(device->registers[j].type, device->registers[j].address);
+            }
+            qsort(keys, device->register_count, sizeof(modbus_register_index_t), compare_register_keys);
+            bool duplicate = false;
+            for (uint16_t j = 1; j < device->register_count && !duplicate; j++) {
+                duplicate = keys[j].key == keys[j - 1].key;
+            }
+            free(keys);
+            if (duplicate) {
+                return ESP_ERR_INVALID_ARG;
+            }
         }
+    }
+    if (size.registers > MODBUS_MAX_VALUE_SLOTS) {
+        return ESP_ERR_NO_MEM;
+    }
+    if (history > MODBUS_HISTORY_RINGS) {
+        return ESP_ERR_INVALID_SIZE;
+    }
 
-        devices[i].last_error = 0;
-        devices[i].last_seen = 0;
-        devices[i].status = DEVICE_STATUS_UNKNOWN;
-        devices[i].poll_count = 0;
-        devices[i].error_count = 0;
+    modbus_snapshot_t *next = begin_replace(&size);
+    if (next == NULL) {
+        return ESP_ERR_NO_MEM;
     }
+    // Blobs of devices that are gone get erased, the rest rewritten
+    for (uint8_t i = 0; i < current_snapshot->device_count; i++) {
+        mark_device_dirty(current_snapshot->devices[i].device_id);
+    }
+    for (uint8_t i = 0; i < count; i++) {
+        mark_device_dirty(devices[i].device_id);
+        append_device(next, &devices[i]);
+    }
+    device_list_dirty = true;
+    publish_edit(next);
 
-    nvs_close(nvs_handle);
-    ESP_LOGI(TAG, "Loaded %d device(s) from NVS", device_count);
+    ESP_LOGI(TAG, "Replaced configuration with %d device(s), %d register(s)", count, size.registers);
     return ESP_OK;
 }
 
-esp_err_t modbus_add_device(const modbus_device_t *device)
+esp_err_t modbus_add_register(uint8_t device_id, const modbus_register_t *reg)
 {
-    if (device_count >= MAX_MODBUS_DEVICES) {
-        ESP_LOGE(TAG, "Maximum number of devices reached");
+    modbus_snapshot_t *next = begin_edit();
+    if (next == NULL) {
         return ESP_ERR_NO_MEM;
     }
 
-    if (modbus_device_exists(device->device_id)) {
-        ESP_LOGE(TAG, "Device ID %d already exists", device->device_id);
+    int slot = find_device_slot(next, device_id);
+    if (slot < 0) {
+        abort_edit(next);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    if (modbus_validate_register(reg) != ESP_OK) {
+        abort_edit(next);
         return ESP_ERR_INVALID_ARG;
     }
 
-    memcpy(&devices[device_count], device, sizeof(modbus_device_t));
-    devices[device_count].last_error = 0;
-    devices[device_count].last_seen = 0;
-    devices[device_count].status = DEVICE_STATUS_UNKNOWN;
-    devices[device_count].poll_count = 0;
-    devices[device_count].error_count = 0;
-    device_count++;
+    snapshot_size_t more = {0};
+    size_registers(&more, reg, 1);
+    if (next->devices[slot].register_count >= MAX_REGISTERS_PER_DEVICE || !reserve_edit(&next, &more)) {
+        abort_edit(next);
+        return ESP_ERR_NO_MEM;
+    }
 
-    ESP_LOGI(TAG, "Added device: ID=%d, Name=%s", device->device_id, device->name);
+    if (find_register_index(next, slot, reg->type, reg->address) >= 0) {
+        ESP_LOGW(TAG, "Register address %d (Type %d) already exists for device %d", 
+                  reg->address, reg->type, device_id);
+        abort_edit(next);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    modbus_device_t *device = &next->devices[slot];
+    resize_registers(next, slot, device->register_count + 1);
+    copy_registers(next, &device->registers[device->register_count - 1], reg, 1);
+    if (!history_fits(next)) {
+        abort_edit(next);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    mark_device_dirty(device_id);
+    publish_edit(next);
+
+    ESP_LOGI(TAG, "Added register: Device=%d, Addr=%d, Name=%s", device_id, reg->address, reg->name);
     return ESP_OK;
 }
 
-esp_err_t modbus_update_device(uint8_t device_id, const modbus_device_t *device)
+esp_err_t modbus_update_register(uint8_t device_id, register_type_t type, uint16_t address,
+                                 const modbus_register_t *reg)
 {
-    for (uint8_t i = 0; i < device_count; i++) {
-        if (devices[i].device_id == device_id) {
-            memcpy(&devices[i], device, sizeof(modbus_device_t));
-            ESP_LOGI(TAG, "Updated device: ID=%d", device_id);
-            return ESP_OK;
-        }
+    modbus_snapshot_t *next = begin_edit();
+    if (next == NULL) {
+        return ESP_ERR_NO_MEM;
     }
-    return ESP_ERR_NOT_FOUND;
-}
 
-esp_err_t modbus_remove_device(uint8_t device_id)
-{
-    for (uint8_t i = 0; i < device_count; i++) {
-        if (devices[i].device_id == device_id) {
-            if (i < device_count - 1) {
-                memmove(&devices[i], &devices[i + 1], (device_count - 1 - i) * sizeof(modbus_device_t));
-            }
-            device_count--;
-            ESP_LOGI(TAG, "Removed device ID=%d", device_id);
-            return ESP_OK;
-        }
+    int slot = find_device_slot(next, device_id);
+    int i = slot < 0 ? -1 : find_register_index(next, slot, type, address);
+    if (i < 0) {
+        abort_edit(next);
+        return ESP_ERR_NOT_FOUND;
     }
-    return ESP_ERR_NOT_FOUND;
-}
 
-modbus_device_t* modbus_get_device(uint8_t device_id)
-{
-    for (uint8_t i = 0; i < device_count; i++) {
-        if (devices[i].device_id == device_id) {
-            return &devices[i];
-        }
+    if (modbus_validate_register(reg) != ESP_OK ||
+        ((reg->type != type || reg->address != address) &&
+         find_register_index(next, slot, reg->type, reg->address) >= 0)) {
+        abort_edit(next);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    snapshot_size_t more = {0};
+    size_registers(&more, reg, 1);
+    more.registers = 0;
+    if (!reserve_edit(&next, &more)) {
+        abort_edit(next);
+        return ESP_ERR_NO_MEM;
+    }
+
+    copy_registers(next, &next->devices[slot].registers[i], reg, 1);
+    if (!history_fits(next)) {
+        abort_edit(next);
+        return ESP_ERR_INVALID_SIZE;
     }
-    return NULL;
+    mark_device_dirty(device_id);
+    publish_edit(next);
+    ESP_LOGI(TAG, "Updated register: Device=%d, Type=%d, Addr=%d", device_id, type, address);
+    return ESP_OK;
 }
 
-modbus_device_t* modbus_list_devices(uint8_t *count)
+esp_err_t modbus_remove_register(uint8_t device_id, register_type_t type, uint16_t address)
 {
-    if (count == NULL) {
-        return NULL;
+    modbus_snapshot_t *next = begin_edit();
+    if (next == NULL) {
+        return ESP_ERR_NO_MEM;
     }
 
-    if (device_count == 0) {
-        *count = 0;
-        return NULL;
+    int slot = find_device_slot(next, device_id);
+    int i = slot < 0 ? -1 : find_register_index(next, slot, type, address);
+    if (i < 0) {
+        abort_edit(next);
+        return ESP_ERR_NOT_FOUND;
     }
 
-    *count = device_count;
-    return devices;
+    modbus_device_t *device = &next->devices[slot];
+    if (i < device->register_count - 1) {
+        memmove(&device->registers[i], &device->registers[i + 1], (device->register_count - 1 - i) * sizeof(modbus_register_t));
+    }
+    resize_registers(next, slot, device->register_count - 1);
+    mark_device_dirty(device_id);
+    publish_edit(next);
+    ESP_LOGI(TAG, "Removed register: Device=%d, Type=%d, Addr=%d", device_id, type, address);
+    return ESP_OK;
 }
 
-esp_err_t modbus_add_register(uint8_t device_id, const modbus_register_t *reg)
+esp_err_t modbus_get_register(uint8_t device_id, register_type_t type, uint16_t address,
+                              modbus_register_t *reg)
 {
-    modbus_device_t *device = modbus_get_device(device_id);
-    if (device == NULL) {
-        return ESP_ERR_NOT_FOUND;
+    const modbus_snapshot_t *snapshot = modbus_snapshot_acquire();
+    const modbus_register_t *found = modbus_snapshot_find_register(snapshot, device_id, type, address);
+    if (found != NULL && reg != NULL) {
+        memcpy(reg, found, sizeof(modbus_register_t));
+        reg->description = "";
+        reg->expression = "";
+        reg->expr = NULL;
     }
+    modbus_snapshot_release(snapshot);
+    return found != NULL ? ESP_OK : ESP_ERR_NOT_FOUND;
+}
 
-    if (device->register_count >= MAX_REGISTERS_PER_DEVICE) {
-        return ESP_ERR_NO_MEM;
+// Stores a new raw value and feeds it to history, logging, the Influx push,
+// rollups and alarms. Returns whether the value differs from the previous one.
+static bool store_register_value(const modbus_snapshot_t *snapshot, uint8_t device_id,
+                                 const modbus_register_t *reg, uint32_t value, uint32_t now)
+{
+    portENTER_CRITICAL(&value_mux);
+    bool changed = values[reg->value_slot].last_update == 0 || values[reg->value_slot].raw != value;
+    if (changed) {
+        values[reg->value_slot].version = ++values_version;
     }
+    values[reg->value_slot].raw = value;
+    values[reg->value_slot].last_update = now;
+    portEXIT_CRITICAL(&value_mux);
+    if (reg->history) {
+        modbus_history_record(reg->value_slot, now, value);
+    }
+    ts_log_record(device_id, reg->type, reg->address, reg->value_slot, now, value);
+    influx_push_record(device_id, reg->type, reg->address, reg->value_slot, now, value);
 
-    for (uint8_t i = 0; i < device->register_count; i++) {
-        if (device->registers[i].address == reg->address && device->registers[i].type == reg->type) {
-            ESP_LOGW(TAG, "Register address %d (Type %d) already exists for device %d", 
-                      reg->address, reg->type, device_id);
-            return ESP_ERR_INVALID_ARG;
+    modbus_decoded_t decoded;
+    modbus_decode_run(&reg->decode, value, &decoded);
+    if (reg->history) {
+        modbus_rollup_record(reg->value_slot, now, &decoded);
+    }
+    if (changed) {
+        modbus_alarms_evaluate(snapshot, reg, device_id, value, &decoded, now);
+    }
+    return changed;
+}
+
+// Whether any register reg's expression reads is in dirty
+static bool inputs_dirty(const modbus_register_t *reg, const uint32_t *dirty)
+{
+    for (uint8_t d = 0; d < reg->expr->dep_count; d++) {
+        if (bitmap_test(dirty, reg->expr->deps[d])) {
+            return true;
         }
     }
+    return false;
+}
 
-    memcpy(&device->registers[device->register_count], reg, sizeof(modbus_register_t));
-    device->registers[device->register_count].last_value = 0;
-    device->registers[device->register_count].last_update = 0;
-    device->register_count++;
+// Re-evaluates the virtual registers that read any register in dirty, in
+// dependency order, so a chain of virtual registers settles in one pass
+static void update_virtual_registers(const modbus_snapshot_t *snapshot, const modbus_device_t *device,
+                                     uint32_t *dirty, uint32_t now)
+{
+    const uint16_t *order = &snapshot->virtual_order[register_base(snapshot, device)];
+    for (uint16_t k = 0; k < device->virtual_count; k++) {
+        uint16_t index = order[k];
+        const modbus_register_t *reg = &device->registers[index];
+        if (!inputs_dirty(reg, dirty)) {
+            continue;
+        }
 
-    ESP_LOGI(TAG, "Added register: Device=%d, Addr=%d, Name=%s", device_id, reg->address, reg->name);
-    return ESP_OK;
+        int64_t args[MODBUS_EXPR_MAX_DEPS];
+        bool ready = true;
+        for (uint8_t d = 0; d < reg->expr->dep_count && ready; d++) {
+            const modbus_register_t *dep = &device->registers[reg->expr->deps[d]];
+            modbus_value_t raw;
+            modbus_decoded_t decoded;
+            modbus_read_value(dep, &raw);
+            ready = raw.last_update != 0;
+            modbus_decode_run(&dep->decode, raw.raw, &decoded);
+
+            // Bring the operand to the expression's fixed point
+            int64_t v = decoded.value;
+            for (uint8_t i = decoded.decimals; i < MODBUS_EXPR_DECIMALS; i++) {
+                v *= 10;
+            }
+            for (uint8_t i = MODBUS_EXPR_DECIMALS; i < decoded.decimals; i++) {
+                v /= 10;
+            }
+            args[d] = v;
+        }
+
+        int32_t result;
+        if (ready && modbus_expr_eval(reg->expr, args, &result) &&
+            store_register_value(snapshot, device->device_id, reg, (uint32_t)result, now)) {
+            bitmap_set(dirty, index);
+        }
+    }
 }
 
-esp_err_t modbus_update_register(uint8_t device_id, uint16_t address, const modbus_register_t *reg)
+esp_err_t modbus_update_register_value(uint8_t device_id, register_type_t type, uint16_t address,
+                                       uint32_t value)
 {
-    modbus_device_t *device = modbus_get_device(device_id);
-    if (device == NULL) {
+    const modbus_snapshot_t *snapshot = modbus_snapshot_acquire();
+    const modbus_device_t *device = modbus_snapshot_find_device(snapshot, device_id);
+    const modbus_register_t *reg = modbus_snapshot_find_register(snapshot, device_id, type, address);
+    if (reg == NULL) {
+        modbus_snapshot_release(snapshot);
         return ESP_ERR_NOT_FOUND;
     }
 
-    for (uint8_t i = 0; i < device->register_count; i++) {
-        if (device->registers[i].address == address) {
-            uint16_t last_val = device->registers[i].last_value;
-            uint32_t last_upd = device->registers[i].last_update;
-            memcpy(&device->registers[i], reg, sizeof(modbus_register_t));
-            device->registers[i].last_value = last_val;
-            device->registers[i].last_update = last_upd;
-            ESP_LOGI(TAG, "Updated register: Device=%d, Addr=%d", device_id, address);
-            return ESP_OK;
-        }
+    uint32_t now = xTaskGetTickCount() * portTICK_PERIOD_MS;
+    if (store_register_value(snapshot, device_id, reg, value, now) && device->virtual_count > 0) {
+        uint32_t dirty[REGISTER_BITMAP_WORDS] = {0};
+        bitmap_set(dirty, (uint16_t)(reg - device->registers));
+        update_virtual_registers(snapshot, device, dirty, now);
     }
-    return ESP_ERR_NOT_FOUND;
+
+    modbus_snapshot_release(snapshot);
+    return ESP_OK;
 }
 
-esp_err_t modbus_remove_register(uint8_t device_id, uint16_t address)
+void modbus_read_value(const modbus_register_t *reg, modbus_value_t *value)
 {
-    modbus_device_t *device = modbus_get_device(device_id);
-    if (device == NULL) {
-        return ESP_ERR_NOT_FOUND;
+    portENTER_CRITICAL(&value_mux);
+    *value = values[reg->value_slot];
+    portEXIT_CRITICAL(&value_mux);
+}
+
+void modbus_decode_value(const modbus_register_t *reg, const modbus_value_t *value, modbus_decoded_t *decoded)
+{
+    modbus_decode_run(&reg->decode, value->raw, decoded);
+}
+
+uint32_t modbus_encode_value(const modbus_register_t *reg, double value)
+{
+    if (reg->type == REGISTER_TYPE_COIL) {
+        return value != 0;
     }
+    modbus_value_t current;
+    modbus_read_value(reg, &current);
+    return modbus_encode_run(&reg->decode, reg->format, reg->word_order, value, current.raw);
+}
 
-    for (uint8_t i = 0; i < device->register_count; i++) {
-        if (device->registers[i].address == address) {
-            if (i < device->register_count - 1) {
-                memmove(&device->registers[i], &device->registers[i + 1], (device->register_count - 1 - i) * sizeof(modbus_register_t));
-            }
-            device->register_count--;
-            ESP_LOGI(TAG, "Removed register: Device=%d, Addr=%d", device_id, address);
-            return ESP_OK;
+static int resolve_any_register(void *ctx, uint8_t type, uint16_t address)
+{
+    return 0;
+}
+
+esp_err_t modbus_validate_register(const modbus_register_t *reg)
+{
+    if (!(reg->deadband >= 0.0f && reg->deadband < 1e9f)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    // References are resolved when the configuration is published; only the
+    // syntax can be checked without the rest of the device
+    if (reg->type == REGISTER_TYPE_VIRTUAL) {
+        modbus_expr_t expr;
+        if (reg->expression == NULL || strnlen(reg->expression, MODBUS_EXPR_MAX_LEN) >= MODBUS_EXPR_MAX_LEN) {
+            return ESP_ERR_INVALID_ARG;
         }
+        return modbus_expr_compile(reg->expression, resolve_any_register, NULL, &expr);
+    }
+    // Bit registers carry a single bit; multi-word formats need 16-bit registers
+    if ((reg->type == REGISTER_TYPE_COIL || reg->type == REGISTER_TYPE_DISCRETE) &&
+        reg->format != REGISTER_FORMAT_UINT16) {
+        return ESP_ERR_INVALID_ARG;
     }
-    return ESP_ERR_NOT_FOUND;
+
+    modbus_decode_t decode;
+    return modbus_decode_compile(reg->format, reg->word_order, reg->bit_mask,
+                                 reg->scale, reg->offset, &decode);
 }
 
-modbus_register_t* modbus_get_register(uint8_t device_id, uint16_t address)
+void modbus_read_device_state(const modbus_device_t *device, modbus_device_state_t *state)
 {
-    modbus_device_t *device = modbus_get_device(device_id);
-    if (device == NULL) {
-        return NULL;
-    }
+    portENTER_CRITICAL(&value_mux);
+    *state = device_states[device->state_slot];
+    portEXIT_CRITICAL(&value_mux);
+}
 
-    for (uint8_t i = 0; i < device->register_count; i++) {
-        if (device->registers[i].address == address) {
-            return &device->registers[i];
+void modbus_record_poll_result(uint8_t device_id, bool success, uint8_t error)
+{
+    const modbus_snapshot_t *snapshot = modbus_snapshot_acquire();
+    const modbus_device_t *device = modbus_snapshot_find_device(snapshot, device_id);
+    if (device != NULL) {
+        uint64_t now = xTaskGetTickCount() * portTICK_PERIOD_MS;
+        portENTER_CRITICAL(&value_mux);
+        modbus_device_state_t *state = &device_states[device->state_slot];
+        device_status_t status = state->status;
+        uint8_t last_error = state->last_error;
+        state->poll_count++;
+        if (success) {
+            state->last_seen = now;
+            state->status = DEVICE_STATUS_ONLINE;
+        } else {
+            state->error_count++;
+            state->last_error = error;
+            state->status = DEVICE_STATUS_ERROR;
+        }
+        if (state->status != status || state->last_error != last_error) {
+            state->version = ++values_version;
         }
+        portEXIT_CRITICAL(&value_mux);
     }
-    return NULL;
+    modbus_snapshot_release(snapshot);
 }
 
-esp_err_t modbus_update_register_value(uint8_t device_id, uint16_t address, uint16_t value)
+uint32_t modbus_values_version(void)
 {
-    modbus_register_t *reg = modbus_get_register(device_id, address);
-    if (reg == NULL) {
-        return ESP_ERR_NOT_FOUND;
-    }
+    portENTER_CRITICAL(&value_mux);
+    uint32_t version = values_version;
+    portEXIT_CRITICAL(&value_mux);
+    return version;
+}
 
-    reg->last_value = value;
-    reg->last_update = xTaskGetTickCount() * portTICK_PERIOD_MS;
-    return ESP_OK;
+esp_err_t modbus_get_decoded_value(uint8_t device_id, register_type_t type, uint16_t address,
+                                   modbus_decoded_t *value)
+{
+    const modbus_snapshot_t *snapshot = modbus_snapshot_acquire();
+    const modbus_register_t *reg = modbus_snapshot_find_register(snapshot, device_id, type, address);
+    if (reg != NULL) {
+        modbus_value_t raw;
+        modbus_read_value(reg, &raw);
+        modbus_decode_value(reg, &raw, value);
+    }
+    modbus_snapshot_release(snapshot);
+    return reg != NULL ? ESP_OK : ESP_ERR_NOT_FOUND;
 }
 
-float modbus_get_scaled_value(uint8_t device_id, uint16_t address)
+float modbus_get_scaled_value(uint8_t device_id, register_type_t type, uint16_t address)
 {
-    modbus_register_t *reg = modbus_get_register(device_id, address);
-    if (reg == NULL) {
+    modbus_decoded_t value;
+    if (modbus_get_decoded_value(device_id, type, address, &value) != ESP_OK) {
         return 0.0f;
     }
-
-    return (float)reg->last_value * reg->scale + reg->offset;
+    return modbus_decoded_to_float(&value);
 }
 
-uint16_t modbus_get_raw_value(uint8_t device_id, uint16_t address)
+uint32_t modbus_get_raw_value(uint8_t device_id, register_type_t type, uint16_t address)
 {
-    modbus_register_t *reg = modbus_get_register(device_id, address);
-    if (reg == NULL) {
+    modbus_register_t reg;
+    if (modbus_get_register(device_id, type, address, &reg) != ESP_OK) {
         return 0;
     }
 
-    return reg->last_value;
+    modbus_value_t value;
+    modbus_read_value(&reg, &value);
+    return value.raw;
 }
 
 uint8_t modbus_get_device_count(void)
 {
-    return device_count;
+    const modbus_snapshot_t *snapshot = modbus_snapshot_acquire();
+    uint8_t count = snapshot->device_count;
+    modbus_snapshot_release(snapshot);
+    return count;
 }
 
 bool modbus_device_exists(uint8_t device_id)
 {
-    return modbus_get_device(device_id) != NULL;
+    const modbus_snapshot_t *snapshot = modbus_snapshot_acquire();
+    bool exists = modbus_snapshot_find_device(snapshot, device_id) != NULL;
+    modbus_snapshot_release(snapshot);
+    return exists;
 }
 
 esp_err_t modbus_clear_all_devices(void)
 {
-    memset(devices, 0, sizeof(devices));
-    device_count = 0;
-    
+    modbus_snapshot_t *next = begin_edit();
+    if (next == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
     nvs_handle_t nvs_handle;
     if (nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs_handle) == ESP_OK) {
-        nvs_erase_all(nvs_handle);
+        // Every ID, not just the configured ones: a device removed since the
+        // last save still has its blob until the pending save erases it
+        char key[16];
+        for (uint16_t id = 0; id <= UINT8_MAX; id++) {
+            device_blob_key(key, sizeof(key), id);
+            nvs_erase_key(nvs_handle, key);
+        }
+        nvs_erase_key(nvs_handle, DEVICE_LIST_KEY);
         nvs_commit(nvs_handle);
         nvs_close(nvs_handle);
     }
+
+    if (save_timer != NULL) {
+        esp_timer_stop(save_timer);
+    }
+    next->device_count = 0;
+    next->register_count = 0;
+    next->expr_count = 0;
+    next->string_size = 0;
+    memset(dirty_devices, 0, sizeof(dirty_devices));
+    device_list_dirty = false;
+    publish_edit(next);
     
     ESP_LOGI(TAG, "Cleared all devices");
     return ESP_OK;
-}
\ No newline at end of file
+}
@@ -4,17 +4,29 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include "esp_err.h"
+#include "modbus_decode.h"
+#include "modbus_expr.h"
 
-#define MAX_MODBUS_DEVICES 1
-#define MAX_REGISTERS_PER_DEVICE 10
+#define MAX_MODBUS_DEVICES 64
+#define MAX_REGISTERS_PER_DEVICE 512
+// Registers across all devices, enough for the largest profile. Snapshots are
+// sized to the registers actually configured (about 130 bytes each with the
+// index, plus their strings; twice while an edit is being published), so this
+// bounds the worst case and the per-slot runtime tables (about 70 bytes per
+// slot across the modules).
+#define MODBUS_MAX_VALUE_SLOTS 512
+#define REGISTER_DESC_MAX_LEN 64
 #define DEVICE_NAME_MAX_LEN 32
 #define DEVICE_DESC_MAX_LEN 64
+#define DEVICE_PROFILE_MAX_LEN 16
+#define MODBUS_SAVE_DEBOUNCE_MS 2000
 
 typedef enum {
     REGISTER_TYPE_COIL = 0x01,
     REGISTER_TYPE_DISCRETE = 0x02,
     REGISTER_TYPE_HOLDING = 0x03,
-    REGISTER_TYPE_INPUT = 0x04
+    REGISTER_TYPE_INPUT = 0x04,
+    REGISTER_TYPE_VIRTUAL = 0x05    // Computed by the gateway from other registers of the device
 } register_type_t;
 
 typedef enum {
@@ -24,6 +36,9 @@ typedef enum {
     DEVICE_STATUS_ERROR = 3
 } device_status_t;
 
+// description and expression point into the snapshot's string pool, and are
+// never NULL there. Registers passed in to the edit functions may point to any
+// caller storage, NULL meaning empty; the strings are copied in.
 typedef struct {
     uint16_t address;
     register_type_t type;
@@ -32,44 +47,139 @@ typedef struct {
     float scale;
     float offset;
     bool writable;
-    char description[64];
-    uint16_t last_value;
-    uint32_t last_update;
+    bool history;               // Keeps a history ring, see MODBUS_HISTORY_RINGS
+    const char *description;    // Up to REGISTER_DESC_MAX_LEN - 1 characters
+    register_format_t format;
+    register_word_order_t word_order;
+    uint16_t bit_mask;          // Bitfield format only
+    uint16_t value_slot;        // Assigned by the device manager on publish
+    modbus_decode_t decode;     // Compiled by the device manager on publish
+    const char *expression;     // Virtual registers only, up to MODBUS_EXPR_MAX_LEN - 1 characters
+    modbus_expr_t *expr;        // Compiled by the device manager on publish, virtual registers only
+    float deadband;             // Smallest change published over MQTT, in engineering units; 0 = any
+    int64_t deadband_fixed;     // deadband at decode.decimals, compiled on publish
 } modbus_register_t;
 
 typedef struct {
     uint8_t device_id;
     char name[DEVICE_NAME_MAX_LEN];
     char description[DEVICE_DESC_MAX_LEN];
+    char profile[DEVICE_PROFILE_MAX_LEN];   // Build-time register profile id, empty if none
     uint32_t poll_interval_ms;
     bool enabled;
+    uint16_t baudrate;
+    uint8_t state_slot;         // Assigned by the device manager on publish
+    uint16_t register_count;
+    uint16_t virtual_count;     // Set on publish
+    // register_count entries. Within a snapshot this points into its register
+    // pool; devices passed in to the edit functions point to caller storage.
+    modbus_register_t *registers;
+} modbus_device_t;
+
+// Runtime state lives outside the configuration so snapshots stay immutable
+typedef struct {
+    uint32_t raw;               // Register words in wire order, first word in the upper half
+    uint32_t last_update;
+    uint32_t version;           // modbus_values_version() when the value last changed
+} modbus_value_t;
+
+typedef struct {
+    device_status_t status;
     uint8_t last_error;
     uint64_t last_seen;
-    device_status_t status;
     uint32_t poll_count;
     uint32_t error_count;
-    uint16_t baudrate;
-    uint8_t register_count;
-    modbus_register_t registers[MAX_REGISTERS_PER_DEVICE];
-} modbus_device_t;
+    uint32_t version;           // modbus_values_version() when status or last_error changed
+} modbus_device_state_t;
+
+typedef struct {
+    uint32_t key;
+    uint16_t reg_index;
+} modbus_register_index_t;
+
+// Immutable configuration snapshot. Readers pin it with
+// modbus_snapshot_acquire() and must release it when done; writers publish a
+// new snapshot and the old one is freed once its last reader releases it.
+//
+// A snapshot is a single allocation sized to its contents. The registers of
+// all devices share one pool, each device's registers a contiguous run in
+// device order; the index and evaluation order pools run parallel to it.
+// Register strings and the compiled programs of virtual registers, which most
+// registers do without, live in pools of their own.
+typedef struct modbus_snapshot {
+    uint32_t version;
+    uint32_t refs;
+    uint8_t device_count;
+    uint8_t device_capacity;
+    uint16_t register_count;
+    uint16_t register_capacity;
+    uint16_t expr_count;
+    uint16_t expr_capacity;
+    uint32_t string_size;
+    uint32_t string_capacity;
+    uint8_t device_slots[UINT8_MAX + 1];
+    modbus_device_t *devices;
+    modbus_register_t *registers;
+    modbus_register_index_t *register_index;   // Each device's run sorted by type and address
+    uint16_t *virtual_order;    // Device-relative indices of virtual registers in evaluation order
+    modbus_expr_t *exprs;
+    char *strings;
+    // Kept by the device manager once the snapshot is replaced: the value
+    // slots that may not be reused while it is alive, and the next older
+    // replaced snapshot still alive
+    uint32_t freed_slots[(MODBUS_MAX_VALUE_SLOTS + 31) / 32];
+    struct modbus_snapshot *older;
+} modbus_snapshot_t;
 
 esp_err_t modbus_devices_init(void);
 esp_err_t modbus_devices_save(void);
+esp_err_t modbus_devices_schedule_save(void);
 esp_err_t modbus_devices_load(void);
 
+const modbus_snapshot_t* modbus_snapshot_acquire(void);
+void modbus_snapshot_release(const modbus_snapshot_t *snapshot);
+const modbus_device_t* modbus_snapshot_find_device(const modbus_snapshot_t *snapshot, uint8_t device_id);
+const modbus_register_t* modbus_snapshot_find_register(const modbus_snapshot_t *snapshot, uint8_t device_id,
+                                                       register_type_t type, uint16_t address);
+
 esp_err_t modbus_add_device(const modbus_device_t *device);
 esp_err_t modbus_update_device(uint8_t device_id, const modbus_device_t *device);
 esp_err_t modbus_remove_device(uint8_t device_id);
-modbus_device_t* modbus_get_device(uint8_t device_id);
-modbus_device_t* modbus_list_devices(uint8_t *count);
+// Replaces the whole device and register set in one edit. Everything is
+// validated first: on error the live configuration is untouched.
+//
+// The edit functions return ESP_ERR_INVALID_SIZE if more than
+// MODBUS_HISTORY_RINGS registers would keep history.
+esp_err_t modbus_replace_devices(const modbus_device_t *devices, uint8_t count);
 
 esp_err_t modbus_add_register(uint8_t device_id, const modbus_register_t *reg);
-esp_err_t modbus_update_register(uint8_t device_id, uint16_t address, const modbus_register_t *reg);
-esp_err_t modbus_remove_register(uint8_t device_id, uint16_t address);
-modbus_register_t* modbus_get_register(uint8_t device_id, uint16_t address);
-esp_err_t modbus_update_register_value(uint8_t device_id, uint16_t address, uint16_t value);
-float modbus_get_scaled_value(uint8_t device_id, uint16_t address);
-uint16_t modbus_get_raw_value(uint8_t device_id, uint16_t address);
+esp_err_t modbus_update_register(uint8_t device_id, register_type_t type, uint16_t address,
+                                 const modbus_register_t *reg);
+esp_err_t modbus_remove_register(uint8_t device_id, register_type_t type, uint16_t address);
+// Copies a register out of the current configuration. Its description and
+// expression live in the snapshot, so the copy has them empty; pin a snapshot
+// to read them.
+esp_err_t modbus_get_register(uint8_t device_id, register_type_t type, uint16_t address,
+                              modbus_register_t *reg);
+esp_err_t modbus_update_register_value(uint8_t device_id, register_type_t type, uint16_t address,
+                                       uint32_t value);
+esp_err_t modbus_get_decoded_value(uint8_t device_id, register_type_t type, uint16_t address,
+                                   modbus_decoded_t *value);
+float modbus_get_scaled_value(uint8_t device_id, register_type_t type, uint16_t address);
+uint32_t modbus_get_raw_value(uint8_t device_id, register_type_t type, uint16_t address);
+
+void modbus_read_value(const modbus_register_t *reg, modbus_value_t *value);
+void modbus_decode_value(const modbus_register_t *reg, const modbus_value_t *value, modbus_decoded_t *decoded);
+// Raw value (wire order, first word in the upper half) for writing value to
+// reg, in the engineering units its reads decode to. A bitfield keeps the bits
+// outside its mask as last polled.
+uint32_t modbus_encode_value(const modbus_register_t *reg, double value);
+esp_err_t modbus_validate_register(const modbus_register_t *reg);
+void modbus_read_device_state(const modbus_device_t *device, modbus_device_state_t *state);
+void modbus_record_poll_result(uint8_t device_id, bool success, uint8_t error);
+// Counter bumped on every value or device status change; clients pass it back
+// to fetch only what changed since
+uint32_t modbus_values_version(void);
 
 uint8_t modbus_get_device_count(void);
 bool modbus_device_exists(uint8_t device_id);
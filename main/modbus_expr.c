@@ -0,0 +1,377 @@
+#include "modbus_expr.h"
+#include "modbus_devices.h"
+#include <string.h>
+#include <ctype.h>
+#include "esp_log.h"
+
+static const char *TAG = "MODBUS_EXPR";
+
+#define EXPR_ONE 1000           // 10^MODBUS_EXPR_DECIMALS
+
+typedef enum {
+    EXPR_OP_CONST = 1,          // operand: index into consts
+    EXPR_OP_ARG,                // operand: index into deps
+    EXPR_OP_ADD,
+    EXPR_OP_SUB,
+    EXPR_OP_MUL,
+    EXPR_OP_DIV,
+    EXPR_OP_NEG,
+    EXPR_OP_ABS,
+    EXPR_OP_MIN,
+    EXPR_OP_MAX,
+    EXPR_OP_DIVN                // operand: plain integer divisor (avg)
+} expr_op_t;
+
+typedef struct {
+    const char *p;
+    modbus_expr_t *expr;
+    modbus_expr_resolve_cb resolve;
+    void *ctx;
+    uint8_t depth;
+    const char *error;
+} expr_parser_t;
+
+static void skip_space(expr_parser_t *ps)
+{
+    while (*ps->p == ' ' || *ps->p == '\t') {
+        ps->p++;
+    }
+}
+
+static bool accept(expr_parser_t *ps, char c)
+{
+    skip_space(ps);
+    if (*ps->p != c) {
+        return false;
+    }
+    ps->p++;
+    return true;
+}
+
+static bool fail(expr_parser_t *ps, const char *error)
+{
+    if (ps->error == NULL) {
+        ps->error = error;
+    }
+    return false;
+}
+
+// Appends an instruction and tracks the stack depth it leaves behind
+static bool emit(expr_parser_t *ps, expr_op_t op, int operand, int stack_change)
+{
+    modbus_expr_t *expr = ps->expr;
+    if (expr->code_len + (operand >= 0 ? 2 : 1) > MODBUS_EXPR_MAX_CODE) {
+        return fail(ps, "expression too long");
+    }
+    expr->code[expr->code_len++] = op;
+    if (operand >= 0) {
+        expr->code[expr->code_len++] = (uint8_t)operand;
+    }
+    ps->depth += stack_change;
+    if (ps->depth > MODBUS_EXPR_MAX_STACK) {
+        return fail(ps, "expression nested too deeply");
+    }
+    return true;
+}
+
+static bool parse_expr(expr_parser_t *ps);
+
+static bool parse_number(expr_parser_t *ps)
+{
+    int64_t value = 0;
+    int decimals = -1;
+
+    while (isdigit((unsigned char)*ps->p) || (*ps->p == '.' && decimals < 0)) {
+        if (*ps->p == '.') {
+            decimals = 0;
+        } else {
+            if (decimals >= MODBUS_EXPR_DECIMALS) {
+                return fail(ps, "too many decimals");
+            }
+            value = value * 10 + (*ps->p - '0');
+            if (decimals >= 0) {
+                decimals++;
+            }
+            if (value > INT32_MAX) {
+                return fail(ps, "number out of range");
+            }
+        }
+        ps->p++;
+    }
+    for (int d = decimals < 0 ? 0 : decimals; d < MODBUS_EXPR_DECIMALS; d++) {
+        value *= 10;
+    }
+    if (value > INT32_MAX) {
+        return fail(ps, "number out of range");
+    }
+
+    modbus_expr_t *expr = ps->expr;
+    if (expr->const_count >= MODBUS_EXPR_MAX_CONSTS) {
+        return fail(ps, "too many constants");
+    }
+    expr->consts[expr->const_count] = (int32_t)value;
+    return emit(ps, EXPR_OP_CONST, expr->const_count++, 1);
+}
+
+static bool parse_register(expr_parser_t *ps, uint8_t type)
+{
+    uint32_t address = 0;
+    while (isdigit((unsigned char)*ps->p)) {
+        address = address * 10 + (*ps->p++ - '0');
+        if (address > UINT16_MAX) {
+            return fail(ps, "register address out of range");
+        }
+    }
+
+    int index = ps->resolve(ps->ctx, type, (uint16_t)address);
+    if (index < 0) {
+        return fail(ps, "unknown register");
+    }
+
+    modbus_expr_t *expr = ps->expr;
+    uint8_t dep = 0;
+    while (dep < expr->dep_count && expr->deps[dep] != index) {
+        dep++;
+    }
+    if (dep == expr->dep_count) {
+        if (expr->dep_count >= MODBUS_EXPR_MAX_DEPS) {
+            return fail(ps, "too many registers referenced");
+        }
+        expr->deps[expr->dep_count++] = (uint16_t)index;
+    }
+    return emit(ps, EXPR_OP_ARG, dep, 1);
+}
+
+static bool parse_function(expr_parser_t *ps, const char *name, size_t len)
+{
+    expr_op_t op;
+    if (len == 3 && strncmp(name, "min", 3) == 0) {
+        op = EXPR_OP_MIN;
+    } else if (len == 3 && strncmp(name, "max", 3) == 0) {
+        op = EXPR_OP_MAX;
+    } else if (len == 3 && strncmp(name, "avg", 3) == 0) {
+        op = EXPR_OP_ADD;
+    } else if (len == 3 && strncmp(name, "abs", 3) == 0) {
+        op = EXPR_OP_ABS;
+    } else {
+        return fail(ps, "unknown function");
+    }
+
+    if (!accept(ps, '(')) {
+        return fail(ps, "expected '('");
+    }
+    int args = 0;
+    do {
+        if (!parse_expr(ps)) {
+            return false;
+        }
+        // Fold variadic functions as they go so the stack stays shallow
+        if (++args > 1 && op != EXPR_OP_ABS && !emit(ps, op, -1, -1)) {
+            return false;
+        }
+    } while (accept(ps, ','));
+    if (!accept(ps, ')')) {
+        return fail(ps, "expected ')'");
+    }
+
+    if (op == EXPR_OP_ABS) {
+        return args == 1 ? emit(ps, EXPR_OP_ABS, -1, 0) : fail(ps, "abs() takes one argument");
+    }
+    if (op != EXPR_OP_ADD || args == 1) {
+        return true;
+    }
+    return args <= UINT8_MAX ? emit(ps, EXPR_OP_DIVN, args, 0) : fail(ps, "too many arguments");
+}
+
+static bool parse_primary(expr_parser_t *ps)
+{
+    skip_space(ps);
+    char c = *ps->p;
+
+    if (isdigit((unsigned char)c) || c == '.') {
+        return parse_number(ps);
+    }
+    if (accept(ps, '(')) {
+        if (!parse_expr(ps)) {
+            return false;
+        }
+        return accept(ps, ')') ? true : fail(ps, "expected ')'");
+    }
+    if (!isalpha((unsigned char)c)) {
+        return fail(ps, c == '\0' ? "unexpected end of expression" : "unexpected character");
+    }
+
+    // A letter followed by a digit is a register reference
+    if (isdigit((unsigned char)ps->p[1])) {
+        static const struct { char letter; uint8_t type; } letters[] = {
+            { 'c', REGISTER_TYPE_COIL },
+            { 'd', REGISTER_TYPE_DISCRETE },
+            { 'h', REGISTER_TYPE_HOLDING },
+            { 'i', REGISTER_TYPE_INPUT },
+            { 'v', REGISTER_TYPE_VIRTUAL },
+        };
+        for (size_t i = 0; i < sizeof(letters) / sizeof(letters[0]); i++) {
+            if (tolower((unsigned char)c) == letters[i].letter) {
+                ps->p++;
+                return parse_register(ps, letters[i].type);
+            }
+        }
+        return fail(ps, "unknown register type");
+    }
+
+    const char *name = ps->p;
+    while (isalpha((unsigned char)*ps->p)) {
+        ps->p++;
+    }
+    return parse_function(ps, name, ps->p - name);
+}
+
+static bool parse_unary(expr_parser_t *ps)
+{
+    if (accept(ps, '-')) {
+        return parse_unary(ps) && emit(ps, EXPR_OP_NEG, -1, 0);
+    }
+    return parse_primary(ps);
+}
+
+static bool parse_term(expr_parser_t *ps)
+{
+    if (!parse_unary(ps)) {
+        return false;
+    }
+    for (;;) {
+        expr_op_t op;
+        if (accept(ps, '*')) {
+            op = EXPR_OP_MUL;
+        } else if (accept(ps, '/')) {
+            op = EXPR_OP_DIV;
+        } else {
+            return true;
+        }
+        if (!parse_unary(ps) || !emit(ps, op, -1, -1)) {
+            return false;
+        }
+    }
+}
+
+static bool parse_expr(expr_parser_t *ps)
+{
+    if (!parse_term(ps)) {
+        return false;
+    }
+    for (;;) {
+        expr_op_t op;
+        if (accept(ps, '+')) {
+            op = EXPR_OP_ADD;
+        } else if (accept(ps, '-')) {
+            op = EXPR_OP_SUB;
+        } else {
+            return true;
+        }
+        if (!parse_term(ps) || !emit(ps, op, -1, -1)) {
+            return false;
+        }
+    }
+}
+
+esp_err_t modbus_expr_compile(const char *text, modbus_expr_resolve_cb resolve, void *ctx,
+                              modbus_expr_t *expr)
+{
+    memset(expr, 0, sizeof(modbus_expr_t));
+
+    expr_parser_t ps = {
+        .p = text,
+        .expr = expr,
+        .resolve = resolve,
+        .ctx = ctx,
+    };
+    bool ok = parse_expr(&ps);
+    skip_space(&ps);
+    if (ok && *ps.p != '\0') {
+        ok = fail(&ps, "unexpected character");
+    }
+
+    if (!ok) {
+        ESP_LOGW(TAG, "Invalid expression \"%s\" at offset %d: %s", text, (int)(ps.p - text), ps.error);
+        memset(expr, 0, sizeof(modbus_expr_t));
+        return ESP_ERR_INVALID_ARG;
+    }
+    return ESP_OK;
+}
+
+bool modbus_expr_eval(const modbus_expr_t *expr, const int64_t *args, int32_t *out)
+{
+    int64_t stack[MODBUS_EXPR_MAX_STACK];
+    int sp = 0;
+
+    if (expr->code_len == 0) {
+        return false;
+    }
+
+    // The compiler has checked operands and stack depth, so only arithmetic
+    // can fail here
+    for (uint8_t pc = 0; pc < expr->code_len; pc++) {
+        int64_t *a = sp >= 2 ? &stack[sp - 2] : stack;
+        int64_t b = sp > 0 ? stack[sp - 1] : 0;
+
+        switch (expr->code[pc]) {
+            case EXPR_OP_CONST:
+                stack[sp++] = expr->consts[expr->code[++pc]];
+                break;
+            case EXPR_OP_ARG:
+                stack[sp++] = args[expr->code[++pc]];
+                break;
+            case EXPR_OP_ADD:
+                if (__builtin_add_overflow(*a, b, a)) {
+                    return false;
+                }
+                sp--;
+                break;
+            case EXPR_OP_SUB:
+                if (__builtin_sub_overflow(*a, b, a)) {
+                    return false;
+                }
+                sp--;
+                break;
+            case EXPR_OP_MUL:
+                if (__builtin_mul_overflow(*a, b, a)) {
+                    return false;
+                }
+                *a /= EXPR_ONE;
+                sp--;
+                break;
+            case EXPR_OP_DIV:
+                if (b == 0 || __builtin_mul_overflow(*a, (int64_t)EXPR_ONE, a)) {
+                    return false;
+                }
+                *a /= b;
+                sp--;
+                break;
+            case EXPR_OP_NEG:
+                stack[sp - 1] = -b;
+                break;
+            case EXPR_OP_ABS:
+                stack[sp - 1] = b < 0 ? -b : b;
+                break;
+            case EXPR_OP_MIN:
+                *a = *a < b ? *a : b;
+                sp--;
+                break;
+            case EXPR_OP_MAX:
+                *a = *a > b ? *a : b;
+                sp--;
+                break;
+            case EXPR_OP_DIVN:
+                stack[sp - 1] = b / expr->code[++pc];
+                break;
+            default:
+                return false;
+        }
+    }
+
+    if (sp != 1 || stack[0] > INT32_MAX || stack[0] < INT32_MIN) {
+        return false;
+    }
+    *out = (int32_t)stack[0];
+    return true;
+}
@@ -0,0 +1,45 @@
+#ifndef MODBUS_EXPR_H
+#define MODBUS_EXPR_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+#define MODBUS_EXPR_MAX_LEN 64
+#define MODBUS_EXPR_MAX_CODE 48
+#define MODBUS_EXPR_MAX_CONSTS 8
+#define MODBUS_EXPR_MAX_DEPS 8
+#define MODBUS_EXPR_MAX_STACK 8
+
+// Expressions evaluate in fixed point with MODBUS_EXPR_DECIMALS decimals;
+// a virtual register stores the result as a signed 32-bit raw value
+#define MODBUS_EXPR_DECIMALS 3
+
+// Stack program compiled once per virtual register when the configuration
+// changes. Operands referring to registers index deps[], which holds the
+// index of the referenced register within its device.
+typedef struct {
+    uint8_t code[MODBUS_EXPR_MAX_CODE];
+    uint8_t code_len;           // 0 if the register has no usable program
+    uint8_t const_count;
+    uint8_t dep_count;
+    uint16_t deps[MODBUS_EXPR_MAX_DEPS];
+    int32_t consts[MODBUS_EXPR_MAX_CONSTS];
+} modbus_expr_t;
+
+// Maps a register reference (type code letter already converted to a
+// register_type_t value) to its index in the device; negative if unknown
+typedef int (*modbus_expr_resolve_cb)(void *ctx, uint8_t type, uint16_t address);
+
+// Syntax: numbers, + - * /, unary minus, parentheses, min(), max(), avg()
+// with up to MODBUS_EXPR_MAX_STACK arguments, abs(), and register references
+// written as a type letter and address: C (coil), D (discrete input),
+// H (holding), I (input) or V (virtual), e.g. "(H5 - H1) * 100 / (H30 - H1)"
+esp_err_t modbus_expr_compile(const char *text, modbus_expr_resolve_cb resolve, void *ctx,
+                              modbus_expr_t *expr);
+
+// args holds the current value of each dependency in expression fixed point.
+// Returns false on division by zero or if the result doesn't fit 32 bits.
+bool modbus_expr_eval(const modbus_expr_t *expr, const int64_t *args, int32_t *out);
+
+#endif
@@ -0,0 +1,560 @@
+#include "modbus_history.h"
+#include "modbus_devices.h"
+#include <string.h>
+#include <stdlib.h>
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+
+static const char *TAG = "MODBUS_HISTORY";
+
+// Worst case for one sample: 4 + 32 timestamp bits and 2 + 10 + 32 value bits
+#define SAMPLE_MAX_BITS 80
+#define BLOCK_CAPACITY_BITS (MODBUS_HISTORY_BLOCK_BYTES * 8)
+
+typedef struct {
+    modbus_history_block_t blocks[MODBUS_HISTORY_BLOCKS];
+    uint32_t head_seq;          // Block currently being filled
+    uint32_t prev_ts;
+    int32_t prev_delta;
+    uint32_t prev_value;
+    uint8_t leading;
+    uint8_t trailing;
+} history_ring_t;
+
+#define NO_RING 0xFF
+
+// Rings are handed to slots as they first record and given back on reset, so
+// history costs MODBUS_HISTORY_RINGS rings however many registers there are.
+static history_ring_t rings[MODBUS_HISTORY_RINGS];
+static uint16_t ring_owner[MODBUS_HISTORY_RINGS];
+static uint8_t slot_ring[MODBUS_MAX_VALUE_SLOTS];
+static portMUX_TYPE history_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static void put_bits(modbus_history_block_t *block, uint32_t value, uint8_t count)
+{
+    for (int i = count - 1; i >= 0; i--) {
+        if ((value >> i) & 1u) {
+            block->data[block->bits / 8] |= 0x80 >> (block->bits % 8);
+        }
+        block->bits++;
+    }
+}
+
+static uint32_t get_bits(const modbus_history_block_t *block, uint16_t *pos, uint8_t count)
+{
+    uint32_t value = 0;
+    for (uint8_t i = 0; i < count; i++) {
+        value = (value << 1) | ((block->data[*pos / 8] >> (7 - *pos % 8)) & 1u);
+        (*pos)++;
+    }
+    return value;
+}
+
+static inline modbus_history_block_t* ring_block(history_ring_t *ring, uint32_t seq)
+{
+    return &ring->blocks[seq % MODBUS_HISTORY_BLOCKS];
+}
+
+static inline uint32_t ring_oldest_seq(const history_ring_t *ring)
+{
+    return ring->head_seq >= MODBUS_HISTORY_BLOCKS - 1 ? ring->head_seq - (MODBUS_HISTORY_BLOCKS - 1) : 0;
+}
+
+static void start_block(history_ring_t *ring, uint32_t seq, uint32_t ts, uint32_t raw)
+{
+    modbus_history_block_t *block = ring_block(ring, seq);
+    memset(block, 0, sizeof(modbus_history_block_t));
+    block->seq = seq;
+    block->start_ts = ts;
+    block->end_ts = ts;
+    block->first_value = raw;
+    block->count = 1;
+
+    ring->head_seq = seq;
+    ring->prev_ts = ts;
+    ring->prev_delta = 0;
+    ring->prev_value = raw;
+    ring->leading = 0xFF;
+    ring->trailing = 0;
+}
+
+static void encode_timestamp(modbus_history_block_t *block, int32_t dod)
+{
+    if (dod == 0) {
+        put_bits(block, 0x0, 1);
+    } else if (dod >= -63 && dod <= 64) {
+        put_bits(block, 0x2, 2);
+        put_bits(block, dod + 63, 7);
+    } else if (dod >= -255 && dod <= 256) {
+        put_bits(block, 0x6, 3);
+        put_bits(block, dod + 255, 9);
+    } else if (dod >= -2047 && dod <= 2048) {
+        put_bits(block, 0xE, 4);
+        put_bits(block, dod + 2047, 12);
+    } else {
+        put_bits(block, 0xF, 4);
+        put_bits(block, (uint32_t)dod, 32);
+    }
+}
+
+static int32_t decode_timestamp(const modbus_history_block_t *block, uint16_t *pos)
+{
+    if (get_bits(block, pos, 1) == 0) {
+        return 0;
+    }
+    if (get_bits(block, pos, 1) == 0) {
+        return (int32_t)get_bits(block, pos, 7) - 63;
+    }
+    if (get_bits(block, pos, 1) == 0) {
+        return (int32_t)get_bits(block, pos, 9) - 255;
+    }
+    if (get_bits(block, pos, 1) == 0) {
+        return (int32_t)get_bits(block, pos, 12) - 2047;
+    }
+    return (int32_t)get_bits(block, pos, 32);
+}
+
+// Gorilla value encoding: '0' repeats the previous value, '10' reuses the
+// previous window of meaningful XOR bits, '11' opens a new window.
+static void encode_value(history_ring_t *ring, modbus_history_block_t *block, uint32_t raw)
+{
+    uint32_t x = raw ^ ring->prev_value;
+    if (x == 0) {
+        put_bits(block, 0x0, 1);
+        return;
+    }
+
+    uint8_t leading = __builtin_clz(x);
+    uint8_t trailing = __builtin_ctz(x);
+    if (ring->leading != 0xFF && leading >= ring->leading && trailing >= ring->trailing) {
+        put_bits(block, 0x2, 2);
+        put_bits(block, x >> ring->trailing, 32 - ring->leading - ring->trailing);
+        return;
+    }
+
+    uint8_t meaningful = 32 - leading - trailing;
+    put_bits(block, 0x3, 2);
+    put_bits(block, leading, 5);
+    put_bits(block, meaningful - 1, 5);
+    put_bits(block, x >> trailing, meaningful);
+    ring->leading = leading;
+    ring->trailing = trailing;
+}
+
+// Ring held by slot, or NULL; called with history_mux held
+static history_ring_t* find_ring(uint16_t slot)
+{
+    if (slot >= MODBUS_MAX_VALUE_SLOTS || slot_ring[slot] == NO_RING) {
+        return NULL;
+    }
+    return &rings[slot_ring[slot]];
+}
+
+// Gives slot a free ring, or NULL if all are taken; called with history_mux
+// held. Readers only trust blocks whose count and seq match, so resetting the
+// headers is enough to empty a ring.
+static history_ring_t* claim_ring(uint16_t slot)
+{
+    for (uint8_t i = 0; i < MODBUS_HISTORY_RINGS; i++) {
+        if (ring_owner[i] != UINT16_MAX) {
+            continue;
+        }
+        history_ring_t *ring = &rings[i];
+        ring->head_seq = 0;
+        for (uint8_t b = 0; b < MODBUS_HISTORY_BLOCKS; b++) {
+            ring->blocks[b].count = 0;
+            ring->blocks[b].end_ts = 0;
+        }
+        ring_owner[i] = slot;
+        slot_ring[slot] = i;
+        return ring;
+    }
+    return NULL;
+}
+
+esp_err_t modbus_history_init(void)
+{
+    portENTER_CRITICAL(&history_mux);
+    memset(slot_ring, NO_RING, sizeof(slot_ring));
+    memset(ring_owner, 0xFF, sizeof(ring_owner));
+    portEXIT_CRITICAL(&history_mux);
+
+    ESP_LOGI(TAG, "History: %d ring(s) x %d bytes", MODBUS_HISTORY_RINGS, (int)sizeof(history_ring_t));
+    return ESP_OK;
+}
+
+void modbus_history_record(uint16_t slot, uint32_t timestamp_ms, uint32_t raw)
+{
+    if (slot >= MODBUS_MAX_VALUE_SLOTS) {
+        return;
+    }
+
+    uint32_t ts = timestamp_ms / MODBUS_HISTORY_RESOLUTION_MS;
+
+    portENTER_CRITICAL(&history_mux);
+    history_ring_t *ring = find_ring(slot);
+    if (ring == NULL && (ring = claim_ring(slot)) == NULL) {
+        // Every ring is in use, which only lasts until readers release the
+        // snapshot of a register that gave its ring up; retried next sample
+        portEXIT_CRITICAL(&history_mux);
+        return;
+    }
+    modbus_history_block_t *block = ring_block(ring, ring->head_seq);
+    if (block->count == 0) {
+        start_block(ring, ring->head_seq, ts, raw);
+    } else if (ts < ring->prev_ts || block->count == UINT16_MAX ||
+               block->bits + SAMPLE_MAX_BITS > BLOCK_CAPACITY_BITS) {
+        // Seal the block; the next one overwrites the oldest in the ring
+        start_block(ring, ring->head_seq + 1, ts, raw);
+    } else {
+        int32_t delta = (int32_t)(ts - ring->prev_ts);
+        encode_timestamp(block, delta - ring->prev_delta);
+        encode_value(ring, block, raw);
+        ring->prev_ts = ts;
+        ring->prev_delta = delta;
+        ring->prev_value = raw;
+        block->end_ts = ts;
+        block->count++;
+    }
+    portEXIT_CRITICAL(&history_mux);
+}
+
+void modbus_history_reset(uint16_t slot)
+{
+    if (slot >= MODBUS_MAX_VALUE_SLOTS) {
+        return;
+    }
+
+    portENTER_CRITICAL(&history_mux);
+    if (slot_ring[slot] != NO_RING) {
+        ring_owner[slot_ring[slot]] = UINT16_MAX;
+        slot_ring[slot] = NO_RING;
+    }
+    portEXIT_CRITICAL(&history_mux);
+}
+
+// Copies block seq (or the oldest still held, if seq was overwritten) into
+// the cursor. Returns false once past the head block.
+static bool cursor_load(modbus_history_cursor_t *cursor, uint32_t seq)
+{
+    portENTER_CRITICAL(&history_mux);
+    history_ring_t *ring = find_ring(cursor->slot);
+    bool valid = false;
+    if (ring != NULL) {
+        uint32_t oldest = ring_oldest_seq(ring);
+        if (seq < oldest) {
+            seq = oldest;
+        }
+        const modbus_history_block_t *block = ring_block(ring, seq);
+        valid = seq <= ring->head_seq && block->count > 0 && block->seq == seq;
+    }
+    if (valid) {
+        const modbus_history_block_t *block = ring_block(ring, seq);
+        memcpy(&cursor->block, block, sizeof(modbus_history_block_t));
+        cursor->last_block = seq == ring->head_seq;
+    }
+    portEXIT_CRITICAL(&history_mux);
+
+    if (!valid) {
+        return false;
+    }
+
+    cursor->seq = seq;
+    cursor->index = 0;
+    cursor->bitpos = 0;
+    cursor->prev_ts = cursor->block.start_ts;
+    cursor->prev_delta = 0;
+    cursor->prev_value = cursor->block.first_value;
+    cursor->leading = 0xFF;
+    cursor->trailing = 0;
+    return true;
+}
+
+// Decodes the next sample of the loaded block, moving to the next block as needed
+static bool cursor_read(modbus_history_cursor_t *cursor, modbus_history_point_t *point)
+{
+    while (!cursor->done) {
+        if (!cursor->loaded || cursor->index >= cursor->block.count) {
+            bool more = cursor->loaded ? !cursor->last_block && cursor_load(cursor, cursor->seq + 1)
+                                       : cursor_load(cursor, 0);
+            cursor->loaded = true;
+            if (!more) {
+                cursor->done = true;
+                break;
+            }
+        }
+
+        const modbus_history_block_t *block = &cursor->block;
+        if (cursor->index > 0) {
+            int32_t delta = cursor->prev_delta + decode_timestamp(block, &cursor->bitpos);
+            cursor->prev_ts += delta;
+            cursor->prev_delta = delta;
+
+            if (get_bits(block, &cursor->bitpos, 1) != 0) {
+                if (get_bits(block, &cursor->bitpos, 1) != 0) {
+                    cursor->leading = get_bits(block, &cursor->bitpos, 5);
+                    uint8_t meaningful = get_bits(block, &cursor->bitpos, 5) + 1;
+                    cursor->trailing = 32 - cursor->leading - meaningful;
+                }
+                uint8_t meaningful = 32 - cursor->leading - cursor->trailing;
+                cursor->prev_value ^= get_bits(block, &cursor->bitpos, meaningful) << cursor->trailing;
+            }
+        }
+        cursor->index++;
+
+        point->timestamp = cursor->prev_ts * MODBUS_HISTORY_RESOLUTION_MS;
+        point->raw = cursor->prev_value;
+        return true;
+    }
+    return false;
+}
+
+void modbus_history_cursor_init(modbus_history_cursor_t *cursor, uint16_t slot, uint32_t from_ms, uint32_t to_ms)
+{
+    memset(cursor, 0, sizeof(modbus_history_cursor_t));
+    cursor->slot = slot;
+    cursor->to = to_ms;
+    if (slot >= MODBUS_MAX_VALUE_SLOTS) {
+        cursor->done = true;
+        return;
+    }
+
+    // Skip whole blocks that end before the range using their headers
+    uint32_t from = from_ms / MODBUS_HISTORY_RESOLUTION_MS;
+    uint32_t seq = 0;
+    portENTER_CRITICAL(&history_mux);
+    history_ring_t *ring = find_ring(slot);
+    if (ring != NULL) {
+        seq = ring_oldest_seq(ring);
+        while (seq < ring->head_seq && ring_block(ring, seq)->end_ts < from) {
+            seq++;
+        }
+    }
+    portEXIT_CRITICAL(&history_mux);
+
+    if (cursor_load(cursor, seq)) {
+        cursor->loaded = true;
+    } else {
+        cursor->done = true;
+    }
+
+    modbus_history_point_t point;
+    while (modbus_history_cursor_peek(cursor, &point) && point.timestamp < from_ms) {
+        modbus_history_cursor_advance(cursor);
+    }
+}
+
+bool modbus_history_cursor_peek(modbus_history_cursor_t *cursor, modbus_history_point_t *point)
+{
+    if (!cursor->has_peek) {
+        if (!cursor_read(cursor, &cursor->peek)) {
+            return false;
+        }
+        cursor->has_peek = true;
+    }
+    if (cursor->peek.timestamp > cursor->to) {
+        return false;
+    }
+    *point = cursor->peek;
+    return true;
+}
+
+void modbus_history_cursor_advance(modbus_history_cursor_t *cursor)
+{
+    cursor->has_peek = false;
+}
+
+// Per-series state for the streaming LTTB pass: one cursor walks the bucket
+// being emitted, a second one runs a bucket ahead to supply its average.
+typedef struct {
+    modbus_history_cursor_t pick;
+    modbus_history_cursor_t ahead;
+    const modbus_decode_t *decode;
+    bool have_anchor;
+    int64_t anchor_t;
+    int64_t anchor_v;
+} lttb_series_t;
+
+static int64_t decode_point(const modbus_decode_t *decode, uint32_t raw)
+{
+    modbus_decoded_t value;
+    modbus_decode_run(decode, raw, &value);
+    return value.value;
+}
+
+static int64_t clamp_diff(int64_t v)
+{
+    // Keeps the triangle area products inside int64
+    const int64_t limit = (int64_t)1 << 29;
+    return v > limit ? limit : (v < -limit ? -limit : v);
+}
+
+// Picks the point of [start, end) forming the largest triangle with the
+// previous pick and the average of the next bucket [end, next_end)
+static bool lttb_select(lttb_series_t *s, uint32_t start, uint32_t end, uint32_t next_end,
+                        bool last_bucket, modbus_history_point_t *out)
+{
+    modbus_history_point_t p;
+
+    int64_t sum_t = 0;
+    int64_t sum_v = 0;
+    uint32_t n = 0;
+    while (modbus_history_cursor_peek(&s->ahead, &p) && p.timestamp < next_end) {
+        if (p.timestamp >= end) {
+            sum_t += p.timestamp - end;
+            sum_v += decode_point(s->decode, p.raw);
+            n++;
+        }
+        modbus_history_cursor_advance(&s->ahead);
+    }
+
+    bool found = false;
+    int64_t best_area = -1;
+    int64_t c_t = n > 0 ? (int64_t)end + sum_t / n : (int64_t)end + (next_end - end) / 2;
+    int64_t c_v = n > 0 ? sum_v / n : s->anchor_v;
+
+    while (modbus_history_cursor_peek(&s->pick, &p) && p.timestamp < end) {
+        modbus_history_cursor_advance(&s->pick);
+
+        if (!s->have_anchor || last_bucket) {
+            // The first bucket keeps its first point and the last its last,
+            // like classic LTTB
+            if (!found || last_bucket) {
+                *out = p;
+                found = true;
+            }
+            continue;
+        }
+
+        int64_t v = decode_point(s->decode, p.raw);
+        int64_t area = clamp_diff(s->anchor_t - c_t) * clamp_diff(v - s->anchor_v) -
+                       clamp_diff(s->anchor_t - (int64_t)p.timestamp) * clamp_diff(c_v - s->anchor_v);
+        if (area < 0) {
+            area = -area;
+        }
+        if (area > best_area) {
+            best_area = area;
+            *out = p;
+            found = true;
+        }
+    }
+
+    if (found) {
+        s->have_anchor = true;
+        s->anchor_t = out->timestamp;
+        s->anchor_v = decode_point(s->decode, out->raw);
+    }
+    return found;
+}
+
+static esp_err_t query_raw(uint16_t slot, const modbus_decode_t *decode, uint32_t from_ms, uint32_t to_ms,
+                           modbus_history_row_cb cb, void *ctx)
+{
+    modbus_history_cursor_t *cursor = malloc(sizeof(modbus_history_cursor_t));
+    if (cursor == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    esp_err_t err = ESP_OK;
+    bool present = true;
+    modbus_history_point_t p;
+    modbus_history_cursor_init(cursor, slot, from_ms, to_ms);
+    while (err == ESP_OK && modbus_history_cursor_peek(cursor, &p)) {
+        modbus_history_cursor_advance(cursor);
+        modbus_decoded_t value;
+        modbus_decode_run(decode, p.raw, &value);
+        err = cb(ctx, p.timestamp, &value, &present, 1);
+    }
+
+    free(cursor);
+    return err;
+}
+
+esp_err_t modbus_history_query(const uint16_t *slots, const modbus_decode_t *const *decoders, size_t count,
+                               uint32_t from_ms, uint32_t to_ms, uint16_t max_points,
+                               modbus_history_row_cb cb, void *ctx)
+{
+    if (count == 0 || count > MODBUS_HISTORY_MAX_SERIES || from_ms > to_ms) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (max_points == 0) {
+        if (count == 1) {
+            return query_raw(slots[0], decoders[0], from_ms, to_ms, cb, ctx);
+        }
+        max_points = MODBUS_HISTORY_DEFAULT_POINTS;
+    }
+
+    lttb_series_t *series = malloc(count * sizeof(lttb_series_t));
+    if (series == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    // Narrow the range to the data actually held so buckets aren't wasted
+    uint32_t first = UINT32_MAX;
+    uint32_t last = 0;
+    for (size_t i = 0; i < count; i++) {
+        memset(&series[i], 0, sizeof(lttb_series_t));
+        series[i].decode = decoders[i];
+        modbus_history_cursor_init(&series[i].pick, slots[i], from_ms, to_ms);
+        modbus_history_cursor_init(&series[i].ahead, slots[i], from_ms, to_ms);
+
+        modbus_history_point_t p;
+        if (modbus_history_cursor_peek(&series[i].pick, &p) && p.timestamp < first) {
+            first = p.timestamp;
+        }
+        portENTER_CRITICAL(&history_mux);
+        const history_ring_t *ring = find_ring(slots[i]);
+        uint32_t end_ms = ring == NULL ? 0 :
+                          ring->blocks[ring->head_seq % MODBUS_HISTORY_BLOCKS].end_ts * MODBUS_HISTORY_RESOLUTION_MS;
+        portEXIT_CRITICAL(&history_mux);
+        if (end_ms > last) {
+            last = end_ms;
+        }
+    }
+
+    esp_err_t err = ESP_OK;
+    if (first != UINT32_MAX) {
+        from_ms = first;
+        to_ms = last < to_ms ? last : to_ms;
+
+        uint32_t span = to_ms - from_ms + 1;
+        uint32_t width = (span + max_points - 1) / max_points;
+        uint16_t buckets = (span + width - 1) / width;
+
+        // The ahead cursors start one bucket in, past bucket 0
+        modbus_history_point_t p;
+        for (size_t i = 0; i < count; i++) {
+            while (modbus_history_cursor_peek(&series[i].ahead, &p) && p.timestamp < from_ms + width) {
+                modbus_history_cursor_advance(&series[i].ahead);
+            }
+        }
+
+        modbus_decoded_t values[MODBUS_HISTORY_MAX_SERIES];
+        bool present[MODBUS_HISTORY_MAX_SERIES];
+        for (uint16_t b = 0; b < buckets && err == ESP_OK; b++) {
+            uint32_t start = from_ms + b * width;
+            uint32_t end = b + 1 == buckets ? to_ms + 1 : start + width;
+            uint32_t next_end = end + width;
+            uint32_t timestamp = start + width / 2;
+            bool any = false;
+
+            for (size_t i = 0; i < count; i++) {
+                present[i] = lttb_select(&series[i], start, end, next_end, b + 1 == buckets, &p);
+                if (present[i]) {
+                    modbus_decode_run(series[i].decode, p.raw, &values[i]);
+                    any = true;
+                    if (count == 1) {
+                        timestamp = p.timestamp;
+                    }
+                }
+            }
+
+            if (any) {
+                err = cb(ctx, timestamp, values, present, count);
+            }
+        }
+    }
+
+    free(series);
+    return err;
+}
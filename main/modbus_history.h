@@ -0,0 +1,80 @@
+#ifndef MODBUS_HISTORY_H
+#define MODBUS_HISTORY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "modbus_decode.h"
+
+// A register with history enabled gets a fixed ring of compressed blocks from
+// a pool of MODBUS_HISTORY_RINGS when it first records; the device manager
+// lets no more registers than that enable it. When a ring is full its oldest
+// block is dropped, so memory use never grows.
+#define MODBUS_HISTORY_BLOCK_BYTES 256
+#define MODBUS_HISTORY_BLOCKS 8
+#define MODBUS_HISTORY_RINGS 16
+#define MODBUS_HISTORY_RESOLUTION_MS 100
+#define MODBUS_HISTORY_MAX_SERIES 4
+#define MODBUS_HISTORY_DEFAULT_POINTS 500
+
+// Compressed block: the first sample is stored verbatim in the header, the
+// rest as Gorilla-style delta-of-delta timestamps and XOR'd values.
+typedef struct {
+    uint32_t seq;
+    uint32_t start_ts;          // In MODBUS_HISTORY_RESOLUTION_MS units
+    uint32_t end_ts;
+    uint32_t first_value;
+    uint16_t count;
+    uint16_t bits;
+    uint8_t data[MODBUS_HISTORY_BLOCK_BYTES];
+} modbus_history_block_t;
+
+typedef struct {
+    uint32_t timestamp;         // Milliseconds since boot, like modbus_value_t
+    uint32_t raw;
+} modbus_history_point_t;
+
+// Reads one slot's samples in time order from private block copies, so the
+// poller is only held up for the copy of each block.
+typedef struct {
+    uint16_t slot;
+    uint32_t to;
+    uint32_t seq;
+    bool loaded;
+    bool last_block;
+    bool done;
+    bool has_peek;
+    modbus_history_point_t peek;
+    modbus_history_block_t block;
+    uint16_t index;
+    uint16_t bitpos;
+    uint32_t prev_ts;
+    int32_t prev_delta;
+    uint32_t prev_value;
+    uint8_t leading;
+    uint8_t trailing;
+} modbus_history_cursor_t;
+
+// Called once per output row; values are fixed point as decoded by the
+// series' decode program. Returning an error stops the query.
+typedef esp_err_t (*modbus_history_row_cb)(void *ctx, uint32_t timestamp, const modbus_decoded_t *values,
+                                           const bool *present, size_t count);
+
+esp_err_t modbus_history_init(void);
+void modbus_history_record(uint16_t slot, uint32_t timestamp_ms, uint32_t raw);
+void modbus_history_reset(uint16_t slot);
+
+void modbus_history_cursor_init(modbus_history_cursor_t *cursor, uint16_t slot, uint32_t from_ms, uint32_t to_ms);
+bool modbus_history_cursor_peek(modbus_history_cursor_t *cursor, modbus_history_point_t *point);
+void modbus_history_cursor_advance(modbus_history_cursor_t *cursor);
+
+// Streams [from_ms, to_ms] for up to MODBUS_HISTORY_MAX_SERIES slots. With
+// max_points == 0 a single series is returned sample by sample; otherwise the
+// range is split into max_points time buckets, each series is downsampled
+// with Largest-Triangle-Three-Buckets and the columns are aligned per bucket.
+esp_err_t modbus_history_query(const uint16_t *slots, const modbus_decode_t *const *decoders, size_t count,
+                               uint32_t from_ms, uint32_t to_ms, uint16_t max_points,
+                               modbus_history_row_cb cb, void *ctx);
+
+#endif
@@ -6,6 +6,7 @@
 #include "driver/gpio.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/semphr.h"
 #include "esp_log.h"
 #include "esp_timer.h"
 #include <inttypes.h>
@@ -22,6 +23,31 @@ static TaskHandle_t polling_task_handle = NULL;
 static volatile bool polling_active = false;
 static volatile uint32_t last_error = 0;
 static bool modbus_logging_enabled = false;
+// Serializes transactions from the poller and the web handlers; recursive so
+// a caller can hold the bus across several transactions
+static SemaphoreHandle_t bus_mutex = NULL;
+// Moving average of whole transactions, retries included: the bus time a
+// transaction really costs. Starts from a typical 9600 baud exchange.
+static volatile uint32_t avg_transaction_us = 50000;
+
+// A block read in progress. Callers wanting a block it covers take a
+// reference and wait on ready; the caller that started it posts ready once
+// per waiter and the slot is free again when the last reference goes.
+typedef struct {
+    bool active;
+    bool done;
+    uint8_t device_id;
+    register_type_t type;
+    uint16_t address;
+    uint16_t count;
+    uint8_t refs;
+    SemaphoreHandle_t ready;
+    modbus_read_info_t info;
+    uint16_t values[MODBUS_READ_MAX_COUNT];
+} inflight_read_t;
+
+static inflight_read_t inflight_reads[MODBUS_READ_MAX_INFLIGHT];
+static portMUX_TYPE inflight_mux = portMUX_INITIALIZER_UNLOCKED;
 
 static void log_hex_dump(const uint8_t *data, uint16_t len)
 {
@@ -153,10 +179,20 @@ static modbus_result_t receive_response(uint8_t *frame, uint16_t *frame_len)
     return MODBUS_RESULT_OK;
 }
 
-static modbus_result_t execute_modbus_transaction(uint8_t device_id, uint8_t function,
-                                                uint16_t address, uint16_t quantity,
-                                                const uint8_t *data, uint16_t data_len,
-                                                uint8_t *response_frame, uint16_t *response_len)
+// Folds a finished transaction into the average (weight 1/8); returns its
+// duration in microseconds. Only called with the bus held.
+static int64_t record_transaction_time(int64_t start_us)
+{
+    int64_t elapsed = esp_timer_get_time() - start_us;
+    uint32_t sample = elapsed > UINT32_MAX / 8 ? UINT32_MAX / 8 : (uint32_t)elapsed;
+    avg_transaction_us = avg_transaction_us - avg_transaction_us / 8 + sample / 8;
+    return elapsed;
+}
+
+static modbus_result_t run_transaction(uint8_t device_id, uint8_t function,
+                                       uint16_t address, uint16_t quantity,
+                                       const uint8_t *data, uint16_t data_len,
+                                       uint8_t *response_frame, uint16_t *response_len)
 {
     int64_t transaction_start = esp_timer_get_time();
 
@@ -214,7 +250,7 @@ static modbus_result_t execute_modbus_transaction(uint8_t device_id, uint8_t fun
         ESP_LOGI(TAG, "ATTEMPT %d/%d: DevID=%d, FC=0x%02X, Addr=%d, Result=OK",
                   retry + 1, modbus_config.retry_attempts, device_id, function, address);
 
-        int64_t total_time = (esp_timer_get_time() - transaction_start) / 1000;
+        int64_t total_time = record_transaction_time(transaction_start) / 1000;
         ESP_LOGI(TAG, "TRANSACTION SUCCESS: DevID=%d, FC=0x%02X, Attempts=%d, Total Time=%lld ms",
                   device_id, function, retry + 1, total_time);
 
@@ -222,13 +258,25 @@ static modbus_result_t execute_modbus_transaction(uint8_t device_id, uint8_t fun
         return MODBUS_RESULT_OK;
     }
 
-    int64_t total_time = (esp_timer_get_time() - transaction_start) / 1000;
+    int64_t total_time = record_transaction_time(transaction_start) / 1000;
     ESP_LOGE(TAG, "TRANSACTION FAILED: DevID=%d, FC=0x%02X, Attempts=%d, Total Time=%lld ms",
               device_id, function, modbus_config.retry_attempts, total_time);
 
     return result;
 }
 
+static modbus_result_t execute_modbus_transaction(uint8_t device_id, uint8_t function,
+                                                uint16_t address, uint16_t quantity,
+                                                const uint8_t *data, uint16_t data_len,
+                                                uint8_t *response_frame, uint16_t *response_len)
+{
+    modbus_manager_lock_bus();
+    modbus_result_t result = run_transaction(device_id, function, address, quantity, data, data_len,
+                                             response_frame, response_len);
+    modbus_manager_unlock_bus();
+    return result;
+}
+
 esp_err_t modbus_manager_init(modbus_config_t *config)
 {
     if (modbus_config.initialized) {
@@ -248,6 +296,20 @@ esp_err_t modbus_manager_init(modbus_config_t *config)
         memcpy(&modbus_config, config, sizeof(modbus_config_t));
     }
 
+    bus_mutex = xSemaphoreCreateRecursiveMutex();
+    if (bus_mutex == NULL) {
+        ESP_LOGE(TAG, "Failed to create bus mutex");
+        return ESP_ERR_NO_MEM;
+    }
+    for (int i = 0; i < MODBUS_READ_MAX_INFLIGHT; i++) {
+        // Waiters are HTTP workers and the poller, far fewer than this
+        inflight_reads[i].ready = xSemaphoreCreateCounting(16, 0);
+        if (inflight_reads[i].ready == NULL) {
+            ESP_LOGE(TAG, "Failed to create read semaphore");
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
     gpio_init();
     uart_init();
 
@@ -288,6 +350,20 @@ bool modbus_manager_is_initialized(void)
     return modbus_config.initialized;
 }
 
+void modbus_manager_lock_bus(void)
+{
+    if (bus_mutex != NULL) {
+        xSemaphoreTakeRecursive(bus_mutex, portMAX_DELAY);
+    }
+}
+
+void modbus_manager_unlock_bus(void)
+{
+    if (bus_mutex != NULL) {
+        xSemaphoreGiveRecursive(bus_mutex);
+    }
+}
+
 modbus_result_t modbus_read_holding_registers(uint8_t device_id, uint16_t address,
                                            uint16_t count, uint16_t *values)
 {
@@ -377,6 +453,12 @@ modbus_result_t modbus_read_coils(uint8_t device_id, uint16_t address,
         return MODBUS_RESULT_INVALID_RESPONSE;
     }
 
+    // One bit per coil; anything else is a malformed reply and must not be
+    // copied into the caller's count-sized buffer
+    if (response.byte_count != (count + 7) / 8) {
+        return MODBUS_RESULT_INVALID_RESPONSE;
+    }
+
     memcpy(values, response.data, response.byte_count);
     return MODBUS_RESULT_OK;
 }
@@ -403,10 +485,127 @@ modbus_result_t modbus_read_discrete_inputs(uint8_t device_id, uint16_t address,
         return MODBUS_RESULT_INVALID_RESPONSE;
     }
 
+    // One bit per input; anything else is a malformed reply and must not be
+    // copied into the caller's count-sized buffer
+    if (response.byte_count != (count + 7) / 8) {
+        return MODBUS_RESULT_INVALID_RESPONSE;
+    }
+
     memcpy(values, response.data, response.byte_count);
     return MODBUS_RESULT_OK;
 }
 
+// Sends the read for a block and unpacks it to one value per address
+static void read_block(uint8_t device_id, register_type_t type, uint16_t address, uint16_t count,
+                       uint16_t *values, modbus_read_info_t *info)
+{
+    uint8_t bits[MODBUS_READ_MAX_COUNT / 8] = {0};
+
+    // Held across the transaction so last_error is still this read's
+    modbus_manager_lock_bus();
+    switch (type) {
+        case REGISTER_TYPE_HOLDING:
+            info->result = modbus_read_holding_registers(device_id, address, count, values);
+            break;
+        case REGISTER_TYPE_INPUT:
+            info->result = modbus_read_input_registers(device_id, address, count, values);
+            break;
+        case REGISTER_TYPE_COIL:
+            info->result = modbus_read_coils(device_id, address, count, bits);
+            break;
+        case REGISTER_TYPE_DISCRETE:
+            info->result = modbus_read_discrete_inputs(device_id, address, count, bits);
+            break;
+        default:
+            info->result = MODBUS_RESULT_INVALID_RESPONSE;
+            break;
+    }
+    info->exception = info->result == MODBUS_RESULT_EXCEPTION ? last_error : 0;
+    modbus_manager_unlock_bus();
+
+    info->timestamp = xTaskGetTickCount() * portTICK_PERIOD_MS;
+    info->shared = false;
+    if (info->result == MODBUS_RESULT_OK && (type == REGISTER_TYPE_COIL || type == REGISTER_TYPE_DISCRETE)) {
+        for (uint16_t i = 0; i < count; i++) {
+            values[i] = (bits[i / 8] >> (i % 8)) & 1;
+        }
+    }
+}
+
+static void put_inflight(inflight_read_t *read)
+{
+    portENTER_CRITICAL(&inflight_mux);
+    if (--read->refs == 0) {
+        read->active = false;
+    }
+    portEXIT_CRITICAL(&inflight_mux);
+}
+
+modbus_result_t modbus_read_shared(uint8_t device_id, register_type_t type, uint16_t address,
+                                   uint16_t count, uint16_t *values, modbus_read_info_t *info)
+{
+    if (count == 0 || count > MODBUS_READ_MAX_COUNT) {
+        info->result = MODBUS_RESULT_INVALID_RESPONSE;
+        info->exception = 0;
+        info->timestamp = 0;
+        info->shared = false;
+        return info->result;
+    }
+
+    inflight_read_t *joined = NULL;
+    inflight_read_t *started = NULL;
+    portENTER_CRITICAL(&inflight_mux);
+    for (int i = 0; i < MODBUS_READ_MAX_INFLIGHT && joined == NULL; i++) {
+        inflight_read_t *read = &inflight_reads[i];
+        if (read->active && !read->done && read->device_id == device_id && read->type == type &&
+            read->address <= address && (uint32_t)address + count <= (uint32_t)read->address + read->count) {
+            read->refs++;
+            joined = read;
+        }
+    }
+    for (int i = 0; i < MODBUS_READ_MAX_INFLIGHT && joined == NULL && started == NULL; i++) {
+        inflight_read_t *read = &inflight_reads[i];
+        if (!read->active) {
+            read->active = true;
+            read->done = false;
+            read->device_id = device_id;
+            read->type = type;
+            read->address = address;
+            read->count = count;
+            read->refs = 1;
+            started = read;
+        }
+    }
+    portEXIT_CRITICAL(&inflight_mux);
+
+    if (joined != NULL) {
+        xSemaphoreTake(joined->ready, portMAX_DELAY);
+        *info = joined->info;
+        info->shared = true;
+        memcpy(values, &joined->values[address - joined->address], count * sizeof(uint16_t));
+        put_inflight(joined);
+        return info->result;
+    }
+    if (started == NULL) {
+        // Every slot busy: read unshared
+        read_block(device_id, type, address, count, values, info);
+        return info->result;
+    }
+
+    read_block(device_id, type, address, count, started->values, &started->info);
+    portENTER_CRITICAL(&inflight_mux);
+    started->done = true;
+    uint8_t waiters = started->refs - 1;
+    portEXIT_CRITICAL(&inflight_mux);
+    *info = started->info;
+    memcpy(values, started->values, count * sizeof(uint16_t));
+    for (uint8_t i = 0; i < waiters; i++) {
+        xSemaphoreGive(started->ready);
+    }
+    put_inflight(started);
+    return info->result;
+}
+
 modbus_result_t modbus_write_single_register(uint8_t device_id, uint16_t address,
                                            uint16_t value)
 {
@@ -414,11 +613,12 @@ modbus_result_t modbus_write_single_register(uint8_t device_id, uint16_t address
         return MODBUS_RESULT_NOT_INITIALIZED;
     }
 
+    uint8_t data[2] = { value >> 8, value & 0xFF };
     uint8_t response_frame[MODBUS_MAX_FRAME_LEN];
     uint16_t response_len = 0;
 
     modbus_result_t result = execute_modbus_transaction(device_id, MODBUS_FC_WRITE_SINGLE_REGISTER,
-                                                     address, 1, (uint8_t*)&value, 2,
+                                                     address, 1, data, sizeof(data),
                                                      response_frame, &response_len);
     return result;
 }
@@ -430,11 +630,20 @@ modbus_result_t modbus_write_multiple_registers(uint8_t device_id, uint16_t addr
         return MODBUS_RESULT_NOT_INITIALIZED;
     }
 
+    if (count == 0 || count > MODBUS_MAX_WRITE_REGISTERS) {
+        return MODBUS_RESULT_INVALID_RESPONSE;
+    }
+
+    uint8_t data[MODBUS_MAX_WRITE_REGISTERS * 2];
+    for (uint16_t i = 0; i < count; i++) {
+        data[i * 2] = values[i] >> 8;
+        data[i * 2 + 1] = values[i] & 0xFF;
+    }
     uint8_t response_frame[MODBUS_MAX_FRAME_LEN];
     uint16_t response_len = 0;
 
     modbus_result_t result = execute_modbus_transaction(device_id, MODBUS_FC_WRITE_MULTIPLE_REGISTERS,
-                                                     address, count, (uint8_t*)values, count * 2,
+                                                     address, count, data, count * 2,
                                                      response_frame, &response_len);
     return result;
 }
@@ -466,8 +675,9 @@ modbus_result_t modbus_write_multiple_coils(uint8_t device_id, uint16_t address,
     uint8_t response_frame[MODBUS_MAX_FRAME_LEN];
     uint16_t response_len = 0;
 
+    // values holds the coils packed LSB first, as on the wire
     modbus_result_t result = execute_modbus_transaction(device_id, MODBUS_FC_WRITE_MULTIPLE_COILS,
-                                                     address, count, values, count,
+                                                     address, count, values, (count + 7) / 8,
                                                      response_frame, &response_len);
     return result;
 }
@@ -484,68 +694,56 @@ static void polling_task(void *pvParameters)
         }
 
         vTaskDelay(pdMS_TO_TICKS(1));
-        uint8_t count;
-        modbus_device_t *devices = modbus_list_devices(&count);
-        if (devices != NULL) {
-            for (uint8_t i = 0; i < count && polling_active; i++) {
-                if (!devices[i].enabled) {
+        // Pin one configuration snapshot for the whole pass; edits made
+        // meanwhile are picked up on the next pass.
+        const modbus_snapshot_t *snapshot = modbus_snapshot_acquire();
+        const modbus_device_t *devices = snapshot->devices;
+        for (uint8_t i = 0; i < snapshot->device_count && polling_active; i++) {
+            if (!devices[i].enabled) {
+                continue;
+            }
+
+            for (uint16_t j = 0; j < devices[i].register_count && polling_active; j++) {
+                // Virtual registers are computed by the device manager as
+                // their inputs update
+                if (devices[i].registers[j].type == REGISTER_TYPE_VIRTUAL) {
                     continue;
                 }
 
-                for (uint8_t j = 0; j < devices[i].register_count && polling_active; j++) {
-                    uint16_t value;
-                    modbus_result_t result = MODBUS_RESULT_OK;
-
-                    switch (devices[i].registers[j].type) {
-                        case REGISTER_TYPE_HOLDING:
-                            result = modbus_read_holding_registers(devices[i].device_id,
-                                                                devices[i].registers[j].address, 1, &value);
-                            break;
-                        case REGISTER_TYPE_INPUT:
-                            result = modbus_read_input_registers(devices[i].device_id,
-                                                               devices[i].registers[j].address, 1, &value);
-                            break;
-                        case REGISTER_TYPE_COIL:
-                            {
-                                uint8_t coil_val;
-                                result = modbus_read_coils(devices[i].device_id,
-                                                          devices[i].registers[j].address, 1, &coil_val);
-                                value = coil_val;
-                            }
-                            break;
-                        case REGISTER_TYPE_DISCRETE:
-                            {
-                                uint8_t discrete_val;
-                                result = modbus_read_discrete_inputs(devices[i].device_id,
-                                                                devices[i].registers[j].address, 1, &discrete_val);
-                                value = discrete_val;
-                            }
-                            break;
-                    }
-
-                    devices[i].poll_count++;
-                    if (result == MODBUS_RESULT_OK) {
-                        modbus_update_register_value(devices[i].device_id,
-                                                   devices[i].registers[j].address, value);
-                        devices[i].last_seen = xTaskGetTickCount() * portTICK_PERIOD_MS;
-                        devices[i].status = DEVICE_STATUS_ONLINE;
-                    } else {
-                        devices[i].error_count++;
-                        devices[i].last_error = last_error;
-                        devices[i].status = DEVICE_STATUS_ERROR;
-                        ESP_LOGW(TAG, "Failed to read register %d from device %d: %s",
-                                  devices[i].registers[j].address, devices[i].device_id,
-                                  modbus_result_to_string(result));
-                    }
-
-                    vTaskDelay(pdMS_TO_TICKS(10));
+                // 32-bit formats are read in a single transaction so both
+                // words come from the same device-side sample. Shared reads
+                // let an on-demand request for the same block ride along.
+                register_type_t type = devices[i].registers[j].type;
+                bool bits = type == REGISTER_TYPE_COIL || type == REGISTER_TYPE_DISCRETE;
+                uint8_t words = bits ? 1 : modbus_format_word_count(devices[i].registers[j].format);
+                uint16_t regs[2] = {0};
+                modbus_read_info_t info;
+                modbus_result_t result = modbus_read_shared(devices[i].device_id, type,
+                                                            devices[i].registers[j].address, words, regs, &info);
+                uint32_t value = words == 2 ? ((uint32_t)regs[0] << 16) | regs[1] : regs[0];
+
+                if (result == MODBUS_RESULT_OK) {
+                    modbus_update_register_value(devices[i].device_id,
+                                               devices[i].registers[j].type,
+                                               devices[i].registers[j].address, value);
+                    modbus_record_poll_result(devices[i].device_id, true, 0);
+                } else {
+                    // The global last_error may belong to another client's
+                    // read by now; info carries this read's exception
+                    modbus_record_poll_result(devices[i].device_id, false, info.exception);
+                    ESP_LOGW(TAG, "Failed to read register %d from device %d: %s",
+                              devices[i].registers[j].address, devices[i].device_id,
+                              modbus_result_to_string(result));
                 }
 
-                if (devices[i].register_count > 0) {
-                    vTaskDelay(pdMS_TO_TICKS(devices[i].poll_interval_ms));
-                }
+                vTaskDelay(pdMS_TO_TICKS(10));
+            }
+
+            if (devices[i].register_count > 0) {
+                vTaskDelay(pdMS_TO_TICKS(devices[i].poll_interval_ms));
             }
         }
+        modbus_snapshot_release(snapshot);
     }
 
     ESP_LOGI(TAG, "Modbus polling task stopped");
@@ -585,6 +783,11 @@ bool modbus_manager_is_polling(void)
     return polling_active;
 }
 
+uint32_t modbus_manager_transaction_time_us(void)
+{
+    return avg_transaction_us;
+}
+
 uint32_t modbus_manager_get_last_error(void)
 {
     return last_error;
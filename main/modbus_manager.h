@@ -5,6 +5,7 @@
 #include <stdbool.h>
 #include "esp_err.h"
 #include "driver/gpio.h"
+#include "modbus_devices.h"
 
 #define MODBUS_DEFAULT_TX_PIN 21
 #define MODBUS_DEFAULT_RX_PIN 20
@@ -13,6 +14,11 @@
 #define MODBUS_DEFAULT_BAUDRATE 9600
 #define MODBUS_DEFAULT_TIMEOUT_MS 1000
 #define MODBUS_MAX_RETRY_ATTEMPTS 3
+// Largest FC16 payload that fits the frame buffer
+#define MODBUS_MAX_WRITE_REGISTERS 120
+// Largest block modbus_read_shared() reads in one transaction
+#define MODBUS_READ_MAX_COUNT 64
+#define MODBUS_READ_MAX_INFLIGHT 4
 
 typedef enum {
     MODBUS_RESULT_OK = 0,
@@ -24,6 +30,14 @@ typedef enum {
     MODBUS_RESULT_NOT_INITIALIZED
 } modbus_result_t;
 
+// Outcome of modbus_read_shared()
+typedef struct {
+    modbus_result_t result;
+    uint8_t exception;          // Exception code if result is MODBUS_RESULT_EXCEPTION
+    uint32_t timestamp;         // Milliseconds since boot when the response arrived
+    bool shared;                // Answered by a transaction another caller started
+} modbus_read_info_t;
+
 typedef struct {
     int tx_pin;
     int rx_pin;
@@ -39,6 +53,11 @@ esp_err_t modbus_manager_init(modbus_config_t *config);
 esp_err_t modbus_manager_deinit(void);
 bool modbus_manager_is_initialized(void);
 
+// Holds the bus across several transactions so the poller can't interleave;
+// the transaction functions below take it themselves
+void modbus_manager_lock_bus(void);
+void modbus_manager_unlock_bus(void);
+
 modbus_result_t modbus_read_holding_registers(uint8_t device_id, uint16_t address, 
                                            uint16_t count, uint16_t *values);
 modbus_result_t modbus_read_input_registers(uint8_t device_id, uint16_t address,
@@ -48,6 +67,14 @@ modbus_result_t modbus_read_coils(uint8_t device_id, uint16_t address,
 modbus_result_t modbus_read_discrete_inputs(uint8_t device_id, uint16_t address,
                                           uint16_t count, uint8_t *values);
 
+// Reads count registers or bits (one value per address, 0/1 for bits) with
+// single-flight semantics: a caller asking for a block that is already being
+// read, by the poller or another request, waits for that transaction instead
+// of sending its own. Up to MODBUS_READ_MAX_INFLIGHT blocks are tracked;
+// beyond that reads simply aren't shared.
+modbus_result_t modbus_read_shared(uint8_t device_id, register_type_t type, uint16_t address,
+                                   uint16_t count, uint16_t *values, modbus_read_info_t *info);
+
 modbus_result_t modbus_write_single_register(uint8_t device_id, uint16_t address,
                                            uint16_t value);
 modbus_result_t modbus_write_multiple_registers(uint8_t device_id, uint16_t address,
@@ -61,6 +88,9 @@ esp_err_t modbus_manager_start_polling(void);
 esp_err_t modbus_manager_stop_polling(void);
 bool modbus_manager_is_polling(void);
 
+// Average bus time of one transaction including retries, in microseconds
+uint32_t modbus_manager_transaction_time_us(void);
+
 uint32_t modbus_manager_get_last_error(void);
 const char* modbus_result_to_string(modbus_result_t result);
 
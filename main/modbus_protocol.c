@@ -57,8 +57,9 @@ esp_err_t modbus_build_request(uint8_t device_id, uint8_t function,
             frame[index++] = data[0] ? 0xFF : 0x00;
             frame[index++] = 0x00;
         } else {
-            frame[index++] = (data[0] >> 8) & 0xFF;
-            frame[index++] = data[0] & 0xFF;
+            // Register value in wire order
+            frame[index++] = data[0];
+            frame[index++] = data[1];
         }
     } else {
         frame[index++] = (address >> 8) & 0xFF;
@@ -67,18 +68,13 @@ esp_err_t modbus_build_request(uint8_t device_id, uint8_t function,
         frame[index++] = quantity & 0xFF;
 
         if (data != NULL && data_len > 0) {
-            if (function == MODBUS_FC_WRITE_MULTIPLE_REGISTERS) {
-                frame[index++] = data_len * 2;
-                for (uint16_t i = 0; i < data_len; i++) {
-                    frame[index++] = (data[i] >> 8) & 0xFF;
-                    frame[index++] = data[i] & 0xFF;
-                }
-            } else if (function == MODBUS_FC_WRITE_MULTIPLE_COILS) {
-                frame[index++] = data_len;
-                for (uint16_t i = 0; i < data_len; i++) {
-                    frame[index++] = data[i];
-                }
+            // FC15/FC16 payload, already in wire order, after its byte count
+            if (data_len > MODBUS_MAX_FRAME_LEN - 9) {
+                return ESP_ERR_INVALID_SIZE;
             }
+            frame[index++] = data_len;
+            memcpy(&frame[index], data, data_len);
+            index += data_len;
         }
     }
     
@@ -0,0 +1,247 @@
+#include "modbus_rollup.h"
+#include "modbus_devices.h"
+#include <string.h>
+#include <stdlib.h>
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+
+static const char *TAG = "MODBUS_ROLLUP";
+
+typedef struct {
+    uint32_t width_ms;
+    uint16_t length;
+    uint16_t offset;            // First bucket of the tier in rollup_ring_t.buckets
+} tier_info_t;
+
+static const tier_info_t tiers[ROLLUP_TIER_COUNT] = {
+    [ROLLUP_TIER_1M] = { 60 * 1000, MODBUS_ROLLUP_1M_BUCKETS, 0 },
+    [ROLLUP_TIER_15M] = { 15 * 60 * 1000, MODBUS_ROLLUP_15M_BUCKETS, MODBUS_ROLLUP_1M_BUCKETS },
+    [ROLLUP_TIER_1H] = { 60 * 60 * 1000, MODBUS_ROLLUP_1H_BUCKETS,
+                         MODBUS_ROLLUP_1M_BUCKETS + MODBUS_ROLLUP_15M_BUCKETS },
+};
+#define ROLLUP_BUCKETS (MODBUS_ROLLUP_1M_BUCKETS + MODBUS_ROLLUP_15M_BUCKETS + MODBUS_ROLLUP_1H_BUCKETS)
+
+// Values are stored in the register's fixed-point units, clamped to 32 bits.
+// Closed buckets keep their mean; the open bucket of each tier keeps a sum.
+// Sample counts live apart from the values so a bucket takes 18 bytes rather
+// than 20 with padding; a count of 0 marks a bucket empty, and buckets the
+// head skips over are emptied that way as it advances.
+typedef struct {
+    int32_t min;
+    int32_t max;
+    int32_t mean;
+    int32_t last;
+} rollup_bucket_t;
+
+typedef struct {
+    uint32_t head;              // Bucket number (timestamp / width) being filled
+    uint16_t filled;
+    int64_t sum;
+} rollup_tier_t;
+
+typedef struct {
+    uint8_t decimals;
+    rollup_tier_t tiers[ROLLUP_TIER_COUNT];
+    rollup_bucket_t buckets[ROLLUP_BUCKETS];
+    uint16_t counts[ROLLUP_BUCKETS];
+} rollup_ring_t;
+
+static rollup_ring_t *rings[MODBUS_MAX_VALUE_SLOTS];
+static uint16_t ring_count;
+static portMUX_TYPE rollup_mux = portMUX_INITIALIZER_UNLOCKED;
+
+uint32_t modbus_rollup_width_ms(modbus_rollup_tier_t tier)
+{
+    return tiers[tier].width_ms;
+}
+
+uint32_t modbus_rollup_span_ms(modbus_rollup_tier_t tier)
+{
+    return tiers[tier].width_ms * tiers[tier].length;
+}
+
+static inline uint16_t bucket_index(modbus_rollup_tier_t tier, uint32_t number)
+{
+    return tiers[tier].offset + number % tiers[tier].length;
+}
+
+static void close_bucket(rollup_ring_t *ring, modbus_rollup_tier_t tier)
+{
+    rollup_tier_t *state = &ring->tiers[tier];
+    uint16_t index = bucket_index(tier, state->head);
+    if (ring->counts[index] > 0) {
+        ring->buckets[index].mean = (int32_t)(state->sum / ring->counts[index]);
+    }
+    state->sum = 0;
+}
+
+static void tier_record(rollup_ring_t *ring, modbus_rollup_tier_t tier, uint32_t timestamp_ms, int32_t value)
+{
+    rollup_tier_t *state = &ring->tiers[tier];
+    uint32_t number = timestamp_ms / tiers[tier].width_ms;
+
+    if (state->filled == 0) {
+        state->head = number;
+        state->filled = 1;
+        state->sum = 0;
+    } else if (number < state->head) {
+        // A late sample for a closed bucket
+        return;
+    } else if (number > state->head) {
+        close_bucket(ring, tier);
+        uint32_t skip = number - state->head;
+        // At most one lap of counts to clear, so this stays short
+        for (uint32_t n = 1; n <= skip && n <= tiers[tier].length; n++) {
+            ring->counts[bucket_index(tier, state->head + n)] = 0;
+        }
+        state->head = number;
+        state->filled = state->filled + skip < tiers[tier].length ? state->filled + skip : tiers[tier].length;
+    }
+
+    uint16_t index = bucket_index(tier, number);
+    rollup_bucket_t *bucket = &ring->buckets[index];
+    if (ring->counts[index] == 0) {
+        bucket->min = value;
+        bucket->max = value;
+    } else {
+        bucket->min = value < bucket->min ? value : bucket->min;
+        bucket->max = value > bucket->max ? value : bucket->max;
+    }
+    bucket->last = value;
+    if (ring->counts[index] < UINT16_MAX) {
+        ring->counts[index]++;
+        state->sum += value;
+    }
+}
+
+// A new scale makes the stored aggregates meaningless, and once the
+// millisecond clock wraps the bucket numbers start over
+static bool ring_usable(const rollup_ring_t *ring, uint32_t timestamp_ms, uint8_t decimals)
+{
+    const rollup_tier_t *state = &ring->tiers[ROLLUP_TIER_1M];
+    uint32_t number = timestamp_ms / tiers[ROLLUP_TIER_1M].width_ms;
+    return ring->decimals == decimals &&
+           !(state->filled > 0 && number + tiers[ROLLUP_TIER_1M].length <= state->head);
+}
+
+void modbus_rollup_record(uint16_t slot, uint32_t timestamp_ms, const modbus_decoded_t *value)
+{
+    if (slot >= MODBUS_MAX_VALUE_SLOTS) {
+        return;
+    }
+
+    int32_t v = value->value > INT32_MAX ? INT32_MAX : (value->value < INT32_MIN ? INT32_MIN : (int32_t)value->value);
+
+    // At most one replacement: the ring found, or none, is swapped for a
+    // zeroed one allocated outside the critical section
+    for (int attempt = 0; attempt < 2; attempt++) {
+        bool recorded = false;
+        bool full = false;
+        portENTER_CRITICAL(&rollup_mux);
+        rollup_ring_t *ring = rings[slot];
+        if (ring != NULL && ring_usable(ring, timestamp_ms, value->decimals)) {
+            for (int tier = 0; tier < ROLLUP_TIER_COUNT; tier++) {
+                tier_record(ring, tier, timestamp_ms, v);
+            }
+            recorded = true;
+        } else if (ring == NULL) {
+            full = ring_count >= MODBUS_ROLLUP_RINGS;
+        }
+        portEXIT_CRITICAL(&rollup_mux);
+        if (recorded || full || attempt > 0) {
+            return;
+        }
+
+        rollup_ring_t *fresh = calloc(1, sizeof(rollup_ring_t));
+        if (fresh == NULL) {
+            ESP_LOGW(TAG, "No memory for rollups of slot %u", slot);
+            return;
+        }
+        fresh->decimals = value->decimals;
+
+        rollup_ring_t *unused = fresh;
+        portENTER_CRITICAL(&rollup_mux);
+        if (rings[slot] == ring && (ring != NULL || ring_count < MODBUS_ROLLUP_RINGS)) {
+            rings[slot] = fresh;
+            ring_count += ring == NULL ? 1 : 0;
+            unused = ring;
+        }
+        portEXIT_CRITICAL(&rollup_mux);
+        free(unused);
+    }
+}
+
+void modbus_rollup_reset(uint16_t slot)
+{
+    if (slot >= MODBUS_MAX_VALUE_SLOTS) {
+        return;
+    }
+
+    portENTER_CRITICAL(&rollup_mux);
+    rollup_ring_t *ring = rings[slot];
+    rings[slot] = NULL;
+    ring_count -= ring != NULL ? 1 : 0;
+    portEXIT_CRITICAL(&rollup_mux);
+    free(ring);
+}
+
+esp_err_t modbus_rollup_query(uint16_t slot, modbus_rollup_tier_t tier, uint32_t from_ms, uint32_t to_ms,
+                              modbus_rollup_cb cb, void *ctx)
+{
+    if (slot >= MODBUS_MAX_VALUE_SLOTS || tier >= ROLLUP_TIER_COUNT || from_ms > to_ms) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    uint32_t width = tiers[tier].width_ms;
+    uint32_t first = from_ms / width;
+    uint32_t last = to_ms / width;
+    esp_err_t err = ESP_OK;
+
+    for (uint32_t number = first; number <= last && err == ESP_OK; number++) {
+        // Copy one bucket at a time so the poller is never held up for long
+        rollup_bucket_t bucket;
+        uint16_t count = 0;
+        uint8_t decimals = 0;
+        int64_t sum = 0;
+        bool open = false;
+        bool held = false;
+
+        portENTER_CRITICAL(&rollup_mux);
+        rollup_ring_t *ring = rings[slot];
+        if (ring != NULL) {
+            const rollup_tier_t *state = &ring->tiers[tier];
+            if (state->filled > 0 && number <= state->head && state->head - number < state->filled) {
+                uint16_t index = bucket_index(tier, number);
+                bucket = ring->buckets[index];
+                count = ring->counts[index];
+                decimals = ring->decimals;
+                open = number == state->head;
+                sum = state->sum;
+                held = true;
+            } else if (state->filled > 0 && number < state->head) {
+                // Not held any more: continue with the oldest bucket still in the ring
+                number = state->head - state->filled;
+            } else {
+                last = number;
+            }
+        } else {
+            last = number;
+        }
+        portEXIT_CRITICAL(&rollup_mux);
+
+        if (!held || count == 0) {
+            continue;
+        }
+
+        modbus_rollup_point_t point = {
+            .start = number * width,
+            .count = count,
+            .min = { bucket.min, decimals },
+            .max = { bucket.max, decimals },
+            .mean = { open ? sum / count : bucket.mean, decimals },
+            .last = { bucket.last, decimals },
+        };
+        err = cb(ctx, &point);
+    }
+    return err;
+}
@@ -0,0 +1,49 @@
+#ifndef MODBUS_ROLLUP_H
+#define MODBUS_ROLLUP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "modbus_decode.h"
+#include "modbus_history.h"
+
+// Aggregates kept at three resolutions for the registers that keep history:
+// by default 15 minutes of 1-minute buckets, 6 hours of 15-minute buckets and
+// a week of 1-hour buckets, 18 bytes each. A ring (about 3.8 KB with these
+// depths) is allocated when such a register first reports a value.
+#define MODBUS_ROLLUP_1M_BUCKETS 15
+#define MODBUS_ROLLUP_15M_BUCKETS 24
+#define MODBUS_ROLLUP_1H_BUCKETS 168
+#define MODBUS_ROLLUP_RINGS MODBUS_HISTORY_RINGS
+
+typedef enum {
+    ROLLUP_TIER_1M = 0,
+    ROLLUP_TIER_15M,
+    ROLLUP_TIER_1H,
+    ROLLUP_TIER_COUNT
+} modbus_rollup_tier_t;
+
+typedef struct {
+    uint32_t start;             // Bucket start, milliseconds since boot
+    uint32_t count;
+    modbus_decoded_t min;
+    modbus_decoded_t max;
+    modbus_decoded_t mean;
+    modbus_decoded_t last;
+} modbus_rollup_point_t;
+
+// Called for each non-empty bucket in time order; returning an error stops
+// the query
+typedef esp_err_t (*modbus_rollup_cb)(void *ctx, const modbus_rollup_point_t *point);
+
+uint32_t modbus_rollup_width_ms(modbus_rollup_tier_t tier);
+uint32_t modbus_rollup_span_ms(modbus_rollup_tier_t tier);
+
+void modbus_rollup_record(uint16_t slot, uint32_t timestamp_ms, const modbus_decoded_t *value);
+void modbus_rollup_reset(uint16_t slot);
+
+esp_err_t modbus_rollup_query(uint16_t slot, modbus_rollup_tier_t tier, uint32_t from_ms, uint32_t to_ms,
+                              modbus_rollup_cb cb, void *ctx);
+
+#endif
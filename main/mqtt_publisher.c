@@ -0,0 +1,643 @@
+#include "mqtt_publisher.h"
+#include "modbus_devices.h"
+#include "modbus_manager.h"
+#include "modbus_batch.h"
+#include "bus_admission.h"
+#include "json_writer.h"
+#include "nvs_storage.h"
+#include "nvs.h"
+#include "mqtt_client.h"
+#include "cJSON.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include <string.h>
+#include <stdio.h>
+#include <inttypes.h>
+
+static const char *TAG = "MQTT";
+
+#define MQTT_CONFIG_KEY "mqtt_config"
+#define MQTT_BLOB_MAGIC 0x514D
+#define MQTT_BLOB_VERSION 1
+#define MQTT_TASK_STACK_SIZE 6144
+#define MQTT_TICK_MS 50
+#define MQTT_COMMAND_MAX_LEN 192
+#define MQTT_COMMAND_QUEUE_LEN 4
+#define MQTT_TOPIC_BUF_LEN (MQTT_TOPIC_MAX_LEN + 16)
+#define QUEUE_RECORD_HEADER 3
+// Admission control key for commands, apart from any client address
+#define MQTT_ADMISSION_CLIENT 0xFFFFFFFFu
+
+typedef struct {
+    uint16_t magic;
+    uint8_t version;
+    uint8_t reserved;
+} mqtt_blob_header_t;
+
+typedef struct {
+    uint16_t len;
+    char data[MQTT_COMMAND_MAX_LEN];
+} mqtt_command_t;
+
+typedef struct {
+    size_t len;
+    char data[MQTT_MAX_PAYLOAD];
+} mqtt_payload_t;
+
+// Configuration as saved, and the copy the task runs with; the task picks up
+// changes and reconnects
+static mqtt_config_t config = {
+    .qos = 0,
+    .interval_ms = MQTT_DEFAULT_INTERVAL_MS,
+    .topic = "modbus/gateway",
+};
+static mqtt_config_t active;
+static bool config_changed = false;
+static mqtt_stats_t stats;
+static portMUX_TYPE mqtt_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static TaskHandle_t task_handle = NULL;
+static QueueHandle_t command_queue = NULL;
+static esp_mqtt_client_handle_t client = NULL;
+static char status_topic[MQTT_TOPIC_BUF_LEN];
+static char write_topic[MQTT_TOPIC_BUF_LEN];
+static char result_topic[MQTT_TOPIC_BUF_LEN];
+
+// Offline queue, owned by the task: records of [device_id][length, 2 bytes
+// little endian][payload] back to back in a byte ring
+static uint8_t queue_buf[MQTT_QUEUE_BYTES];
+static size_t queue_head = 0;
+static size_t queue_used = 0;
+static uint16_t queue_count = 0;
+static uint32_t drain_tokens = 0;       // Thousandths of a message
+static uint32_t drain_updated_ms = 0;
+
+// What was last published, by value slot and device state slot, to send only
+// changes beyond the deadband
+static int64_t sent_value[MODBUS_MAX_VALUE_SLOTS];
+static bool sent_valid[MODBUS_MAX_VALUE_SLOTS];
+static uint8_t sent_status[MAX_MODBUS_DEVICES];
+static uint32_t sent_config_version = UINT32_MAX;
+static uint32_t scanned_version = 0;
+
+static mqtt_payload_t payload;
+static json_writer_t writer;
+
+static void count_stat(uint32_t *counter)
+{
+    portENTER_CRITICAL(&mqtt_mux);
+    (*counter)++;
+    portEXIT_CRITICAL(&mqtt_mux);
+}
+
+static void ring_write(size_t pos, const void *data, size_t len)
+{
+    pos %= MQTT_QUEUE_BYTES;
+    size_t first = len < MQTT_QUEUE_BYTES - pos ? len : MQTT_QUEUE_BYTES - pos;
+    memcpy(queue_buf + pos, data, first);
+    memcpy(queue_buf, (const uint8_t *)data + first, len - first);
+}
+
+static void ring_read(size_t pos, void *data, size_t len)
+{
+    pos %= MQTT_QUEUE_BYTES;
+    size_t first = len < MQTT_QUEUE_BYTES - pos ? len : MQTT_QUEUE_BYTES - pos;
+    memcpy(data, queue_buf + pos, first);
+    memcpy((uint8_t *)data + first, queue_buf, len - first);
+}
+
+// Reads the oldest record into payload; returns its device id
+static uint8_t queue_peek(mqtt_payload_t *out)
+{
+    uint8_t header[QUEUE_RECORD_HEADER];
+    ring_read(queue_head, header, sizeof(header));
+    out->len = header[1] | header[2] << 8;
+    ring_read(queue_head + sizeof(header), out->data, out->len);
+    return header[0];
+}
+
+static void queue_pop(void)
+{
+    uint8_t header[QUEUE_RECORD_HEADER];
+    ring_read(queue_head, header, sizeof(header));
+    size_t record = sizeof(header) + (header[1] | header[2] << 8);
+    queue_head = (queue_head + record) % MQTT_QUEUE_BYTES;
+    queue_used -= record;
+    queue_count--;
+}
+
+static void queue_push(uint8_t device_id, const mqtt_payload_t *message)
+{
+    size_t record = QUEUE_RECORD_HEADER + message->len;
+    while (queue_used + record > MQTT_QUEUE_BYTES) {
+        queue_pop();
+        count_stat(&stats.dropped);
+    }
+    uint8_t header[QUEUE_RECORD_HEADER] = { device_id, message->len & 0xFF, message->len >> 8 };
+    ring_write(queue_head + queue_used, header, sizeof(header));
+    ring_write(queue_head + queue_used + sizeof(header), message->data, message->len);
+    queue_used += record;
+    queue_count++;
+}
+
+static esp_err_t payload_flush(void *ctx, const char *data, size_t len)
+{
+    mqtt_payload_t *p = ctx;
+    if (p->len + len > sizeof(p->data)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(p->data + p->len, data, len);
+    p->len += len;
+    return ESP_OK;
+}
+
+static void begin_payload(void)
+{
+    payload.len = 0;
+    json_writer_init(&writer, payload_flush, &payload);
+}
+
+static void mqtt_event_handler(void *arg, esp_event_base_t base, int32_t event_id, void *event_data)
+{
+    esp_mqtt_event_handle_t event = event_data;
+
+    switch ((esp_mqtt_event_id_t)event_id) {
+        case MQTT_EVENT_CONNECTED:
+            ESP_LOGI(TAG, "Connected to broker");
+            portENTER_CRITICAL(&mqtt_mux);
+            stats.connected = true;
+            stats.connects++;
+            portEXIT_CRITICAL(&mqtt_mux);
+            esp_mqtt_client_publish(event->client, status_topic, "online", 0, 1, 1);
+            esp_mqtt_client_subscribe(event->client, write_topic, 1);
+            break;
+
+        case MQTT_EVENT_DISCONNECTED:
+            ESP_LOGW(TAG, "Disconnected from broker");
+            portENTER_CRITICAL(&mqtt_mux);
+            stats.connected = false;
+            portEXIT_CRITICAL(&mqtt_mux);
+            break;
+
+        case MQTT_EVENT_DATA:
+            if (event->topic_len != (int)strlen(write_topic) ||
+                memcmp(event->topic, write_topic, event->topic_len) != 0) {
+                break;
+            }
+            // Commands are small; a fragmented one is refused rather than
+            // reassembled
+            if (event->data_len != event->total_data_len || event->data_len >= MQTT_COMMAND_MAX_LEN) {
+                ESP_LOGW(TAG, "Ignoring oversized command (%d bytes)", event->total_data_len);
+                count_stat(&stats.command_errors);
+                break;
+            }
+            mqtt_command_t command;
+            command.len = event->data_len;
+            memcpy(command.data, event->data, event->data_len);
+            if (xQueueSend(command_queue, &command, 0) != pdTRUE) {
+                ESP_LOGW(TAG, "Command queue full, dropping command");
+                count_stat(&stats.command_errors);
+            }
+            break;
+
+        default:
+            break;
+    }
+}
+
+static void stop_client(void)
+{
+    if (client == NULL) {
+        return;
+    }
+    esp_mqtt_client_destroy(client);
+    client = NULL;
+    portENTER_CRITICAL(&mqtt_mux);
+    stats.connected = false;
+    portEXIT_CRITICAL(&mqtt_mux);
+}
+
+static void start_client(void)
+{
+    if (!active.enabled || active.uri[0] == '\0') {
+        return;
+    }
+
+    snprintf(status_topic, sizeof(status_topic), "%s/status", active.topic);
+    snprintf(write_topic, sizeof(write_topic), "%s/write", active.topic);
+    snprintf(result_topic, sizeof(result_topic), "%s/write/result", active.topic);
+
+    esp_mqtt_client_config_t client_config = {
+        .broker.address.uri = active.uri,
+        .credentials.client_id = active.client_id[0] != '\0' ? active.client_id : NULL,
+        .credentials.username = active.username[0] != '\0' ? active.username : NULL,
+        .credentials.authentication.password = active.password[0] != '\0' ? active.password : NULL,
+        .session.last_will = {
+            .topic = status_topic,
+            .msg = "offline",
+            .qos = 1,
+            .retain = 1,
+        },
+    };
+    client = esp_mqtt_client_init(&client_config);
+    if (client == NULL) {
+        ESP_LOGE(TAG, "Failed to create MQTT client for %s", active.uri);
+        return;
+    }
+    esp_mqtt_client_register_event(client, ESP_EVENT_ANY_ID, mqtt_event_handler, NULL);
+    if (esp_mqtt_client_start(client) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start MQTT client");
+        esp_mqtt_client_destroy(client);
+        client = NULL;
+        return;
+    }
+    ESP_LOGI(TAG, "Publishing to %s under %s/", active.uri, active.topic);
+}
+
+static void write_decoded(json_writer_t *w, const modbus_decoded_t *value)
+{
+    char text[MODBUS_DECODE_STR_LEN];
+    int len = modbus_decode_format(value, text, sizeof(text));
+    json_raw(w, text, len);
+}
+
+// Encodes what changed on device since it was last published into one
+// message and queues it. A value only counts as changed once it moved by its
+// register's deadband, so slow drift is still sent when it adds up.
+static void collect_device(const modbus_device_t *device, uint32_t now)
+{
+    modbus_device_state_t state;
+    modbus_read_device_state(device, &state);
+    bool status_changed = sent_status[device->state_slot] != state.status;
+
+    // Too large for the task stack with long register lists
+    static uint16_t slots[MAX_REGISTERS_PER_DEVICE];
+    static int64_t values[MAX_REGISTERS_PER_DEVICE];
+    uint16_t rows = 0;
+
+    begin_payload();
+    json_begin_object(&writer);
+    json_key(&writer, "now");
+    json_uint(&writer, now);
+    if (status_changed) {
+        json_key(&writer, "status");
+        json_uint(&writer, state.status);
+    }
+    json_key(&writer, "values");
+    json_begin_array(&writer);
+    for (uint16_t j = 0; j < device->register_count; j++) {
+        const modbus_register_t *reg = &device->registers[j];
+        uint16_t slot = reg->value_slot;
+        modbus_value_t value;
+        modbus_read_value(reg, &value);
+        if (value.last_update == 0 || (sent_valid[slot] && value.version <= scanned_version)) {
+            continue;
+        }
+
+        modbus_decoded_t decoded;
+        modbus_decode_value(reg, &value, &decoded);
+        if (sent_valid[slot]) {
+            int64_t delta = decoded.value - sent_value[slot];
+            delta = delta < 0 ? -delta : delta;
+            if (delta == 0 || delta < reg->deadband_fixed) {
+                continue;
+            }
+        }
+
+        json_begin_array(&writer);
+        json_uint(&writer, reg->type);
+        json_uint(&writer, reg->address);
+        write_decoded(&writer, &decoded);
+        json_uint(&writer, value.last_update);
+        json_end_array(&writer);
+        slots[rows] = slot;
+        values[rows] = decoded.value;
+        rows++;
+    }
+    json_end_array(&writer);
+    json_end_object(&writer);
+
+    esp_err_t err = json_writer_finish(&writer);
+    if (rows == 0 && !status_changed) {
+        return;
+    }
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Values of device %d exceed %d bytes, not published", device->device_id, MQTT_MAX_PAYLOAD);
+        count_stat(&stats.dropped);
+        return;
+    }
+
+    sent_status[device->state_slot] = state.status;
+    for (uint16_t i = 0; i < rows; i++) {
+        sent_value[slots[i]] = values[i];
+        sent_valid[slots[i]] = true;
+    }
+    queue_push(device->device_id, &payload);
+}
+
+static void collect_changes(uint32_t now)
+{
+    // Changes made while scanning carry a later version and are looked at
+    // again next time
+    uint32_t version = modbus_values_version();
+    const modbus_snapshot_t *snapshot = modbus_snapshot_acquire();
+
+    if (snapshot->version != sent_config_version) {
+        // Slots may have moved: start over and publish every value once
+        memset(sent_valid, 0, sizeof(sent_valid));
+        memset(sent_status, 0xFF, sizeof(sent_status));
+        sent_config_version = snapshot->version;
+    }
+    for (uint8_t i = 0; i < snapshot->device_count; i++) {
+        collect_device(&snapshot->devices[i], now);
+    }
+
+    modbus_snapshot_release(snapshot);
+    scanned_version = version;
+}
+
+static void drain_queue(uint32_t now)
+{
+    uint32_t tokens = drain_tokens + (now - drain_updated_ms) * MQTT_DRAIN_PER_SECOND;
+    drain_tokens = tokens < MQTT_DRAIN_PER_SECOND * 1000 ? tokens : MQTT_DRAIN_PER_SECOND * 1000;
+    drain_updated_ms = now;
+
+    bool online;
+    portENTER_CRITICAL(&mqtt_mux);
+    online = stats.connected;
+    portEXIT_CRITICAL(&mqtt_mux);
+
+    static mqtt_payload_t message;
+    char topic[MQTT_TOPIC_BUF_LEN];
+    while (online && queue_count > 0 && drain_tokens >= 1000) {
+        uint8_t device_id = queue_peek(&message);
+        snprintf(topic, sizeof(topic), "%s/%u", active.topic, device_id);
+        if (esp_mqtt_client_publish(client, topic, message.data, message.len, active.qos, 0) < 0) {
+            // Connection lost meanwhile; the message stays queued
+            break;
+        }
+        queue_pop();
+        drain_tokens -= 1000;
+        count_stat(&stats.published);
+    }
+}
+
+static void publish_result(const cJSON *id, const char *error, uint8_t exception)
+{
+    begin_payload();
+    json_begin_object(&writer);
+    if (cJSON_IsNumber(id)) {
+        json_key(&writer, "id");
+        json_int(&writer, (int64_t)id->valuedouble);
+    } else if (cJSON_IsString(id)) {
+        json_key(&writer, "id");
+        json_string(&writer, id->valuestring);
+    }
+    json_key(&writer, "status");
+    json_string(&writer, error == NULL ? "ok" : "error");
+    if (error != NULL) {
+        json_key(&writer, "message");
+        json_string(&writer, error);
+        if (exception != 0) {
+            json_key(&writer, "exception");
+            json_uint(&writer, exception);
+        }
+    }
+    json_end_object(&writer);
+
+    if (json_writer_finish(&writer) == ESP_OK && client != NULL) {
+        esp_mqtt_client_publish(client, result_topic, payload.data, payload.len, active.qos, 0);
+    }
+}
+
+// Writes one register as /api/modbus/write does, through the batch executor
+// so the transaction holds the bus against the poller, and admitted like any
+// other bus work from outside
+static void run_command(const mqtt_command_t *command)
+{
+    cJSON *root = cJSON_ParseWithLength(command->data, command->len);
+    cJSON *id = cJSON_GetObjectItem(root, "id");
+    cJSON *device_id = cJSON_GetObjectItem(root, "device_id");
+    cJSON *type = cJSON_GetObjectItem(root, "type");
+    cJSON *address = cJSON_GetObjectItem(root, "address");
+    cJSON *value = cJSON_GetObjectItem(root, "value");
+    const char *error = NULL;
+    modbus_batch_item_t item = { .write = true, .words = 1 };
+
+    if (root == NULL) {
+        error = "Invalid JSON";
+    } else if (!cJSON_IsNumber(device_id) || device_id->valueint < 1 || device_id->valueint > 247 ||
+               !cJSON_IsNumber(address) || address->valueint < 0 || address->valueint > 65535 ||
+               !cJSON_IsNumber(value) || (type != NULL && !cJSON_IsNumber(type))) {
+        error = "device_id (1-247), address and value required";
+    } else {
+        item.device_id = device_id->valueint;
+        item.address = address->valueint;
+
+        const modbus_snapshot_t *snapshot = modbus_snapshot_acquire();
+        const modbus_register_t *reg = NULL;
+        if (type != NULL) {
+            reg = modbus_snapshot_find_register(snapshot, item.device_id, type->valueint, item.address);
+        } else {
+            reg = modbus_snapshot_find_register(snapshot, item.device_id, REGISTER_TYPE_HOLDING, item.address);
+            if (reg == NULL) {
+                reg = modbus_snapshot_find_register(snapshot, item.device_id, REGISTER_TYPE_COIL, item.address);
+            }
+        }
+        // Unlike the web API, commands from the broker only reach registers
+        // configured as writable
+        if (reg == NULL) {
+            error = "Register not found";
+        } else if ((reg->type != REGISTER_TYPE_HOLDING && reg->type != REGISTER_TYPE_COIL) || !reg->writable) {
+            error = "Register is not writable";
+        } else {
+            item.type = reg->type;
+            if (reg->type == REGISTER_TYPE_HOLDING) {
+                item.words = modbus_format_word_count(reg->format);
+            }
+            item.raw = modbus_encode_value(reg, value->valuedouble);
+        }
+        modbus_snapshot_release(snapshot);
+    }
+
+    uint32_t retry_after_ms;
+    if (error == NULL && bus_admission_acquire(MQTT_ADMISSION_CLIENT, 1, &retry_after_ms) != BUS_ADMIT_OK) {
+        error = "Bus busy";
+    }
+    if (error == NULL) {
+        modbus_batch_execute(&item, 1);
+        if (item.result == MODBUS_RESULT_OK) {
+            modbus_update_register_value(item.device_id, item.type, item.address, item.raw);
+        } else {
+            error = modbus_result_to_string(item.result);
+        }
+    }
+
+    count_stat(&stats.commands);
+    if (error != NULL) {
+        ESP_LOGW(TAG, "Write command failed: %s", error);
+        count_stat(&stats.command_errors);
+    }
+    publish_result(id, error, item.result == MODBUS_RESULT_EXCEPTION ? item.exception : 0);
+    cJSON_Delete(root);
+}
+
+static void mqtt_task(void *arg)
+{
+    uint32_t window_start = 0;
+
+    for (;;) {
+        mqtt_command_t command;
+        if (xQueueReceive(command_queue, &command, pdMS_TO_TICKS(MQTT_TICK_MS)) == pdTRUE) {
+            run_command(&command);
+        }
+
+        bool restart;
+        portENTER_CRITICAL(&mqtt_mux);
+        restart = config_changed;
+        if (restart) {
+            active = config;
+            config_changed = false;
+        }
+        portEXIT_CRITICAL(&mqtt_mux);
+        if (restart) {
+            stop_client();
+            start_client();
+        }
+        if (!active.enabled) {
+            continue;
+        }
+
+        uint32_t now = xTaskGetTickCount() * portTICK_PERIOD_MS;
+        if (now - window_start >= active.interval_ms) {
+            window_start = now;
+            collect_changes(now);
+        }
+        drain_queue(now);
+
+        portENTER_CRITICAL(&mqtt_mux);
+        stats.queued = queue_count;
+        stats.queue_bytes = queue_used;
+        portEXIT_CRITICAL(&mqtt_mux);
+    }
+}
+
+static esp_err_t validate_config(const mqtt_config_t *c)
+{
+    if (c->qos > 1 || c->interval_ms < MQTT_MIN_INTERVAL_MS || c->topic[0] == '\0' ||
+        c->topic[strlen(c->topic) - 1] == '/' || strpbrk(c->topic, "+#") != NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (c->enabled && strncmp(c->uri, "mqtt://", 7) != 0 && strncmp(c->uri, "mqtts://", 8) != 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t load_config(void)
+{
+    nvs_handle_t nvs_handle;
+    esp_err_t err = nvs_open(NVS_MODBUS_NAMESPACE, NVS_READONLY, &nvs_handle);
+    if (err != ESP_OK) {
+        return err == ESP_ERR_NVS_NOT_FOUND ? ESP_OK : err;
+    }
+
+    uint8_t buf[sizeof(mqtt_blob_header_t) + sizeof(mqtt_config_t)];
+    size_t len = sizeof(buf);
+    err = nvs_get_blob(nvs_handle, MQTT_CONFIG_KEY, buf, &len);
+    nvs_close(nvs_handle);
+    if (err != ESP_OK) {
+        return err == ESP_ERR_NVS_NOT_FOUND ? ESP_OK : err;
+    }
+
+    mqtt_blob_header_t header;
+    mqtt_config_t loaded;
+    memcpy(&header, buf, sizeof(header));
+    memcpy(&loaded, buf + sizeof(header), sizeof(loaded));
+    if (len != sizeof(buf) || header.magic != MQTT_BLOB_MAGIC || header.version != MQTT_BLOB_VERSION ||
+        validate_config(&loaded) != ESP_OK) {
+        ESP_LOGW(TAG, "Ignoring invalid MQTT configuration blob");
+        return ESP_OK;
+    }
+    config = loaded;
+    return ESP_OK;
+}
+
+static esp_err_t save_config(const mqtt_config_t *c)
+{
+    uint8_t buf[sizeof(mqtt_blob_header_t) + sizeof(mqtt_config_t)];
+    mqtt_blob_header_t header = { MQTT_BLOB_MAGIC, MQTT_BLOB_VERSION, 0 };
+    memcpy(buf, &header, sizeof(header));
+    memcpy(buf + sizeof(header), c, sizeof(*c));
+
+    nvs_handle_t nvs_handle;
+    esp_err_t err = nvs_open(NVS_MODBUS_NAMESPACE, NVS_READWRITE, &nvs_handle);
+    if (err == ESP_OK) {
+        err = nvs_set_blob(nvs_handle, MQTT_CONFIG_KEY, buf, sizeof(buf));
+        if (err == ESP_OK) {
+            err = nvs_commit(nvs_handle);
+        }
+        nvs_close(nvs_handle);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to save MQTT configuration: %s", esp_err_to_name(err));
+    }
+    return err;
+}
+
+esp_err_t mqtt_publisher_init(void)
+{
+    if (task_handle != NULL) {
+        return ESP_OK;
+    }
+
+    esp_err_t err = load_config();
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to load MQTT configuration: %s", esp_err_to_name(err));
+    }
+
+    command_queue = xQueueCreate(MQTT_COMMAND_QUEUE_LEN, sizeof(mqtt_command_t));
+    if (command_queue == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    config_changed = true;
+    if (xTaskCreate(mqtt_task, "mqtt_pub", MQTT_TASK_STACK_SIZE, NULL, 4, &task_handle) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to start MQTT task");
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+void mqtt_publisher_get_config(mqtt_config_t *out)
+{
+    portENTER_CRITICAL(&mqtt_mux);
+    *out = config;
+    portEXIT_CRITICAL(&mqtt_mux);
+}
+
+esp_err_t mqtt_publisher_set_config(const mqtt_config_t *new_config)
+{
+    esp_err_t err = validate_config(new_config);
+    if (err != ESP_OK) {
+        return err;
+    }
+    err = save_config(new_config);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    portENTER_CRITICAL(&mqtt_mux);
+    config = *new_config;
+    config_changed = true;
+    portEXIT_CRITICAL(&mqtt_mux);
+    return ESP_OK;
+}
+
+void mqtt_publisher_get_stats(mqtt_stats_t *out)
+{
+    portENTER_CRITICAL(&mqtt_mux);
+    *out = stats;
+    portEXIT_CRITICAL(&mqtt_mux);
+}
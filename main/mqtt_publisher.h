@@ -0,0 +1,67 @@
+#ifndef MQTT_PUBLISHER_H
+#define MQTT_PUBLISHER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+// Publishes polled values to an MQTT broker and takes register writes from a
+// command topic. Under the base topic <topic>:
+//   <topic>/status           "online", or "offline" as the retained last will
+//   <topic>/<device_id>      values that changed, one message per device per
+//                            interval: {"now":81234,"status":1,
+//                            "values":[[type,address,value,last_update],...]}
+//   <topic>/write            commands: {"id":7,"device_id":1,"type":3,
+//                            "address":135,"value":22.5}
+//   <topic>/write/result     {"id":7,"status":"ok"} or {"id":7,"status":
+//                            "error","message":"..."}
+// A value is sent when it moved by at least its register's deadband since it
+// was last sent. Times are milliseconds since boot, as in /api/modbus/values.
+#define MQTT_URI_MAX_LEN 96
+#define MQTT_CLIENT_ID_MAX_LEN 32
+#define MQTT_USERNAME_MAX_LEN 32
+#define MQTT_PASSWORD_MAX_LEN 64
+#define MQTT_TOPIC_MAX_LEN 48
+#define MQTT_MIN_INTERVAL_MS 100
+#define MQTT_DEFAULT_INTERVAL_MS 1000
+
+// Messages wait in this queue while the broker is unreachable, oldest dropped
+// first when it is full, and drain at MQTT_DRAIN_PER_SECOND once reconnected
+// so a backlog doesn't flood the broker or starve live updates
+#define MQTT_QUEUE_BYTES 8192
+#define MQTT_DRAIN_PER_SECOND 20
+#define MQTT_MAX_PAYLOAD 768
+
+typedef struct {
+    bool enabled;
+    uint8_t qos;                // 0 or 1
+    uint16_t interval_ms;       // Batching window
+    char uri[MQTT_URI_MAX_LEN];             // mqtt://host:1883
+    char client_id[MQTT_CLIENT_ID_MAX_LEN]; // Empty for the esp-mqtt default
+    char username[MQTT_USERNAME_MAX_LEN];
+    char password[MQTT_PASSWORD_MAX_LEN];
+    char topic[MQTT_TOPIC_MAX_LEN];         // Base topic, e.g. "modbus/gateway1"
+} mqtt_config_t;
+
+typedef struct {
+    bool connected;
+    uint32_t published;
+    uint32_t dropped;           // Pushed out of a full queue, or too large
+    uint32_t commands;
+    uint32_t command_errors;
+    uint32_t connects;
+    uint16_t queued;            // Messages waiting
+    uint16_t queue_bytes;
+} mqtt_stats_t;
+
+// Loads the configuration and starts the publisher task; the client connects
+// once enabled with a broker URI
+esp_err_t mqtt_publisher_init(void);
+
+void mqtt_publisher_get_config(mqtt_config_t *config);
+// Validates, saves and applies config; the client reconnects with it
+esp_err_t mqtt_publisher_set_config(const mqtt_config_t *config);
+
+void mqtt_publisher_get_stats(mqtt_stats_t *stats);
+
+#endif
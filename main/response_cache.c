@@ -0,0 +1,210 @@
+#include "response_cache.h"
+#include <string.h>
+#include <stdlib.h>
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+
+static const char *TAG = "RESPONSE_CACHE";
+
+#define CAPTURE_INITIAL_BYTES 1024
+
+typedef struct {
+    char key[RESPONSE_CACHE_KEY_LEN];
+    char tag[RESPONSE_CACHE_TAG_LEN];
+    response_cache_blob_t *blob;    // NULL if the slot is free
+    uint32_t last_used;
+} cache_entry_t;
+
+static cache_entry_t entries[RESPONSE_CACHE_MAX_ENTRIES];
+static uint32_t use_clock = 0;
+static response_cache_stats_t stats;
+static portMUX_TYPE cache_mux = portMUX_INITIALIZER_UNLOCKED;
+
+// Drops the table's reference; returns the blob if the caller must free it.
+// Called with cache_mux held.
+static response_cache_blob_t* evict_locked(cache_entry_t *entry)
+{
+    response_cache_blob_t *blob = entry->blob;
+    entry->blob = NULL;
+    stats.entries--;
+    stats.bytes -= blob->len;
+    stats.evictions++;
+    return --blob->refs == 0 ? blob : NULL;
+}
+
+const response_cache_blob_t* response_cache_get(const char *key, const char *tag)
+{
+    response_cache_blob_t *hit = NULL;
+    response_cache_blob_t *stale = NULL;
+
+    portENTER_CRITICAL(&cache_mux);
+    for (int i = 0; i < RESPONSE_CACHE_MAX_ENTRIES; i++) {
+        cache_entry_t *entry = &entries[i];
+        if (entry->blob == NULL || strcmp(entry->key, key) != 0) {
+            continue;
+        }
+        if (strcmp(entry->tag, tag) == 0) {
+            hit = entry->blob;
+            hit->refs++;
+            entry->last_used = ++use_clock;
+        } else {
+            // The data moved on; this version will never be asked for again
+            stale = evict_locked(entry);
+        }
+        break;
+    }
+    if (hit != NULL) {
+        stats.hits++;
+    } else {
+        stats.misses++;
+    }
+    portEXIT_CRITICAL(&cache_mux);
+
+    free(stale);
+    return hit;
+}
+
+void response_cache_release(const response_cache_blob_t *blob)
+{
+    if (blob == NULL) {
+        return;
+    }
+
+    response_cache_blob_t *b = (response_cache_blob_t *)blob;
+    portENTER_CRITICAL(&cache_mux);
+    bool last = --b->refs == 0;
+    portEXIT_CRITICAL(&cache_mux);
+
+    if (last) {
+        free(b);
+    }
+}
+
+void response_cache_capture_init(response_cache_capture_t *capture)
+{
+    capture->blob = NULL;
+    capture->overflow = false;
+}
+
+void response_cache_capture_append(response_cache_capture_t *capture, const char *data, size_t len)
+{
+    if (capture->overflow) {
+        return;
+    }
+
+    response_cache_blob_t *blob = capture->blob;
+    size_t used = blob != NULL ? blob->len : 0;
+    if (used + len > RESPONSE_CACHE_MAX_ENTRY_BYTES) {
+        capture->overflow = true;
+        return;
+    }
+    if (blob == NULL || used + len > blob->cap) {
+        size_t cap = blob != NULL ? blob->cap : CAPTURE_INITIAL_BYTES;
+        while (cap < used + len) {
+            cap *= 2;
+        }
+        if (cap > RESPONSE_CACHE_MAX_ENTRY_BYTES) {
+            cap = RESPONSE_CACHE_MAX_ENTRY_BYTES;
+        }
+        response_cache_blob_t *grown = realloc(blob, sizeof(response_cache_blob_t) + cap);
+        if (grown == NULL) {
+            capture->overflow = true;
+            return;
+        }
+        grown->len = used;
+        grown->cap = cap;
+        capture->blob = blob = grown;
+    }
+    memcpy(blob->data + used, data, len);
+    blob->len = used + len;
+}
+
+void response_cache_capture_discard(response_cache_capture_t *capture)
+{
+    free(capture->blob);
+    capture->blob = NULL;
+}
+
+void response_cache_put(const char *key, const char *tag, response_cache_capture_t *capture)
+{
+    response_cache_blob_t *blob = capture->blob;
+    capture->blob = NULL;
+    if (capture->overflow || blob == NULL || strlen(key) >= RESPONSE_CACHE_KEY_LEN ||
+        strlen(tag) >= RESPONSE_CACHE_TAG_LEN) {
+        free(blob);
+        portENTER_CRITICAL(&cache_mux);
+        stats.uncacheable++;
+        portEXIT_CRITICAL(&cache_mux);
+        return;
+    }
+
+    // Give back the growth slack before the entry counts against the budget
+    response_cache_blob_t *shrunk = realloc(blob, sizeof(response_cache_blob_t) + blob->len);
+    if (shrunk != NULL) {
+        blob = shrunk;
+        blob->cap = blob->len;
+    }
+    blob->refs = 1;
+
+    response_cache_blob_t *victims[RESPONSE_CACHE_MAX_ENTRIES];
+    int victim_count = 0;
+
+    portENTER_CRITICAL(&cache_mux);
+    // A response rendered concurrently for the same key replaces the old one
+    cache_entry_t *slot = NULL;
+    for (int i = 0; i < RESPONSE_CACHE_MAX_ENTRIES; i++) {
+        if (entries[i].blob != NULL && strcmp(entries[i].key, key) == 0) {
+            victims[victim_count++] = evict_locked(&entries[i]);
+            slot = &entries[i];
+            break;
+        }
+    }
+    // Least recently used entries go until the new one fits
+    while (stats.bytes + blob->len > RESPONSE_CACHE_MAX_BYTES ||
+           (slot == NULL && stats.entries == RESPONSE_CACHE_MAX_ENTRIES)) {
+        cache_entry_t *oldest = NULL;
+        for (int i = 0; i < RESPONSE_CACHE_MAX_ENTRIES; i++) {
+            if (entries[i].blob != NULL && (oldest == NULL || entries[i].last_used < oldest->last_used)) {
+                oldest = &entries[i];
+            }
+        }
+        victims[victim_count++] = evict_locked(oldest);
+        slot = slot != NULL ? slot : oldest;
+    }
+    if (slot == NULL) {
+        for (int i = 0; i < RESPONSE_CACHE_MAX_ENTRIES && slot == NULL; i++) {
+            if (entries[i].blob == NULL) {
+                slot = &entries[i];
+            }
+        }
+    }
+    strcpy(slot->key, key);
+    strcpy(slot->tag, tag);
+    slot->blob = blob;
+    slot->last_used = ++use_clock;
+    stats.entries++;
+    stats.bytes += blob->len;
+    stats.stores++;
+    size_t len = blob->len;
+    size_t bytes = stats.bytes;
+    portEXIT_CRITICAL(&cache_mux);
+
+    for (int i = 0; i < victim_count; i++) {
+        free(victims[i]);
+    }
+    ESP_LOGD(TAG, "Cached %s (%u bytes, %u resident)", key, (unsigned)len, (unsigned)bytes);
+}
+
+void response_cache_record_not_modified(void)
+{
+    portENTER_CRITICAL(&cache_mux);
+    stats.not_modified++;
+    portEXIT_CRITICAL(&cache_mux);
+}
+
+void response_cache_get_stats(response_cache_stats_t *out)
+{
+    portENTER_CRITICAL(&cache_mux);
+    *out = stats;
+    portEXIT_CRITICAL(&cache_mux);
+}
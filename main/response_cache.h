@@ -0,0 +1,62 @@
+#ifndef RESPONSE_CACHE_H
+#define RESPONSE_CACHE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+// Rendered API responses shared between clients. An entry is stored under
+// its request key together with the ETag of the data it was rendered from,
+// and is only served while the caller's current ETag still matches.
+#define RESPONSE_CACHE_MAX_BYTES 16384
+#define RESPONSE_CACHE_MAX_ENTRIES 8
+#define RESPONSE_CACHE_MAX_ENTRY_BYTES (RESPONSE_CACHE_MAX_BYTES / 2)
+#define RESPONSE_CACHE_KEY_LEN 96
+#define RESPONSE_CACHE_TAG_LEN 48
+
+// Immutable once stored. Readers hold a reference while sending, so an entry
+// evicted meanwhile is freed by its last reader.
+typedef struct {
+    uint32_t refs;
+    size_t len;
+    size_t cap;
+    char data[];
+} response_cache_blob_t;
+
+// Collects a response while it is streamed to the first client. Gives up
+// (without failing the response) once it would exceed
+// RESPONSE_CACHE_MAX_ENTRY_BYTES or memory runs out.
+typedef struct {
+    response_cache_blob_t *blob;
+    bool overflow;
+} response_cache_capture_t;
+
+typedef struct {
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t not_modified;      // Answered 304 without a body
+    uint32_t stores;
+    uint32_t evictions;         // Dropped for space or replaced by a newer version
+    uint32_t uncacheable;       // Too large, URI too long for a key, or out of memory
+    uint8_t entries;
+    size_t bytes;               // Resident entry bytes, at most RESPONSE_CACHE_MAX_BYTES
+} response_cache_stats_t;
+
+// Returns the entry for key if it was rendered for tag, or NULL. A non-NULL
+// result must be given back with response_cache_release().
+const response_cache_blob_t* response_cache_get(const char *key, const char *tag);
+void response_cache_release(const response_cache_blob_t *blob);
+
+void response_cache_capture_init(response_cache_capture_t *capture);
+void response_cache_capture_append(response_cache_capture_t *capture, const char *data, size_t len);
+void response_cache_capture_discard(response_cache_capture_t *capture);
+// Stores the captured response under key, evicting least recently used
+// entries to stay within budget; discards it if the capture gave up. Always
+// consumes the capture.
+void response_cache_put(const char *key, const char *tag, response_cache_capture_t *capture);
+
+void response_cache_record_not_modified(void);
+void response_cache_get_stats(response_cache_stats_t *stats);
+
+#endif
@@ -0,0 +1,612 @@
+#include "ts_log.h"
+#include "modbus_devices.h"
+#include <string.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include "esp_log.h"
+#include "esp_rom_crc.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+static const char *TAG = "TS_LOG";
+
+// Flash layout: the partition is a ring of fixed-size segments, each starting
+// with a header and followed by CRC-protected blocks of varint-packed samples.
+// Segment seq lives at index seq % segment_count, so the ring order is
+// implied by the sequence numbers. A segment is sealed with its final length
+// before the next one is opened; only the head segment is ever appended to.
+#define SEGMENT_MAGIC 0x314C5354        // "TSL1"
+#define SEGMENT_HEADER_SIZE 32
+#define SEGMENT_UNSEALED 0xFFFFFFFF
+#define BLOCK_MAGIC 0x4B42              // "BK"
+#define BLOCK_HEADER_SIZE 16
+#define BLOCK_ERASED 0xFFFF
+// device + type + one-byte varints for delta, address and value
+#define SAMPLE_MIN_BYTES 5
+#define SAMPLE_MAX_BYTES 15
+#define BLOCK_MAX_SAMPLES ((TS_LOG_BLOCK_SIZE - BLOCK_HEADER_SIZE) / SAMPLE_MIN_BYTES)
+
+typedef struct {
+    uint32_t magic;
+    uint32_t seq;
+    uint16_t boot;              // Boot that opened the segment
+    uint16_t reserved;
+    uint32_t crc;               // Over the fields above
+    uint32_t sealed;            // Final length, programmed when sealed
+    uint32_t padding[3];
+} segment_header_t;
+
+typedef struct {
+    uint16_t magic;
+    uint16_t length;            // Payload bytes
+    uint16_t count;
+    uint16_t boot;
+    uint32_t base_ms;
+    uint32_t crc;               // Over the fields above and the payload
+} block_header_t;
+
+_Static_assert(sizeof(segment_header_t) == SEGMENT_HEADER_SIZE, "segment header layout");
+_Static_assert(sizeof(block_header_t) == BLOCK_HEADER_SIZE, "block header layout");
+
+typedef struct {
+    uint32_t key;
+    uint32_t raw;
+    uint32_t logged_at;
+    bool valid;
+} slot_state_t;
+
+static ts_log_storage_t storage;
+static bool log_open = false;
+static SemaphoreHandle_t log_lock = NULL;
+static uint16_t segment_count;
+static uint16_t boot;
+
+// Write position and the oldest segment still held
+static uint32_t head_seq;
+static uint32_t head_offset;
+static uint32_t oldest_seq;
+// End of the most recently overwritten segment, so a collector that had read
+// all of it is not told it missed data
+static ts_log_cursor_t dropped_end;
+
+// Blocks packed on the poll path and waiting to be written. Recording only
+// touches RAM under queue_mux; erases and writes happen in the writer (the
+// flush task), under log_lock. The block after the completed ones is the one
+// being filled, unless all of them are waiting.
+typedef struct {
+    uint8_t data[TS_LOG_BLOCK_SIZE] __attribute__((aligned(4)));     // Header filled in when written
+    uint16_t len;
+    uint16_t count;
+    uint32_t base;
+    uint32_t prev;
+} pending_block_t;
+
+static pending_block_t queue[TS_LOG_QUEUE_BLOCKS];
+static uint8_t queue_tail;          // Oldest completed block
+static uint8_t queue_completed;
+static uint32_t queue_dropped;      // Samples refused while every block waited
+static portMUX_TYPE queue_mux = portMUX_INITIALIZER_UNLOCKED;
+static void (*wake_writer)(void) = NULL;
+
+static slot_state_t slots[MODBUS_MAX_VALUE_SLOTS];
+
+static inline uint32_t align4(uint32_t n)
+{
+    return (n + 3) & ~3u;
+}
+
+static inline size_t segment_base(uint32_t seq)
+{
+    return (size_t)(seq % segment_count) * TS_LOG_SEGMENT_SIZE;
+}
+
+static const segment_header_t* segment_at(uint16_t index)
+{
+    return (const segment_header_t *)(storage.mapped + (size_t)index * TS_LOG_SEGMENT_SIZE);
+}
+
+static uint32_t segment_header_crc(const segment_header_t *header)
+{
+    return esp_rom_crc32_le(0, (const uint8_t *)header, offsetof(segment_header_t, crc));
+}
+
+static bool segment_valid(uint16_t index)
+{
+    const segment_header_t *header = segment_at(index);
+    return header->magic == SEGMENT_MAGIC && header->seq % segment_count == index &&
+           header->crc == segment_header_crc(header);
+}
+
+// True while segment seq is still on flash (not yet overwritten)
+static bool segment_holds(uint32_t seq)
+{
+    const segment_header_t *header = segment_at(seq % segment_count);
+    return header->magic == SEGMENT_MAGIC && header->seq == seq;
+}
+
+static uint32_t block_crc(const block_header_t *header)
+{
+    uint32_t crc = esp_rom_crc32_le(0, (const uint8_t *)header, offsetof(block_header_t, crc));
+    return esp_rom_crc32_le(crc, (const uint8_t *)header + BLOCK_HEADER_SIZE, header->length);
+}
+
+// Returns the total size of a valid block at offset, 0 at the erased end of
+// the segment and -1 for a torn or corrupt block
+static int block_at(uint32_t seq, uint32_t offset, const block_header_t **out)
+{
+    if (offset + BLOCK_HEADER_SIZE > TS_LOG_SEGMENT_SIZE) {
+        return 0;
+    }
+    const block_header_t *header = (const block_header_t *)(storage.mapped + segment_base(seq) + offset);
+    if (header->magic == BLOCK_ERASED) {
+        return 0;
+    }
+    if (header->magic != BLOCK_MAGIC || header->length > TS_LOG_BLOCK_SIZE - BLOCK_HEADER_SIZE ||
+        offset + BLOCK_HEADER_SIZE + header->length > TS_LOG_SEGMENT_SIZE || header->crc != block_crc(header)) {
+        return -1;
+    }
+    *out = header;
+    return align4(BLOCK_HEADER_SIZE + header->length);
+}
+
+static uint32_t segment_end(uint32_t seq)
+{
+    if (seq == head_seq) {
+        return head_offset;
+    }
+    uint32_t sealed = segment_at(seq % segment_count)->sealed;
+    if (sealed != SEGMENT_UNSEALED) {
+        return sealed;
+    }
+
+    // Only left unsealed if programming the seal failed
+    uint32_t offset = SEGMENT_HEADER_SIZE;
+    const block_header_t *block;
+    int size;
+    while ((size = block_at(seq, offset, &block)) > 0) {
+        offset += size;
+    }
+    return offset;
+}
+
+static esp_err_t open_segment(uint32_t seq)
+{
+    size_t base = segment_base(seq);
+    uint16_t index = seq % segment_count;
+
+    if (segment_valid(index)) {
+        const segment_header_t *old = segment_at(index);
+        dropped_end.seq = old->seq;
+        dropped_end.offset = segment_end(old->seq);
+        if (old->seq >= oldest_seq) {
+            oldest_seq = old->seq + 1;
+        }
+    }
+
+    esp_err_t err = storage.erase(storage.ctx, base, TS_LOG_SEGMENT_SIZE);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to erase segment %" PRIu32 ": %s", seq, esp_err_to_name(err));
+        return err;
+    }
+
+    segment_header_t header;
+    memset(&header, 0xFF, sizeof(header));
+    header.magic = SEGMENT_MAGIC;
+    header.seq = seq;
+    header.boot = boot;
+    header.crc = segment_header_crc(&header);
+    err = storage.write(storage.ctx, base, &header, sizeof(header));
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to write segment header %" PRIu32 ": %s", seq, esp_err_to_name(err));
+        return err;
+    }
+
+    head_seq = seq;
+    head_offset = SEGMENT_HEADER_SIZE;
+    if (oldest_seq == 0 || oldest_seq > seq) {
+        oldest_seq = seq;
+    }
+    return ESP_OK;
+}
+
+// Programs the final length into the head segment and starts the next one
+static esp_err_t seal_and_advance(void)
+{
+    uint32_t sealed = head_offset;
+    esp_err_t err = storage.write(storage.ctx, segment_base(head_seq) + offsetof(segment_header_t, sealed),
+                                  &sealed, sizeof(sealed));
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to seal segment %" PRIu32 ": %s", head_seq, esp_err_to_name(err));
+    }
+    return open_segment(head_seq + 1);
+}
+
+esp_err_t ts_log_open(const ts_log_storage_t *backing)
+{
+    if (backing->size < 2 * TS_LOG_SEGMENT_SIZE || TS_LOG_SEGMENT_SIZE % backing->erase_size != 0) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (log_lock == NULL) {
+        log_lock = xSemaphoreCreateMutex();
+        if (log_lock == NULL) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    xSemaphoreTake(log_lock, portMAX_DELAY);
+    log_open = false;
+    memset(slots, 0, sizeof(slots));
+    portENTER_CRITICAL(&queue_mux);
+    for (uint8_t i = 0; i < TS_LOG_QUEUE_BLOCKS; i++) {
+        queue[i].len = 0;
+        queue[i].count = 0;
+    }
+    queue_tail = 0;
+    queue_completed = 0;
+    queue_dropped = 0;
+    portEXIT_CRITICAL(&queue_mux);
+
+    storage = *backing;
+    segment_count = storage.size / TS_LOG_SEGMENT_SIZE;
+    head_seq = 0;
+    head_offset = 0;
+    oldest_seq = 0;
+    dropped_end.seq = 0;
+    dropped_end.offset = 0;
+
+    // The newest valid header is the head; the oldest is at most one ring
+    // length behind it
+    uint16_t last_boot = 0;
+    for (uint16_t i = 0; i < segment_count; i++) {
+        if (segment_valid(i) && segment_at(i)->seq > head_seq) {
+            head_seq = segment_at(i)->seq;
+            last_boot = segment_at(i)->boot;
+        }
+    }
+    for (uint16_t i = 0; i < segment_count && head_seq > 0; i++) {
+        uint32_t seq = segment_at(i)->seq;
+        if (segment_valid(i) && seq + segment_count > head_seq && (oldest_seq == 0 || seq < oldest_seq)) {
+            oldest_seq = seq;
+        }
+    }
+
+    esp_err_t err = ESP_OK;
+    if (head_seq == 0) {
+        boot = 1;
+        err = open_segment(1);
+    } else {
+        // Walk the head segment to the end of its last intact block
+        uint32_t offset = SEGMENT_HEADER_SIZE;
+        const block_header_t *block;
+        int size;
+        while ((size = block_at(head_seq, offset, &block)) > 0) {
+            if (block->boot > last_boot) {
+                last_boot = block->boot;
+            }
+            offset += size;
+        }
+        boot = last_boot + 1;
+        head_offset = offset;
+
+        // A sealed head or a torn block can't be appended to
+        if (segment_at(head_seq % segment_count)->sealed != SEGMENT_UNSEALED) {
+            err = open_segment(head_seq + 1);
+        } else if (size < 0) {
+            ESP_LOGW(TAG, "Torn block in segment %" PRIu32 " at %" PRIu32 ", sealing", head_seq, offset);
+            err = seal_and_advance();
+        }
+    }
+
+    log_open = err == ESP_OK;
+    xSemaphoreGive(log_lock);
+
+    ESP_LOGI(TAG, "Log %s: %u segment(s), oldest %" PRIu32 ", head %" PRIu32 " at %" PRIu32 ", boot %u",
+             log_open ? "open" : "failed", segment_count, oldest_seq, head_seq, head_offset, boot);
+    return err;
+}
+
+uint16_t ts_log_boot(void)
+{
+    return boot;
+}
+
+void ts_log_set_wake(void (*wake)(void))
+{
+    wake_writer = wake;
+}
+
+// The block being filled, or NULL while every block waits for the writer
+static pending_block_t* filling_block(void)
+{
+    if (queue_completed == TS_LOG_QUEUE_BLOCKS) {
+        return NULL;
+    }
+    return &queue[(queue_tail + queue_completed) % TS_LOG_QUEUE_BLOCKS];
+}
+
+// Appends a completed block to the head segment, sealing it first if the
+// block doesn't fit. *consumed is false when the block is still to be
+// written, i.e. the next segment couldn't be opened.
+static esp_err_t write_block(pending_block_t *block, bool *consumed)
+{
+    *consumed = false;
+    uint32_t size = align4(BLOCK_HEADER_SIZE + block->len);
+    if (head_offset + size > TS_LOG_SEGMENT_SIZE) {
+        esp_err_t err = seal_and_advance();
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+
+    block_header_t *header = (block_header_t *)block->data;
+    header->magic = BLOCK_MAGIC;
+    header->length = block->len;
+    header->count = block->count;
+    header->boot = boot;
+    header->base_ms = block->base;
+    header->crc = block_crc(header);
+    // Padding stays erased so it can't be mistaken for a block header
+    memset(block->data + BLOCK_HEADER_SIZE + block->len, 0xFF, size - BLOCK_HEADER_SIZE - block->len);
+
+    esp_err_t err = storage.write(storage.ctx, segment_base(head_seq) + head_offset, block->data, size);
+    *consumed = true;
+    if (err != ESP_OK) {
+        // The area may be partly programmed; never write over it again
+        ESP_LOGE(TAG, "Failed to write block: %s", esp_err_to_name(err));
+        head_offset += size;
+        return seal_and_advance();
+    }
+    head_offset += size;
+    return ESP_OK;
+}
+
+static esp_err_t write_queue(bool partial)
+{
+    if (!log_open) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    xSemaphoreTake(log_lock, portMAX_DELAY);
+    portENTER_CRITICAL(&queue_mux);
+    pending_block_t *filling = filling_block();
+    if (partial && filling != NULL && filling->count > 0) {
+        queue_completed++;
+    }
+    uint32_t dropped = queue_dropped;
+    queue_dropped = 0;
+    portEXIT_CRITICAL(&queue_mux);
+
+    if (dropped > 0) {
+        ESP_LOGW(TAG, "Dropped %" PRIu32 " sample(s) waiting for flash", dropped);
+    }
+
+    // Completed blocks are only changed here, so they can be written without
+    // holding the mux
+    esp_err_t err = ESP_OK;
+    while (err == ESP_OK) {
+        portENTER_CRITICAL(&queue_mux);
+        pending_block_t *block = queue_completed > 0 ? &queue[queue_tail] : NULL;
+        portEXIT_CRITICAL(&queue_mux);
+        if (block == NULL) {
+            break;
+        }
+
+        bool consumed;
+        err = write_block(block, &consumed);
+        if (!consumed) {
+            break;
+        }
+        portENTER_CRITICAL(&queue_mux);
+        block->len = 0;
+        block->count = 0;
+        queue_tail = (queue_tail + 1) % TS_LOG_QUEUE_BLOCKS;
+        queue_completed--;
+        portEXIT_CRITICAL(&queue_mux);
+    }
+    xSemaphoreGive(log_lock);
+    return err;
+}
+
+esp_err_t ts_log_write_pending(void)
+{
+    return write_queue(false);
+}
+
+esp_err_t ts_log_flush(void)
+{
+    return write_queue(true);
+}
+
+static uint8_t put_varint(uint8_t *out, uint32_t value)
+{
+    uint8_t n = 0;
+    while (value >= 0x80) {
+        out[n++] = (uint8_t)value | 0x80;
+        value >>= 7;
+    }
+    out[n++] = (uint8_t)value;
+    return n;
+}
+
+static bool get_varint(const uint8_t **p, const uint8_t *end, uint32_t *value)
+{
+    *value = 0;
+    for (uint8_t shift = 0; shift < 35 && *p < end; shift += 7) {
+        uint8_t byte = *(*p)++;
+        *value |= (uint32_t)(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void ts_log_record(uint8_t device_id, uint8_t type, uint16_t address, uint16_t slot,
+                   uint32_t timestamp_ms, uint32_t raw)
+{
+    if (!log_open || slot >= MODBUS_MAX_VALUE_SLOTS) {
+        return;
+    }
+
+    uint32_t key = ((uint32_t)device_id << 24) | ((uint32_t)type << 16) | address;
+    bool completed = false;
+    portENTER_CRITICAL(&queue_mux);
+
+    // Only changes (and a periodic heartbeat) reach flash
+    slot_state_t *state = &slots[slot];
+    if (state->valid && state->key == key && state->raw == raw &&
+        timestamp_ms - state->logged_at < TS_LOG_HEARTBEAT_MS) {
+        portEXIT_CRITICAL(&queue_mux);
+        return;
+    }
+
+    pending_block_t *block = filling_block();
+    if (block != NULL && block->count > 0 &&
+        (timestamp_ms < block->prev || block->count == BLOCK_MAX_SAMPLES ||
+         BLOCK_HEADER_SIZE + block->len + SAMPLE_MAX_BYTES > TS_LOG_BLOCK_SIZE)) {
+        queue_completed++;
+        completed = true;
+        block = filling_block();
+    }
+
+    if (block == NULL) {
+        // Left unmarked in slots[] so the value is retried next poll
+        queue_dropped++;
+    } else {
+        if (block->count == 0) {
+            block->base = timestamp_ms;
+            block->prev = timestamp_ms;
+        }
+
+        uint8_t *p = block->data + BLOCK_HEADER_SIZE + block->len;
+        uint8_t n = put_varint(p, timestamp_ms - block->prev);
+        p[n++] = device_id;
+        p[n++] = type;
+        n += put_varint(p + n, address);
+        n += put_varint(p + n, raw);
+        block->len += n;
+        block->count++;
+        block->prev = timestamp_ms;
+
+        state->key = key;
+        state->raw = raw;
+        state->logged_at = timestamp_ms;
+        state->valid = true;
+    }
+    portEXIT_CRITICAL(&queue_mux);
+
+    if (completed && wake_writer != NULL) {
+        wake_writer();
+    }
+}
+
+esp_err_t ts_log_begin(const ts_log_cursor_t *after, ts_log_cursor_t *start, ts_log_cursor_t *end, bool *gap)
+{
+    if (!log_open) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    esp_err_t err = ESP_OK;
+    xSemaphoreTake(log_lock, portMAX_DELAY);
+    end->seq = head_seq;
+    end->offset = head_offset;
+    *gap = false;
+
+    if (after == NULL) {
+        start->seq = oldest_seq;
+        start->offset = SEGMENT_HEADER_SIZE;
+    } else if (after->seq > head_seq || (after->seq == head_seq && after->offset > head_offset) ||
+               after->offset < SEGMENT_HEADER_SIZE || after->offset > TS_LOG_SEGMENT_SIZE) {
+        // Not a position this log has reached, e.g. from before a reflash
+        err = ESP_ERR_INVALID_ARG;
+    } else if (after->seq < oldest_seq) {
+        *gap = !(after->seq == dropped_end.seq && after->offset == dropped_end.offset &&
+                 after->seq + 1 == oldest_seq);
+        start->seq = oldest_seq;
+        start->offset = SEGMENT_HEADER_SIZE;
+    } else if (after->seq < head_seq && after->offset >= segment_end(after->seq)) {
+        start->seq = after->seq + 1;
+        start->offset = SEGMENT_HEADER_SIZE;
+    } else {
+        *start = *after;
+    }
+    xSemaphoreGive(log_lock);
+    return err;
+}
+
+static size_t decode_block(const block_header_t *header, ts_log_sample_t *samples)
+{
+    const uint8_t *p = (const uint8_t *)header + BLOCK_HEADER_SIZE;
+    const uint8_t *limit = p + header->length;
+    uint32_t timestamp = header->base_ms;
+    size_t count = 0;
+
+    while (count < header->count && count < BLOCK_MAX_SAMPLES) {
+        uint32_t delta, address, raw;
+        if (!get_varint(&p, limit, &delta) || limit - p < 2) {
+            break;
+        }
+        ts_log_sample_t *sample = &samples[count];
+        sample->device_id = *p++;
+        sample->type = *p++;
+        if (!get_varint(&p, limit, &address) || !get_varint(&p, limit, &raw)) {
+            break;
+        }
+        timestamp += delta;
+        sample->boot = header->boot;
+        sample->timestamp = timestamp;
+        sample->address = address;
+        sample->raw = raw;
+        count++;
+    }
+    return count;
+}
+
+esp_err_t ts_log_read(const ts_log_cursor_t *start, const ts_log_cursor_t *end,
+                      ts_log_block_cb cb, void *ctx)
+{
+    if (!log_open) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    ts_log_sample_t *samples = malloc(BLOCK_MAX_SAMPLES * sizeof(ts_log_sample_t));
+    if (samples == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    esp_err_t err = ESP_OK;
+    ts_log_cursor_t pos = *start;
+    while (err == ESP_OK && (pos.seq < end->seq || (pos.seq == end->seq && pos.offset < end->offset))) {
+        uint32_t limit = pos.seq == end->seq ? end->offset : segment_end(pos.seq);
+        if (pos.offset >= limit || !segment_holds(pos.seq)) {
+            pos.seq++;
+            pos.offset = SEGMENT_HEADER_SIZE;
+            continue;
+        }
+
+        const block_header_t *header;
+        int size = block_at(pos.seq, pos.offset, &header);
+        if (size <= 0) {
+            // Sealed segments end at their last good block, so this only
+            // happens if the segment was overwritten under the reader
+            err = ESP_ERR_INVALID_STATE;
+            break;
+        }
+        size_t count = decode_block(header, samples);
+        pos.offset += size;
+
+        if (!segment_holds(pos.seq)) {
+            err = ESP_ERR_INVALID_STATE;
+            break;
+        }
+        ts_log_cursor_t next = pos;
+        if (pos.seq < end->seq && pos.offset >= segment_end(pos.seq)) {
+            next.seq++;
+            next.offset = SEGMENT_HEADER_SIZE;
+        }
+        err = cb(ctx, samples, count, &next);
+    }
+
+    free(samples);
+    return err;
+}
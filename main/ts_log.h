@@ -0,0 +1,84 @@
+#ifndef TS_LOG_H
+#define TS_LOG_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+#define TS_LOG_PARTITION_LABEL "tslog"
+#define TS_LOG_SEGMENT_SIZE (32 * 1024)
+#define TS_LOG_BLOCK_SIZE 512
+#define TS_LOG_FLUSH_INTERVAL_MS 30000
+// Blocks that can wait in RAM for the writer; covers a segment erase at the
+// busiest poll rate
+#define TS_LOG_QUEUE_BLOCKS 4
+// A register that keeps its value is still logged this often, so gaps in the
+// log mean the gateway was not polling rather than that nothing changed
+#define TS_LOG_HEARTBEAT_MS 300000
+
+// Flash access used by the log. Reads go straight through the mapped view;
+// writes only ever program erased bytes. The firmware binds this to the
+// "tslog" partition, host tools can bind it to a file-backed image.
+typedef struct {
+    const uint8_t *mapped;
+    size_t size;
+    size_t erase_size;
+    esp_err_t (*write)(void *ctx, size_t offset, const void *data, size_t len);
+    esp_err_t (*erase)(void *ctx, size_t offset, size_t len);
+    void *ctx;
+} ts_log_storage_t;
+
+// Position in the log: the segment sequence number and the byte offset of
+// the next block within it. Sequence numbers never repeat.
+typedef struct {
+    uint32_t seq;
+    uint32_t offset;
+} ts_log_cursor_t;
+
+typedef struct {
+    uint16_t boot;
+    uint32_t timestamp;         // Milliseconds since that boot
+    uint8_t device_id;
+    uint8_t type;
+    uint16_t address;
+    uint32_t raw;
+} ts_log_sample_t;
+
+// Called for each durable block; samples are only valid during the call and
+// *next is the cursor to acknowledge once they are processed. Returning an
+// error stops the read.
+typedef esp_err_t (*ts_log_block_cb)(void *ctx, const ts_log_sample_t *samples, size_t count,
+                                     const ts_log_cursor_t *next);
+
+esp_err_t ts_log_init(void);
+esp_err_t ts_log_open(const ts_log_storage_t *storage);
+esp_err_t ts_log_storage_partition(const char *label, ts_log_storage_t *storage);
+uint16_t ts_log_boot(void);
+
+// Logs a polled value if it changed since the last sample of its value slot
+// or the heartbeat interval has passed. Samples are packed into RAM blocks;
+// this never touches flash, so it is safe on the poll path. When every block
+// is waiting for the writer the sample is dropped (and retried next poll).
+void ts_log_record(uint8_t device_id, uint8_t type, uint16_t address, uint16_t slot,
+                   uint32_t timestamp_ms, uint32_t raw);
+
+// Called from ts_log_record, outside any lock, when a block is complete and
+// should be written soon
+void ts_log_set_wake(void (*wake)(void));
+
+// Writer side: write the completed blocks (erasing the next segment when the
+// head fills up), and ts_log_flush also the partly filled one
+esp_err_t ts_log_write_pending(void);
+esp_err_t ts_log_flush(void);
+
+// Resolves a read: *start is the first block after *after (the oldest block
+// when after is NULL) and *end the current write position. *gap is set when
+// blocks following *after have already been overwritten.
+esp_err_t ts_log_begin(const ts_log_cursor_t *after, ts_log_cursor_t *start, ts_log_cursor_t *end, bool *gap);
+
+// Reads the blocks in [start, end) straight from the mapped flash
+esp_err_t ts_log_read(const ts_log_cursor_t *start, const ts_log_cursor_t *end,
+                      ts_log_block_cb cb, void *ctx);
+
+#endif
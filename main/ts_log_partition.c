@@ -0,0 +1,94 @@
+#include "ts_log.h"
+#include "esp_partition.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+static const char *TAG = "TS_LOG";
+
+#define WRITER_STACK_SIZE 3072
+#define WRITER_PRIORITY 2
+
+static TaskHandle_t writer_task = NULL;
+
+static esp_err_t partition_write(void *ctx, size_t offset, const void *data, size_t len)
+{
+    return esp_partition_write((const esp_partition_t *)ctx, offset, data, len);
+}
+
+static esp_err_t partition_erase(void *ctx, size_t offset, size_t len)
+{
+    return esp_partition_erase_range((const esp_partition_t *)ctx, offset, len);
+}
+
+// Maps the whole partition once; the flash driver keeps the mapping coherent
+// with writes and erases made through esp_partition
+esp_err_t ts_log_storage_partition(const char *label, ts_log_storage_t *storage)
+{
+    const esp_partition_t *partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+                                                                ESP_PARTITION_SUBTYPE_ANY, label);
+    if (partition == NULL) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    const void *mapped;
+    esp_partition_mmap_handle_t handle;
+    esp_err_t err = esp_partition_mmap(partition, 0, partition->size, ESP_PARTITION_MMAP_DATA, &mapped, &handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    storage->mapped = mapped;
+    storage->size = partition->size;
+    storage->erase_size = partition->erase_size;
+    storage->write = partition_write;
+    storage->erase = partition_erase;
+    storage->ctx = (void *)partition;
+    return ESP_OK;
+}
+
+static void wake_writer(void)
+{
+    xTaskNotifyGive(writer_task);
+}
+
+// Does the flash work for the log at a lower priority than polling: writes
+// blocks as the poller completes them and flushes the partial one every
+// TS_LOG_FLUSH_INTERVAL_MS
+static void writer_main(void *arg)
+{
+    TickType_t last_flush = xTaskGetTickCount();
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(TS_LOG_FLUSH_INTERVAL_MS));
+        if (xTaskGetTickCount() - last_flush >= pdMS_TO_TICKS(TS_LOG_FLUSH_INTERVAL_MS)) {
+            ts_log_flush();
+            last_flush = xTaskGetTickCount();
+        } else {
+            ts_log_write_pending();
+        }
+    }
+}
+
+esp_err_t ts_log_init(void)
+{
+    ts_log_storage_t storage;
+    esp_err_t err = ts_log_storage_partition(TS_LOG_PARTITION_LABEL, &storage);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "No usable \"%s\" partition: %s", TS_LOG_PARTITION_LABEL, esp_err_to_name(err));
+        return err;
+    }
+
+    err = ts_log_open(&storage);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    if (writer_task == NULL) {
+        if (xTaskCreate(writer_main, "ts_log", WRITER_STACK_SIZE, NULL, WRITER_PRIORITY, &writer_task) != pdPASS) {
+            ESP_LOGE(TAG, "Failed to create writer task");
+            return ESP_ERR_NO_MEM;
+        }
+        ts_log_set_wake(wake_writer);
+    }
+    return ESP_OK;
+}
@@ -0,0 +1,12 @@
+#include "web_assets.h"
+#include <string.h>
+
+const web_asset_t* web_asset_find(const char *path, size_t path_len)
+{
+    for (size_t i = 0; i < web_asset_count; i++) {
+        if (strncmp(web_assets[i].path, path, path_len) == 0 && web_assets[i].path[path_len] == '\0') {
+            return &web_assets[i];
+        }
+    }
+    return NULL;
+}
@@ -0,0 +1,24 @@
+#ifndef WEB_ASSETS_H
+#define WEB_ASSETS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Web UI files gzipped at build time (tools/gen_web_assets.py). The tables
+// are const and stay in flash; content is served exactly as stored.
+typedef struct {
+    const char *path;           // Request path, e.g. "/modbus.js"
+    const char *content_type;
+    const uint8_t *data;        // gzip stream
+    size_t length;
+    const char *etag;           // Quoted strong ETag derived from the content hash
+} web_asset_t;
+
+extern const web_asset_t web_assets[];
+extern const size_t web_asset_count;
+
+// path need not be terminated at path_len, so a request URI can be matched
+// without copying off its query string
+const web_asset_t* web_asset_find(const char *path, size_t path_len);
+
+#endif
@@ -2,30 +2,38 @@
 #include "nvs_storage.h"
 #include "wifi_manager.h"
 #include "modbus_devices.h"
+#include "device_profiles.h"
+#include "web_assets.h"
+#include "json_writer.h"
+#include "json_reader.h"
+#include "cbor_keys.h"
+#include "response_cache.h"
+#include "bus_admission.h"
+#include "http_workers.h"
+#include "modbus_history.h"
+#include "ts_log.h"
+#include "modbus_rollup.h"
+#include "modbus_alarms.h"
 #include "modbus_manager.h"
+#include "modbus_batch.h"
+#include "mqtt_publisher.h"
+#include "influx_push.h"
 #include "esp_http_server.h"
 #include "esp_log.h"
+#include "esp_random.h"
 #include "cJSON.h"
+#include "lwip/sockets.h"
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <inttypes.h>
-
-extern const char index_html_start[] asm("_binary_index_html_start");
-extern const char index_html_end[] asm("_binary_index_html_end");
-extern const char style_css_start[] asm("_binary_style_css_start");
-extern const char style_css_end[] asm("_binary_style_css_end");
-extern const char script_js_start[] asm("_binary_script_js_start");
-extern const char script_js_end[] asm("_binary_script_js_end");
-extern const char modbus_html_start[] asm("_binary_modbus_html_start");
-extern const char modbus_html_end[] asm("_binary_modbus_html_end");
-extern const char dashboard_html_start[] asm("_binary_dashboard_html_start");
-extern const char dashboard_html_end[] asm("_binary_dashboard_html_end");
-extern const char modbus_js_start[] asm("_binary_modbus_js_start");
-extern const char modbus_js_end[] asm("_binary_modbus_js_end");
+#include <math.h>
 
 static const char *TAG = "WEB_SERVER";
 static httpd_handle_t server = NULL;
+// Random per boot, so configuration tags don't repeat across restarts even
+// though snapshot versions start over
+static uint32_t boot_tag = 0;
 
 static char* extract_query_value(const char *query, const char *key)
 {
@@ -65,49 +73,77 @@ static char* extract_query_value(const char *query, const char *key)
     return value;
 }
 
+// Resolves the register type for register-addressed requests. The "type" query
+// parameter disambiguates coils and holding registers sharing an address; when
+// it is omitted the first configured type at that address is used.
+static esp_err_t resolve_register_type(uint8_t device_id, const char *type_str, uint16_t address,
+                                       register_type_t *type)
+{
+    if (type_str != NULL) {
+        int value = atoi(type_str);
+        if (value < REGISTER_TYPE_COIL || value > REGISTER_TYPE_VIRTUAL) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        *type = (register_type_t)value;
+        return ESP_OK;
+    }
+
+    static const register_type_t probe_order[] = {
+        REGISTER_TYPE_HOLDING, REGISTER_TYPE_INPUT, REGISTER_TYPE_COIL, REGISTER_TYPE_DISCRETE,
+        REGISTER_TYPE_VIRTUAL
+    };
+    const modbus_snapshot_t *snapshot = modbus_snapshot_acquire();
+    esp_err_t err = ESP_ERR_NOT_FOUND;
+    for (size_t i = 0; i < sizeof(probe_order) / sizeof(probe_order[0]); i++) {
+        if (modbus_snapshot_find_register(snapshot, device_id, probe_order[i], address) != NULL) {
+            *type = probe_order[i];
+            err = ESP_OK;
+            break;
+        }
+    }
+    modbus_snapshot_release(snapshot);
+    return err;
+}
+
+// True if the request's If-None-Match lists etag (quoted)
+static bool etag_matches(httpd_req_t *req, const char *etag)
+{
+    char if_none_match[96];
+    return httpd_req_get_hdr_value_str(req, "If-None-Match", if_none_match, sizeof(if_none_match)) == ESP_OK &&
+           strstr(if_none_match, etag) != NULL;
+}
+
+// Sends a gzipped asset, or 304 if the client already holds this version.
+// Stylesheets and scripts are referenced from the pages with their content
+// hash in the query string, so a URL with a query never changes content and
+// can be cached for good; pages themselves are always revalidated.
+static esp_err_t send_web_asset(httpd_req_t *req, const web_asset_t *asset)
+{
+    bool versioned = strchr(req->uri, '?') != NULL;
+    httpd_resp_set_hdr(req, "Cache-Control", versioned ? "public, max-age=31536000, immutable" : "no-cache");
+    httpd_resp_set_hdr(req, "ETag", asset->etag);
+
+    if (etag_matches(req, asset->etag)) {
+        httpd_resp_set_status(req, "304 Not Modified");
+        return httpd_resp_send(req, NULL, 0);
+    }
+
+    // Every browser the UI supports accepts gzip, so no identity copy is kept
+    httpd_resp_set_type(req, asset->content_type);
+    httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
+    return httpd_resp_send(req, (const char *)asset->data, asset->length);
+}
+
 static esp_err_t get_static_file_handler(httpd_req_t *req)
 {
-    const char *uri = req->uri;
-    const char *filename = NULL;
-    const char *content_type = NULL;
-    const char *file_start;
-    const char *file_end;
-
-    if (strcmp(uri, "/style.css") == 0) {
-        filename = "style.css";
-        content_type = "text/css";
-        file_start = style_css_start;
-        file_end = style_css_end;
-    } else if (strcmp(uri, "/script.js") == 0) {
-        filename = "script.js";
-        content_type = "application/javascript";
-        file_start = script_js_start;
-        file_end = script_js_end;
-    } else if (strcmp(uri, "/modbus.html") == 0) {
-        filename = "modbus.html";
-        content_type = "text/html";
-        file_start = modbus_html_start;
-        file_end = modbus_html_end;
-    } else if (strcmp(uri, "/dashboard.html") == 0) {
-        filename = "dashboard.html";
-        content_type = "text/html";
-        file_start = dashboard_html_start;
-        file_end = dashboard_html_end;
-    } else if (strcmp(uri, "/modbus.js") == 0) {
-        filename = "modbus.js";
-        content_type = "application/javascript";
-        file_start = modbus_js_start;
-        file_end = modbus_js_end;
-    } else {
+    const web_asset_t *asset = web_asset_find(req->uri, strcspn(req->uri, "?"));
+    if (asset == NULL) {
         httpd_resp_send_404(req);
         return ESP_OK;
     }
 
-    httpd_resp_set_type(req, content_type);
-    httpd_resp_send(req, file_start, file_end - file_start);
-
-    ESP_LOGI(TAG, "Serving %s", filename);
-    return ESP_OK;
+    ESP_LOGI(TAG, "Serving %s", asset->path);
+    return send_web_asset(req, asset);
 }
 
 static esp_err_t get_status_handler(httpd_req_t *req)
@@ -187,497 +223,3457 @@ static esp_err_t post_clear_handler(httpd_req_t *req)
 
 
 
-static esp_err_t api_get_devices_handler(httpd_req_t *req)
+// Splits the next comma-separated number off *list
+static bool next_list_value(char **list, long *value)
 {
-    uint8_t count = 0;
-    const modbus_device_t *devices = modbus_list_devices(&count);
+    if (*list == NULL || **list == '\0') {
+        return false;
+    }
+    char *end;
+    *value = strtol(*list, &end, 10);
+    if (end == *list || (*end != ',' && *end != '\0')) {
+        return false;
+    }
+    *list = *end == ',' ? end + 1 : end;
+    return true;
+}
 
-    if (devices == NULL) {
-        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to get devices");
-        return ESP_FAIL;
+// Fields of /api/modbus/devices, selectable with ?fields=. Register fields
+// are named "registers.<field>"; "registers" alone selects all of them.
+typedef enum {
+    DEVICE_FIELD_DEVICE_ID,
+    DEVICE_FIELD_NAME,
+    DEVICE_FIELD_DESCRIPTION,
+    DEVICE_FIELD_POLL_INTERVAL_MS,
+    DEVICE_FIELD_BAUDRATE,
+    DEVICE_FIELD_ENABLED,
+    DEVICE_FIELD_PROFILE,
+    DEVICE_FIELD_STATUS,
+    DEVICE_FIELD_LAST_ERROR,
+    DEVICE_FIELD_POLL_COUNT,
+    DEVICE_FIELD_ERROR_COUNT,
+    DEVICE_FIELD_REGISTER_COUNT,
+    DEVICE_FIELD_REGISTERS,
+    DEVICE_FIELD_COUNT
+} device_field_t;
+
+static const char *const device_field_names[DEVICE_FIELD_COUNT] = {
+    "device_id", "name", "description", "poll_interval_ms", "baudrate", "enabled", "profile",
+    "status", "last_error", "poll_count", "error_count", "register_count", "registers",
+};
+
+typedef enum {
+    REGISTER_FIELD_ADDRESS,
+    REGISTER_FIELD_TYPE,
+    REGISTER_FIELD_NAME,
+    REGISTER_FIELD_UNIT,
+    REGISTER_FIELD_SCALE,
+    REGISTER_FIELD_OFFSET,
+    REGISTER_FIELD_WRITABLE,
+    REGISTER_FIELD_FORMAT,
+    REGISTER_FIELD_WORD_ORDER,
+    REGISTER_FIELD_BIT_MASK,
+    REGISTER_FIELD_EXPRESSION,
+    REGISTER_FIELD_DESCRIPTION,
+    REGISTER_FIELD_DEADBAND,
+    REGISTER_FIELD_HISTORY,
+    REGISTER_FIELD_LAST_VALUE,
+    REGISTER_FIELD_VALUE,
+    REGISTER_FIELD_DECIMALS,
+    REGISTER_FIELD_LAST_UPDATE,
+    REGISTER_FIELD_COUNT
+} register_field_t;
+
+static const char *const register_field_names[REGISTER_FIELD_COUNT] = {
+    "address", "type", "name", "unit", "scale", "offset", "writable", "format", "word_order",
+    "bit_mask", "expression", "description", "deadband", "history", "last_value", "value", "decimals",
+    "last_update",
+};
+
+#define FIELD_BIT(field) (1u << (field))
+
+static int find_field(const char *const *names, size_t count, const char *name, size_t len)
+{
+    for (size_t i = 0; i < count; i++) {
+        if (strncmp(names[i], name, len) == 0 && names[i][len] == '\0') {
+            return (int)i;
+        }
     }
+    return -1;
+}
 
-    cJSON *root = cJSON_CreateArray();
-    for (uint8_t i = 0; i < count; i++) {
-        cJSON *device = cJSON_CreateObject();
-        cJSON_AddNumberToObject(device, "device_id", devices[i].device_id);
-        cJSON_AddStringToObject(device, "name", devices[i].name);
-        cJSON_AddStringToObject(device, "description", devices[i].description);
-        cJSON_AddNumberToObject(device, "poll_interval_ms", devices[i].poll_interval_ms);
-        cJSON_AddNumberToObject(device, "baudrate", devices[i].baudrate);
-        cJSON_AddNumberToObject(device, "enabled", devices[i].enabled);
-        cJSON_AddNumberToObject(device, "status", devices[i].status);
-        cJSON_AddNumberToObject(device, "last_error", devices[i].last_error);
-        cJSON_AddNumberToObject(device, "poll_count", devices[i].poll_count);
-        cJSON_AddNumberToObject(device, "error_count", devices[i].error_count);
-
-        cJSON *registers = cJSON_CreateArray();
-        for (uint8_t j = 0; j < devices[i].register_count; j++) {
-            cJSON *reg = cJSON_CreateObject();
-            cJSON_AddNumberToObject(reg, "address", devices[i].registers[j].address);
-            cJSON_AddNumberToObject(reg, "type", devices[i].registers[j].type);
-            cJSON_AddStringToObject(reg, "name", devices[i].registers[j].name);
-            cJSON_AddStringToObject(reg, "unit", devices[i].registers[j].unit);
-            cJSON_AddNumberToObject(reg, "scale", devices[i].registers[j].scale);
-            cJSON_AddNumberToObject(reg, "offset", devices[i].registers[j].offset);
-            cJSON_AddNumberToObject(reg, "writable", devices[i].registers[j].writable);
-            cJSON_AddNumberToObject(reg, "last_value", devices[i].registers[j].last_value);
-            cJSON_AddNumberToObject(reg, "last_update", devices[i].registers[j].last_update);
-            cJSON_AddItemToArray(registers, reg);
-        }
-        cJSON_AddNumberToObject(device, "register_count", devices[i].register_count);
-        cJSON_AddItemToObject(device, "registers", registers);
-        cJSON_AddItemToArray(root, device);
+// Parses a ?fields= list into device and register field masks
+static bool parse_device_fields(const char *list, uint32_t *device_mask, uint32_t *register_mask)
+{
+    static const char prefix[] = "registers.";
+    *device_mask = 0;
+    *register_mask = 0;
+
+    while (*list != '\0') {
+        size_t len = strcspn(list, ",");
+        int field;
+        if (len > sizeof(prefix) - 1 && strncmp(list, prefix, sizeof(prefix) - 1) == 0) {
+            field = find_field(register_field_names, REGISTER_FIELD_COUNT,
+                               list + sizeof(prefix) - 1, len - (sizeof(prefix) - 1));
+            if (field < 0) {
+                return false;
+            }
+            *register_mask |= FIELD_BIT(field);
+            *device_mask |= FIELD_BIT(DEVICE_FIELD_REGISTERS);
+        } else {
+            field = find_field(device_field_names, DEVICE_FIELD_COUNT, list, len);
+            if (field < 0) {
+                return false;
+            }
+            *device_mask |= FIELD_BIT(field);
+            if (field == DEVICE_FIELD_REGISTERS) {
+                *register_mask = FIELD_BIT(REGISTER_FIELD_COUNT) - 1;
+            }
+        }
+        list += len;
+        if (*list == ',') {
+            list++;
+        }
     }
+    return true;
+}
 
-    char *json_str = cJSON_PrintUnformatted(root);
-    httpd_resp_set_type(req, "application/json");
-    httpd_resp_send(req, json_str, strlen(json_str));
+static esp_err_t json_chunk_flush(void *ctx, const char *data, size_t len)
+{
+    return httpd_resp_send_chunk(ctx, data, len);
+}
 
-    free(json_str);
-    cJSON_Delete(root);
+static bool wants_cbor(httpd_req_t *req)
+{
+    char accept[96];
+    return httpd_req_get_hdr_value_str(req, "Accept", accept, sizeof(accept)) == ESP_OK &&
+           strstr(accept, "application/cbor") != NULL;
+}
 
-    return ESP_OK;
+static void response_set_type(httpd_req_t *req, bool cbor)
+{
+    httpd_resp_set_type(req, cbor ? "application/cbor" : "application/json");
+    httpd_resp_set_hdr(req, "Vary", "Accept");
 }
 
-static esp_err_t api_post_device_handler(httpd_req_t *req)
+static void response_writer_setup(httpd_req_t *req, json_writer_t *w, bool cbor,
+                                  json_writer_flush_cb flush, void *ctx)
 {
-    char buf[512];
-    int ret = httpd_req_recv(req, buf, sizeof(buf));
-    if (ret <= 0) {
-        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Failed to receive data");
-        return ESP_FAIL;
+    if (cbor) {
+        json_writer_init_cbor(w, flush, ctx, cbor_keys, cbor_key_count);
+    } else {
+        json_writer_init(w, flush, ctx);
     }
-    buf[ret] = '\0';
+    response_set_type(req, cbor);
+}
 
-    cJSON *root = cJSON_Parse(buf);
-    if (root == NULL) {
-        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid JSON");
-        return ESP_FAIL;
+// Sets up w for a chunked response in the representation the client accepts:
+// CBOR if it asks for application/cbor, JSON otherwise
+static void response_writer_init(httpd_req_t *req, json_writer_t *w, bool cbor)
+{
+    response_writer_setup(req, w, cbor, json_chunk_flush, req);
+}
+
+typedef void (*snapshot_render_fn)(json_writer_t *w, const modbus_snapshot_t *snapshot, const void *arg);
+
+typedef struct {
+    json_writer_t w;
+    httpd_req_t *req;
+    response_cache_capture_t capture;
+} cached_render_t;
+
+static esp_err_t cached_chunk_flush(void *ctx, const char *data, size_t len)
+{
+    cached_render_t *render = ctx;
+    response_cache_capture_append(&render->capture, data, len);
+    return httpd_resp_send_chunk(render->req, data, len);
+}
+
+// Serves a response rendered from snapshot through the shared response
+// cache. tag names the data the response shows: it is the ETag, so a client
+// holding it gets a 304, and while it doesn't change every client is sent
+// the bytes rendered for the first one. The entry key is the full URI and
+// representation, so each query has its own.
+static esp_err_t send_snapshot_response(httpd_req_t *req, const modbus_snapshot_t *snapshot, const char *tag,
+                                        snapshot_render_fn render, const void *arg)
+{
+    bool cbor = wants_cbor(req);
+    char etag[RESPONSE_CACHE_TAG_LEN + 8];
+    // Each representation needs its own validator
+    snprintf(etag, sizeof(etag), cbor ? "\"%s+cbor\"" : "\"%s\"", tag);
+
+    httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+    httpd_resp_set_hdr(req, "ETag", etag);
+    if (etag_matches(req, etag)) {
+        response_cache_record_not_modified();
+        httpd_resp_set_status(req, "304 Not Modified");
+        return httpd_resp_send(req, NULL, 0);
     }
 
-    cJSON *device_id = cJSON_GetObjectItem(root, "device_id");
-    if (!device_id || !cJSON_IsNumber(device_id)) {
-        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Missing or invalid field: device_id");
-        cJSON_Delete(root);
-        return ESP_FAIL;
+    // A URI too long for the key is served uncached: a truncated key could
+    // match another query's entry
+    char key[RESPONSE_CACHE_KEY_LEN];
+    int key_len = snprintf(key, sizeof(key), "%c%s", cbor ? 'C' : 'J', req->uri);
+    bool keyed = key_len >= 0 && (size_t)key_len < sizeof(key);
+    const response_cache_blob_t *blob = keyed ? response_cache_get(key, tag) : NULL;
+    if (blob != NULL) {
+        response_set_type(req, cbor);
+        esp_err_t err = httpd_resp_send(req, blob->data, blob->len);
+        response_cache_release(blob);
+        return err;
     }
-    if (device_id->valueint < 1 || device_id->valueint > 247) {
-        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid device_id: must be 1-247");
-        cJSON_Delete(root);
+
+    cached_render_t *r = malloc(sizeof(cached_render_t));
+    if (r == NULL) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
         return ESP_FAIL;
     }
+    r->req = req;
+    response_cache_capture_init(&r->capture);
+    // Counted as uncacheable when it reaches response_cache_put()
+    r->capture.overflow = !keyed;
+    response_writer_setup(req, &r->w, cbor, cached_chunk_flush, r);
+    render(&r->w, snapshot, arg);
+
+    esp_err_t err = json_writer_finish(&r->w);
+    if (err == ESP_OK) {
+        response_cache_put(key, tag, &r->capture);
+    } else {
+        response_cache_capture_discard(&r->capture);
+    }
+    free(r);
+    if (err != ESP_OK) {
+        // Headers are already out; cut the response short
+        ESP_LOGW(TAG, "Response to %s aborted: %s", req->uri, esp_err_to_name(err));
+        return err;
+    }
+    return httpd_resp_sendstr_chunk(req, NULL);
+}
 
-    cJSON *name = cJSON_GetObjectItem(root, "name");
-    if (!name || !cJSON_IsString(name) || strlen(name->valuestring) == 0) {
-        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Missing or invalid field: name");
-        cJSON_Delete(root);
-        return ESP_FAIL;
+// Writes a fixed-point number given as mantissa and decimals. CBOR gets the
+// mantissa alone; the decimals are in the register's "decimals" field.
+static void json_fixed(json_writer_t *w, int64_t value, uint8_t decimals)
+{
+    if (w->format == JSON_WRITER_CBOR) {
+        json_int(w, value);
+        return;
     }
+    modbus_decoded_t decoded = { value, decimals };
+    char text[MODBUS_DECODE_STR_LEN];
+    int len = modbus_decode_format(&decoded, text, sizeof(text));
+    json_raw(w, text, len);
+}
 
-    cJSON *poll_interval = cJSON_GetObjectItem(root, "poll_interval_ms");
-    if (!poll_interval || !cJSON_IsNumber(poll_interval)) {
-        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Missing or invalid field: poll_interval_ms");
-        cJSON_Delete(root);
-        return ESP_FAIL;
+static void write_register_json(json_writer_t *w, const modbus_register_t *reg, uint32_t fields)
+{
+    modbus_value_t value;
+    modbus_decoded_t decoded;
+    modbus_read_value(reg, &value);
+    modbus_decode_value(reg, &value, &decoded);
+
+    json_begin_object(w);
+    if (fields & FIELD_BIT(REGISTER_FIELD_ADDRESS)) {
+        json_key(w, "address");
+        json_uint(w, reg->address);
     }
-    if (poll_interval->valueint < 1000 || poll_interval->valueint > 60000) {
-        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid poll_interval_ms: must be 1000-60000");
-        cJSON_Delete(root);
-        return ESP_FAIL;
+    if (fields & FIELD_BIT(REGISTER_FIELD_TYPE)) {
+        json_key(w, "type");
+        json_uint(w, reg->type);
+    }
+    if (fields & FIELD_BIT(REGISTER_FIELD_NAME)) {
+        json_key(w, "name");
+        json_string(w, reg->name);
+    }
+    if (fields & FIELD_BIT(REGISTER_FIELD_UNIT)) {
+        json_key(w, "unit");
+        json_string(w, reg->unit);
+    }
+    // Scale and offset come from the compiled decode program, which holds
+    // them in fixed point, so no float formatting is needed
+    if (fields & FIELD_BIT(REGISTER_FIELD_SCALE)) {
+        json_key(w, "scale");
+        json_fixed(w, reg->decode.mul, reg->decode.decimals);
     }
+    if (fields & FIELD_BIT(REGISTER_FIELD_OFFSET)) {
+        json_key(w, "offset");
+        json_fixed(w, reg->decode.add, reg->decode.decimals);
+    }
+    if (fields & FIELD_BIT(REGISTER_FIELD_WRITABLE)) {
+        json_key(w, "writable");
+        json_uint(w, reg->writable);
+    }
+    if (fields & FIELD_BIT(REGISTER_FIELD_FORMAT)) {
+        json_key(w, "format");
+        json_uint(w, reg->format);
+    }
+    if (fields & FIELD_BIT(REGISTER_FIELD_WORD_ORDER)) {
+        json_key(w, "word_order");
+        json_uint(w, reg->word_order);
+    }
+    if (fields & FIELD_BIT(REGISTER_FIELD_BIT_MASK)) {
+        json_key(w, "bit_mask");
+        json_uint(w, reg->bit_mask);
+    }
+    if ((fields & FIELD_BIT(REGISTER_FIELD_EXPRESSION)) && reg->type == REGISTER_TYPE_VIRTUAL) {
+        json_key(w, "expression");
+        json_string(w, reg->expression);
+    }
+    if (fields & FIELD_BIT(REGISTER_FIELD_DESCRIPTION)) {
+        json_key(w, "description");
+        json_string(w, reg->description);
+    }
+    if (fields & FIELD_BIT(REGISTER_FIELD_DEADBAND)) {
+        json_key(w, "deadband");
+        json_fixed(w, reg->deadband_fixed, reg->decode.decimals);
+    }
+    if (fields & FIELD_BIT(REGISTER_FIELD_HISTORY)) {
+        json_key(w, "history");
+        json_uint(w, reg->history);
+    }
+    if (fields & FIELD_BIT(REGISTER_FIELD_LAST_VALUE)) {
+        json_key(w, "last_value");
+        json_uint(w, value.raw);
+    }
+    if (fields & FIELD_BIT(REGISTER_FIELD_VALUE)) {
+        json_key(w, "value");
+        json_fixed(w, decoded.value, decoded.decimals);
+    }
+    if (fields & FIELD_BIT(REGISTER_FIELD_DECIMALS)) {
+        json_key(w, "decimals");
+        json_uint(w, reg->decode.decimals);
+    }
+    if (fields & FIELD_BIT(REGISTER_FIELD_LAST_UPDATE)) {
+        json_key(w, "last_update");
+        json_uint(w, value.last_update);
+    }
+    json_end_object(w);
+}
 
-    cJSON *baudrate = cJSON_GetObjectItem(root, "baudrate");
-    if (!baudrate || !cJSON_IsNumber(baudrate)) {
-        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Missing or invalid field: baudrate");
-        cJSON_Delete(root);
-        return ESP_FAIL;
+static void write_device_json(json_writer_t *w, const modbus_device_t *device,
+                              uint32_t fields, uint32_t register_fields)
+{
+    modbus_device_state_t state;
+    modbus_read_device_state(device, &state);
+
+    json_begin_object(w);
+    if (fields & FIELD_BIT(DEVICE_FIELD_DEVICE_ID)) {
+        json_key(w, "device_id");
+        json_uint(w, device->device_id);
     }
-    if (baudrate->valueint != 9600 && baudrate->valueint != 19200 && 
-        baudrate->valueint != 38400 && baudrate->valueint != 115200) {
-        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid baudrate: must be 9600, 19200, 38400, or 115200");
-        cJSON_Delete(root);
-        return ESP_FAIL;
+    if (fields & FIELD_BIT(DEVICE_FIELD_NAME)) {
+        json_key(w, "name");
+        json_string(w, device->name);
+    }
+    if (fields & FIELD_BIT(DEVICE_FIELD_DESCRIPTION)) {
+        json_key(w, "description");
+        json_string(w, device->description);
+    }
+    if (fields & FIELD_BIT(DEVICE_FIELD_POLL_INTERVAL_MS)) {
+        json_key(w, "poll_interval_ms");
+        json_uint(w, device->poll_interval_ms);
+    }
+    if (fields & FIELD_BIT(DEVICE_FIELD_BAUDRATE)) {
+        json_key(w, "baudrate");
+        json_uint(w, device->baudrate);
+    }
+    if (fields & FIELD_BIT(DEVICE_FIELD_ENABLED)) {
+        json_key(w, "enabled");
+        json_uint(w, device->enabled);
+    }
+    if (fields & FIELD_BIT(DEVICE_FIELD_PROFILE)) {
+        json_key(w, "profile");
+        json_string(w, device->profile);
+    }
+    if (fields & FIELD_BIT(DEVICE_FIELD_STATUS)) {
+        json_key(w, "status");
+        json_uint(w, state.status);
     }
+    if (fields & FIELD_BIT(DEVICE_FIELD_LAST_ERROR)) {
+        json_key(w, "last_error");
+        json_uint(w, state.last_error);
+    }
+    if (fields & FIELD_BIT(DEVICE_FIELD_POLL_COUNT)) {
+        json_key(w, "poll_count");
+        json_uint(w, state.poll_count);
+    }
+    if (fields & FIELD_BIT(DEVICE_FIELD_ERROR_COUNT)) {
+        json_key(w, "error_count");
+        json_uint(w, state.error_count);
+    }
+    if (fields & FIELD_BIT(DEVICE_FIELD_REGISTER_COUNT)) {
+        json_key(w, "register_count");
+        json_uint(w, device->register_count);
+    }
+    if (fields & FIELD_BIT(DEVICE_FIELD_REGISTERS)) {
+        json_key(w, "registers");
+        json_begin_array(w);
+        for (uint16_t j = 0; j < device->register_count; j++) {
+            write_register_json(w, &device->registers[j], register_fields);
+        }
+        json_end_array(w);
+    }
+    json_end_object(w);
+}
 
-    cJSON *enabled = cJSON_GetObjectItem(root, "enabled");
-    if (!enabled || (!cJSON_IsBool(enabled) && !cJSON_IsTrue(enabled) && !cJSON_IsFalse(enabled))) {
-        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Missing or invalid field: enabled");
-        cJSON_Delete(root);
-        return ESP_FAIL;
+// Poll and error counters change on every poll without moving the values
+// version, so a cached device list that shows them is re-rendered this often
+#define DEVICE_COUNTERS_MAX_AGE_MS 5000
+
+typedef struct {
+    uint32_t fields;
+    uint32_t register_fields;
+    bool filter;
+    uint32_t wanted[(UINT8_MAX + 1) / 32];
+} device_list_query_t;
+
+static void render_device_list(json_writer_t *w, const modbus_snapshot_t *snapshot, const void *arg)
+{
+    const device_list_query_t *query = arg;
+    json_begin_array(w);
+    for (uint8_t i = 0; i < snapshot->device_count && w->err == ESP_OK; i++) {
+        uint8_t id = snapshot->devices[i].device_id;
+        if (!query->filter || (query->wanted[id / 32] & (1u << (id % 32)))) {
+            write_device_json(w, &snapshot->devices[i], query->fields, query->register_fields);
+        }
     }
+    json_end_array(w);
+}
 
-    modbus_device_t device = {0};
-    device.device_id = device_id->valueint;
-    strncpy(device.name, name->valuestring, sizeof(device.name) - 1);
-    
-    cJSON *desc = cJSON_GetObjectItem(root, "description");
-    if (desc && desc->valuestring) {
-        strncpy(device.description, desc->valuestring, sizeof(device.description) - 1);
+// Streams the device list straight from the snapshot into fixed-size
+// chunks, so memory use doesn't grow with the number of devices.
+// ?device=1,2 limits the list, ?fields=name,registers.value projects it.
+// Clients refreshing an unchanged list share one cached rendering.
+static esp_err_t api_get_devices_handler(httpd_req_t *req)
+{
+    device_list_query_t list_query = {
+        .fields = FIELD_BIT(DEVICE_FIELD_COUNT) - 1,
+        .register_fields = FIELD_BIT(REGISTER_FIELD_COUNT) - 1,
+    };
+
+    char query[160];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) {
+        char value[128];
+        if (httpd_query_key_value(query, "fields", value, sizeof(value)) == ESP_OK &&
+            !parse_device_fields(value, &list_query.fields, &list_query.register_fields)) {
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid fields");
+            return ESP_FAIL;
+        }
+        if (httpd_query_key_value(query, "device", value, sizeof(value)) == ESP_OK) {
+            char *list = value;
+            long id;
+            list_query.filter = true;
+            while (next_list_value(&list, &id)) {
+                if (id < 1 || id > 247) {
+                    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid device: must be 1-247");
+                    return ESP_FAIL;
+                }
+                list_query.wanted[id / 32] |= 1u << (id % 32);
+            }
+            if (*list != '\0') {
+                httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid device list");
+                return ESP_FAIL;
+            }
+        }
     }
-    
-    device.poll_interval_ms = poll_interval->valueint;
-    device.baudrate = baudrate->valueint;
-    device.enabled = enabled->type == cJSON_True;
-    device.register_count = 0;
 
-    esp_err_t err = modbus_add_device(&device);
-    if (err == ESP_OK) {
-        modbus_devices_save();
-        httpd_resp_set_type(req, "application/json");
-        httpd_resp_send(req, "{\"status\":\"ok\"}", 15);
-    } else if (err == ESP_ERR_NO_MEM) {
-        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Maximum devices reached");
-    } else if (err == ESP_ERR_INVALID_ARG) {
-        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Device ID already exists");
-    } else {
-        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to add device");
+    // The values version is read first: anything rendered after it is at
+    // least that new, so the tag can only understate the content
+    uint32_t values_version = modbus_values_version();
+    const modbus_snapshot_t *snapshot = modbus_snapshot_acquire();
+    char tag[RESPONSE_CACHE_TAG_LEN];
+    int len = snprintf(tag, sizeof(tag), "%08" PRIx32 "-%" PRIu32 "-%" PRIu32,
+                       boot_tag, snapshot->version, values_version);
+    if (list_query.fields & (FIELD_BIT(DEVICE_FIELD_POLL_COUNT) | FIELD_BIT(DEVICE_FIELD_ERROR_COUNT))) {
+        uint32_t now = xTaskGetTickCount() * portTICK_PERIOD_MS;
+        snprintf(tag + len, sizeof(tag) - len, "-%" PRIu32, now / DEVICE_COUNTERS_MAX_AGE_MS);
     }
 
-    cJSON_Delete(root);
+    esp_err_t err = send_snapshot_response(req, snapshot, tag, render_device_list, &list_query);
+    modbus_snapshot_release(snapshot);
     return err;
 }
 
-static esp_err_t api_delete_device_handler(httpd_req_t *req)
+// Configuration fields only: what /api/modbus/config serves and clients cache
+#define CONFIG_DEVICE_FIELDS (FIELD_BIT(DEVICE_FIELD_COUNT) - 1 - FIELD_BIT(DEVICE_FIELD_STATUS) - \
+                              FIELD_BIT(DEVICE_FIELD_LAST_ERROR) - FIELD_BIT(DEVICE_FIELD_POLL_COUNT) - \
+                              FIELD_BIT(DEVICE_FIELD_ERROR_COUNT))
+#define CONFIG_REGISTER_FIELDS (FIELD_BIT(REGISTER_FIELD_COUNT) - 1 - FIELD_BIT(REGISTER_FIELD_LAST_VALUE) - \
+                                FIELD_BIT(REGISTER_FIELD_VALUE) - FIELD_BIT(REGISTER_FIELD_LAST_UPDATE))
+
+// Identifies a configuration snapshot across reboots; also the ETag body
+static void config_tag(const modbus_snapshot_t *snapshot, char *tag, size_t len)
 {
-    char url_buf[100];
-    char *device_id_str = NULL;
+    snprintf(tag, len, "%08" PRIx32 "-%" PRIu32, boot_tag, snapshot->version);
+}
 
-    if (httpd_req_get_url_query_str(req, url_buf, sizeof(url_buf)) == ESP_OK) {
-        device_id_str = extract_query_value(url_buf, "device_id");
-        if (device_id_str != NULL) {
-            uint8_t device_id = atoi(device_id_str);
-            if (device_id < 1 || device_id > 247) {
-                httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid device ID: must be 1-247");
-                free(device_id_str);
-                return ESP_FAIL;
-            }
-            free(device_id_str);
-            
-            esp_err_t err = modbus_remove_device(device_id);
-            
-            if (err == ESP_OK) {
-                modbus_devices_save();
-                httpd_resp_set_type(req, "application/json");
-                httpd_resp_send(req, "{\"status\":\"ok\"}", 15);
-                return ESP_OK;
-            } else if (err == ESP_ERR_NOT_FOUND) {
-                httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "Device not found");
-                return ESP_FAIL;
-            } else {
-                httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to delete device");
-                return ESP_FAIL;
-            }
-        }
+// Device and register configuration without runtime state. It only changes
+// when the configuration does, so clients revalidate it with the ETag and
+// poll /api/modbus/values for the values.
+static void render_config(json_writer_t *w, const modbus_snapshot_t *snapshot, const void *arg)
+{
+    json_begin_object(w);
+    json_key(w, "config");
+    json_string(w, arg);
+    json_key(w, "devices");
+    json_begin_array(w);
+    for (uint8_t i = 0; i < snapshot->device_count && w->err == ESP_OK; i++) {
+        write_device_json(w, &snapshot->devices[i], CONFIG_DEVICE_FIELDS, CONFIG_REGISTER_FIELDS);
     }
+    json_end_array(w);
+    json_end_object(w);
+}
 
-    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid request: device_id required");
-    if (device_id_str) free(device_id_str);
-    return ESP_FAIL;
+static esp_err_t api_get_config_handler(httpd_req_t *req)
+{
+    const modbus_snapshot_t *snapshot = modbus_snapshot_acquire();
+    char tag[24];
+    config_tag(snapshot, tag, sizeof(tag));
+    esp_err_t err = send_snapshot_response(req, snapshot, tag, render_config, tag);
+    modbus_snapshot_release(snapshot);
+    return err;
 }
 
-static esp_err_t api_post_register_handler(httpd_req_t *req)
+// PUT /api/modbus/config replaces the whole configuration with a document in
+// the GET shape. The body is parsed token by token through a fixed buffer into
+// a staged device set, so its size costs no RAM, and nothing is applied until
+// all of it has been validated. Read-only and unknown fields are skipped so an
+// export can be sent back unchanged.
+typedef struct {
+    uint32_t description;
+    uint32_t expression;
+} import_strings_t;
+
+typedef struct {
+    json_reader_t reader;
+    modbus_device_t devices[MAX_MODBUS_DEVICES];
+    uint8_t device_count;
+    // Registers of all devices back to back, grown as they are parsed; each
+    // device's registers pointer is set once parsing is done
+    modbus_register_t *registers;
+    uint16_t register_count;
+    uint16_t register_capacity;
+    uint16_t first_register[MAX_MODBUS_DEVICES];
+    // Register descriptions and expressions back to back, likewise grown; the
+    // registers point into it once parsing is done, until then string_at
+    // holds their offsets. Offset 0 is an empty string.
+    char *strings;
+    uint32_t string_size;
+    uint32_t string_capacity;
+    import_strings_t *string_at;
+    char error[80];
+} config_import_t;
+
+static int request_body_read(void *ctx, char *buf, size_t len)
 {
-    char buf[512];
-    int ret = httpd_req_recv(req, buf, sizeof(buf));
-    if (ret <= 0) {
-        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Failed to receive data");
-        return ESP_FAIL;
+    int ret;
+    do {
+        ret = httpd_req_recv(ctx, buf, len);
+    } while (ret == HTTPD_SOCK_ERR_TIMEOUT);
+    return ret;
+}
+
+static bool import_fail(config_import_t *import, const char *field)
+{
+    if (import->error[0] == '\0') {
+        if (import->reader.err != ESP_OK) {
+            snprintf(import->error, sizeof(import->error), "Invalid JSON");
+        } else {
+            snprintf(import->error, sizeof(import->error), "Missing or invalid field: %s", field);
+        }
     }
-    buf[ret] = '\0';
+    return false;
+}
 
-    cJSON *root = cJSON_Parse(buf);
-    if (root == NULL) {
-        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid JSON");
-        return ESP_FAIL;
+static bool import_long(const json_reader_t *r, json_token_t token, long min, long max, long *value)
+{
+    char *end;
+    if (token != JSON_TOKEN_NUMBER) {
+        return false;
     }
+    *value = strtol(r->text, &end, 10);
+    return *end == '\0' && *value >= min && *value <= max;
+}
 
-    cJSON *device_id = cJSON_GetObjectItem(root, "device_id");
-    if (!device_id || !cJSON_IsNumber(device_id)) {
-        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Missing or invalid field: device_id");
-        cJSON_Delete(root);
-        return ESP_FAIL;
+static bool import_float(const json_reader_t *r, json_token_t token, float *value)
+{
+    char *end;
+    if (token != JSON_TOKEN_NUMBER) {
+        return false;
     }
-    if (device_id->valueint < 1 || device_id->valueint > 247) {
-        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid device_id: must be 1-247");
-        cJSON_Delete(root);
-        return ESP_FAIL;
+    *value = strtof(r->text, &end);
+    return *end == '\0';
+}
+
+// Accepts true/false as well as the 0/1 older exports wrote
+static bool import_bool(const json_reader_t *r, json_token_t token, bool *value)
+{
+    long number;
+    if (token == JSON_TOKEN_TRUE || token == JSON_TOKEN_FALSE) {
+        *value = token == JSON_TOKEN_TRUE;
+        return true;
+    }
+    if (import_long(r, token, 0, 1, &number)) {
+        *value = number != 0;
+        return true;
+    }
+    return false;
+}
+
+static bool import_string(const json_reader_t *r, json_token_t token, char *value, size_t size)
+{
+    if (token != JSON_TOKEN_STRING || r->text_len >= size) {
+        return false;
     }
+    memcpy(value, r->text, r->text_len + 1);
+    return true;
+}
 
-    cJSON *address = cJSON_GetObjectItem(root, "address");
-    if (!address || !cJSON_IsNumber(address)) {
-        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Missing or invalid field: address");
-        cJSON_Delete(root);
+// Appends str to the staged strings and sets *at to its offset
+static bool import_keep_string(config_import_t *import, const char *str, uint32_t *at)
+{
+    size_t len = strlen(str);
+    if (len == 0) {
+        *at = 0;
+        return true;
+    }
+    if (import->string_size + len + 2 > import->string_capacity) {
+        uint32_t capacity = import->string_capacity ? import->string_capacity * 2 : 1024;
+        char *grown = realloc(import->strings, capacity);
+        if (grown == NULL) {
+            snprintf(import->error, sizeof(import->error), "Out of memory");
+            return false;
+        }
+        import->strings = grown;
+        import->string_capacity = capacity;
+        if (import->string_size == 0) {
+            import->strings[import->string_size++] = '\0';
+        }
+    }
+    memcpy(&import->strings[import->string_size], str, len + 1);
+    *at = import->string_size;
+    import->string_size += len + 1;
+    return true;
+}
+
+// Reads the members of a register object; its opening brace is consumed
+static bool import_register(config_import_t *import, modbus_register_t *reg)
+{
+    json_reader_t *r = &import->reader;
+    bool has_address = false;
+    bool has_type = false;
+    json_token_t token;
+    char description[REGISTER_DESC_MAX_LEN] = "";
+    char expression[MODBUS_EXPR_MAX_LEN] = "";
+
+    memset(reg, 0, sizeof(*reg));
+    reg->scale = 1.0f;
+    reg->description = description;
+    reg->expression = expression;
+    while ((token = json_reader_next(r)) == JSON_TOKEN_KEY) {
+        int field = find_field(register_field_names, REGISTER_FIELD_COUNT, r->text, r->text_len);
+        token = json_reader_next(r);
+
+        long number = 0;
+        bool ok;
+        switch (field) {
+            case REGISTER_FIELD_ADDRESS:
+                ok = has_address = import_long(r, token, 0, 65535, &number);
+                reg->address = number;
+                break;
+            case REGISTER_FIELD_TYPE:
+                ok = has_type = import_long(r, token, REGISTER_TYPE_COIL, REGISTER_TYPE_VIRTUAL, &number);
+                reg->type = number;
+                break;
+            case REGISTER_FIELD_NAME:
+                ok = import_string(r, token, reg->name, sizeof(reg->name)) && reg->name[0] != '\0';
+                break;
+            case REGISTER_FIELD_UNIT:
+                ok = import_string(r, token, reg->unit, sizeof(reg->unit));
+                break;
+            case REGISTER_FIELD_SCALE:
+                ok = import_float(r, token, &reg->scale);
+                break;
+            case REGISTER_FIELD_OFFSET:
+                ok = import_float(r, token, &reg->offset);
+                break;
+            case REGISTER_FIELD_WRITABLE:
+                ok = import_bool(r, token, &reg->writable);
+                break;
+            case REGISTER_FIELD_FORMAT:
+                ok = import_long(r, token, 0, UINT8_MAX, &number);
+                reg->format = number;
+                break;
+            case REGISTER_FIELD_WORD_ORDER:
+                ok = import_long(r, token, 0, UINT8_MAX, &number);
+                reg->word_order = number;
+                break;
+            case REGISTER_FIELD_BIT_MASK:
+                ok = import_long(r, token, 0, UINT16_MAX, &number);
+                reg->bit_mask = number;
+                break;
+            case REGISTER_FIELD_EXPRESSION:
+                ok = import_string(r, token, expression, sizeof(expression));
+                break;
+            case REGISTER_FIELD_DESCRIPTION:
+                ok = import_string(r, token, description, sizeof(description));
+                break;
+            case REGISTER_FIELD_DEADBAND:
+                ok = import_float(r, token, &reg->deadband) && reg->deadband >= 0.0f;
+                break;
+            case REGISTER_FIELD_HISTORY:
+                ok = import_bool(r, token, &reg->history);
+                break;
+            default:
+                ok = json_reader_skip(r, token) == ESP_OK;
+                break;
+        }
+        if (!ok) {
+            return import_fail(import, field >= 0 ? register_field_names[field] : "registers");
+        }
+    }
+    if (token != JSON_TOKEN_END_OBJECT) {
+        return import_fail(import, "registers");
+    }
+    if (!has_address || !has_type || reg->name[0] == '\0') {
+        return import_fail(import, !has_address ? "address" : !has_type ? "type" : "name");
+    }
+    if (reg->type == REGISTER_TYPE_VIRTUAL && expression[0] == '\0') {
+        return import_fail(import, "expression");
+    }
+    if (modbus_validate_register(reg) != ESP_OK) {
+        snprintf(import->error, sizeof(import->error), "Invalid %s of register %u",
+                 reg->type == REGISTER_TYPE_VIRTUAL ? "expression" : "format", reg->address);
+        return false;
+    }
+    import_strings_t *at = &import->string_at[import->register_count];
+    return import_keep_string(import, description, &at->description) &&
+           import_keep_string(import, expression, &at->expression);
+}
+
+static bool import_registers(config_import_t *import, modbus_device_t *device)
+{
+    json_reader_t *r = &import->reader;
+    json_token_t token;
+
+    if (json_reader_next(r) != JSON_TOKEN_BEGIN_ARRAY) {
+        return import_fail(import, "registers");
+    }
+    while ((token = json_reader_next(r)) == JSON_TOKEN_BEGIN_OBJECT) {
+        if (device->register_count == MAX_REGISTERS_PER_DEVICE) {
+            snprintf(import->error, sizeof(import->error), "Maximum registers (%d) exceeded for device",
+                     MAX_REGISTERS_PER_DEVICE);
+            return false;
+        }
+        if (import->register_count == MODBUS_MAX_VALUE_SLOTS) {
+            snprintf(import->error, sizeof(import->error), "Maximum registers (%d) exceeded",
+                     MODBUS_MAX_VALUE_SLOTS);
+            return false;
+        }
+        if (import->register_count == import->register_capacity) {
+            uint16_t capacity = import->register_capacity ? import->register_capacity * 2 : 16;
+            if (capacity > MODBUS_MAX_VALUE_SLOTS) {
+                capacity = MODBUS_MAX_VALUE_SLOTS;
+            }
+            modbus_register_t *grown = realloc(import->registers, capacity * sizeof(modbus_register_t));
+            if (grown != NULL) {
+                import->registers = grown;
+            }
+            import_strings_t *grown_at = realloc(import->string_at, capacity * sizeof(import_strings_t));
+            if (grown_at != NULL) {
+                import->string_at = grown_at;
+            }
+            if (grown == NULL || grown_at == NULL) {
+                snprintf(import->error, sizeof(import->error), "Out of memory");
+                return false;
+            }
+            import->register_capacity = capacity;
+        }
+        if (!import_register(import, &import->registers[import->register_count])) {
+            return false;
+        }
+        import->register_count++;
+        device->register_count++;
+    }
+    return token == JSON_TOKEN_END_ARRAY || import_fail(import, "registers");
+}
+
+// Reads the members of a device object; its opening brace is consumed
+static bool import_device(config_import_t *import, modbus_device_t *device)
+{
+    json_reader_t *r = &import->reader;
+    json_token_t token;
+
+    memset(device, 0, sizeof(*device));
+    device->enabled = true;
+    while ((token = json_reader_next(r)) == JSON_TOKEN_KEY) {
+        int field = find_field(device_field_names, DEVICE_FIELD_COUNT, r->text, r->text_len);
+        if (field == DEVICE_FIELD_REGISTERS) {
+            if (!import_registers(import, device)) {
+                return false;
+            }
+            continue;
+        }
+        token = json_reader_next(r);
+
+        long number = 0;
+        bool ok;
+        switch (field) {
+            case DEVICE_FIELD_DEVICE_ID:
+                ok = import_long(r, token, 1, 247, &number);
+                device->device_id = number;
+                break;
+            case DEVICE_FIELD_NAME:
+                ok = import_string(r, token, device->name, sizeof(device->name)) && device->name[0] != '\0';
+                break;
+            case DEVICE_FIELD_DESCRIPTION:
+                ok = import_string(r, token, device->description, sizeof(device->description));
+                break;
+            case DEVICE_FIELD_POLL_INTERVAL_MS:
+                ok = import_long(r, token, 1000, 60000, &number);
+                device->poll_interval_ms = number;
+                break;
+            case DEVICE_FIELD_BAUDRATE:
+                ok = import_long(r, token, 0, 115200, &number) &&
+                     (number == 9600 || number == 19200 || number == 38400 || number == 115200);
+                device->baudrate = number;
+                break;
+            case DEVICE_FIELD_ENABLED:
+                ok = import_bool(r, token, &device->enabled);
+                break;
+            case DEVICE_FIELD_PROFILE:
+                ok = import_string(r, token, device->profile, sizeof(device->profile)) &&
+                     (device->profile[0] == '\0' || device_profile_find(device->profile) != NULL);
+                break;
+            default:
+                ok = json_reader_skip(r, token) == ESP_OK;
+                break;
+        }
+        if (!ok) {
+            return import_fail(import, field >= 0 ? device_field_names[field] : "devices");
+        }
+    }
+    if (token != JSON_TOKEN_END_OBJECT) {
+        return import_fail(import, "devices");
+    }
+    if (device->device_id == 0 || device->name[0] == '\0' || device->poll_interval_ms == 0 ||
+        device->baudrate == 0) {
+        return import_fail(import, device->device_id == 0 ? "device_id" :
+                                   device->name[0] == '\0' ? "name" :
+                                   device->poll_interval_ms == 0 ? "poll_interval_ms" : "baudrate");
+    }
+    return true;
+}
+
+// Parses {"devices":[...]} into import->devices
+static bool import_config(config_import_t *import)
+{
+    json_reader_t *r = &import->reader;
+    json_token_t token;
+    bool has_devices = false;
+
+    if (json_reader_next(r) != JSON_TOKEN_BEGIN_OBJECT) {
+        return import_fail(import, "devices");
+    }
+    while ((token = json_reader_next(r)) == JSON_TOKEN_KEY) {
+        if (strcmp(r->text, "devices") != 0) {
+            if (json_reader_skip(r, json_reader_next(r)) != ESP_OK) {
+                return import_fail(import, "devices");
+            }
+            continue;
+        }
+        if (json_reader_next(r) != JSON_TOKEN_BEGIN_ARRAY) {
+            return import_fail(import, "devices");
+        }
+        has_devices = true;
+        import->device_count = 0;
+        while ((token = json_reader_next(r)) == JSON_TOKEN_BEGIN_OBJECT) {
+            if (import->device_count == MAX_MODBUS_DEVICES) {
+                snprintf(import->error, sizeof(import->error), "Maximum devices (%d) exceeded",
+                         MAX_MODBUS_DEVICES);
+                return false;
+            }
+            import->first_register[import->device_count] = import->register_count;
+            if (!import_device(import, &import->devices[import->device_count])) {
+                return false;
+            }
+            import->device_count++;
+        }
+        if (token != JSON_TOKEN_END_ARRAY) {
+            return import_fail(import, "devices");
+        }
+    }
+    if (token != JSON_TOKEN_END_OBJECT || json_reader_next(r) != JSON_TOKEN_END || !has_devices) {
+        return import_fail(import, "devices");
+    }
+    // Staging no longer moves, so the devices and registers can point into it
+    for (uint8_t i = 0; i < import->device_count; i++) {
+        import->devices[i].registers = &import->registers[import->first_register[i]];
+    }
+    for (uint16_t j = 0; j < import->register_count; j++) {
+        const import_strings_t *at = &import->string_at[j];
+        import->registers[j].description = import->strings ? &import->strings[at->description] : NULL;
+        import->registers[j].expression = import->strings ? &import->strings[at->expression] : NULL;
+    }
+    return true;
+}
+
+static void free_import(config_import_t *import)
+{
+    free(import->registers);
+    free(import->string_at);
+    free(import->strings);
+    free(import);
+}
+
+static void send_history_limit_error(httpd_req_t *req)
+{
+    char message[64];
+    snprintf(message, sizeof(message), "History can be enabled on at most %d registers", MODBUS_HISTORY_RINGS);
+    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, message);
+}
+
+static esp_err_t api_put_config_handler(httpd_req_t *req)
+{
+    // An If-Match precondition guards against overwriting changes made
+    // since the client fetched the configuration it edited
+    char if_match[64];
+    if (httpd_req_get_hdr_value_str(req, "If-Match", if_match, sizeof(if_match)) == ESP_OK &&
+        strcmp(if_match, "*") != 0) {
+        const modbus_snapshot_t *snapshot = modbus_snapshot_acquire();
+        char tag[24];
+        char etag[32];
+        config_tag(snapshot, tag, sizeof(tag));
+        modbus_snapshot_release(snapshot);
+        snprintf(etag, sizeof(etag), "\"%s", tag);
+        // Either representation's validator names the same configuration
+        if (strstr(if_match, etag) == NULL) {
+            httpd_resp_set_status(req, "412 Precondition Failed");
+            httpd_resp_set_type(req, "application/json");
+            return httpd_resp_sendstr(req, "{\"error\":\"Configuration changed\"}");
+        }
+    }
+
+    config_import_t *import = calloc(1, sizeof(config_import_t));
+    if (import == NULL) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
         return ESP_FAIL;
     }
-    if (address->valueint < 0 || address->valueint > 65535) {
-        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid address: must be 0-65535");
-        cJSON_Delete(root);
+    json_reader_init(&import->reader, request_body_read, req);
+
+    if (!import_config(import)) {
+        ESP_LOGW(TAG, "Config import rejected: %s", import->error);
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, import->error);
+        free_import(import);
         return ESP_FAIL;
     }
 
-    cJSON *type = cJSON_GetObjectItem(root, "type");
-    if (!type || !cJSON_IsNumber(type)) {
-        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Missing or invalid field: type");
-        cJSON_Delete(root);
+    esp_err_t err = modbus_replace_devices(import->devices, import->device_count);
+    free_import(import);
+    if (err == ESP_ERR_INVALID_ARG) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Duplicate device ID or register address");
         return ESP_FAIL;
     }
-    if (type->valueint < 1 || type->valueint > 4) {
-        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid type: must be 1 (Coil), 2 (Discrete), 3 (Holding), or 4 (Input)");
-        cJSON_Delete(root);
+    if (err == ESP_ERR_INVALID_SIZE) {
+        send_history_limit_error(req);
         return ESP_FAIL;
     }
-
-    cJSON *name = cJSON_GetObjectItem(root, "name");
-    if (!name || !cJSON_IsString(name) || strlen(name->valuestring) == 0) {
-        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Missing or invalid field: name");
-        cJSON_Delete(root);
+    if (err != ESP_OK) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to apply configuration");
         return ESP_FAIL;
     }
 
-    cJSON *scale = cJSON_GetObjectItem(root, "scale");
-    if (!scale || !cJSON_IsNumber(scale)) {
-        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Missing or invalid field: scale");
-        cJSON_Delete(root);
-        return ESP_FAIL;
+    // Saved right away rather than debounced: the import is one change and
+    // the client should learn if it didn't reach flash
+    err = modbus_devices_save();
+
+    const modbus_snapshot_t *snapshot = modbus_snapshot_acquire();
+    char tag[24];
+    char body[64];
+    config_tag(snapshot, tag, sizeof(tag));
+    modbus_snapshot_release(snapshot);
+    ESP_LOGI(TAG, "Configuration imported as %s", tag);
+    if (err != ESP_OK) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Configuration applied but not saved");
+        return err;
     }
 
-    cJSON *offset = cJSON_GetObjectItem(root, "offset");
-    if (!offset || !cJSON_IsNumber(offset)) {
-        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Missing or invalid field: offset");
-        cJSON_Delete(root);
+    snprintf(body, sizeof(body), "{\"status\":\"ok\",\"config\":\"%s\"}", tag);
+    httpd_resp_set_type(req, "application/json");
+    return httpd_resp_sendstr(req, body);
+}
+
+// Gateway counters for monitoring: the shared response cache and bus
+// admission control
+static esp_err_t api_get_stats_handler(httpd_req_t *req)
+{
+    response_cache_stats_t cache;
+    bus_admission_stats_t bus;
+    http_workers_stats_t workers;
+    mqtt_stats_t mqtt;
+    influx_stats_t influx;
+    response_cache_get_stats(&cache);
+    bus_admission_get_stats(&bus);
+    http_workers_get_stats(&workers);
+    mqtt_publisher_get_stats(&mqtt);
+    influx_push_get_stats(&influx);
+
+    json_writer_t *w = malloc(sizeof(json_writer_t));
+    if (w == NULL) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
         return ESP_FAIL;
     }
+    response_writer_init(req, w, false);
+    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+
+    json_begin_object(w);
+    json_key(w, "response_cache");
+    json_begin_object(w);
+    json_key(w, "entries");
+    json_uint(w, cache.entries);
+    json_key(w, "bytes");
+    json_uint(w, cache.bytes);
+    json_key(w, "max_bytes");
+    json_uint(w, RESPONSE_CACHE_MAX_BYTES);
+    json_key(w, "hits");
+    json_uint(w, cache.hits);
+    json_key(w, "misses");
+    json_uint(w, cache.misses);
+    json_key(w, "not_modified");
+    json_uint(w, cache.not_modified);
+    json_key(w, "stores");
+    json_uint(w, cache.stores);
+    json_key(w, "evictions");
+    json_uint(w, cache.evictions);
+    json_key(w, "uncacheable");
+    json_uint(w, cache.uncacheable);
+    json_end_object(w);
+    json_key(w, "bus");
+    json_begin_object(w);
+    json_key(w, "transaction_us");
+    json_uint(w, bus.transaction_us);
+    json_key(w, "capacity_tps");
+    json_uint(w, bus.transaction_us > 0 ? 1000000 / bus.transaction_us : 0);
+    json_key(w, "poll_reserve_percent");
+    json_uint(w, BUS_POLL_RESERVE_PERCENT);
+    json_key(w, "clients");
+    json_uint(w, bus.clients);
+    json_key(w, "admitted");
+    json_uint(w, bus.admitted);
+    json_key(w, "delayed");
+    json_uint(w, bus.delayed);
+    json_key(w, "client_limited");
+    json_uint(w, bus.client_limited);
+    json_key(w, "busy");
+    json_uint(w, bus.busy);
+    json_end_object(w);
+    json_key(w, "workers");
+    json_begin_object(w);
+    json_key(w, "count");
+    json_uint(w, HTTP_WORKERS_COUNT);
+    json_key(w, "active");
+    json_uint(w, workers.active);
+    json_key(w, "queued");
+    json_uint(w, workers.queued);
+    json_key(w, "submitted");
+    json_uint(w, workers.submitted);
+    json_key(w, "rejected");
+    json_uint(w, workers.rejected);
+    json_end_object(w);
+    json_key(w, "mqtt");
+    json_begin_object(w);
+    json_key(w, "connected");
+    json_bool(w, mqtt.connected);
+    json_key(w, "connects");
+    json_uint(w, mqtt.connects);
+    json_key(w, "published");
+    json_uint(w, mqtt.published);
+    json_key(w, "dropped");
+    json_uint(w, mqtt.dropped);
+    json_key(w, "queued");
+    json_uint(w, mqtt.queued);
+    json_key(w, "queue_bytes");
+    json_uint(w, mqtt.queue_bytes);
+    json_key(w, "commands");
+    json_uint(w, mqtt.commands);
+    json_key(w, "command_errors");
+    json_uint(w, mqtt.command_errors);
+    json_end_object(w);
+    json_key(w, "influx");
+    json_begin_object(w);
+    json_key(w, "time_synced");
+    json_bool(w, influx.time_synced);
+    json_key(w, "spooling");
+    json_bool(w, influx.spooling);
+    json_key(w, "posts");
+    json_uint(w, influx.posts);
+    json_key(w, "samples");
+    json_uint(w, influx.samples);
+    json_key(w, "bytes_raw");
+    json_uint(w, influx.bytes_raw);
+    json_key(w, "bytes_sent");
+    json_uint(w, influx.bytes_sent);
+    json_key(w, "failures");
+    json_uint(w, influx.failures);
+    json_key(w, "rejected");
+    json_uint(w, influx.rejected);
+    json_key(w, "dropped");
+    json_uint(w, influx.dropped);
+    json_key(w, "spool_gaps");
+    json_uint(w, influx.spool_gaps);
+    json_key(w, "unmapped");
+    json_uint(w, influx.unmapped);
+    json_key(w, "buffered");
+    json_uint(w, influx.buffered);
+    json_key(w, "last_status");
+    json_uint(w, influx.last_status);
+    json_key(w, "backoff_ms");
+    json_uint(w, influx.backoff_ms);
+    json_end_object(w);
+    json_end_object(w);
+
+    esp_err_t err = json_writer_finish(w);
+    free(w);
+    if (err != ESP_OK) {
+        return err;
+    }
+    return httpd_resp_sendstr_chunk(req, NULL);
+}
 
-    cJSON *writable = cJSON_GetObjectItem(root, "writable");
-    if (!writable || (!cJSON_IsBool(writable) && !cJSON_IsTrue(writable) && !cJSON_IsFalse(writable))) {
-        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Missing or invalid field: writable");
-        cJSON_Delete(root);
+// Narrows a values delta to some devices and/or registers; all if empty
+#define VALUE_FILTER_MAX_REGISTERS 16
+
+typedef struct {
+    bool all;
+    uint32_t devices[(UINT8_MAX + 1) / 32];
+    uint8_t register_count;
+    uint32_t registers[VALUE_FILTER_MAX_REGISTERS];   // device_id << 24 | type << 16 | address
+} value_filter_t;
+
+static inline uint32_t filter_register_key(uint8_t device_id, uint8_t type, uint16_t address)
+{
+    return ((uint32_t)device_id << 24) | ((uint32_t)type << 16) | address;
+}
+
+static bool filter_device(const value_filter_t *filter, uint8_t device_id)
+{
+    if (filter->all || (filter->devices[device_id / 32] & (1u << (device_id % 32)))) {
+        return true;
+    }
+    for (uint8_t i = 0; i < filter->register_count; i++) {
+        if (filter->registers[i] >> 24 == device_id) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool filter_register(const value_filter_t *filter, uint8_t device_id, const modbus_register_t *reg)
+{
+    if (filter->all || (filter->devices[device_id / 32] & (1u << (device_id % 32)))) {
+        return true;
+    }
+    uint32_t key = filter_register_key(device_id, reg->type, reg->address);
+    for (uint8_t i = 0; i < filter->register_count; i++) {
+        if (filter->registers[i] == key) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Writes the values delta shared by /api/modbus/values and the push socket:
+//   {"version":V,"config":"tag","devices":[[id,status,last_error]],
+//    "values":[[device_id,type,address,value,last_update]]}
+// with only the devices and registers that changed after since.
+static void write_values_json(json_writer_t *w, const modbus_snapshot_t *snapshot, uint32_t since,
+                              uint32_t version, const value_filter_t *filter)
+{
+    char tag[24];
+    config_tag(snapshot, tag, sizeof(tag));
+
+    json_begin_object(w);
+    json_key(w, "version");
+    json_uint(w, version);
+    json_key(w, "config");
+    json_string(w, tag);
+
+    bool open = false;
+    for (uint8_t i = 0; i < snapshot->device_count; i++) {
+        modbus_device_state_t state;
+        modbus_read_device_state(&snapshot->devices[i], &state);
+        if (state.version <= since || !filter_device(filter, snapshot->devices[i].device_id)) {
+            continue;
+        }
+        if (!open) {
+            json_key(w, "devices");
+            json_begin_array(w);
+            open = true;
+        }
+        json_begin_array(w);
+        json_uint(w, snapshot->devices[i].device_id);
+        json_uint(w, state.status);
+        json_uint(w, state.last_error);
+        json_end_array(w);
+    }
+    if (open) {
+        json_end_array(w);
+        open = false;
+    }
+
+    for (uint8_t i = 0; i < snapshot->device_count && w->err == ESP_OK; i++) {
+        const modbus_device_t *device = &snapshot->devices[i];
+        for (uint16_t j = 0; j < device->register_count; j++) {
+            const modbus_register_t *reg = &device->registers[j];
+            modbus_value_t raw;
+            modbus_read_value(reg, &raw);
+            if (raw.version <= since || !filter_register(filter, device->device_id, reg)) {
+                continue;
+            }
+            if (!open) {
+                json_key(w, "values");
+                json_begin_array(w);
+                open = true;
+            }
+            modbus_decoded_t decoded;
+            modbus_decode_value(reg, &raw, &decoded);
+            json_begin_array(w);
+            json_uint(w, device->device_id);
+            json_uint(w, reg->type);
+            json_uint(w, reg->address);
+            json_fixed(w, decoded.value, decoded.decimals);
+            json_uint(w, raw.last_update);
+            json_end_array(w);
+        }
+    }
+    if (open) {
+        json_end_array(w);
+    }
+    json_end_object(w);
+}
+
+// Values and device status changed since ?since=<version>, in the format of
+// write_values_json(). Passing the returned version back makes an unchanged
+// poll a few bytes. A "config" different from the cached one means
+// /api/modbus/config must be fetched again and the values re-read from
+// version 0.
+static esp_err_t api_get_values_handler(httpd_req_t *req)
+{
+    uint32_t since = 0;
+    char query[48];
+    char value[16];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+        httpd_query_key_value(query, "since", value, sizeof(value)) == ESP_OK) {
+        since = strtoul(value, NULL, 10);
+    }
+
+    // Read the version first: anything changing while the rows are written
+    // is either included now or reported again next time, never lost
+    uint32_t version = modbus_values_version();
+    if (since > version) {
+        since = 0;
+    }
+
+    json_writer_t *w = malloc(sizeof(json_writer_t));
+    if (w == NULL) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
         return ESP_FAIL;
     }
+    response_writer_init(req, w, wants_cbor(req));
+    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+
+    static const value_filter_t everything = { .all = true };
+    const modbus_snapshot_t *snapshot = modbus_snapshot_acquire();
+    write_values_json(w, snapshot, since, version, &everything);
+    modbus_snapshot_release(snapshot);
+
+    esp_err_t err = json_writer_finish(w);
+    free(w);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Values response aborted: %s", esp_err_to_name(err));
+        return err;
+    }
+    return httpd_resp_sendstr_chunk(req, NULL);
+}
 
-    modbus_register_t reg = {0};
-    reg.address = address->valueint;
-    reg.type = type->valueint;
-    strncpy(reg.name, name->valuestring, sizeof(reg.name) - 1);
-    
-    cJSON *unit = cJSON_GetObjectItem(root, "unit");
-    if (unit && unit->valuestring) {
-        strncpy(reg.unit, unit->valuestring, sizeof(reg.unit) - 1);
+// Push channel: WebSocket clients on /api/modbus/ws receive the values delta
+// whenever something they subscribed to changes. Each client is just the
+// version it was last sent, so pending changes coalesce by construction and
+// a client's backlog never takes more memory than one delta. A client whose
+// socket can't take more data is skipped (and eventually closed) rather
+// than waited for, so one stalled browser doesn't hold up the others.
+#define PUSH_MAX_CLIENTS 4
+#define PUSH_INTERVAL_MS 250
+#define PUSH_STALL_CLOSE_MS 30000
+
+typedef struct {
+    int fd;                     // -1 if the slot is free
+    uint32_t since;             // Values version last sent
+    uint32_t config_version;    // Snapshot version last sent
+    uint32_t stalled_since;     // ms, 0 while the socket accepts data
+    uint32_t generation;        // Bumped on every (re)subscription
+    value_filter_t filter;
+} push_client_t;
+
+static push_client_t push_clients[PUSH_MAX_CLIENTS] = {
+    [0 ... PUSH_MAX_CLIENTS - 1] = { .fd = -1 },
+};
+static portMUX_TYPE push_mux = portMUX_INITIALIZER_UNLOCKED;
+static TaskHandle_t push_task_handle = NULL;
+
+static esp_err_t push_set_client(int fd, const value_filter_t *filter)
+{
+    int slot = -1;
+    portENTER_CRITICAL(&push_mux);
+    for (int i = 0; i < PUSH_MAX_CLIENTS; i++) {
+        if (push_clients[i].fd == fd) {
+            slot = i;
+            break;
+        }
+        if (slot < 0 && push_clients[i].fd < 0) {
+            slot = i;
+        }
     }
-    
-    reg.scale = scale->valuedouble;
-    reg.offset = offset->valuedouble;
-    reg.writable = writable->type == cJSON_True;
-    
-    cJSON *desc = cJSON_GetObjectItem(root, "description");
-    if (desc && desc->valuestring) {
-        strncpy(reg.description, desc->valuestring, sizeof(reg.description) - 1);
+    if (slot >= 0) {
+        // A new subscription starts over with every current value
+        push_clients[slot].fd = fd;
+        push_clients[slot].since = 0;
+        push_clients[slot].config_version = UINT32_MAX;    // Nothing sent yet
+        push_clients[slot].stalled_since = 0;
+        push_clients[slot].generation++;
+        push_clients[slot].filter = *filter;
     }
+    portEXIT_CRITICAL(&push_mux);
+    return slot >= 0 ? ESP_OK : ESP_ERR_NO_MEM;
+}
 
-    esp_err_t err = modbus_add_register(device_id->valueint, &reg);
-    
-    if (err == ESP_OK) {
-        modbus_devices_save();
-        httpd_resp_set_type(req, "application/json");
-        httpd_resp_send(req, "{\"status\":\"ok\"}", 15);
-    } else if (err == ESP_ERR_NOT_FOUND) {
-        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Device not found");
-    } else if (err == ESP_ERR_NO_MEM) {
-        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Maximum registers (10) reached for device");
-    } else if (err == ESP_ERR_INVALID_ARG) {
-        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Register address already exists for this device");
-    } else {
-        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to add register");
+static void push_remove_client(int fd)
+{
+    portENTER_CRITICAL(&push_mux);
+    for (int i = 0; i < PUSH_MAX_CLIENTS; i++) {
+        if (push_clients[i].fd == fd) {
+            push_clients[i].fd = -1;
+        }
     }
+    portEXIT_CRITICAL(&push_mux);
+}
 
-    cJSON_Delete(root);
-    return err;
+typedef struct {
+    int fd;
+    bool started;
+} push_stream_t;
+
+// Sends each writer buffer as one fragment of a single text message
+static esp_err_t push_flush(void *ctx, const char *data, size_t len)
+{
+    push_stream_t *stream = ctx;
+    httpd_ws_frame_t frame = {
+        .final = false,
+        .fragmented = true,
+        .type = stream->started ? HTTPD_WS_TYPE_CONTINUE : HTTPD_WS_TYPE_TEXT,
+        .payload = (uint8_t *)data,
+        .len = len,
+    };
+    stream->started = true;
+    return httpd_ws_send_frame_async(server, stream->fd, &frame);
 }
 
-static esp_err_t api_delete_register_handler(httpd_req_t *req)
+static bool socket_writable(int fd)
 {
-    char url_buf[100];
-    char *device_id_str = NULL;
-    char *address_str = NULL;
+    fd_set writable;
+    struct timeval timeout = { 0, 0 };
+    FD_ZERO(&writable);
+    FD_SET(fd, &writable);
+    return select(fd + 1, NULL, &writable, NULL, &timeout) > 0;
+}
 
-    if (httpd_req_get_url_query_str(req, url_buf, sizeof(url_buf)) == ESP_OK) {
-        device_id_str = extract_query_value(url_buf, "device_id");
-        address_str = extract_query_value(url_buf, "address");
-        
-        if (device_id_str != NULL && address_str != NULL) {
-            uint8_t device_id = atoi(device_id_str);
-            uint16_t address = atoi(address_str);
-            
-            if (device_id < 1 || device_id > 247) {
-                httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid device ID: must be 1-247");
-                free(device_id_str);
-                free(address_str);
-                return ESP_FAIL;
+static void push_task(void *arg)
+{
+    json_writer_t *w = arg;
+
+    for (;;) {
+        vTaskDelay(pdMS_TO_TICKS(PUSH_INTERVAL_MS));
+
+        uint32_t version = modbus_values_version();
+        const modbus_snapshot_t *snapshot = modbus_snapshot_acquire();
+        uint32_t now = xTaskGetTickCount() * portTICK_PERIOD_MS;
+
+        for (int i = 0; i < PUSH_MAX_CLIENTS; i++) {
+            push_client_t client;
+            portENTER_CRITICAL(&push_mux);
+            client = push_clients[i];
+            portEXIT_CRITICAL(&push_mux);
+
+            if (client.fd < 0 || (client.since == version && client.config_version == snapshot->version)) {
+                continue;
             }
-            
-            if (address > 65535) {
-                httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid register address: must be 0-65535");
-                free(device_id_str);
-                free(address_str);
-                return ESP_FAIL;
+            if (httpd_ws_get_fd_info(server, client.fd) != HTTPD_WS_CLIENT_WEBSOCKET) {
+                push_remove_client(client.fd);
+                continue;
             }
-            
-            free(device_id_str);
-            free(address_str);
-            
-            esp_err_t err = modbus_remove_register(device_id, address);
-            
-            if (err == ESP_OK) {
-                modbus_devices_save();
-                httpd_resp_set_type(req, "application/json");
-                httpd_resp_send(req, "{\"status\":\"ok\"}", 15);
-                return ESP_OK;
-            } else if (err == ESP_ERR_NOT_FOUND) {
-                httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "Device or register not found");
-                return ESP_FAIL;
+            if (!socket_writable(client.fd)) {
+                if (client.stalled_since == 0) {
+                    client.stalled_since = now ? now : 1;
+                } else if (now - client.stalled_since > PUSH_STALL_CLOSE_MS) {
+                    ESP_LOGW(TAG, "Closing stalled push client %d", client.fd);
+                    push_remove_client(client.fd);
+                    httpd_sess_trigger_close(server, client.fd);
+                    continue;
+                }
             } else {
-                httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to delete register");
-                return ESP_FAIL;
+                push_stream_t stream = { client.fd, false };
+                json_writer_init(w, push_flush, &stream);
+                write_values_json(w, snapshot, client.since > version ? 0 : client.since, version, &client.filter);
+                esp_err_t err = json_writer_finish(w);
+                if (err == ESP_OK) {
+                    httpd_ws_frame_t end = {
+                        .final = true,
+                        .fragmented = true,
+                        .type = HTTPD_WS_TYPE_CONTINUE,
+                    };
+                    err = httpd_ws_send_frame_async(server, client.fd, &end);
+                }
+                if (err != ESP_OK) {
+                    // A half-sent message can't be resumed
+                    ESP_LOGW(TAG, "Push to client %d failed: %s", client.fd, esp_err_to_name(err));
+                    push_remove_client(client.fd);
+                    httpd_sess_trigger_close(server, client.fd);
+                    continue;
+                }
+                client.since = version;
+                client.config_version = snapshot->version;
+                client.stalled_since = 0;
+            }
+
+            // Keep the progress unless the client resubscribed meanwhile
+            portENTER_CRITICAL(&push_mux);
+            if (push_clients[i].fd == client.fd && push_clients[i].generation == client.generation) {
+                push_clients[i].since = client.since;
+                push_clients[i].config_version = client.config_version;
+                push_clients[i].stalled_since = client.stalled_since;
             }
+            portEXIT_CRITICAL(&push_mux);
         }
+        modbus_snapshot_release(snapshot);
+    }
+}
+
+// Subscription message: {"devices":[1,2],"registers":[[1,3,6]]}, each list
+// optional; an empty object subscribes to everything
+static bool parse_subscription(const char *text, value_filter_t *filter)
+{
+    memset(filter, 0, sizeof(value_filter_t));
+    cJSON *root = cJSON_Parse(text);
+    if (root == NULL) {
+        return false;
     }
 
-    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid request: device_id and address required");
-    if (device_id_str) free(device_id_str);
-    if (address_str) free(address_str);
-    return ESP_FAIL;
+    bool ok = true;
+    cJSON *devices = cJSON_GetObjectItem(root, "devices");
+    cJSON *registers = cJSON_GetObjectItem(root, "registers");
+    cJSON *item;
+    if (cJSON_IsArray(devices)) {
+        cJSON_ArrayForEach(item, devices) {
+            if (!cJSON_IsNumber(item) || item->valueint < 1 || item->valueint > 247) {
+                ok = false;
+                break;
+            }
+            filter->devices[item->valueint / 32] |= 1u << (item->valueint % 32);
+        }
+    }
+    if (ok && cJSON_IsArray(registers)) {
+        cJSON_ArrayForEach(item, registers) {
+            cJSON *id = cJSON_GetArrayItem(item, 0);
+            cJSON *type = cJSON_GetArrayItem(item, 1);
+            cJSON *address = cJSON_GetArrayItem(item, 2);
+            if (filter->register_count >= VALUE_FILTER_MAX_REGISTERS ||
+                !cJSON_IsNumber(id) || !cJSON_IsNumber(type) || !cJSON_IsNumber(address)) {
+                ok = false;
+                break;
+            }
+            filter->registers[filter->register_count++] =
+                filter_register_key(id->valueint, type->valueint, address->valueint);
+        }
+    }
+    filter->all = !cJSON_IsArray(devices) && !cJSON_IsArray(registers);
+    cJSON_Delete(root);
+    return ok;
 }
 
-static esp_err_t api_post_write_handler(httpd_req_t *req)
+static esp_err_t ws_values_handler(httpd_req_t *req)
 {
-    char url_buf[100];
-    char *device_id_str = NULL;
-    char *address_str = NULL;
+    int fd = httpd_req_to_sockfd(req);
+
+    if (req->method == HTTP_GET) {
+        // Handshake done: subscribed to everything until the client narrows it
+        static const value_filter_t everything = { .all = true };
+        if (push_set_client(fd, &everything) != ESP_OK) {
+            ESP_LOGW(TAG, "Push clients full, refusing %d", fd);
+            return ESP_FAIL;
+        }
+        ESP_LOGI(TAG, "Push client %d connected", fd);
+        return ESP_OK;
+    }
+
+    httpd_ws_frame_t frame = {0};
+    esp_err_t err = httpd_ws_recv_frame(req, &frame, 0);
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (frame.type != HTTPD_WS_TYPE_TEXT || frame.len >= 256) {
+        return frame.type == HTTPD_WS_TYPE_TEXT ? ESP_ERR_INVALID_SIZE : ESP_OK;
+    }
+
+    char text[256];
+    frame.payload = (uint8_t *)text;
+    err = httpd_ws_recv_frame(req, &frame, sizeof(text) - 1);
+    if (err != ESP_OK) {
+        return err;
+    }
+    text[frame.len] = '\0';
+
+    value_filter_t filter;
+    if (!parse_subscription(text, &filter)) {
+        ESP_LOGW(TAG, "Push client %d sent an invalid subscription", fd);
+        return ESP_OK;
+    }
+    return push_set_client(fd, &filter);
+}
+
+static esp_err_t api_post_device_handler(httpd_req_t *req)
+{
+    char buf[512];
+    int ret = httpd_req_recv(req, buf, sizeof(buf));
+    if (ret <= 0) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Failed to receive data");
+        return ESP_FAIL;
+    }
+    buf[ret] = '\0';
+
+    cJSON *root = cJSON_Parse(buf);
+    if (root == NULL) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid JSON");
+        return ESP_FAIL;
+    }
+
+    cJSON *device_id = cJSON_GetObjectItem(root, "device_id");
+    if (!device_id || !cJSON_IsNumber(device_id)) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Missing or invalid field: device_id");
+        cJSON_Delete(root);
+        return ESP_FAIL;
+    }
+    if (device_id->valueint < 1 || device_id->valueint > 247) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid device_id: must be 1-247");
+        cJSON_Delete(root);
+        return ESP_FAIL;
+    }
+
+    cJSON *name = cJSON_GetObjectItem(root, "name");
+    if (!name || !cJSON_IsString(name) || strlen(name->valuestring) == 0) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Missing or invalid field: name");
+        cJSON_Delete(root);
+        return ESP_FAIL;
+    }
+
+    cJSON *poll_interval = cJSON_GetObjectItem(root, "poll_interval_ms");
+    if (!poll_interval || !cJSON_IsNumber(poll_interval)) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Missing or invalid field: poll_interval_ms");
+        cJSON_Delete(root);
+        return ESP_FAIL;
+    }
+    if (poll_interval->valueint < 1000 || poll_interval->valueint > 60000) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid poll_interval_ms: must be 1000-60000");
+        cJSON_Delete(root);
+        return ESP_FAIL;
+    }
+
+    cJSON *baudrate = cJSON_GetObjectItem(root, "baudrate");
+    if (!baudrate || !cJSON_IsNumber(baudrate)) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Missing or invalid field: baudrate");
+        cJSON_Delete(root);
+        return ESP_FAIL;
+    }
+    if (baudrate->valueint != 9600 && baudrate->valueint != 19200 && 
+        baudrate->valueint != 38400 && baudrate->valueint != 115200) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid baudrate: must be 9600, 19200, 38400, or 115200");
+        cJSON_Delete(root);
+        return ESP_FAIL;
+    }
+
+    cJSON *enabled = cJSON_GetObjectItem(root, "enabled");
+    if (!enabled || (!cJSON_IsBool(enabled) && !cJSON_IsTrue(enabled) && !cJSON_IsFalse(enabled))) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Missing or invalid field: enabled");
+        cJSON_Delete(root);
+        return ESP_FAIL;
+    }
+
+    modbus_device_t device = {0};
+    device.device_id = device_id->valueint;
+    strncpy(device.name, name->valuestring, sizeof(device.name) - 1);
+    
+    cJSON *desc = cJSON_GetObjectItem(root, "description");
+    if (desc && desc->valuestring) {
+        strncpy(device.description, desc->valuestring, sizeof(device.description) - 1);
+    }
+    
+    cJSON *profile = cJSON_GetObjectItem(root, "profile");
+    if (profile && cJSON_IsString(profile) && profile->valuestring[0] != '\0') {
+        if (device_profile_find(profile->valuestring) == NULL) {
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Unknown profile");
+            cJSON_Delete(root);
+            return ESP_FAIL;
+        }
+        strncpy(device.profile, profile->valuestring, sizeof(device.profile) - 1);
+    }
+
+    device.poll_interval_ms = poll_interval->valueint;
+    device.baudrate = baudrate->valueint;
+    device.enabled = enabled->type == cJSON_True;
+    device.register_count = 0;
+
+    esp_err_t err = modbus_add_device(&device);
+    if (err == ESP_OK) {
+        modbus_devices_schedule_save();
+        httpd_resp_set_type(req, "application/json");
+        httpd_resp_send(req, "{\"status\":\"ok\"}", 15);
+    } else if (err == ESP_ERR_NO_MEM) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Maximum devices reached");
+    } else if (err == ESP_ERR_INVALID_ARG) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Device ID already exists");
+    } else {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to add device");
+    }
+
+    cJSON_Delete(root);
+    return err;
+}
+
+static esp_err_t api_delete_device_handler(httpd_req_t *req)
+{
+    char url_buf[100];
+    char *device_id_str = NULL;
+
+    if (httpd_req_get_url_query_str(req, url_buf, sizeof(url_buf)) == ESP_OK) {
+        device_id_str = extract_query_value(url_buf, "device_id");
+        if (device_id_str != NULL) {
+            uint8_t device_id = atoi(device_id_str);
+            if (device_id < 1 || device_id > 247) {
+                httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid device ID: must be 1-247");
+                free(device_id_str);
+                return ESP_FAIL;
+            }
+            free(device_id_str);
+            
+            esp_err_t err = modbus_remove_device(device_id);
+            
+            if (err == ESP_OK) {
+                modbus_devices_schedule_save();
+                httpd_resp_set_type(req, "application/json");
+                httpd_resp_send(req, "{\"status\":\"ok\"}", 15);
+                return ESP_OK;
+            } else if (err == ESP_ERR_NOT_FOUND) {
+                httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "Device not found");
+                return ESP_FAIL;
+            } else {
+                httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to delete device");
+                return ESP_FAIL;
+            }
+        }
+    }
+
+    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid request: device_id required");
+    if (device_id_str) free(device_id_str);
+    return ESP_FAIL;
+}
+
+static esp_err_t api_post_register_handler(httpd_req_t *req)
+{
+    char buf[512];
+    int ret = httpd_req_recv(req, buf, sizeof(buf));
+    if (ret <= 0) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Failed to receive data");
+        return ESP_FAIL;
+    }
+    buf[ret] = '\0';
+
+    cJSON *root = cJSON_Parse(buf);
+    if (root == NULL) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid JSON");
+        return ESP_FAIL;
+    }
+
+    cJSON *device_id = cJSON_GetObjectItem(root, "device_id");
+    if (!device_id || !cJSON_IsNumber(device_id)) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Missing or invalid field: device_id");
+        cJSON_Delete(root);
+        return ESP_FAIL;
+    }
+    if (device_id->valueint < 1 || device_id->valueint > 247) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid device_id: must be 1-247");
+        cJSON_Delete(root);
+        return ESP_FAIL;
+    }
+
+    cJSON *address = cJSON_GetObjectItem(root, "address");
+    if (!address || !cJSON_IsNumber(address)) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Missing or invalid field: address");
+        cJSON_Delete(root);
+        return ESP_FAIL;
+    }
+    if (address->valueint < 0 || address->valueint > 65535) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid address: must be 0-65535");
+        cJSON_Delete(root);
+        return ESP_FAIL;
+    }
+
+    cJSON *type = cJSON_GetObjectItem(root, "type");
+    if (!type || !cJSON_IsNumber(type)) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Missing or invalid field: type");
+        cJSON_Delete(root);
+        return ESP_FAIL;
+    }
+    if (type->valueint < 1 || type->valueint > 5) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST,
+                            "Invalid type: must be 1 (Coil), 2 (Discrete), 3 (Holding), 4 (Input) or 5 (Virtual)");
+        cJSON_Delete(root);
+        return ESP_FAIL;
+    }
+
+    // Virtual registers are computed from an expression; their scale and
+    // access are fixed by the device manager
+    bool is_virtual = type->valueint == REGISTER_TYPE_VIRTUAL;
+    cJSON *expression = cJSON_GetObjectItem(root, "expression");
+    if (is_virtual && (!cJSON_IsString(expression) ||
+                       strlen(expression->valuestring) >= MODBUS_EXPR_MAX_LEN)) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Missing or invalid field: expression");
+        cJSON_Delete(root);
+        return ESP_FAIL;
+    }
+
+    // Registers listed in the device's profile take their defaults from it,
+    // so only the fields that differ need to be sent
+    const modbus_profile_register_t *profile_reg = NULL;
+    const modbus_snapshot_t *snapshot = modbus_snapshot_acquire();
+    const modbus_device_t *device = modbus_snapshot_find_device(snapshot, device_id->valueint);
+    const modbus_profile_t *profile = device ? device_profile_find(device->profile) : NULL;
+    if (profile != NULL) {
+        profile_reg = device_profile_find_register(profile, type->valueint, address->valueint);
+    }
+    modbus_snapshot_release(snapshot);
+
+    cJSON *name = cJSON_GetObjectItem(root, "name");
+    if (name ? !cJSON_IsString(name) || strlen(name->valuestring) == 0 : profile_reg == NULL) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Missing or invalid field: name");
+        cJSON_Delete(root);
+        return ESP_FAIL;
+    }
+
+    cJSON *scale = cJSON_GetObjectItem(root, "scale");
+    if (scale ? !cJSON_IsNumber(scale) : profile_reg == NULL && !is_virtual) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Missing or invalid field: scale");
+        cJSON_Delete(root);
+        return ESP_FAIL;
+    }
+
+    cJSON *offset = cJSON_GetObjectItem(root, "offset");
+    if (offset ? !cJSON_IsNumber(offset) : profile_reg == NULL && !is_virtual) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Missing or invalid field: offset");
+        cJSON_Delete(root);
+        return ESP_FAIL;
+    }
+
+    cJSON *writable = cJSON_GetObjectItem(root, "writable");
+    if (writable ? !cJSON_IsBool(writable) : profile_reg == NULL && !is_virtual) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Missing or invalid field: writable");
+        cJSON_Delete(root);
+        return ESP_FAIL;
+    }
+
+    cJSON *history = cJSON_GetObjectItem(root, "history");
+    if (history && !cJSON_IsBool(history)) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid field: history");
+        cJSON_Delete(root);
+        return ESP_FAIL;
+    }
+
+    modbus_register_t reg = {0};
+    if (profile_reg != NULL) {
+        device_profile_make_register(profile_reg, &reg);
+    }
+    reg.address = address->valueint;
+    reg.type = type->valueint;
+    if (name) {
+        strncpy(reg.name, name->valuestring, sizeof(reg.name) - 1);
+    }
+    
+    cJSON *unit = cJSON_GetObjectItem(root, "unit");
+    if (unit && unit->valuestring) {
+        strncpy(reg.unit, unit->valuestring, sizeof(reg.unit) - 1);
+    }
+    
+    if (scale) {
+        reg.scale = scale->valuedouble;
+    }
+    if (offset) {
+        reg.offset = offset->valuedouble;
+    }
+    if (writable) {
+        reg.writable = writable->type == cJSON_True;
+    }
+    reg.history = history && history->type == cJSON_True;
+    
+    // Both strings are copied in by the device manager, which cuts the
+    // description to REGISTER_DESC_MAX_LEN - 1 characters
+    cJSON *desc = cJSON_GetObjectItem(root, "description");
+    if (desc && desc->valuestring) {
+        reg.description = desc->valuestring;
+    }
+
+    cJSON *format = cJSON_GetObjectItem(root, "format");
+    if (format && cJSON_IsNumber(format)) {
+        reg.format = format->valueint;
+    }
+
+    cJSON *word_order = cJSON_GetObjectItem(root, "word_order");
+    if (word_order && cJSON_IsNumber(word_order)) {
+        reg.word_order = word_order->valueint;
+    }
+
+    cJSON *bit_mask = cJSON_GetObjectItem(root, "bit_mask");
+    if (bit_mask && cJSON_IsNumber(bit_mask)) {
+        reg.bit_mask = bit_mask->valueint;
+    }
+
+    cJSON *deadband = cJSON_GetObjectItem(root, "deadband");
+    if (deadband && cJSON_IsNumber(deadband)) {
+        reg.deadband = deadband->valuedouble;
+    }
+
+    if (is_virtual) {
+        reg.expression = expression->valuestring;
+    }
+
+    if (modbus_validate_register(&reg) != ESP_OK) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, is_virtual ? "Invalid expression" :
+                            "Invalid format: check format (0-5), word_order, bit_mask, scale and deadband");
+        cJSON_Delete(root);
+        return ESP_FAIL;
+    }
+
+    esp_err_t err = modbus_add_register(device_id->valueint, &reg);
+    
+    if (err == ESP_OK) {
+        modbus_devices_schedule_save();
+        httpd_resp_set_type(req, "application/json");
+        httpd_resp_send(req, "{\"status\":\"ok\"}", 15);
+    } else if (err == ESP_ERR_NOT_FOUND) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Device not found");
+    } else if (err == ESP_ERR_NO_MEM) {
+        char message[64];
+        snprintf(message, sizeof(message), "Maximum registers (%d per device, %d in total) reached",
+                 MAX_REGISTERS_PER_DEVICE, MODBUS_MAX_VALUE_SLOTS);
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, message);
+    } else if (err == ESP_ERR_INVALID_SIZE) {
+        send_history_limit_error(req);
+    } else if (err == ESP_ERR_INVALID_ARG) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Register address already exists for this device");
+    } else {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to add register");
+    }
+
+    cJSON_Delete(root);
+    return err;
+}
+
+static esp_err_t api_delete_register_handler(httpd_req_t *req)
+{
+    char url_buf[100];
+    char *device_id_str = NULL;
+    char *address_str = NULL;
+    char *type_str = NULL;
+
+    if (httpd_req_get_url_query_str(req, url_buf, sizeof(url_buf)) == ESP_OK) {
+        device_id_str = extract_query_value(url_buf, "device_id");
+        address_str = extract_query_value(url_buf, "address");
+        type_str = extract_query_value(url_buf, "type");
+        
+        if (device_id_str != NULL && address_str != NULL) {
+            uint8_t device_id = atoi(device_id_str);
+            uint16_t address = atoi(address_str);
+            
+            if (device_id < 1 || device_id > 247) {
+                httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid device ID: must be 1-247");
+                free(device_id_str);
+                free(address_str);
+                if (type_str) free(type_str);
+                return ESP_FAIL;
+            }
+            
+            if (address > 65535) {
+                httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid register address: must be 0-65535");
+                free(device_id_str);
+                free(address_str);
+                if (type_str) free(type_str);
+                return ESP_FAIL;
+            }
+            
+            register_type_t type;
+            esp_err_t err = resolve_register_type(device_id, type_str, address, &type);
+
+            free(device_id_str);
+            free(address_str);
+            if (type_str) free(type_str);
+
+            if (err == ESP_ERR_INVALID_ARG) {
+                httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid type: must be 1-5");
+                return ESP_FAIL;
+            }
+            if (err == ESP_OK) {
+                err = modbus_remove_register(device_id, type, address);
+            }
+            
+            if (err == ESP_OK) {
+                modbus_devices_schedule_save();
+                httpd_resp_set_type(req, "application/json");
+                httpd_resp_send(req, "{\"status\":\"ok\"}", 15);
+                return ESP_OK;
+            } else if (err == ESP_ERR_NOT_FOUND) {
+                httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "Device or register not found");
+                return ESP_FAIL;
+            } else {
+                httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to delete register");
+                return ESP_FAIL;
+            }
+        }
+    }
+
+    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid request: device_id and address required");
+    if (device_id_str) free(device_id_str);
+    if (address_str) free(address_str);
+    if (type_str) free(type_str);
+    return ESP_FAIL;
+}
+
+// Identifies the client for admission control by its address, with IPv6
+// addresses folded to 32 bits
+static uint32_t client_address_key(httpd_req_t *req)
+{
+    struct sockaddr_storage addr;
+    socklen_t len = sizeof(addr);
+    if (getpeername(httpd_req_to_sockfd(req), (struct sockaddr *)&addr, &len) != 0) {
+        return 0;
+    }
+    if (addr.ss_family == AF_INET) {
+        return ((struct sockaddr_in *)&addr)->sin_addr.s_addr;
+    }
+    const uint32_t *words = (const uint32_t *)&((struct sockaddr_in6 *)&addr)->sin6_addr;
+    return words[0] ^ words[1] ^ words[2] ^ words[3];
+}
+
+// Admits bus work for req. When it can't run within the admission deadline
+// the request is answered here, 429 if this client is over its share and 503
+// if the bus is, with Retry-After, and false is returned.
+static bool admit_bus_work(httpd_req_t *req, uint16_t transactions)
+{
+    uint32_t retry_after_ms;
+    bus_admit_t verdict = bus_admission_acquire(client_address_key(req), transactions, &retry_after_ms);
+    if (verdict == BUS_ADMIT_OK) {
+        return true;
+    }
+
+    char retry_after[12];
+    snprintf(retry_after, sizeof(retry_after), "%" PRIu32, (retry_after_ms + 999) / 1000);
+    httpd_resp_set_status(req, verdict == BUS_ADMIT_CLIENT_LIMITED ? "429 Too Many Requests" :
+                                                                      "503 Service Unavailable");
+    httpd_resp_set_hdr(req, "Retry-After", retry_after);
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_sendstr(req, verdict == BUS_ADMIT_CLIENT_LIMITED ?
+                            "{\"status\":\"error\",\"message\":\"Too many bus requests from this client\"}" :
+                            "{\"status\":\"error\",\"message\":\"Bus busy\"}");
+    return false;
+}
+
+// Moves a bus-bound request off the httpd task, which would otherwise stall
+// every other client for the whole transaction and its retries. handler is
+// run again from the start on a worker. Returns true when the caller must
+// return at once: the request was handed over, or refused with 503 because
+// all workers are taken.
+static bool defer_to_worker(httpd_req_t *req, http_workers_handler_t handler)
+{
+    if (http_workers_on_worker()) {
+        return false;
+    }
+    if (http_workers_submit(req, handler) != ESP_OK) {
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        httpd_resp_set_hdr(req, "Retry-After", "1");
+        httpd_resp_set_type(req, "application/json");
+        httpd_resp_sendstr(req, "{\"status\":\"error\",\"message\":\"Bus busy\"}");
+    }
+    return true;
+}
+
+static esp_err_t api_post_write_handler(httpd_req_t *req)
+{
+    if (defer_to_worker(req, api_post_write_handler)) {
+        return ESP_OK;
+    }
+
+    char url_buf[100];
+    char *device_id_str = NULL;
+    char *address_str = NULL;
+    char *type_str = NULL;
+
+    if (httpd_req_get_url_query_str(req, url_buf, sizeof(url_buf)) == ESP_OK) {
+        device_id_str = extract_query_value(url_buf, "device_id");
+        address_str = extract_query_value(url_buf, "address");
+        type_str = extract_query_value(url_buf, "type");
+        
+        if (device_id_str != NULL && address_str != NULL) {
+            uint8_t device_id = atoi(device_id_str);
+            uint16_t address = atoi(address_str);
+            
+            if (device_id < 1 || device_id > 247) {
+                httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid device ID: must be 1-247");
+                free(device_id_str);
+                free(address_str);
+                if (type_str) free(type_str);
+                return ESP_FAIL;
+            }
+            
+            if (address > 65535) {
+                httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid register address: must be 0-65535");
+                free(device_id_str);
+                free(address_str);
+                if (type_str) free(type_str);
+                return ESP_FAIL;
+            }
+            
+            char buf[100];
+            int ret = httpd_req_recv(req, buf, sizeof(buf));
+            if (ret <= 0) {
+                httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Failed to receive data");
+                free(device_id_str);
+                free(address_str);
+                if (type_str) free(type_str);
+                return ESP_FAIL;
+            }
+            buf[ret] = '\0';
+
+            cJSON *root = cJSON_Parse(buf);
+            if (root == NULL) {
+                httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid JSON");
+                free(device_id_str);
+                free(address_str);
+                if (type_str) free(type_str);
+                return ESP_FAIL;
+            }
+
+            cJSON *value_item = cJSON_GetObjectItem(root, "value");
+            if (!value_item || !cJSON_IsNumber(value_item)) {
+                httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Missing or invalid field: value");
+                free(device_id_str);
+                free(address_str);
+                if (type_str) free(type_str);
+                cJSON_Delete(root);
+                return ESP_FAIL;
+            }
+
+            double value_num = value_item->valuedouble;
+
+            register_type_t type;
+            esp_err_t err = resolve_register_type(device_id, type_str, address, &type);
+
+            free(device_id_str);
+            free(address_str);
+            if (type_str) free(type_str);
+
+            if (err == ESP_ERR_INVALID_ARG) {
+                httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid type: must be 1-5");
+                cJSON_Delete(root);
+                return ESP_FAIL;
+            }
+
+            modbus_register_t reg;
+            if (err != ESP_OK || modbus_get_register(device_id, type, address, &reg) != ESP_OK) {
+                httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "Register not found");
+                cJSON_Delete(root);
+                return ESP_FAIL;
+            }
+
+            if ((reg.type == REGISTER_TYPE_COIL || reg.type == REGISTER_TYPE_HOLDING) &&
+                !admit_bus_work(req, 1)) {
+                cJSON_Delete(root);
+                return ESP_OK;
+            }
+
+            modbus_result_t result;
+
+            switch (reg.type) {
+                case REGISTER_TYPE_COIL:
+                    {
+                        bool coil_value = (value_num != 0);
+                        result = modbus_write_single_coil(device_id, address, coil_value);
+                        if (result == MODBUS_RESULT_OK) {
+                            uint16_t coil_result = coil_value ? 1 : 0;
+                            modbus_update_register_value(device_id, type, address, coil_result);
+                        }
+                    }
+                    break;
+
+                case REGISTER_TYPE_HOLDING:
+                    {
+                        uint32_t raw = modbus_encode_value(&reg, value_num);
+                        if (modbus_format_word_count(reg.format) == 2) {
+                            // Both words go out in one FC16 transaction
+                            uint16_t words[2] = { raw >> 16, raw & 0xFFFF };
+                            result = modbus_write_multiple_registers(device_id, address, words, 2);
+                        } else {
+                            result = modbus_write_single_register(device_id, address, raw);
+                        }
+                        if (result == MODBUS_RESULT_OK) {
+                            modbus_update_register_value(device_id, type, address, raw);
+                        }
+                    }
+                    break;
+
+                case REGISTER_TYPE_DISCRETE:
+                case REGISTER_TYPE_INPUT:
+                case REGISTER_TYPE_VIRTUAL:
+                    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Cannot write to read-only register type");
+                    cJSON_Delete(root);
+                    return ESP_FAIL;
+
+                default:
+                    httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Unknown register type");
+                    cJSON_Delete(root);
+                    return ESP_FAIL;
+            }
+
+            if (result == MODBUS_RESULT_OK) {
+                httpd_resp_set_type(req, "application/json");
+                httpd_resp_send(req, "{\"status\":\"ok\"}", 15);
+                cJSON_Delete(root);
+                return ESP_OK;
+            } else {
+                httpd_resp_set_type(req, "application/json");
+                char response[100];
+                snprintf(response, sizeof(response), "{\"status\":\"error\",\"message\":\"%s\"}", 
+                         modbus_result_to_string(result));
+                httpd_resp_send(req, response, strlen(response));
+                cJSON_Delete(root);
+                return ESP_OK;
+            }
+        }
+    }
+
+    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid request: device_id and address required");
+    if (device_id_str) free(device_id_str);
+    if (address_str) free(address_str);
+    if (type_str) free(type_str);
+    return ESP_FAIL;
+}
+
+#define BATCH_BODY_MAX 8192
+
+// Fills items from {"items":[{"device_id":1,"type":3,"address":100,"value":5},...]}.
+// An item with a value is a write. Configured registers are written and read
+// in their format; other addresses are accessed as raw 16-bit registers or
+// bits, so "type" is required for them. Returns NULL or the error message.
+static const char* parse_batch_items(cJSON *list, modbus_batch_item_t *items, size_t *count)
+{
+    const modbus_snapshot_t *snapshot = modbus_snapshot_acquire();
+    const char *error = NULL;
+    size_t n = 0;
+    cJSON *entry;
+
+    cJSON_ArrayForEach(entry, list) {
+        if (n == MODBUS_BATCH_MAX_ITEMS) {
+            error = "Too many items";
+            break;
+        }
+        cJSON *device_id = cJSON_GetObjectItem(entry, "device_id");
+        cJSON *type = cJSON_GetObjectItem(entry, "type");
+        cJSON *address = cJSON_GetObjectItem(entry, "address");
+        cJSON *value = cJSON_GetObjectItem(entry, "value");
+        if (!cJSON_IsNumber(device_id) || device_id->valueint < 1 || device_id->valueint > 247 ||
+            !cJSON_IsNumber(address) || address->valueint < 0 || address->valueint > 65535) {
+            error = "Each item needs device_id (1-247) and address (0-65535)";
+            break;
+        }
+        if (value != NULL && !cJSON_IsNumber(value)) {
+            error = "Invalid field: value";
+            break;
+        }
+
+        modbus_batch_item_t *item = &items[n];
+        memset(item, 0, sizeof(*item));
+        item->device_id = device_id->valueint;
+        item->address = address->valueint;
+        item->write = value != NULL;
+        item->words = 1;
+
+        const modbus_register_t *reg = NULL;
+        if (type == NULL) {
+            static const register_type_t probe_order[] = {
+                REGISTER_TYPE_HOLDING, REGISTER_TYPE_INPUT, REGISTER_TYPE_COIL, REGISTER_TYPE_DISCRETE
+            };
+            for (size_t i = 0; i < sizeof(probe_order) / sizeof(probe_order[0]) && reg == NULL; i++) {
+                reg = modbus_snapshot_find_register(snapshot, item->device_id, probe_order[i], item->address);
+            }
+            if (reg == NULL) {
+                error = "Item type is required for unconfigured registers";
+                break;
+            }
+            item->type = reg->type;
+        } else if (!cJSON_IsNumber(type) || type->valueint < REGISTER_TYPE_COIL ||
+                   type->valueint > REGISTER_TYPE_INPUT) {
+            error = "Invalid item type: must be 1-4";
+            break;
+        } else {
+            item->type = (register_type_t)type->valueint;
+            reg = modbus_snapshot_find_register(snapshot, item->device_id, item->type, item->address);
+        }
+
+        if (item->write && item->type != REGISTER_TYPE_HOLDING && item->type != REGISTER_TYPE_COIL) {
+            error = "Cannot write to read-only register type";
+            break;
+        }
+        if (reg != NULL && (item->type == REGISTER_TYPE_HOLDING || item->type == REGISTER_TYPE_INPUT)) {
+            item->words = modbus_format_word_count(reg->format);
+        }
+        if (item->write) {
+            if (reg != NULL) {
+                item->raw = modbus_encode_value(reg, value->valuedouble);
+            } else {
+                item->raw = item->type == REGISTER_TYPE_COIL ? value->valuedouble != 0 :
+                            (uint16_t)(int32_t)value->valuedouble;
+            }
+        }
+        n++;
+    }
+
+    modbus_snapshot_release(snapshot);
+    *count = n;
+    return error;
+}
+
+// Runs a list of register reads and writes in as few Modbus transactions as
+// possible (see modbus_batch_execute()) and returns a result per item, in
+// request order:
+//   {"transactions":2,"results":[{"status":"ok"},{"status":"ok","value":21.5},
+//    {"status":"error","message":"Exception","exception":2}]}
+static esp_err_t api_post_batch_handler(httpd_req_t *req)
+{
+    if (defer_to_worker(req, api_post_batch_handler)) {
+        return ESP_OK;
+    }
+    if (req->content_len == 0 || req->content_len > BATCH_BODY_MAX) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Request body missing or too large");
+        return ESP_FAIL;
+    }
+
+    char *body = malloc(req->content_len + 1);
+    if (body == NULL) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
+        return ESP_FAIL;
+    }
+    size_t received = 0;
+    while (received < req->content_len) {
+        int ret = httpd_req_recv(req, body + received, req->content_len - received);
+        if (ret == HTTPD_SOCK_ERR_TIMEOUT) {
+            continue;
+        }
+        if (ret <= 0) {
+            free(body);
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Failed to receive data");
+            return ESP_FAIL;
+        }
+        received += ret;
+    }
+    body[received] = '\0';
+
+    cJSON *root = cJSON_Parse(body);
+    free(body);
+    cJSON *list = cJSON_GetObjectItem(root, "items");
+    if (!cJSON_IsArray(list)) {
+        cJSON_Delete(root);
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Missing or invalid field: items");
+        return ESP_FAIL;
+    }
+
+    modbus_batch_item_t *items = malloc(sizeof(modbus_batch_item_t) * MODBUS_BATCH_MAX_ITEMS);
+    if (items == NULL) {
+        cJSON_Delete(root);
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
+        return ESP_FAIL;
+    }
+    size_t count = 0;
+    const char *error = parse_batch_items(list, items, &count);
+    cJSON_Delete(root);
+    if (error != NULL) {
+        free(items);
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, error);
+        return ESP_FAIL;
+    }
+
+    if (!admit_bus_work(req, modbus_batch_count_transactions(items, count))) {
+        free(items);
+        return ESP_OK;
+    }
+    size_t transactions = modbus_batch_execute(items, count);
+
+    // Cache what the bus confirmed, as a poll would have
+    for (size_t i = 0; i < count; i++) {
+        if (items[i].result == MODBUS_RESULT_OK) {
+            modbus_update_register_value(items[i].device_id, items[i].type, items[i].address, items[i].raw);
+        }
+    }
+
+    json_writer_t *w = malloc(sizeof(json_writer_t));
+    if (w == NULL) {
+        free(items);
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
+        return ESP_FAIL;
+    }
+    json_writer_init(w, json_chunk_flush, req);
+    httpd_resp_set_type(req, "application/json");
+
+    const modbus_snapshot_t *snapshot = modbus_snapshot_acquire();
+    json_begin_object(w);
+    json_key(w, "transactions");
+    json_uint(w, transactions);
+    json_key(w, "results");
+    json_begin_array(w);
+    for (size_t i = 0; i < count && w->err == ESP_OK; i++) {
+        const modbus_batch_item_t *item = &items[i];
+        json_begin_object(w);
+        json_key(w, "status");
+        if (item->result != MODBUS_RESULT_OK) {
+            json_string(w, "error");
+            json_key(w, "message");
+            json_string(w, modbus_result_to_string(item->result));
+            if (item->result == MODBUS_RESULT_EXCEPTION) {
+                json_key(w, "exception");
+                json_uint(w, item->exception);
+            }
+        } else {
+            json_string(w, "ok");
+            if (!item->write) {
+                const modbus_register_t *reg =
+                    modbus_snapshot_find_register(snapshot, item->device_id, item->type, item->address);
+                json_key(w, "value");
+                if (reg != NULL) {
+                    modbus_decoded_t decoded;
+                    modbus_decode_run(&reg->decode, item->raw, &decoded);
+                    json_fixed(w, decoded.value, decoded.decimals);
+                } else {
+                    json_uint(w, item->raw);
+                }
+            }
+        }
+        json_end_object(w);
+    }
+    json_end_array(w);
+    json_end_object(w);
+    modbus_snapshot_release(snapshot);
+    free(items);
+
+    esp_err_t err = json_writer_finish(w);
+    free(w);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Batch response aborted: %s", esp_err_to_name(err));
+        return err;
+    }
+    return httpd_resp_sendstr_chunk(req, NULL);
+}
+
+// Parses an optional numeric query parameter; false if present but invalid
+static bool query_number(const char *query, const char *key, long min, long max, long *value)
+{
+    char buf[16];
+    char *end;
+    if (httpd_query_key_value(query, key, buf, sizeof(buf)) != ESP_OK) {
+        return true;
+    }
+    *value = strtol(buf, &end, 0);
+    return end != buf && *end == '\0' && *value >= min && *value <= max;
+}
+
+// Word or bit i of a configured register's stored value
+static uint16_t stored_word(const modbus_register_t *reg, const modbus_value_t *value, uint16_t i)
+{
+    if (modbus_format_word_count(reg->format) == 2 && reg->type != REGISTER_TYPE_COIL &&
+        reg->type != REGISTER_TYPE_DISCRETE) {
+        return i == 0 ? value->raw >> 16 : value->raw & 0xFFFF;
+    }
+    return value->raw & 0xFFFF;
+}
+
+static const modbus_register_t* covering_register(const modbus_device_t *device, register_type_t type,
+                                                  uint32_t address)
+{
+    for (uint16_t j = 0; j < device->register_count; j++) {
+        const modbus_register_t *reg = &device->registers[j];
+        bool bits = type == REGISTER_TYPE_COIL || type == REGISTER_TYPE_DISCRETE;
+        uint8_t words = bits ? 1 : modbus_format_word_count(reg->format);
+        if (reg->type == type && address >= reg->address && address < (uint32_t)reg->address + words) {
+            return reg;
+        }
+    }
+    return NULL;
+}
+
+// What the poller last stored for a block. Only possible if every address
+// belongs to a configured register that has a value; timestamp is the oldest
+// sample's.
+static bool read_stored_block(uint8_t device_id, register_type_t type, uint16_t address, uint16_t count,
+                              uint16_t *values, uint32_t *timestamp)
+{
+    const modbus_snapshot_t *snapshot = modbus_snapshot_acquire();
+    const modbus_device_t *device = modbus_snapshot_find_device(snapshot, device_id);
+    bool found = device != NULL;
+    *timestamp = UINT32_MAX;
+    for (uint16_t i = 0; i < count && found; i++) {
+        const modbus_register_t *reg = covering_register(device, type, (uint32_t)address + i);
+        modbus_value_t value = {0};
+        if (reg != NULL) {
+            modbus_read_value(reg, &value);
+        }
+        found = value.last_update != 0;
+        if (found) {
+            values[i] = stored_word(reg, &value, address + i - reg->address);
+            *timestamp = value.last_update < *timestamp ? value.last_update : *timestamp;
+        }
+    }
+    modbus_snapshot_release(snapshot);
+    return found;
+}
+
+// Stores a fresh read into the configured registers it fully covers
+static void store_block(uint8_t device_id, register_type_t type, uint16_t address, uint16_t count,
+                        const uint16_t *values)
+{
+    const modbus_snapshot_t *snapshot = modbus_snapshot_acquire();
+    const modbus_device_t *device = modbus_snapshot_find_device(snapshot, device_id);
+    for (uint16_t j = 0; device != NULL && j < device->register_count; j++) {
+        const modbus_register_t *reg = &device->registers[j];
+        bool bits = type == REGISTER_TYPE_COIL || type == REGISTER_TYPE_DISCRETE;
+        uint8_t words = bits ? 1 : modbus_format_word_count(reg->format);
+        if (reg->type != type || reg->address < address ||
+            (uint32_t)reg->address + words > (uint32_t)address + count) {
+            continue;
+        }
+        const uint16_t *v = &values[reg->address - address];
+        modbus_update_register_value(device_id, type, reg->address,
+                                     words == 2 ? ((uint32_t)v[0] << 16) | v[1] : v[0]);
+    }
+    modbus_snapshot_release(snapshot);
+}
+
+// Reads a block on demand: ?device=&type=&address=&count=&max_age_ms=.
+// The value the poller stored is served if it is at most max_age_ms old
+// (default 0, always read); otherwise the block is read from the bus, sharing
+// a transaction already in flight for it. Values are raw registers or bits.
+static esp_err_t api_get_read_handler(httpd_req_t *req)
+{
+    char query[128];
+    char type_buf[4];
+    long device_id = 0;
+    long address = -1;
+    long count = 1;
+    long max_age = 0;
+
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) != ESP_OK ||
+        !query_number(query, "device", 1, 247, &device_id) || device_id == 0 ||
+        !query_number(query, "address", 0, 65535, &address) || address < 0 ||
+        !query_number(query, "count", 1, MODBUS_READ_MAX_COUNT, &count) || address + count > 65536 ||
+        !query_number(query, "max_age_ms", 0, INT32_MAX, &max_age)) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST,
+                            "Invalid request: device (1-247) and address required, count 1-64");
+        return ESP_FAIL;
+    }
+
+    register_type_t type;
+    bool has_type = httpd_query_key_value(query, "type", type_buf, sizeof(type_buf)) == ESP_OK;
+    esp_err_t err = resolve_register_type(device_id, has_type ? type_buf : NULL, address, &type);
+    if (err == ESP_ERR_NOT_FOUND) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Missing type: address is not configured");
+        return ESP_FAIL;
+    }
+    if (err != ESP_OK || type == REGISTER_TYPE_VIRTUAL) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid type: must be 1-4");
+        return ESP_FAIL;
+    }
+
+    uint16_t values[MODBUS_READ_MAX_COUNT];
+    uint32_t now = xTaskGetTickCount() * portTICK_PERIOD_MS;
+    uint32_t timestamp = 0;
+    modbus_read_info_t info = { .result = MODBUS_RESULT_OK };
+    const char *source = "cache";
+    bool stored = read_stored_block(device_id, type, address, count, values, &timestamp);
+    bool have_values = stored;
+
+    if (!stored || now - timestamp > (uint32_t)max_age) {
+        // Served from the stored values up to here; only a bus read goes to
+        // a worker
+        if (defer_to_worker(req, api_get_read_handler)) {
+            return ESP_OK;
+        }
+        if (!admit_bus_work(req, 1)) {
+            return ESP_OK;
+        }
+        uint16_t fresh[MODBUS_READ_MAX_COUNT];
+        modbus_read_shared(device_id, type, address, count, fresh, &info);
+        if (info.result == MODBUS_RESULT_OK) {
+            memcpy(values, fresh, count * sizeof(uint16_t));
+            timestamp = info.timestamp;
+            have_values = true;
+            source = info.shared ? "shared" : "bus";
+            if (!info.shared) {
+                store_block(device_id, type, address, count, values);
+            }
+        }
+        now = xTaskGetTickCount() * portTICK_PERIOD_MS;
+    }
+
+    json_writer_t *w = malloc(sizeof(json_writer_t));
+    if (w == NULL) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
+        return ESP_FAIL;
+    }
+    response_writer_init(req, w, wants_cbor(req));
+    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+
+    // good: read within max_age_ms; stale: the read failed and the stored
+    // value is older than asked for; bad: no value at all
+    json_begin_object(w);
+    json_key(w, "device_id");
+    json_uint(w, device_id);
+    json_key(w, "type");
+    json_uint(w, type);
+    json_key(w, "address");
+    json_uint(w, address);
+    json_key(w, "quality");
+    json_string(w, info.result == MODBUS_RESULT_OK ? "good" : have_values ? "stale" : "bad");
+    if (info.result != MODBUS_RESULT_OK) {
+        json_key(w, "message");
+        json_string(w, modbus_result_to_string(info.result));
+        if (info.result == MODBUS_RESULT_EXCEPTION) {
+            json_key(w, "exception");
+            json_uint(w, info.exception);
+        }
+    }
+    if (have_values) {
+        json_key(w, "source");
+        json_string(w, source);
+        json_key(w, "timestamp");
+        json_uint(w, timestamp);
+        json_key(w, "age_ms");
+        json_uint(w, now - timestamp);
+        json_key(w, "values");
+        json_begin_array(w);
+        for (long i = 0; i < count; i++) {
+            json_uint(w, values[i]);
+        }
+        json_end_array(w);
+    }
+    json_end_object(w);
+
+    err = json_writer_finish(w);
+    free(w);
+    if (err != ESP_OK) {
+        return err;
+    }
+    return httpd_resp_sendstr_chunk(req, NULL);
+}
+
+static esp_err_t api_get_logging_config_handler(httpd_req_t *req)
+{
+    bool enabled = modbus_manager_get_logging();
+
+    cJSON *root = cJSON_CreateObject();
+    cJSON_AddBoolToObject(root, "logging_enabled", enabled);
+
+    char *json_str = cJSON_PrintUnformatted(root);
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, json_str, strlen(json_str));
+
+    free(json_str);
+    cJSON_Delete(root);
+
+    return ESP_OK;
+}
+
+static esp_err_t api_post_logging_config_handler(httpd_req_t *req)
+{
+    char buf[256];
+    int ret = httpd_req_recv(req, buf, sizeof(buf));
+    if (ret <= 0) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Failed to receive data");
+        return ESP_FAIL;
+    }
+    buf[ret] = '\0';
+
+    cJSON *root = cJSON_Parse(buf);
+    if (root == NULL) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid JSON");
+        return ESP_FAIL;
+    }
+
+    cJSON *enabled = cJSON_GetObjectItem(root, "logging_enabled");
+    if (!enabled || (!cJSON_IsBool(enabled) && !cJSON_IsTrue(enabled) && !cJSON_IsFalse(enabled))) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Missing or invalid field: logging_enabled");
+        cJSON_Delete(root);
+        return ESP_FAIL;
+    }
+
+    bool logging_state = enabled->type == cJSON_True;
+    modbus_manager_set_logging(logging_state);
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, "{\"status\":\"ok\"}", 15);
+
+    cJSON_Delete(root);
+    return ESP_OK;
+}
+
+// Lists the compiled device profiles, or with ?id= the registers of one
+// profile. Register lists run to hundreds of entries, so they are streamed
+// one object per chunk straight from the flash tables.
+static esp_err_t api_get_profiles_handler(httpd_req_t *req)
+{
+    char url_buf[64];
+    char *id_str = NULL;
+    if (httpd_req_get_url_query_str(req, url_buf, sizeof(url_buf)) == ESP_OK) {
+        id_str = extract_query_value(url_buf, "id");
+    }
+
+    httpd_resp_set_type(req, "application/json");
+
+    if (id_str == NULL) {
+        cJSON *root = cJSON_CreateArray();
+        for (size_t i = 0; i < modbus_profile_count; i++) {
+            cJSON *profile = cJSON_CreateObject();
+            cJSON_AddStringToObject(profile, "id", modbus_profiles[i].id);
+            cJSON_AddStringToObject(profile, "name", modbus_profiles[i].name);
+            cJSON_AddNumberToObject(profile, "baudrate", modbus_profiles[i].baudrate);
+            cJSON_AddNumberToObject(profile, "register_count", modbus_profiles[i].register_count);
+            cJSON_AddItemToArray(root, profile);
+        }
+
+        char *json_str = cJSON_PrintUnformatted(root);
+        httpd_resp_send(req, json_str, strlen(json_str));
+        free(json_str);
+        cJSON_Delete(root);
+        return ESP_OK;
+    }
+
+    const modbus_profile_t *profile = device_profile_find(id_str);
+    free(id_str);
+    if (profile == NULL) {
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "Profile not found");
+        return ESP_FAIL;
+    }
+
+    httpd_resp_sendstr_chunk(req, "[");
+    for (size_t i = 0; i < profile->register_count; i++) {
+        const modbus_profile_register_t *entry = &profile->registers[i];
+        cJSON *reg = cJSON_CreateObject();
+        cJSON_AddNumberToObject(reg, "address", entry->address);
+        cJSON_AddNumberToObject(reg, "type", entry->type);
+        cJSON_AddNumberToObject(reg, "format", entry->format);
+        cJSON_AddNumberToObject(reg, "divisor", entry->divisor);
+        cJSON_AddBoolToObject(reg, "writable", entry->writable);
+        cJSON_AddStringToObject(reg, "symbol", entry->symbol);
+        cJSON_AddStringToObject(reg, "name", entry->name);
+        cJSON_AddStringToObject(reg, "unit", entry->unit);
+
+        char *json_str = cJSON_PrintUnformatted(reg);
+        cJSON_Delete(reg);
+        if (json_str == NULL) {
+            break;
+        }
+        if (i > 0) {
+            httpd_resp_sendstr_chunk(req, ",");
+        }
+        esp_err_t err = httpd_resp_sendstr_chunk(req, json_str);
+        free(json_str);
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+    httpd_resp_sendstr_chunk(req, "]");
+    return httpd_resp_sendstr_chunk(req, NULL);
+}
+
+#define STREAM_CHUNK_SIZE 512
+
+// Collects small pieces of a chunked response and sends them in
+// STREAM_CHUNK_SIZE chunks rather than one chunk per row
+typedef struct {
+    httpd_req_t *req;
+    char buf[STREAM_CHUNK_SIZE];
+    size_t len;
+    bool first;
+} chunk_stream_t;
+
+static esp_err_t chunk_stream_flush(chunk_stream_t *stream)
+{
+    if (stream->len == 0) {
+        return ESP_OK;
+    }
+    esp_err_t err = httpd_resp_send_chunk(stream->req, stream->buf, stream->len);
+    stream->len = 0;
+    return err;
+}
+
+static esp_err_t chunk_stream_write(chunk_stream_t *stream, const char *data, size_t len)
+{
+    if (stream->len + len > sizeof(stream->buf)) {
+        esp_err_t err = chunk_stream_flush(stream);
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+    memcpy(stream->buf + stream->len, data, len);
+    stream->len += len;
+    return ESP_OK;
+}
+
+static esp_err_t history_row(void *ctx, uint32_t timestamp, const modbus_decoded_t *values,
+                             const bool *present, size_t count)
+{
+    json_writer_t *w = ctx;
+    json_begin_array(w);
+    json_uint(w, timestamp);
+    for (size_t i = 0; i < count; i++) {
+        if (present[i]) {
+            json_fixed(w, values[i].value, values[i].decimals);
+        } else {
+            json_null(w);
+        }
+    }
+    json_end_array(w);
+    return w->err;
+}
+
+// Streams register history as aligned columns. device, type and address take
+// comma-separated lists (a single entry is reused for every series), from/to
+// are milliseconds since boot and max_points enables LTTB downsampling.
+static esp_err_t api_get_history_handler(httpd_req_t *req)
+{
+    char url_buf[160];
+    char device_buf[48] = {0};
+    char type_buf[48] = {0};
+    char address_buf[64] = {0};
+    char number_buf[16];
+
+    if (httpd_req_get_url_query_str(req, url_buf, sizeof(url_buf)) != ESP_OK ||
+        httpd_query_key_value(url_buf, "device", device_buf, sizeof(device_buf)) != ESP_OK ||
+        httpd_query_key_value(url_buf, "address", address_buf, sizeof(address_buf)) != ESP_OK) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid request: device and address required");
+        return ESP_FAIL;
+    }
+    httpd_query_key_value(url_buf, "type", type_buf, sizeof(type_buf));
+
+    uint32_t now = xTaskGetTickCount() * portTICK_PERIOD_MS;
+    uint32_t from = 0;
+    uint32_t to = now;
+    uint16_t max_points = 0;
+    if (httpd_query_key_value(url_buf, "from", number_buf, sizeof(number_buf)) == ESP_OK) {
+        from = strtoul(number_buf, NULL, 10);
+    }
+    if (httpd_query_key_value(url_buf, "to", number_buf, sizeof(number_buf)) == ESP_OK) {
+        to = strtoul(number_buf, NULL, 10);
+    }
+    if (httpd_query_key_value(url_buf, "max_points", number_buf, sizeof(number_buf)) == ESP_OK) {
+        unsigned long n = strtoul(number_buf, NULL, 10);
+        max_points = n > UINT16_MAX ? UINT16_MAX : n;
+    }
+    if (from > to) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid range: from is after to");
+        return ESP_FAIL;
+    }
+
+    modbus_register_t regs[MODBUS_HISTORY_MAX_SERIES];
+    uint16_t slots[MODBUS_HISTORY_MAX_SERIES];
+    const modbus_decode_t *decoders[MODBUS_HISTORY_MAX_SERIES];
+    size_t count = 0;
+
+    char *devices = device_buf;
+    char *types = type_buf[0] ? type_buf : NULL;
+    char *addresses = address_buf;
+    long device_id = 0;
+    long type_num = 0;
+    long address = 0;
+    bool more = true;
+    while (more) {
+        bool got_device = next_list_value(&devices, &device_id);
+        bool got_type = types != NULL && next_list_value(&types, &type_num);
+        bool got_address = next_list_value(&addresses, &address);
+        more = got_device || got_type || got_address;
+        if (!more) {
+            break;
+        }
+        if (count == MODBUS_HISTORY_MAX_SERIES) {
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Too many registers requested");
+            return ESP_FAIL;
+        }
+        if ((count == 0 && (!got_device || !got_address)) || device_id < 1 || device_id > 247 ||
+            address < 0 || address > 65535) {
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid device or address");
+            return ESP_FAIL;
+        }
+
+        char type_str[4];
+        snprintf(type_str, sizeof(type_str), "%ld", type_num);
+        register_type_t type;
+        esp_err_t err = resolve_register_type(device_id, types != NULL ? type_str : NULL, address, &type);
+        if (err == ESP_ERR_INVALID_ARG) {
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid type: must be 1-5");
+            return ESP_FAIL;
+        }
+        if (err != ESP_OK || modbus_get_register(device_id, type, address, &regs[count]) != ESP_OK) {
+            httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "Register not found");
+            return ESP_FAIL;
+        }
+        if (!regs[count].history) {
+            httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "History is not enabled for this register");
+            return ESP_FAIL;
+        }
+        slots[count] = regs[count].value_slot;
+        decoders[count] = &regs[count].decode;
+        count++;
+    }
+
+    json_writer_t *w = malloc(sizeof(json_writer_t));
+    if (w == NULL) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
+        return ESP_FAIL;
+    }
+    response_writer_init(req, w, wants_cbor(req));
+
+    json_begin_object(w);
+    json_key(w, "now");
+    json_uint(w, now);
+    json_key(w, "columns");
+    json_begin_array(w);
+    json_string(w, "t");
+    for (size_t i = 0; i < count; i++) {
+        json_string(w, regs[i].name);
+    }
+    json_end_array(w);
+    json_key(w, "decimals");
+    json_begin_array(w);
+    for (size_t i = 0; i < count; i++) {
+        json_uint(w, regs[i].decode.decimals);
+    }
+    json_end_array(w);
+    json_key(w, "rows");
+    json_begin_array(w);
+
+    esp_err_t err = modbus_history_query(slots, decoders, count, from, to, max_points, history_row, w);
+    json_end_array(w);
+    json_end_object(w);
+    if (err == ESP_OK) {
+        err = json_writer_finish(w);
+    }
+    free(w);
+    if (err != ESP_OK) {
+        // Headers are already out; cut the response short
+        ESP_LOGW(TAG, "History query aborted: %s", esp_err_to_name(err));
+        return err;
+    }
+    return httpd_resp_sendstr_chunk(req, NULL);
+}
+
+static esp_err_t rollup_row(void *ctx, const modbus_rollup_point_t *point)
+{
+    chunk_stream_t *stream = ctx;
+    char row[32 + 4 * MODBUS_DECODE_STR_LEN];
+    int len = snprintf(row, sizeof(row), "%s[%" PRIu32 ",", stream->first ? "" : ",", point->start);
+    const modbus_decoded_t *values[] = { &point->min, &point->max, &point->mean, &point->last };
+    for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+        len += modbus_decode_format(values[i], row + len, sizeof(row) - len);
+        row[len++] = ',';
+    }
+    len += snprintf(row + len, sizeof(row) - len, "%" PRIu32 "]", point->count);
+    stream->first = false;
+    return chunk_stream_write(stream, row, len);
+}
+
+// Serves pre-aggregated buckets for one register. resolution is 1m, 15m or
+// 1h; without it the finest tier that still covers from..to is used.
+static esp_err_t api_get_rollup_handler(httpd_req_t *req)
+{
+    char url_buf[128];
+    char param[16];
+    if (httpd_req_get_url_query_str(req, url_buf, sizeof(url_buf)) != ESP_OK ||
+        httpd_query_key_value(url_buf, "device", param, sizeof(param)) != ESP_OK) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid request: device and address required");
+        return ESP_FAIL;
+    }
+    long device_id = strtol(param, NULL, 10);
+    if (httpd_query_key_value(url_buf, "address", param, sizeof(param)) != ESP_OK) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid request: device and address required");
+        return ESP_FAIL;
+    }
+    long address = strtol(param, NULL, 10);
+    if (device_id < 1 || device_id > 247 || address < 0 || address > 65535) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid device or address");
+        return ESP_FAIL;
+    }
+
+    char type_buf[4];
+    bool has_type = httpd_query_key_value(url_buf, "type", type_buf, sizeof(type_buf)) == ESP_OK;
+    register_type_t type;
+    modbus_register_t reg;
+    esp_err_t err = resolve_register_type(device_id, has_type ? type_buf : NULL, address, &type);
+    if (err == ESP_ERR_INVALID_ARG) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid type: must be 1-5");
+        return ESP_FAIL;
+    }
+    if (err != ESP_OK || modbus_get_register(device_id, type, address, &reg) != ESP_OK) {
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "Register not found");
+        return ESP_FAIL;
+    }
+    // Aggregates are kept alongside history, for the same registers
+    if (!reg.history) {
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "History is not enabled for this register");
+        return ESP_FAIL;
+    }
+
+    uint32_t now = xTaskGetTickCount() * portTICK_PERIOD_MS;
+    uint32_t to = now;
+    bool has_from = false;
+    uint32_t from = 0;
+    if (httpd_query_key_value(url_buf, "to", param, sizeof(param)) == ESP_OK) {
+        to = strtoul(param, NULL, 10);
+    }
+    if (httpd_query_key_value(url_buf, "from", param, sizeof(param)) == ESP_OK) {
+        from = strtoul(param, NULL, 10);
+        has_from = true;
+    }
+
+    modbus_rollup_tier_t tier = ROLLUP_TIER_1M;
+    if (httpd_query_key_value(url_buf, "resolution", param, sizeof(param)) == ESP_OK) {
+        static const char *names[ROLLUP_TIER_COUNT] = { "1m", "15m", "1h" };
+        tier = ROLLUP_TIER_COUNT;
+        for (int i = 0; i < ROLLUP_TIER_COUNT; i++) {
+            if (strcmp(param, names[i]) == 0) {
+                tier = i;
+            }
+        }
+        if (tier == ROLLUP_TIER_COUNT) {
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid resolution: must be 1m, 15m or 1h");
+            return ESP_FAIL;
+        }
+    } else if (has_from) {
+        while (tier < ROLLUP_TIER_1H && now - from > modbus_rollup_span_ms(tier)) {
+            tier++;
+        }
+    }
+    if (!has_from) {
+        uint32_t span = modbus_rollup_span_ms(tier);
+        from = to > span ? to - span : 0;
+    }
+    if (from > to) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid range: from is after to");
+        return ESP_FAIL;
+    }
+
+    chunk_stream_t *stream = calloc(1, sizeof(chunk_stream_t));
+    if (stream == NULL) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
+        return ESP_FAIL;
+    }
+    stream->req = req;
+    stream->first = true;
+
+    char head[128];
+    snprintf(head, sizeof(head),
+             "{\"now\":%" PRIu32 ",\"resolution\":%" PRIu32 ","
+             "\"columns\":[\"t\",\"min\",\"max\",\"mean\",\"last\",\"count\"],\"rows\":[",
+             now, modbus_rollup_width_ms(tier));
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_sendstr_chunk(req, head);
+
+    err = modbus_rollup_query(reg.value_slot, tier, from, to, rollup_row, stream);
+    if (err == ESP_OK) {
+        err = chunk_stream_flush(stream);
+    }
+    free(stream);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Rollup query aborted: %s", esp_err_to_name(err));
+        return err;
+    }
+
+    httpd_resp_sendstr_chunk(req, "]}");
+    return httpd_resp_sendstr_chunk(req, NULL);
+}
+
+typedef struct {
+    chunk_stream_t stream;
+    const modbus_snapshot_t *snapshot;
+    bool csv;
+    bool filter;
+    uint16_t boot;
+    uint32_t from;
+    uint32_t to;
+} log_export_t;
+
+static esp_err_t log_export_block(void *ctx, const ts_log_sample_t *samples, size_t count,
+                                  const ts_log_cursor_t *next)
+{
+    log_export_t *export = ctx;
+    for (size_t i = 0; i < count; i++) {
+        const ts_log_sample_t *sample = &samples[i];
+        if (export->filter && (sample->boot != export->boot || sample->timestamp < export->from ||
+                               sample->timestamp > export->to)) {
+            continue;
+        }
+
+        // Values are decoded with the register's current configuration, if
+        // it still exists
+        char value[MODBUS_DECODE_STR_LEN] = "";
+        const modbus_register_t *reg = modbus_snapshot_find_register(export->snapshot, sample->device_id,
+                                                                     sample->type, sample->address);
+        if (reg != NULL) {
+            modbus_decoded_t decoded;
+            modbus_decode_run(&reg->decode, sample->raw, &decoded);
+            modbus_decode_format(&decoded, value, sizeof(value));
+        }
+
+        char line[128];
+        int len;
+        if (export->csv) {
+            len = snprintf(line, sizeof(line), "%u,%" PRIu32 ",%u,%u,%u,%" PRIu32 ",%s\n",
+                           sample->boot, sample->timestamp, sample->device_id, sample->type,
+                           sample->address, sample->raw, value);
+        } else {
+            len = snprintf(line, sizeof(line),
+                           "{\"boot\":%u,\"t\":%" PRIu32 ",\"device_id\":%u,\"type\":%u,\"address\":%u,"
+                           "\"raw\":%" PRIu32 ",\"value\":%s}\n",
+                           sample->boot, sample->timestamp, sample->device_id, sample->type,
+                           sample->address, sample->raw, reg != NULL ? value : "null");
+        }
+        esp_err_t err = chunk_stream_write(&export->stream, line, len);
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+    return ESP_OK;
+}
+
+// Streams the flash log as NDJSON or CSV. A collector passes the
+// X-Log-Cursor of its last complete response as ?after= to receive only
+// newer samples; X-Log-Gap reports samples overwritten in between.
+static esp_err_t api_get_log_handler(httpd_req_t *req)
+{
+    char url_buf[128] = {0};
+    char param[24];
+    httpd_req_get_url_query_str(req, url_buf, sizeof(url_buf));
+
+    log_export_t *export = calloc(1, sizeof(log_export_t));
+    if (export == NULL) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
+        return ESP_FAIL;
+    }
+    export->stream.req = req;
+    export->csv = httpd_query_key_value(url_buf, "format", param, sizeof(param)) == ESP_OK &&
+                  strcmp(param, "csv") == 0;
+
+    // from/to are milliseconds since boot, within ?boot= (default: this boot)
+    export->boot = ts_log_boot();
+    export->to = UINT32_MAX;
+    if (httpd_query_key_value(url_buf, "boot", param, sizeof(param)) == ESP_OK) {
+        export->boot = atoi(param);
+        export->filter = true;
+    }
+    if (httpd_query_key_value(url_buf, "from", param, sizeof(param)) == ESP_OK) {
+        export->from = strtoul(param, NULL, 10);
+        export->filter = true;
+    }
+    if (httpd_query_key_value(url_buf, "to", param, sizeof(param)) == ESP_OK) {
+        export->to = strtoul(param, NULL, 10);
+        export->filter = true;
+    }
+
+    ts_log_cursor_t after;
+    bool has_after = false;
+    if (httpd_query_key_value(url_buf, "after", param, sizeof(param)) == ESP_OK) {
+        if (sscanf(param, "%" SCNu32 ":%" SCNu32, &after.seq, &after.offset) != 2) {
+            free(export);
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid cursor: expected seq:offset");
+            return ESP_FAIL;
+        }
+        has_after = true;
+    }
+
+    ts_log_cursor_t start, end;
+    bool gap;
+    esp_err_t err = ts_log_begin(has_after ? &after : NULL, &start, &end, &gap);
+    if (err != ESP_OK) {
+        free(export);
+        if (err == ESP_ERR_INVALID_ARG) {
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Unknown log position");
+        } else {
+            httpd_resp_set_status(req, "503 Service Unavailable");
+            httpd_resp_sendstr(req, "Flash log not available");
+        }
+        return ESP_FAIL;
+    }
+
+    char cursor[24];
+    snprintf(cursor, sizeof(cursor), "%" PRIu32 ":%" PRIu32, end.seq, end.offset);
+    httpd_resp_set_type(req, export->csv ? "text/csv" : "application/x-ndjson");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+    httpd_resp_set_hdr(req, "X-Log-Cursor", cursor);
+    httpd_resp_set_hdr(req, "X-Log-Gap", gap ? "1" : "0");
+
+    if (export->csv) {
+        const char *header = "boot,t,device_id,type,address,raw,value\n";
+        chunk_stream_write(&export->stream, header, strlen(header));
+    }
+
+    export->snapshot = modbus_snapshot_acquire();
+    err = ts_log_read(&start, &end, log_export_block, export);
+    modbus_snapshot_release(export->snapshot);
+    if (err == ESP_OK) {
+        err = chunk_stream_flush(&export->stream);
+    }
+    free(export);
+    if (err != ESP_OK) {
+        // A truncated response must not be acknowledged, so end it without
+        // the terminating chunk
+        ESP_LOGW(TAG, "Log export aborted: %s", esp_err_to_name(err));
+        return err;
+    }
+    return httpd_resp_sendstr_chunk(req, NULL);
+}
+
+static double alarm_units_to_double(const alarm_rule_t *rule, int64_t value)
+{
+    // Stale timeouts are plain milliseconds
+    return rule->kind == ALARM_KIND_STALE ? (double)value : (double)value / 1e6;
+}
+
+static cJSON* alarm_rule_to_json(const alarm_rule_t *rule)
+{
+    cJSON *obj = cJSON_CreateObject();
+    cJSON_AddNumberToObject(obj, "id", rule->id);
+    cJSON_AddStringToObject(obj, "name", rule->name);
+    cJSON_AddNumberToObject(obj, "device_id", rule->device_id);
+    cJSON_AddNumberToObject(obj, "type", rule->type);
+    cJSON_AddNumberToObject(obj, "address", rule->address);
+    cJSON_AddNumberToObject(obj, "kind", rule->kind);
+    cJSON_AddNumberToObject(obj, "severity", rule->severity);
+    cJSON_AddNumberToObject(obj, "threshold", alarm_units_to_double(rule, rule->threshold));
+    cJSON_AddNumberToObject(obj, "hysteresis", alarm_units_to_double(rule, rule->hysteresis));
+    cJSON_AddNumberToObject(obj, "mask", rule->mask);
+    return obj;
+}
+
+static esp_err_t api_get_alarms_handler(httpd_req_t *req)
+{
+    alarm_active_t *active = malloc(MAX_ALARM_RULES * sizeof(alarm_active_t));
+    if (active == NULL) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
+        return ESP_FAIL;
+    }
+    size_t count = modbus_alarms_get_active(active, MAX_ALARM_RULES);
+
+    cJSON *root = cJSON_CreateArray();
+    for (size_t i = 0; i < count; i++) {
+        cJSON *alarm = alarm_rule_to_json(&active[i].rule);
+        char value_str[MODBUS_DECODE_STR_LEN];
+        modbus_decode_format(&active[i].value, value_str, sizeof(value_str));
+        cJSON_AddNumberToObject(alarm, "since", active[i].since);
+        cJSON_AddRawToObject(alarm, "value", value_str);
+        cJSON_AddItemToArray(root, alarm);
+    }
+    free(active);
+
+    char *json_str = cJSON_PrintUnformatted(root);
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, json_str, strlen(json_str));
+    free(json_str);
+    cJSON_Delete(root);
+    return ESP_OK;
+}
+
+static esp_err_t api_get_alarm_rules_handler(httpd_req_t *req)
+{
+    alarm_rule_t *rules = malloc(MAX_ALARM_RULES * sizeof(alarm_rule_t));
+    if (rules == NULL) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
+        return ESP_FAIL;
+    }
+    size_t count = modbus_alarms_get_rules(rules, MAX_ALARM_RULES);
+
+    cJSON *root = cJSON_CreateArray();
+    for (size_t i = 0; i < count; i++) {
+        cJSON_AddItemToArray(root, alarm_rule_to_json(&rules[i]));
+    }
+    free(rules);
+
+    char *json_str = cJSON_PrintUnformatted(root);
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, json_str, strlen(json_str));
+    free(json_str);
+    cJSON_Delete(root);
+    return ESP_OK;
+}
+
+// Adds a rule, or replaces the rule with the same id
+static esp_err_t api_post_alarm_rule_handler(httpd_req_t *req)
+{
+    char buf[512];
+    int ret = httpd_req_recv(req, buf, sizeof(buf) - 1);
+    if (ret <= 0) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Failed to receive data");
+        return ESP_FAIL;
+    }
+    buf[ret] = '\0';
+
+    cJSON *root = cJSON_Parse(buf);
+    if (root == NULL) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid JSON");
+        return ESP_FAIL;
+    }
+
+    cJSON *device_id = cJSON_GetObjectItem(root, "device_id");
+    cJSON *address = cJSON_GetObjectItem(root, "address");
+    cJSON *kind = cJSON_GetObjectItem(root, "kind");
+    cJSON *threshold = cJSON_GetObjectItem(root, "threshold");
+    if (!cJSON_IsNumber(device_id) || !cJSON_IsNumber(address) || !cJSON_IsNumber(kind)) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Missing or invalid field: device_id, address or kind");
+        cJSON_Delete(root);
+        return ESP_FAIL;
+    }
+    if (kind->valueint != ALARM_KIND_BIT && !cJSON_IsNumber(threshold)) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Missing or invalid field: threshold");
+        cJSON_Delete(root);
+        return ESP_FAIL;
+    }
+    if (device_id->valueint < 1 || device_id->valueint > 247 || address->valueint < 0 || address->valueint > 65535) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid device_id or address");
+        cJSON_Delete(root);
+        return ESP_FAIL;
+    }
+
+    alarm_rule_t rule = {0};
+    rule.device_id = device_id->valueint;
+    rule.address = address->valueint;
+    rule.kind = kind->valueint < 0 ? UINT8_MAX : kind->valueint;
+
+    cJSON *id = cJSON_GetObjectItem(root, "id");
+    if (cJSON_IsNumber(id) && id->valueint >= 1 && id->valueint <= 255) {
+        rule.id = id->valueint;
+    }
+
+    cJSON *type = cJSON_GetObjectItem(root, "type");
+    char type_str[4];
+    if (cJSON_IsNumber(type)) {
+        snprintf(type_str, sizeof(type_str), "%d", type->valueint & 0xFF);
+    }
+    register_type_t reg_type;
+    esp_err_t err = resolve_register_type(rule.device_id, cJSON_IsNumber(type) ? type_str : NULL,
+                                          rule.address, &reg_type);
+    if (err != ESP_OK) {
+        httpd_resp_send_err(req, err == ESP_ERR_INVALID_ARG ? HTTPD_400_BAD_REQUEST : HTTPD_404_NOT_FOUND,
+                            err == ESP_ERR_INVALID_ARG ? "Invalid type: must be 1-5" : "Register not found");
+        cJSON_Delete(root);
+        return ESP_FAIL;
+    }
+    rule.type = reg_type;
+
+    cJSON *name = cJSON_GetObjectItem(root, "name");
+    if (cJSON_IsString(name)) {
+        strncpy(rule.name, name->valuestring, sizeof(rule.name) - 1);
+    }
+    cJSON *severity = cJSON_GetObjectItem(root, "severity");
+    if (cJSON_IsNumber(severity) && severity->valueint >= 0 && severity->valueint <= 2) {
+        rule.severity = severity->valueint;
+    }
+    cJSON *mask = cJSON_GetObjectItem(root, "mask");
+    rule.mask = cJSON_IsNumber(mask) ? (uint16_t)mask->valueint : 1;
+
+    // Thresholds arrive in engineering units and are stored in fixed point
+    double scale = rule.kind == ALARM_KIND_STALE ? 1.0 : 1e6;
+    cJSON *hysteresis = cJSON_GetObjectItem(root, "hysteresis");
+    double threshold_num = cJSON_IsNumber(threshold) ? threshold->valuedouble : 0;
+    double hysteresis_num = cJSON_IsNumber(hysteresis) ? hysteresis->valuedouble : 0;
+    if (threshold_num * scale > 9e15 || threshold_num * scale < -9e15 ||
+        hysteresis_num * scale > 9e15 || hysteresis_num < 0) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid threshold or hysteresis");
+        cJSON_Delete(root);
+        return ESP_FAIL;
+    }
+    rule.threshold = llround(threshold_num * scale);
+    rule.hysteresis = llround(hysteresis_num * scale);
+    cJSON_Delete(root);
+
+    err = modbus_alarms_set_rule(&rule);
+    if (err == ESP_ERR_INVALID_ARG) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid rule: kind must be 0-4, bit rules need a mask");
+        return ESP_FAIL;
+    }
+    if (err == ESP_ERR_NO_MEM) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Too many alarm rules");
+        return ESP_FAIL;
+    }
+    if (err != ESP_OK) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to save alarm rule");
+        return ESP_FAIL;
+    }
 
-    if (httpd_req_get_url_query_str(req, url_buf, sizeof(url_buf)) == ESP_OK) {
-        device_id_str = extract_query_value(url_buf, "device_id");
-        address_str = extract_query_value(url_buf, "address");
-        
-        if (device_id_str != NULL && address_str != NULL) {
-            uint8_t device_id = atoi(device_id_str);
-            uint16_t address = atoi(address_str);
-            
-            if (device_id < 1 || device_id > 247) {
-                httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid device ID: must be 1-247");
-                free(device_id_str);
-                free(address_str);
-                return ESP_FAIL;
-            }
-            
-            if (address > 65535) {
-                httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid register address: must be 0-65535");
-                free(device_id_str);
-                free(address_str);
-                return ESP_FAIL;
-            }
-            
-            char buf[100];
-            int ret = httpd_req_recv(req, buf, sizeof(buf));
-            if (ret <= 0) {
-                httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Failed to receive data");
-                free(device_id_str);
-                free(address_str);
-                return ESP_FAIL;
-            }
-            buf[ret] = '\0';
+    char response[40];
+    snprintf(response, sizeof(response), "{\"status\":\"ok\",\"id\":%u}", rule.id);
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_sendstr(req, response);
+    return ESP_OK;
+}
 
-            cJSON *root = cJSON_Parse(buf);
-            if (root == NULL) {
-                httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid JSON");
-                free(device_id_str);
-                free(address_str);
-                return ESP_FAIL;
-            }
+static esp_err_t api_delete_alarm_rule_handler(httpd_req_t *req)
+{
+    char url_buf[32];
+    char id_buf[8];
+    if (httpd_req_get_url_query_str(req, url_buf, sizeof(url_buf)) != ESP_OK ||
+        httpd_query_key_value(url_buf, "id", id_buf, sizeof(id_buf)) != ESP_OK) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid request: id required");
+        return ESP_FAIL;
+    }
 
-            cJSON *value_item = cJSON_GetObjectItem(root, "value");
-            if (!value_item || !cJSON_IsNumber(value_item)) {
-                httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Missing or invalid field: value");
-                free(device_id_str);
-                free(address_str);
-                cJSON_Delete(root);
-                return ESP_FAIL;
-            }
+    int id = atoi(id_buf);
+    esp_err_t err = id >= 1 && id <= 255 ? modbus_alarms_remove_rule(id) : ESP_ERR_NOT_FOUND;
+    if (err == ESP_ERR_NOT_FOUND) {
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "Alarm rule not found");
+        return ESP_FAIL;
+    }
+    if (err != ESP_OK) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to save alarm rules");
+        return ESP_FAIL;
+    }
 
-            uint16_t value = value_item->valueint;
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, "{\"status\":\"ok\"}", 15);
+    return ESP_OK;
+}
 
-            free(device_id_str);
-            free(address_str);
+// The broker password is write-only: GET reports whether one is set, and a
+// POST without "password" keeps it
+static esp_err_t api_get_mqtt_config_handler(httpd_req_t *req)
+{
+    mqtt_config_t mqtt;
+    mqtt_publisher_get_config(&mqtt);
 
-            modbus_register_t *reg = modbus_get_register(device_id, address);
-            if (reg == NULL) {
-                httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "Register not found");
-                cJSON_Delete(root);
-                return ESP_FAIL;
-            }
+    cJSON *root = cJSON_CreateObject();
+    cJSON_AddBoolToObject(root, "enabled", mqtt.enabled);
+    cJSON_AddStringToObject(root, "uri", mqtt.uri);
+    cJSON_AddStringToObject(root, "client_id", mqtt.client_id);
+    cJSON_AddStringToObject(root, "username", mqtt.username);
+    cJSON_AddBoolToObject(root, "password_set", mqtt.password[0] != '\0');
+    cJSON_AddStringToObject(root, "topic", mqtt.topic);
+    cJSON_AddNumberToObject(root, "qos", mqtt.qos);
+    cJSON_AddNumberToObject(root, "interval_ms", mqtt.interval_ms);
 
-            modbus_result_t result;
+    char *json_str = cJSON_PrintUnformatted(root);
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, json_str, strlen(json_str));
 
-            switch (reg->type) {
-                case REGISTER_TYPE_COIL:
-                    {
-                        bool coil_value = (value != 0);
-                        result = modbus_write_single_coil(device_id, address, coil_value);
-                        if (result == MODBUS_RESULT_OK) {
-                            uint16_t coil_result = coil_value ? 1 : 0;
-                            modbus_update_register_value(device_id, address, coil_result);
-                        }
-                    }
-                    break;
+    free(json_str);
+    cJSON_Delete(root);
+    return ESP_OK;
+}
 
-                case REGISTER_TYPE_HOLDING:
-                    result = modbus_write_single_register(device_id, address, value);
-                    if (result == MODBUS_RESULT_OK) {
-                        modbus_update_register_value(device_id, address, value);
-                    }
-                    break;
+static bool copy_string_field(cJSON *root, const char *key, char *dst, size_t len)
+{
+    cJSON *item = cJSON_GetObjectItem(root, key);
+    if (item == NULL) {
+        return true;
+    }
+    if (!cJSON_IsString(item) || strlen(item->valuestring) >= len) {
+        return false;
+    }
+    strcpy(dst, item->valuestring);
+    return true;
+}
 
-                case REGISTER_TYPE_DISCRETE:
-                case REGISTER_TYPE_INPUT:
-                    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Cannot write to read-only register type");
-                    cJSON_Delete(root);
-                    return ESP_FAIL;
+static esp_err_t api_post_mqtt_config_handler(httpd_req_t *req)
+{
+    char buf[512];
+    int ret = httpd_req_recv(req, buf, sizeof(buf) - 1);
+    if (ret <= 0) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Failed to receive data");
+        return ESP_FAIL;
+    }
+    buf[ret] = '\0';
 
-                default:
-                    httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Unknown register type");
-                    cJSON_Delete(root);
-                    return ESP_FAIL;
-            }
+    cJSON *root = cJSON_Parse(buf);
+    if (root == NULL) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid JSON");
+        return ESP_FAIL;
+    }
 
-            if (result == MODBUS_RESULT_OK) {
-                httpd_resp_set_type(req, "application/json");
-                httpd_resp_send(req, "{\"status\":\"ok\"}", 15);
-                cJSON_Delete(root);
-                return ESP_OK;
-            } else {
-                httpd_resp_set_type(req, "application/json");
-                char response[100];
-                snprintf(response, sizeof(response), "{\"status\":\"error\",\"message\":\"%s\"}", 
-                         modbus_result_to_string(result));
-                httpd_resp_send(req, response, strlen(response));
-                cJSON_Delete(root);
-                return ESP_OK;
-            }
+    // Fields left out keep their current values
+    mqtt_config_t mqtt;
+    mqtt_publisher_get_config(&mqtt);
+    cJSON *enabled = cJSON_GetObjectItem(root, "enabled");
+    cJSON *qos = cJSON_GetObjectItem(root, "qos");
+    cJSON *interval = cJSON_GetObjectItem(root, "interval_ms");
+    bool ok = (enabled == NULL || cJSON_IsBool(enabled)) &&
+              (qos == NULL || cJSON_IsNumber(qos)) &&
+              (interval == NULL || (cJSON_IsNumber(interval) && interval->valuedouble >= 0 &&
+                                    interval->valuedouble <= UINT16_MAX)) &&
+              copy_string_field(root, "uri", mqtt.uri, sizeof(mqtt.uri)) &&
+              copy_string_field(root, "client_id", mqtt.client_id, sizeof(mqtt.client_id)) &&
+              copy_string_field(root, "username", mqtt.username, sizeof(mqtt.username)) &&
+              copy_string_field(root, "password", mqtt.password, sizeof(mqtt.password)) &&
+              copy_string_field(root, "topic", mqtt.topic, sizeof(mqtt.topic));
+    if (ok) {
+        if (enabled != NULL) {
+            mqtt.enabled = cJSON_IsTrue(enabled);
+        }
+        if (qos != NULL) {
+            mqtt.qos = qos->valueint < 0 || qos->valueint > 1 ? 0xFF : qos->valueint;
+        }
+        if (interval != NULL) {
+            mqtt.interval_ms = interval->valueint;
         }
     }
+    cJSON_Delete(root);
 
-    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid request: device_id and address required");
-    if (device_id_str) free(device_id_str);
-    if (address_str) free(address_str);
-    return ESP_FAIL;
+    esp_err_t err = ok ? mqtt_publisher_set_config(&mqtt) : ESP_ERR_INVALID_ARG;
+    if (err == ESP_ERR_INVALID_ARG) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST,
+                            "Invalid MQTT configuration: uri must be mqtt:// or mqtts:// when enabled, "
+                            "qos 0 or 1, interval_ms >= 100"
+                            ", topic without wildcards or trailing /");
+        return ESP_FAIL;
+    }
+    if (err != ESP_OK) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to save MQTT configuration");
+        return ESP_FAIL;
+    }
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, "{\"status\":\"ok\"}", 15);
+    return ESP_OK;
 }
 
-static esp_err_t api_get_logging_config_handler(httpd_req_t *req)
+// The token is write-only like the MQTT password
+static esp_err_t api_get_influx_config_handler(httpd_req_t *req)
 {
-    bool enabled = modbus_manager_get_logging();
+    influx_config_t influx;
+    influx_push_get_config(&influx);
 
     cJSON *root = cJSON_CreateObject();
-    cJSON_AddBoolToObject(root, "logging_enabled", enabled);
+    cJSON_AddBoolToObject(root, "enabled", influx.enabled);
+    cJSON_AddStringToObject(root, "url", influx.url);
+    cJSON_AddBoolToObject(root, "token_set", influx.token[0] != '\0');
+    cJSON_AddBoolToObject(root, "gzip", influx.gzip);
+    cJSON_AddNumberToObject(root, "batch_samples", influx.batch_samples);
+    cJSON_AddNumberToObject(root, "max_age_ms", influx.max_age_ms);
 
     char *json_str = cJSON_PrintUnformatted(root);
     httpd_resp_set_type(req, "application/json");
@@ -685,14 +3681,13 @@ static esp_err_t api_get_logging_config_handler(httpd_req_t *req)
 
     free(json_str);
     cJSON_Delete(root);
-
     return ESP_OK;
 }
 
-static esp_err_t api_post_logging_config_handler(httpd_req_t *req)
+static esp_err_t api_post_influx_config_handler(httpd_req_t *req)
 {
-    char buf[256];
-    int ret = httpd_req_recv(req, buf, sizeof(buf));
+    char buf[512];
+    int ret = httpd_req_recv(req, buf, sizeof(buf) - 1);
     if (ret <= 0) {
         httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Failed to receive data");
         return ESP_FAIL;
@@ -705,29 +3700,59 @@ static esp_err_t api_post_logging_config_handler(httpd_req_t *req)
         return ESP_FAIL;
     }
 
-    cJSON *enabled = cJSON_GetObjectItem(root, "logging_enabled");
-    if (!enabled || (!cJSON_IsBool(enabled) && !cJSON_IsTrue(enabled) && !cJSON_IsFalse(enabled))) {
-        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Missing or invalid field: logging_enabled");
-        cJSON_Delete(root);
-        return ESP_FAIL;
+    // Fields left out keep their current values
+    influx_config_t influx;
+    influx_push_get_config(&influx);
+    cJSON *enabled = cJSON_GetObjectItem(root, "enabled");
+    cJSON *gzip = cJSON_GetObjectItem(root, "gzip");
+    cJSON *batch = cJSON_GetObjectItem(root, "batch_samples");
+    cJSON *max_age = cJSON_GetObjectItem(root, "max_age_ms");
+    bool ok = (enabled == NULL || cJSON_IsBool(enabled)) &&
+              (gzip == NULL || cJSON_IsBool(gzip)) &&
+              (batch == NULL || (cJSON_IsNumber(batch) && batch->valuedouble >= 0 &&
+                                 batch->valuedouble <= UINT16_MAX)) &&
+              (max_age == NULL || (cJSON_IsNumber(max_age) && max_age->valuedouble >= 0 &&
+                                   max_age->valuedouble <= UINT32_MAX)) &&
+              copy_string_field(root, "url", influx.url, sizeof(influx.url)) &&
+              copy_string_field(root, "token", influx.token, sizeof(influx.token));
+    if (ok) {
+        if (enabled != NULL) {
+            influx.enabled = cJSON_IsTrue(enabled);
+        }
+        if (gzip != NULL) {
+            influx.gzip = cJSON_IsTrue(gzip);
+        }
+        if (batch != NULL) {
+            influx.batch_samples = batch->valueint;
+        }
+        if (max_age != NULL) {
+            influx.max_age_ms = (uint32_t)max_age->valuedouble;
+        }
     }
+    cJSON_Delete(root);
 
-    bool logging_state = enabled->type == cJSON_True;
-    modbus_manager_set_logging(logging_state);
+    esp_err_t err = ok ? influx_push_set_config(&influx) : ESP_ERR_INVALID_ARG;
+    if (err == ESP_ERR_INVALID_ARG) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST,
+                            "Invalid push configuration: url must be http:// when enabled, "
+                            "batch_samples 1-256, max_age_ms 1000-3600000");
+        return ESP_FAIL;
+    }
+    if (err != ESP_OK) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to save push configuration");
+        return ESP_FAIL;
+    }
 
     httpd_resp_set_type(req, "application/json");
     httpd_resp_send(req, "{\"status\":\"ok\"}", 15);
-
-    cJSON_Delete(root);
     return ESP_OK;
 }
 
 static esp_err_t root_handler(httpd_req_t *req)
 {
     ESP_LOGI(TAG, "Root handler called");
-    httpd_resp_set_type(req, "text/html");
-    httpd_resp_send(req, index_html_start, index_html_end - index_html_start);
-    return ESP_OK;
+    const char *index = "/index.html";
+    return send_web_asset(req, web_asset_find(index, strlen(index)));
 }
 
 static httpd_uri_t uri_handlers[] = {
@@ -803,6 +3828,37 @@ static httpd_uri_t uri_handlers[] = {
         .handler = api_delete_device_handler,
         .user_ctx = NULL
     },
+    {
+        .uri = "/api/modbus/config",
+        .method = HTTP_GET,
+        .handler = api_get_config_handler,
+        .user_ctx = NULL
+    },
+    {
+        .uri = "/api/modbus/config",
+        .method = HTTP_PUT,
+        .handler = api_put_config_handler,
+        .user_ctx = NULL
+    },
+    {
+        .uri = "/api/modbus/stats",
+        .method = HTTP_GET,
+        .handler = api_get_stats_handler,
+        .user_ctx = NULL
+    },
+    {
+        .uri = "/api/modbus/values",
+        .method = HTTP_GET,
+        .handler = api_get_values_handler,
+        .user_ctx = NULL
+    },
+    {
+        .uri = "/api/modbus/ws",
+        .method = HTTP_GET,
+        .handler = ws_values_handler,
+        .user_ctx = NULL,
+        .is_websocket = true
+    },
     {
         .uri = "/api/modbus/registers",
         .method = HTTP_POST,
@@ -821,6 +3877,18 @@ static httpd_uri_t uri_handlers[] = {
         .handler = api_post_write_handler,
         .user_ctx = NULL
     },
+    {
+        .uri = "/api/modbus/batch",
+        .method = HTTP_POST,
+        .handler = api_post_batch_handler,
+        .user_ctx = NULL
+    },
+    {
+        .uri = "/api/modbus/read",
+        .method = HTTP_GET,
+        .handler = api_get_read_handler,
+        .user_ctx = NULL
+    },
     {
         .uri = "/api/modbus/logging-config",
         .method = HTTP_GET,
@@ -832,15 +3900,107 @@ static httpd_uri_t uri_handlers[] = {
         .method = HTTP_POST,
         .handler = api_post_logging_config_handler,
         .user_ctx = NULL
+    },
+    {
+        .uri = "/api/modbus/profiles",
+        .method = HTTP_GET,
+        .handler = api_get_profiles_handler,
+        .user_ctx = NULL
+    },
+    {
+        .uri = "/api/modbus/history",
+        .method = HTTP_GET,
+        .handler = api_get_history_handler,
+        .user_ctx = NULL
+    },
+    {
+        .uri = "/api/modbus/log",
+        .method = HTTP_GET,
+        .handler = api_get_log_handler,
+        .user_ctx = NULL
+    },
+    {
+        .uri = "/api/modbus/rollup",
+        .method = HTTP_GET,
+        .handler = api_get_rollup_handler,
+        .user_ctx = NULL
+    },
+    {
+        .uri = "/api/modbus/alarms",
+        .method = HTTP_GET,
+        .handler = api_get_alarms_handler,
+        .user_ctx = NULL
+    },
+    {
+        .uri = "/api/modbus/alarm-rules",
+        .method = HTTP_GET,
+        .handler = api_get_alarm_rules_handler,
+        .user_ctx = NULL
+    },
+    {
+        .uri = "/api/modbus/alarm-rules",
+        .method = HTTP_POST,
+        .handler = api_post_alarm_rule_handler,
+        .user_ctx = NULL
+    },
+    {
+        .uri = "/api/modbus/alarm-rules",
+        .method = HTTP_DELETE,
+        .handler = api_delete_alarm_rule_handler,
+        .user_ctx = NULL
+    },
+    {
+        .uri = "/api/modbus/mqtt",
+        .method = HTTP_GET,
+        .handler = api_get_mqtt_config_handler,
+        .user_ctx = NULL
+    },
+    {
+        .uri = "/api/modbus/mqtt",
+        .method = HTTP_POST,
+        .handler = api_post_mqtt_config_handler,
+        .user_ctx = NULL
+    },
+    {
+        .uri = "/api/modbus/influx",
+        .method = HTTP_GET,
+        .handler = api_get_influx_config_handler,
+        .user_ctx = NULL
+    },
+    {
+        .uri = "/api/modbus/influx",
+        .method = HTTP_POST,
+        .handler = api_post_influx_config_handler,
+        .user_ctx = NULL
     }
 };
 
+// Session close hook: drops the socket's push subscription, if any
+static void web_server_close_fn(httpd_handle_t hd, int sockfd)
+{
+    push_remove_client(sockfd);
+    close(sockfd);
+}
+
 esp_err_t web_server_start(void)
 {
     httpd_config_t config = HTTPD_DEFAULT_CONFIG();
     config.stack_size = 8192;
-    config.max_uri_handlers = 18;
-
+    config.max_uri_handlers = 37;
+    config.close_fn = web_server_close_fn;
+    // Room for several open dashboards (each holds a page, a values socket
+    // and the odd API call) plus requests parked on the workers. httpd takes
+    // three of CONFIG_LWIP_MAX_SOCKETS for itself; two more are left for the
+    // MQTT and Influx connections. When all are taken the least recently used
+    // connection is closed rather than refusing the new one.
+    config.max_open_sockets = 12;
+    config.lru_purge_enable = true;
+    config.backlog_conn = 8;
+    // Idle keep-alive connections that stop mid-request are dropped sooner
+    config.recv_wait_timeout = 3;
+    config.send_wait_timeout = 3;
+
+    boot_tag = esp_random();
     ESP_LOGI(TAG, "Starting HTTP server on port %" PRIu16, config.server_port);
     if (httpd_start(&server, &config) == ESP_OK) {
         for (size_t i = 0; i < sizeof(uri_handlers) / sizeof(uri_handlers[0]); i++) {
@@ -849,6 +4009,19 @@ esp_err_t web_server_start(void)
                 return ESP_FAIL;
             }
         }
+        if (http_workers_start() != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to start HTTP workers");
+            return ESP_FAIL;
+        }
+        if (push_task_handle == NULL) {
+            // The writer lives with the task: its buffer is too big for the stack
+            json_writer_t *w = malloc(sizeof(json_writer_t));
+            if (w == NULL || xTaskCreate(push_task, "ws_push", 4096, w, 4, &push_task_handle) != pdPASS) {
+                free(w);
+                ESP_LOGE(TAG, "Failed to start push task");
+                return ESP_FAIL;
+            }
+        }
         ESP_LOGI(TAG, "HTTP server started successfully");
         return ESP_OK;
     }
@@ -0,0 +1,146 @@
+// Host benchmark of register value decoding: the compiled fixed-point decode
+// program against the float path it replaced ((float)raw * scale + offset,
+// printed as a double), for each data format. The host has an FPU and the
+// ESP32-C3 does not, so the float column flatters the old path.
+// Also checks that writes round-trip: encoding a decoded value gives back
+// the raw register content.
+//
+// Build and run from the repository root:
+//     cc -O2 -Imain -Itools/host -o bench_decode tools/bench_decode.c main/modbus_decode.c -lm
+//     ./bench_decode
+#include "modbus_decode.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define SAMPLES 1024
+#define ITERATIONS 2000
+
+typedef struct {
+    const char *name;
+    register_format_t format;
+    register_word_order_t word_order;
+    uint16_t bit_mask;
+    float scale;
+    float offset;
+} format_case_t;
+
+static const format_case_t cases[] = {
+    { "uint16",          REGISTER_FORMAT_UINT16,   WORD_ORDER_HIGH_FIRST, 0,      1.0f,  0.0f },
+    { "int16 x0.1",      REGISTER_FORMAT_INT16,    WORD_ORDER_HIGH_FIRST, 0,      0.1f,  0.0f },
+    { "int16 x0.1 -40",  REGISTER_FORMAT_INT16,    WORD_ORDER_HIGH_FIRST, 0,      0.1f,  -40.0f },
+    { "uint32 x0.01",    REGISTER_FORMAT_UINT32,   WORD_ORDER_LOW_FIRST,  0,      0.01f, 0.0f },
+    { "int32",           REGISTER_FORMAT_INT32,    WORD_ORDER_HIGH_FIRST, 0,      1.0f,  0.0f },
+    { "float32",         REGISTER_FORMAT_FLOAT32,  WORD_ORDER_HIGH_FIRST, 0,      1.0f,  0.0f },
+    { "bitfield 0x000F", REGISTER_FORMAT_BITFIELD, WORD_ORDER_HIGH_FIRST, 0x000F, 1.0f,  0.0f },
+};
+
+static uint32_t raws[SAMPLES];
+static volatile size_t sink;
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Plausible register contents for the format, in wire order
+static void fill_raws(const format_case_t *c)
+{
+    srand(1);
+    for (int i = 0; i < SAMPLES; i++) {
+        uint32_t v;
+        if (c->format == REGISTER_FORMAT_FLOAT32) {
+            float f = (rand() % 100000) / 100.0f - 200.0f;
+            memcpy(&v, &f, sizeof(v));
+        } else if (c->format == REGISTER_FORMAT_INT16) {
+            v = (uint16_t)(int16_t)(rand() % 1200 - 400);
+        } else if (modbus_format_word_count(c->format) == 2) {
+            v = (uint32_t)rand() * 7919u;
+        } else {
+            v = rand() & 0xFFFF;
+        }
+        if (modbus_format_word_count(c->format) == 2 && c->word_order == WORD_ORDER_LOW_FIRST) {
+            v = (v << 16) | (v >> 16);
+        }
+        raws[i] = v;
+    }
+}
+
+static double bench_fixed(const modbus_decode_t *decode)
+{
+    char text[MODBUS_DECODE_STR_LEN];
+    double start = now_ns();
+    for (int it = 0; it < ITERATIONS; it++) {
+        for (int i = 0; i < SAMPLES; i++) {
+            modbus_decoded_t decoded;
+            modbus_decode_run(decode, raws[i], &decoded);
+            sink += modbus_decode_format(&decoded, text, sizeof(text));
+        }
+    }
+    return (now_ns() - start) / ((double)ITERATIONS * SAMPLES);
+}
+
+// The former path: every register read as uint16 and scaled in float
+static double bench_float(const format_case_t *c)
+{
+    char text[32];
+    double start = now_ns();
+    for (int it = 0; it < ITERATIONS; it++) {
+        for (int i = 0; i < SAMPLES; i++) {
+            float value = (float)(raws[i] & 0xFFFF) * c->scale + c->offset;
+            sink += snprintf(text, sizeof(text), "%.15g", (double)value);
+        }
+    }
+    return (now_ns() - start) / ((double)ITERATIONS * SAMPLES);
+}
+
+// Decodes each sample, encodes the decoded value back and compares
+static int check_round_trip(const format_case_t *c, const modbus_decode_t *decode)
+{
+    int failures = 0;
+    for (int i = 0; i < SAMPLES; i++) {
+        modbus_decoded_t decoded;
+        modbus_decode_run(decode, raws[i], &decoded);
+        double value = (double)decoded.value;
+        for (uint8_t d = 0; d < decoded.decimals; d++) {
+            value /= 10;
+        }
+        // Bits outside a bitfield's mask come from the current register value
+        uint32_t raw = modbus_encode_run(decode, c->format, c->word_order, value, raws[i]);
+
+        modbus_decoded_t again;
+        modbus_decode_run(decode, raw, &again);
+        if (again.value != decoded.value) {
+            if (failures++ == 0) {
+                fprintf(stderr, "%s: raw 0x%08x decodes to %lld, encodes to 0x%08x\n",
+                        c->name, raws[i], (long long)decoded.value, raw);
+            }
+        }
+    }
+    return failures;
+}
+
+int main(void)
+{
+    int failures = 0;
+
+    printf("%d samples x %d iterations, decode + format per value\n\n", SAMPLES, ITERATIONS);
+    printf("%-16s %10s %10s %12s\n", "format", "fixed ns", "float ns", "round trip");
+    for (size_t k = 0; k < sizeof(cases) / sizeof(cases[0]); k++) {
+        const format_case_t *c = &cases[k];
+        modbus_decode_t decode;
+        if (modbus_decode_compile(c->format, c->word_order, c->bit_mask, c->scale, c->offset, &decode) != ESP_OK) {
+            fprintf(stderr, "%s: does not compile\n", c->name);
+            return 1;
+        }
+        fill_raws(c);
+        int failed = check_round_trip(c, &decode);
+        failures += failed;
+        printf("%-16s %10.1f %10.1f %12s\n", c->name, bench_fixed(&decode), bench_float(c),
+               failed ? "FAILED" : "ok");
+    }
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,135 @@
+// Host benchmark of the JSON and CBOR response encodings: payload size and
+// encode time of a /api/modbus/values delta and a /api/modbus/devices listing,
+// through the same json_writer calls the gateway uses.
+//
+// Build and run from the repository root:
+//     cc -O2 -Imain -Itools/host -o bench_encoding tools/bench_encoding.c main/json_writer.c main/cbor_keys.c main/modbus_decode.c -lm
+//     ./bench_encoding
+#include "json_writer.h"
+#include "cbor_keys.h"
+#include "modbus_decode.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define DEVICES 4
+#define REGISTERS 10
+#define ITERATIONS 20000
+
+static esp_err_t count_bytes(void *ctx, const char *data, size_t len)
+{
+    *(size_t *)ctx += len;
+    return ESP_OK;
+}
+
+// As web_server.c: decimal text for JSON, the bare mantissa for CBOR
+static void fixed(json_writer_t *w, int64_t value, uint8_t decimals)
+{
+    if (w->format == JSON_WRITER_CBOR) {
+        json_int(w, value);
+        return;
+    }
+    modbus_decoded_t decoded = { value, decimals };
+    char text[MODBUS_DECODE_STR_LEN];
+    json_raw(w, text, modbus_decode_format(&decoded, text, sizeof(text)));
+}
+
+static void write_values(json_writer_t *w)
+{
+    json_begin_object(w);
+    json_key(w, "version");
+    json_uint(w, 123456);
+    json_key(w, "config");
+    json_string(w, "5f3a9c01-7");
+    json_key(w, "values");
+    json_begin_array(w);
+    for (int d = 0; d < DEVICES; d++) {
+        for (int r = 0; r < REGISTERS; r++) {
+            json_begin_array(w);
+            json_uint(w, d + 1);
+            json_uint(w, 3);
+            json_uint(w, 100 + r);
+            fixed(w, 21500 + d * 1000 - r * 337, 3);
+            json_uint(w, 8123456 + r * 50);
+            json_end_array(w);
+        }
+    }
+    json_end_array(w);
+    json_end_object(w);
+}
+
+static void write_devices(json_writer_t *w)
+{
+    json_begin_array(w);
+    for (int d = 0; d < DEVICES; d++) {
+        json_begin_object(w);
+        json_key(w, "device_id");
+        json_uint(w, d + 1);
+        json_key(w, "name");
+        json_string(w, "Ventilation unit");
+        json_key(w, "status");
+        json_uint(w, 1);
+        json_key(w, "poll_count");
+        json_uint(w, 98765);
+        json_key(w, "registers");
+        json_begin_array(w);
+        for (int r = 0; r < REGISTERS; r++) {
+            json_begin_object(w);
+            json_key(w, "address");
+            json_uint(w, 100 + r);
+            json_key(w, "type");
+            json_uint(w, 3);
+            json_key(w, "name");
+            json_string(w, "Supply air temperature");
+            json_key(w, "unit");
+            json_string(w, "C");
+            json_key(w, "scale");
+            fixed(w, 100, 3);
+            json_key(w, "deadband");
+            fixed(w, 200, 3);
+            json_key(w, "value");
+            fixed(w, 21500 - r * 337, 3);
+            json_key(w, "decimals");
+            json_uint(w, 3);
+            json_key(w, "last_update");
+            json_uint(w, 8123456 + r * 50);
+            json_end_object(w);
+        }
+        json_end_array(w);
+        json_end_object(w);
+    }
+    json_end_array(w);
+}
+
+static void run(const char *name, void (*write)(json_writer_t *), bool cbor)
+{
+    static json_writer_t w;
+    size_t bytes = 0;
+    struct timespec start, end;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < ITERATIONS; i++) {
+        bytes = 0;
+        if (cbor) {
+            json_writer_init_cbor(&w, count_bytes, &bytes, cbor_keys, cbor_key_count);
+        } else {
+            json_writer_init(&w, count_bytes, &bytes);
+        }
+        write(&w);
+        json_writer_finish(&w);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double ns = ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / ITERATIONS;
+    printf("%-8s %-5s %6zu bytes %9.0f ns\n", name, cbor ? "cbor" : "json", bytes, ns);
+}
+
+int main(void)
+{
+    printf("%d devices x %d registers, %d iterations\n", DEVICES, REGISTERS, ITERATIONS);
+    run("values", write_values, false);
+    run("values", write_values, true);
+    run("devices", write_devices, false);
+    run("devices", write_devices, true);
+    return 0;
+}
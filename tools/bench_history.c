@@ -0,0 +1,153 @@
+// Host benchmark of the register history codec: bytes per sample, how much
+// time a ring holds at 1 Hz, and decode throughput for representative
+// series, through modbus_history.c.
+//
+// Build and run from the repository root:
+//     cc -O2 -Imain -Itools/host -o bench_history tools/bench_history.c main/modbus_history.c main/modbus_decode.c -lm
+//     ./bench_history
+#include "modbus_history.h"
+#include "modbus_decode.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define SAMPLES 20000           // More than any ring holds, so each one wraps
+#define POLL_MS 1000
+#define DECODE_ITERATIONS 200
+
+typedef struct {
+    const char *name;
+    register_format_t format;
+    int jitter_ms;              // Poll timing jitter, +/-
+} series_t;
+
+static const series_t series[] = {
+    { "constant status",      REGISTER_FORMAT_UINT16,  0 },
+    { "temperature x0.1",     REGISTER_FORMAT_INT16,   0 },
+    { "temperature, jitter",  REGISTER_FORMAT_INT16,   30 },
+    { "energy counter",       REGISTER_FORMAT_UINT32,  0 },
+    { "fan speed steps",      REGISTER_FORMAT_UINT16,  0 },
+    { "noisy float32",        REGISTER_FORMAT_FLOAT32, 0 },
+};
+
+static volatile uint32_t sink;
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Sample i of series k, as the raw register content
+static uint32_t next_value(size_t k, int i, uint32_t prev)
+{
+    switch (k) {
+        case 0:
+            return 1;
+        case 1:
+        case 2:
+            // 21.5 C drifting by a tenth every ten seconds or so
+            return rand() % 10 == 0 ? (uint16_t)((int16_t)prev + (rand() % 2 ? 1 : -1)) : prev;
+        case 3:
+            return prev + rand() % 4;
+        case 4:
+            return i % 300 == 0 ? (uint32_t)(30 + rand() % 5 * 10) : prev;
+        default:
+            {
+                float f = 230.0f + (rand() % 200 - 100) / 100.0f;
+                uint32_t raw;
+                memcpy(&raw, &f, sizeof(raw));
+                return raw;
+            }
+    }
+}
+
+static uint32_t first_value(size_t k)
+{
+    return k == 1 || k == 2 ? 215 : 0;
+}
+
+// Samples held for slot and the time between the oldest and newest
+static uint32_t count_held(uint16_t slot, uint32_t *span_ms)
+{
+    modbus_history_cursor_t cursor;
+    modbus_history_point_t point;
+    uint32_t count = 0;
+    uint32_t first = 0;
+    uint32_t last = 0;
+
+    modbus_history_cursor_init(&cursor, slot, 0, UINT32_MAX);
+    while (modbus_history_cursor_peek(&cursor, &point)) {
+        if (count++ == 0) {
+            first = point.timestamp;
+        }
+        last = point.timestamp;
+        modbus_history_cursor_advance(&cursor);
+    }
+    *span_ms = last - first;
+    return count;
+}
+
+static double decode_ns_per_sample(uint16_t slot, uint32_t held)
+{
+    modbus_history_cursor_t cursor;
+    modbus_history_point_t point;
+    double start = now_ns();
+    for (int it = 0; it < DECODE_ITERATIONS; it++) {
+        modbus_history_cursor_init(&cursor, slot, 0, UINT32_MAX);
+        while (modbus_history_cursor_peek(&cursor, &point)) {
+            sink += point.raw;
+            modbus_history_cursor_advance(&cursor);
+        }
+    }
+    return (now_ns() - start) / ((double)DECODE_ITERATIONS * held);
+}
+
+static esp_err_t count_rows(void *ctx, uint32_t timestamp, const modbus_decoded_t *values,
+                            const bool *present, size_t count)
+{
+    (*(uint32_t *)ctx)++;
+    return ESP_OK;
+}
+
+int main(void)
+{
+    const double ring_bytes = MODBUS_HISTORY_BLOCKS * sizeof(modbus_history_block_t);
+
+    modbus_history_init();
+    printf("%d samples at %d ms into rings of %d x %d-byte blocks (%.0f bytes with headers)\n\n",
+           SAMPLES, POLL_MS, MODBUS_HISTORY_BLOCKS, MODBUS_HISTORY_BLOCK_BYTES, ring_bytes);
+    printf("%-22s %8s %12s %10s %12s %14s\n", "series", "held", "bytes/sample", "span min",
+           "decode ns", "lttb 500 us");
+
+    for (size_t k = 0; k < sizeof(series) / sizeof(series[0]); k++) {
+        uint16_t slot = (uint16_t)k;
+        uint32_t value = first_value(k);
+        uint32_t ts = 0;
+
+        srand(1);
+        for (int i = 0; i < SAMPLES; i++) {
+            int jitter = series[k].jitter_ms ? rand() % (2 * series[k].jitter_ms + 1) - series[k].jitter_ms : 0;
+            value = next_value(k, i, value);
+            modbus_history_record(slot, ts + jitter, value);
+            ts += POLL_MS;
+        }
+
+        uint32_t span_ms;
+        uint32_t held = count_held(slot, &span_ms);
+
+        modbus_decode_t decode;
+        const modbus_decode_t *decoders[1] = { &decode };
+        modbus_decode_compile(series[k].format, WORD_ORDER_HIGH_FIRST, 0, 1.0f, 0.0f, &decode);
+        uint32_t rows = 0;
+        double start = now_ns();
+        modbus_history_query(&slot, decoders, 1, 0, UINT32_MAX, 500, count_rows, &rows);
+        double lttb_us = (now_ns() - start) / 1000;
+
+        printf("%-22s %8u %12.2f %10.1f %12.1f %14.1f\n", series[k].name, held, ring_bytes / held,
+               span_ms / 60000.0, decode_ns_per_sample(slot, held), lttb_us);
+    }
+    return 0;
+}
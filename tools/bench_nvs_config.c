@@ -0,0 +1,158 @@
+// Host benchmark of the device configuration in NVS: time and flash entries
+// written for a full save, a one-device delta save and a load of a configuration
+// that uses every register slot, through modbus_devices.c and an in-memory NVS.
+//
+// Build and run from the repository root:
+//     cc -O2 -Imain -Itools/host -o bench_nvs_config tools/bench_nvs_config.c main/modbus_devices.c main/modbus_decode.c main/modbus_expr.c tools/host/nvs_host.c -lm
+//     ./bench_nvs_config
+#include "modbus_devices.h"
+#include "modbus_history.h"
+#include "modbus_rollup.h"
+#include "modbus_alarms.h"
+#include "ts_log.h"
+#include "influx_push.h"
+#include "nvs.h"
+#include "esp_timer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// One eAirMD-sized device plus small meters filling the remaining slots
+#define LARGE_REGISTERS 467
+#define SMALL_REGISTERS 3
+#define DEVICES (1 + (MODBUS_MAX_VALUE_SLOTS - LARGE_REGISTERS) / SMALL_REGISTERS)
+#define ITERATIONS 200
+// The 152 KB nvs partition: 38 pages of 126 entries, one kept free for
+// garbage collection. The alarm, MQTT and Influx settings share it.
+#define NVS_ENTRIES_AVAILABLE (37 * 126)
+
+// Value pipeline hooks modbus_devices.c calls; the benchmark stores no values
+esp_err_t modbus_history_init(void) { return ESP_OK; }
+void modbus_history_record(uint16_t slot, uint32_t timestamp_ms, uint32_t raw) {}
+void modbus_history_reset(uint16_t slot) {}
+void modbus_rollup_record(uint16_t slot, uint32_t timestamp_ms, const modbus_decoded_t *value) {}
+void modbus_rollup_reset(uint16_t slot) {}
+void ts_log_record(uint8_t device_id, uint8_t type, uint16_t address, uint16_t slot,
+                   uint32_t timestamp_ms, uint32_t raw) {}
+void influx_push_record(uint8_t device_id, uint8_t type, uint16_t address, uint16_t slot,
+                        uint32_t timestamp_ms, uint32_t raw) {}
+void modbus_alarms_evaluate(const modbus_snapshot_t *snapshot, const modbus_register_t *reg,
+                            uint8_t device_id, uint32_t raw, const modbus_decoded_t *value,
+                            uint32_t now) {}
+
+static modbus_device_t devices[DEVICES];
+static modbus_register_t registers[MODBUS_MAX_VALUE_SLOTS];
+static int register_total;
+
+static void build_config(void)
+{
+    modbus_register_t *next = registers;
+    for (int d = 0; d < DEVICES; d++) {
+        modbus_device_t *device = &devices[d];
+        memset(device, 0, sizeof(*device));
+        device->device_id = d + 1;
+        if (d == 0) {
+            strcpy(device->name, "Air handling unit");
+            strcpy(device->description, "Roof, technical room");
+        } else {
+            snprintf(device->name, sizeof(device->name), "Energy meter %d", d);
+            snprintf(device->description, sizeof(device->description), "Floor %d, distribution board", d / 4 + 1);
+        }
+        device->poll_interval_ms = 5000;
+        device->baudrate = 9600;
+        device->enabled = true;
+        device->registers = next;
+        device->register_count = d == 0 ? LARGE_REGISTERS : SMALL_REGISTERS;
+
+        for (int r = 0; r < device->register_count; r++) {
+            modbus_register_t *reg = &next[r];
+            memset(reg, 0, sizeof(*reg));
+            reg->address = 100 + r * 2;
+            reg->type = r % 2 ? REGISTER_TYPE_INPUT : REGISTER_TYPE_HOLDING;
+            snprintf(reg->name, sizeof(reg->name), "Supply air temperature %d", r + 1);
+            strcpy(reg->unit, "C");
+            reg->description = r % 4 ? "" : "Measured after the heat exchanger";
+            reg->scale = 0.1f;
+            reg->format = REGISTER_FORMAT_INT16;
+            reg->deadband = 0.2f;
+        }
+        next += device->register_count;
+    }
+    register_total = next - registers;
+}
+
+static double elapsed_us(int64_t start, int iterations)
+{
+    return (double)(esp_timer_get_time() - start) / iterations;
+}
+
+static void report(const char *what, double us, const nvs_host_stats_t *stats, int iterations)
+{
+    printf("%-26s %10.1f us %8.1f writes %8.1f entries %8.1f reads\n", what, us,
+           (double)stats->writes / iterations, (double)stats->entries_written / iterations,
+           (double)stats->reads / iterations);
+}
+
+int main(void)
+{
+    nvs_host_stats_t stats;
+    int64_t start;
+    double us;
+
+    build_config();
+    modbus_devices_init();
+    if (modbus_replace_devices(devices, DEVICES) != ESP_OK) {
+        fprintf(stderr, "Configuration of %d devices, %d registers rejected\n", DEVICES, register_total);
+        return 1;
+    }
+    printf("%d devices, %d registers (%d on the largest)\n\n", DEVICES, register_total, LARGE_REGISTERS);
+
+    // Every device dirty, into an empty partition
+    us = 0;
+    nvs_host_reset_stats();
+    for (int i = 0; i < ITERATIONS; i++) {
+        nvs_host_clear();
+        modbus_replace_devices(devices, DEVICES);
+        start = esp_timer_get_time();
+        modbus_devices_save();
+        us += elapsed_us(start, ITERATIONS);
+    }
+    nvs_host_get_stats(&stats);
+    report("save, all devices", us, &stats, ITERATIONS);
+
+    // One register edited: only its device's blob is rewritten
+    us = 0;
+    nvs_host_reset_stats();
+    for (int i = 0; i < ITERATIONS; i++) {
+        const modbus_device_t *device = &devices[i % DEVICES];
+        modbus_register_t reg = device->registers[0];
+        reg.scale = 0.1f + 0.001f * (i + 1);
+        modbus_update_register(device->device_id, reg.type, reg.address, &reg);
+        start = esp_timer_get_time();
+        modbus_devices_save();
+        us += elapsed_us(start, ITERATIONS);
+    }
+    nvs_host_get_stats(&stats);
+    report("save, one device changed", us, &stats, ITERATIONS);
+
+    nvs_host_reset_stats();
+    start = esp_timer_get_time();
+    for (int i = 0; i < ITERATIONS; i++) {
+        modbus_devices_load();
+    }
+    us = elapsed_us(start, ITERATIONS);
+    nvs_host_get_stats(&stats);
+    report("load", us, &stats, ITERATIONS);
+
+    if (modbus_get_device_count() != DEVICES) {
+        fprintf(stderr, "Loaded %d devices, expected %d\n", modbus_get_device_count(), DEVICES);
+        return 1;
+    }
+    printf("\nNVS entries in use: %u of about %d\n", stats.entries_used, NVS_ENTRIES_AVAILABLE);
+    if (stats.entries_used > NVS_ENTRIES_AVAILABLE / 2) {
+        // Leave room for the other settings and for a device being rewritten
+        fprintf(stderr, "Configuration uses more than half of the partition\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,210 @@
+#!/usr/bin/env python3
+"""Compile vendor Modbus register lists (docs/devices/*.csv) into C tables.
+
+The generated source holds one const table per device profile so register
+metadata lives in flash rodata instead of being typed into the web UI.
+
+Usage:
+    gen_device_profiles.py --output device_profiles_data.c \\
+        --profile eairmd "Enervent eAirMD" 19200 eAirMD-....csv \\
+        --profile ewind "Enervent eWind" 9600 eWind-....csv
+"""
+
+import argparse
+import csv
+import io
+import re
+import sys
+
+REGISTER_TYPES = {
+    'hreg': 'REGISTER_TYPE_HOLDING',
+    'holding reg': 'REGISTER_TYPE_HOLDING',
+    'ireg': 'REGISTER_TYPE_INPUT',
+    'input reg': 'REGISTER_TYPE_INPUT',
+    'coil': 'REGISTER_TYPE_COIL',
+    'discrete': 'REGISTER_TYPE_DISCRETE',
+}
+
+# Numeric register_type_t values; tables are sorted by (type, address) so the
+# firmware can binary-search them
+TYPE_ORDER = {
+    'REGISTER_TYPE_COIL': 1,
+    'REGISTER_TYPE_DISCRETE': 2,
+    'REGISTER_TYPE_HOLDING': 3,
+    'REGISTER_TYPE_INPUT': 4,
+}
+
+FORMATS = {
+    'int16': 'REGISTER_FORMAT_INT16',
+    'bitfield': 'REGISTER_FORMAT_BITFIELD',
+}
+
+ADDRESS_RE = re.compile(r'^\s*([A-Za-z ]+?)\s+(\d+)\s*$')
+
+
+def read_rows(path):
+    # The vendor exports are not consistent about their encoding
+    with open(path, 'rb') as f:
+        data = f.read()
+    try:
+        text = data.decode('utf-8-sig')
+    except UnicodeDecodeError:
+        text = data.decode('cp1252')
+    return list(csv.reader(io.StringIO(text), delimiter=';'))
+
+
+def column_map(header):
+    """Maps logical fields to column indices for either vendor layout."""
+    names = [h.strip().lower() for h in header]
+    cols = {name: i for i, name in enumerate(names)}
+    if 'address' in cols:
+        # eAirMD: Address;Symbol;Type;Multiplier;Bounds;Name;Description;...
+        label, description = cols.get('name'), cols.get('description')
+    else:
+        # eWind: Register;Symbol;Description;Name;Type;R/W;...  where the
+        # short label is in "Description" and the long text in "Name"
+        label, description = cols.get('description'), cols.get('name')
+    return {
+        'symbol': cols.get('symbol'),
+        'type': cols.get('type'),
+        'multiplier': cols.get('multiplier'),
+        'rw': cols.get('r/w'),
+        'label': label,
+        'description': description,
+    }
+
+
+def cell(row, index):
+    if index is None or index >= len(row):
+        return ''
+    return ' '.join(row[index].split())
+
+
+def infer_unit(reg_type, fmt, divisor, text):
+    # The register lists carry no unit column; infer the common ones for
+    # measurement registers
+    if reg_type not in ('REGISTER_TYPE_HOLDING', 'REGISTER_TYPE_INPUT') or fmt == 'REGISTER_FORMAT_BITFIELD':
+        return ''
+    lower = text.lower()
+    if '%rh' in lower or ('humidity' in lower and 'absolute' not in lower):
+        return '%RH'
+    if 'co2' in lower or 'co₂' in lower or 'carbon dioxide' in lower:
+        return 'ppm'
+    if fmt == 'REGISTER_FORMAT_INT16' and divisor == 10 and (
+            'temp' in lower or 'air' in lower or re.search(r'\bte\d\d', lower)):
+        return '°C'
+    if 'fan speed' in lower or 'fanspeed' in lower:
+        return '%'
+    return ''
+
+
+def parse_profile(path):
+    columns = None
+    registers = []
+    seen = set()
+
+    for row in read_rows(path):
+        if not row or not row[0].strip():
+            continue
+        first = row[0].strip().lower()
+        if len(row) > 1 and row[1].strip().lower() == 'symbol':
+            columns = column_map(row)
+            continue
+
+        match = ADDRESS_RE.match(row[0])
+        if columns is None or match is None:
+            continue
+        reg_type = REGISTER_TYPES.get(match.group(1).strip().lower())
+        if reg_type is None:
+            continue
+
+        symbol = cell(row, columns['symbol'])
+        if not symbol or symbol.lower().startswith('reserved'):
+            continue
+
+        address = int(match.group(2))
+        if (reg_type, address) in seen:
+            print(f'{path}: duplicate {first}, keeping the first entry', file=sys.stderr)
+            continue
+        seen.add((reg_type, address))
+
+        fmt = FORMATS.get(cell(row, columns['type']).lower(), 'REGISTER_FORMAT_UINT16')
+        multiplier = cell(row, columns['multiplier'])
+        divisor = int(multiplier) if multiplier.isdigit() and int(multiplier) > 0 else 1
+
+        # Only a list with an R/W column (eWind) says what may be written;
+        # without one (eAirMD) everything starts read-only, since alarm and
+        # status coils sit among the settings
+        writable = 'W' in cell(row, columns['rw']).upper()
+
+        label = cell(row, columns['label']) or symbol
+        description = cell(row, columns['description'])
+        registers.append({
+            'address': address,
+            'type': reg_type,
+            'format': fmt,
+            'divisor': divisor,
+            'writable': writable,
+            'symbol': symbol,
+            'name': label,
+            'unit': infer_unit(reg_type, fmt, divisor, label),
+        })
+
+    registers.sort(key=lambda r: (TYPE_ORDER[r['type']], r['address']))
+    return registers
+
+
+def c_string(text):
+    out = []
+    for byte in text.encode('utf-8'):
+        if byte in (0x22, 0x5C):
+            out.append('\\' + chr(byte))
+        elif 0x20 <= byte < 0x7F:
+            out.append(chr(byte))
+        else:
+            out.append(f'\\{byte:03o}')
+    return '"' + ''.join(out) + '"'
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('--output', required=True)
+    parser.add_argument('--profile', nargs=4, action='append', required=True,
+                        metavar=('ID', 'NAME', 'BAUDRATE', 'CSV'))
+    args = parser.parse_args()
+
+    lines = [
+        '// Generated by tools/gen_device_profiles.py from docs/devices. Do not edit.',
+        '#include "device_profiles.h"',
+        '',
+    ]
+    entries = []
+    for profile_id, name, baudrate, path in args.profile:
+        registers = parse_profile(path)
+        if not registers:
+            sys.exit(f'{path}: no registers found')
+
+        table = f'{profile_id}_registers'
+        lines.append(f'static const modbus_profile_register_t {table}[] = {{')
+        for r in registers:
+            lines.append(
+                f'    {{ {r["address"]}, {r["type"]}, {r["format"]}, {r["divisor"]}, '
+                f'{"true" if r["writable"] else "false"}, {c_string(r["symbol"])}, '
+                f'{c_string(r["name"])}, {c_string(r["unit"])} }},')
+        lines.append('};')
+        lines.append('')
+        entries.append(f'    {{ {c_string(profile_id)}, {c_string(name)}, {int(baudrate)}, '
+                       f'sizeof({table}) / sizeof({table}[0]), {table} }},')
+
+    lines.append('const modbus_profile_t modbus_profiles[] = {')
+    lines.extend(entries)
+    lines.append('};')
+    lines.append('')
+    lines.append('const size_t modbus_profile_count = sizeof(modbus_profiles) / sizeof(modbus_profiles[0]);')
+
+    with open(args.output, 'w', encoding='ascii') as f:
+        f.write('\n'.join(lines) + '\n')
+
+
+if __name__ == '__main__':
+    main()
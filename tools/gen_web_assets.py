@@ -0,0 +1,123 @@
+#!/usr/bin/env python3
+"""Compress the web UI files (main/html) into C tables with content hashes.
+
+Each asset is gzipped once at build time and served as is with
+Content-Encoding: gzip. Its strong ETag is derived from the SHA-256 of the
+uncompressed content. Pages reference their stylesheets and scripts with a
+?v=<hash> suffix, so those can be cached indefinitely while the pages
+themselves are revalidated. With --bundle the stylesheets and scripts a page
+references are inlined into it instead, so each page loads in one request.
+
+Usage:
+    gen_web_assets.py --output web_assets_data.c [--bundle] index.html style.css ...
+"""
+
+import argparse
+import gzip
+import hashlib
+import os
+import re
+import sys
+
+CONTENT_TYPES = {
+    '.html': 'text/html',
+    '.css': 'text/css',
+    '.js': 'application/javascript',
+}
+
+STYLESHEET_RE = re.compile(r'<link rel="stylesheet" href="/([^"?]+)">')
+SCRIPT_RE = re.compile(r'<script src="/([^"?]+)"></script>')
+
+
+def content_hash(data):
+    return hashlib.sha256(data).hexdigest()[:16]
+
+
+def rewrite_page(text, sources, hashes, bundle):
+    def stylesheet(match):
+        name = match.group(1)
+        if name not in sources:
+            sys.exit(f'page references unknown asset /{name}')
+        if bundle:
+            return '<style>\n' + sources[name].decode('utf-8') + '</style>'
+        return f'<link rel="stylesheet" href="/{name}?v={hashes[name]}">'
+
+    def script(match):
+        name = match.group(1)
+        if name not in sources:
+            sys.exit(f'page references unknown asset /{name}')
+        if bundle:
+            body = sources[name].decode('utf-8')
+            if '</script' in body:
+                sys.exit(f'{name} contains "</script" and cannot be inlined')
+            return '<script>\n' + body + '</script>'
+        return f'<script src="/{name}?v={hashes[name]}"></script>'
+
+    text = STYLESHEET_RE.sub(stylesheet, text)
+    return SCRIPT_RE.sub(script, text)
+
+
+def c_bytes(data):
+    lines = []
+    for i in range(0, len(data), 16):
+        lines.append('    ' + ' '.join(f'0x{b:02x},' for b in data[i:i + 16]))
+    return lines
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('--output', required=True)
+    parser.add_argument('--bundle', action='store_true',
+                        help='inline stylesheets and scripts into the pages')
+    parser.add_argument('files', nargs='+')
+    args = parser.parse_args()
+
+    sources = {}
+    for path in args.files:
+        name = os.path.basename(path)
+        if os.path.splitext(name)[1] not in CONTENT_TYPES:
+            sys.exit(f'{path}: unknown content type')
+        with open(path, 'rb') as f:
+            sources[name] = f.read()
+
+    # Pages embed the hashes of what they reference, so hash the rest first
+    hashes = {name: content_hash(data) for name, data in sources.items() if not name.endswith('.html')}
+    sizes = {}
+    served = {}
+    for name, data in sources.items():
+        if name.endswith('.html'):
+            data = rewrite_page(data.decode('utf-8'), sources, hashes, args.bundle).encode('utf-8')
+            hashes[name] = content_hash(data)
+        sizes[name] = len(data)
+        # mtime=0 keeps the output reproducible
+        served[name] = gzip.compress(data, compresslevel=9, mtime=0)
+
+    lines = [
+        '// Generated by tools/gen_web_assets.py from main/html. Do not edit.',
+        '#include "web_assets.h"',
+        '',
+    ]
+    entries = []
+    for index, name in enumerate(sorted(served)):
+        table = f'asset_{index}'
+        lines.append(f'// {name}: {sizes[name]} bytes, {len(served[name])} gzipped')
+        lines.append(f'static const uint8_t {table}[] = {{')
+        lines.extend(c_bytes(served[name]))
+        lines.append('};')
+        lines.append('')
+        content_type = CONTENT_TYPES[os.path.splitext(name)[1]]
+        entries.append(f'    {{ "/{name}", "{content_type}", {table}, sizeof({table}), '
+                       f'"\\"{hashes[name]}\\"" }},')
+
+    lines.append('const web_asset_t web_assets[] = {')
+    lines.extend(entries)
+    lines.append('};')
+    lines.append('')
+    lines.append('const size_t web_asset_count = sizeof(web_assets) / sizeof(web_assets[0]);')
+
+    with open(args.output, 'w', encoding='ascii') as f:
+        f.write('\n'.join(lines) + '\n')
+
+
+if __name__ == '__main__':
+    main()
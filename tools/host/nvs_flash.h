@@ -0,0 +1,11 @@
+#ifndef HOST_NVS_FLASH_H
+#define HOST_NVS_FLASH_H
+
+#include "esp_err.h"
+
+static inline esp_err_t nvs_flash_init(void)
+{
+    return ESP_OK;
+}
+
+#endif
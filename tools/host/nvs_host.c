@@ -0,0 +1,247 @@
+// In-memory NVS for host harnesses; see nvs.h
+#include "nvs.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define NVS_HOST_MAX_NAMESPACES 8
+#define NVS_HOST_KEY_MAX 16
+#define NVS_HOST_ENTRY_BYTES 32
+
+typedef enum {
+    ITEM_U8,
+    ITEM_U16,
+    ITEM_U32,
+    ITEM_STR,
+    ITEM_BLOB,
+} item_type_t;
+
+typedef struct item {
+    struct item *next;
+    uint8_t ns;
+    item_type_t type;
+    char key[NVS_HOST_KEY_MAX];
+    size_t len;
+    uint8_t data[];
+} item_t;
+
+static char namespaces[NVS_HOST_MAX_NAMESPACES][NVS_HOST_KEY_MAX];
+static item_t *items;
+static nvs_host_stats_t stats;
+
+// Blobs also take an index entry
+static uint32_t item_entries(item_type_t type, size_t len)
+{
+    uint32_t data = (uint32_t)((len + NVS_HOST_ENTRY_BYTES - 1) / NVS_HOST_ENTRY_BYTES);
+    if (type == ITEM_BLOB) {
+        return 2 + data;
+    }
+    return type == ITEM_STR ? 1 + data : 1;
+}
+
+static item_t **find_item(nvs_handle_t handle, const char *key)
+{
+    for (item_t **p = &items; *p != NULL; p = &(*p)->next) {
+        if ((*p)->ns == handle && strcmp((*p)->key, key) == 0) {
+            return p;
+        }
+    }
+    return NULL;
+}
+
+esp_err_t nvs_open(const char *name, nvs_open_mode_t mode, nvs_handle_t *handle)
+{
+    if (strlen(name) >= NVS_HOST_KEY_MAX) {
+        return ESP_ERR_NVS_KEY_TOO_LONG;
+    }
+    for (uint8_t i = 0; i < NVS_HOST_MAX_NAMESPACES; i++) {
+        if (strcmp(namespaces[i], name) == 0) {
+            *handle = i + 1;
+            return ESP_OK;
+        }
+    }
+    // As on the device, a read-only open of a namespace never written fails
+    if (mode == NVS_READONLY) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    for (uint8_t i = 0; i < NVS_HOST_MAX_NAMESPACES; i++) {
+        if (namespaces[i][0] == '\0') {
+            strcpy(namespaces[i], name);
+            *handle = i + 1;
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+}
+
+void nvs_close(nvs_handle_t handle)
+{
+    (void)handle;
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle)
+{
+    (void)handle;
+    stats.commits++;
+    return ESP_OK;
+}
+
+static void drop_item(item_t **p)
+{
+    item_t *item = *p;
+    stats.entries_used -= item_entries(item->type, item->len);
+    *p = item->next;
+    free(item);
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char *key)
+{
+    item_t **p = find_item(handle, key);
+    if (p == NULL) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    drop_item(p);
+    stats.erases++;
+    return ESP_OK;
+}
+
+esp_err_t nvs_erase_all(nvs_handle_t handle)
+{
+    item_t **p = &items;
+    while (*p != NULL) {
+        if ((*p)->ns == handle) {
+            drop_item(p);
+            stats.erases++;
+        } else {
+            p = &(*p)->next;
+        }
+    }
+    return ESP_OK;
+}
+
+static esp_err_t set_item(nvs_handle_t handle, const char *key, item_type_t type, const void *data, size_t len)
+{
+    if (strlen(key) >= NVS_HOST_KEY_MAX) {
+        return ESP_ERR_NVS_KEY_TOO_LONG;
+    }
+    item_t **p = find_item(handle, key);
+    if (p != NULL) {
+        // NVS skips writes that would store the same bytes again
+        if ((*p)->type == type && (*p)->len == len && memcmp((*p)->data, data, len) == 0) {
+            return ESP_OK;
+        }
+        drop_item(p);
+    }
+
+    item_t *item = malloc(sizeof(item_t) + len);
+    if (item == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    item->ns = (uint8_t)handle;
+    item->type = type;
+    strcpy(item->key, key);
+    item->len = len;
+    memcpy(item->data, data, len);
+    item->next = items;
+    items = item;
+
+    uint32_t entries = item_entries(type, len);
+    stats.writes++;
+    stats.entries_written += entries;
+    stats.entries_used += entries;
+    return ESP_OK;
+}
+
+static esp_err_t get_item(nvs_handle_t handle, const char *key, item_type_t type, void *data, size_t *len)
+{
+    item_t **p = find_item(handle, key);
+    if (p == NULL) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    if ((*p)->type != type) {
+        return ESP_ERR_NVS_TYPE_MISMATCH;
+    }
+    stats.reads++;
+    if (data == NULL) {
+        *len = (*p)->len;
+        return ESP_OK;
+    }
+    if (*len < (*p)->len) {
+        return ESP_ERR_NVS_INVALID_LENGTH;
+    }
+    memcpy(data, (*p)->data, (*p)->len);
+    *len = (*p)->len;
+    return ESP_OK;
+}
+
+esp_err_t nvs_set_u8(nvs_handle_t handle, const char *key, uint8_t value)
+{
+    return set_item(handle, key, ITEM_U8, &value, sizeof(value));
+}
+
+esp_err_t nvs_set_u16(nvs_handle_t handle, const char *key, uint16_t value)
+{
+    return set_item(handle, key, ITEM_U16, &value, sizeof(value));
+}
+
+esp_err_t nvs_set_u32(nvs_handle_t handle, const char *key, uint32_t value)
+{
+    return set_item(handle, key, ITEM_U32, &value, sizeof(value));
+}
+
+esp_err_t nvs_set_str(nvs_handle_t handle, const char *key, const char *value)
+{
+    return set_item(handle, key, ITEM_STR, value, strlen(value) + 1);
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t len)
+{
+    return set_item(handle, key, ITEM_BLOB, value, len);
+}
+
+esp_err_t nvs_get_u8(nvs_handle_t handle, const char *key, uint8_t *value)
+{
+    size_t len = sizeof(*value);
+    return get_item(handle, key, ITEM_U8, value, &len);
+}
+
+esp_err_t nvs_get_u16(nvs_handle_t handle, const char *key, uint16_t *value)
+{
+    size_t len = sizeof(*value);
+    return get_item(handle, key, ITEM_U16, value, &len);
+}
+
+esp_err_t nvs_get_u32(nvs_handle_t handle, const char *key, uint32_t *value)
+{
+    size_t len = sizeof(*value);
+    return get_item(handle, key, ITEM_U32, value, &len);
+}
+
+esp_err_t nvs_get_str(nvs_handle_t handle, const char *key, char *value, size_t *len)
+{
+    return get_item(handle, key, ITEM_STR, value, len);
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *value, size_t *len)
+{
+    return get_item(handle, key, ITEM_BLOB, value, len);
+}
+
+void nvs_host_get_stats(nvs_host_stats_t *out)
+{
+    *out = stats;
+}
+
+void nvs_host_reset_stats(void)
+{
+    uint32_t used = stats.entries_used;
+    memset(&stats, 0, sizeof(stats));
+    stats.entries_used = used;
+}
+
+void nvs_host_clear(void)
+{
+    while (items != NULL) {
+        drop_item(&items);
+    }
+    memset(namespaces, 0, sizeof(namespaces));
+}
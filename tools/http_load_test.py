@@ -0,0 +1,164 @@
+#!/usr/bin/env python3
+"""Check that page latency stays flat while bus-bound API requests run.
+
+Simulates several open dashboards fetching pages over keep-alive
+connections, first alone and then while other clients keep the Modbus bus
+busy with writes (or on-demand reads). Bus-bound handlers run on worker
+tasks (main/http_workers.c), so page latency should hardly move; before
+they did, each page waited behind the whole bus transaction.
+
+Usage:
+    http_load_test.py 192.168.4.1 --write 1:3:100:600
+    http_load_test.py 192.168.4.1 --read 1:0 --dashboards 6 --busy-clients 3
+
+Exits non-zero when the loaded 95th percentile page latency exceeds the
+baseline one by more than --max-slowdown.
+"""
+
+import argparse
+import http.client
+import json
+import sys
+import threading
+import time
+
+PAGES = ['/', '/status', '/dashboard.html']
+
+
+def percentile(samples, fraction):
+    if not samples:
+        return float('nan')
+    ordered = sorted(samples)
+    return ordered[min(len(ordered) - 1, int(fraction * len(ordered)))]
+
+
+class Dashboard(threading.Thread):
+    """Fetches pages back to back over one connection, timing each."""
+
+    def __init__(self, host, port, stop):
+        super().__init__(daemon=True)
+        self.host, self.port, self.stop = host, port, stop
+        self.latencies = []
+        self.errors = 0
+
+    def run(self):
+        conn = None
+        index = 0
+        while not self.stop.is_set():
+            path = PAGES[index % len(PAGES)]
+            index += 1
+            try:
+                if conn is None:
+                    conn = http.client.HTTPConnection(self.host, self.port, timeout=10)
+                start = time.monotonic()
+                conn.request('GET', path)
+                response = conn.getresponse()
+                response.read()
+                elapsed = time.monotonic() - start
+                if response.status >= 400:
+                    self.errors += 1
+                else:
+                    self.latencies.append(elapsed)
+            except (OSError, http.client.HTTPException):
+                # Closed by the server's LRU purge or a timeout: reconnect
+                self.errors += 1
+                conn = None
+
+
+class BusClient(threading.Thread):
+    """Keeps issuing one bus-bound request, counting answers by status."""
+
+    def __init__(self, host, port, stop, method, path, body):
+        super().__init__(daemon=True)
+        self.host, self.port, self.stop = host, port, stop
+        self.method, self.path, self.body = method, path, body
+        self.statuses = {}
+
+    def run(self):
+        conn = None
+        while not self.stop.is_set():
+            try:
+                if conn is None:
+                    conn = http.client.HTTPConnection(self.host, self.port, timeout=30)
+                headers = {'Content-Type': 'application/json'} if self.body else {}
+                conn.request(self.method, self.path, body=self.body, headers=headers)
+                response = conn.getresponse()
+                response.read()
+                self.statuses[response.status] = self.statuses.get(response.status, 0) + 1
+                if response.status in (429, 503):
+                    # Honour Retry-After as a well-behaved client would
+                    delay = response.getheader('Retry-After', '1')
+                    self.stop.wait(float(delay) if delay.isdigit() else 1.0)
+            except (OSError, http.client.HTTPException):
+                self.statuses['error'] = self.statuses.get('error', 0) + 1
+                conn = None
+
+
+def run_phase(args, stop_after, bus_request):
+    stop = threading.Event()
+    dashboards = [Dashboard(args.host, args.port, stop) for _ in range(args.dashboards)]
+    busy = []
+    if bus_request is not None:
+        busy = [BusClient(args.host, args.port, stop, *bus_request) for _ in range(args.busy_clients)]
+    for thread in busy + dashboards:
+        thread.start()
+    time.sleep(stop_after)
+    stop.set()
+    for thread in busy + dashboards:
+        thread.join(timeout=35)
+
+    latencies = [sample for d in dashboards for sample in d.latencies]
+    errors = sum(d.errors for d in dashboards)
+    statuses = {}
+    for client in busy:
+        for status, count in client.statuses.items():
+            statuses[status] = statuses.get(status, 0) + count
+    return latencies, errors, statuses
+
+
+def bus_request_from(args):
+    if args.write:
+        device, reg_type, address, value = args.write.split(':')
+        path = '/api/modbus/write?device_id=%s&type=%s&address=%s' % (device, reg_type, address)
+        return 'POST', path, json.dumps({'value': float(value)})
+    device, address = args.read.split(':')
+    return 'GET', '/api/modbus/read?device=%s&address=%s&max_age_ms=0' % (device, address), None
+
+
+def report(name, latencies, errors):
+    print('%-9s %6d pages  p50 %6.1f ms  p95 %6.1f ms  max %6.1f ms  errors %d' % (
+        name, len(latencies), percentile(latencies, 0.5) * 1000,
+        percentile(latencies, 0.95) * 1000, max(latencies, default=float('nan')) * 1000, errors))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split('\n')[0])
+    parser.add_argument('host')
+    parser.add_argument('--port', type=int, default=80)
+    target = parser.add_mutually_exclusive_group(required=True)
+    target.add_argument('--write', metavar='DEVICE:TYPE:ADDRESS:VALUE',
+                        help='keep writing this value (the device must accept it)')
+    target.add_argument('--read', metavar='DEVICE:ADDRESS',
+                        help='keep reading this register from the bus (max_age_ms=0)')
+    parser.add_argument('--dashboards', type=int, default=4)
+    parser.add_argument('--busy-clients', type=int, default=2)
+    parser.add_argument('--seconds', type=float, default=20)
+    parser.add_argument('--max-slowdown', type=float, default=2.0)
+    args = parser.parse_args()
+
+    baseline, base_errors, _ = run_phase(args, args.seconds, None)
+    report('baseline', baseline, base_errors)
+    loaded, load_errors, statuses = run_phase(args, args.seconds, bus_request_from(args))
+    report('loaded', loaded, load_errors)
+    print('bus requests: %s' % ', '.join('%s x%d' % (s, n) for s, n in sorted(statuses.items(), key=str)))
+
+    if not baseline or not loaded:
+        print('no pages completed')
+        return 1
+    slowdown = percentile(loaded, 0.95) / percentile(baseline, 0.95)
+    print('p95 slowdown: %.2fx (limit %.2fx)' % (slowdown, args.max_slowdown))
+    return 0 if slowdown <= args.max_slowdown else 1
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,168 @@
+#!/usr/bin/env python3
+"""Local HTTP sink for testing the gateway's Influx push.
+
+Accepts line protocol POSTs like InfluxDB (/api/v2/write, /write), checks
+every line, and prints one summary per request: samples, body size on the
+wire and uncompressed, and the time span covered. Point the gateway at it:
+
+    curl -X POST http://<device-ip>/api/modbus/influx \\
+      -H "Content-Type: application/json" \\
+      -d '{"enabled": true, "url": "http://<pc-ip>:8086/api/v2/write?bucket=test"}'
+    influx_sink.py --port 8086 --out samples.lp
+
+--outage START:SECONDS answers 503 for a while (or drops the connection
+with --outage-mode drop) to exercise the retry backoff and the read-back
+from the flash log; the sink then reports how long the gateway waited
+between attempts and whether samples went missing or came twice.
+"""
+
+import argparse
+import gzip
+import re
+import signal
+import sys
+import threading
+import time
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+LINE = re.compile(r'^modbus,device=(\d+),type=(\d+),address=(\d+) '
+                  r'(?:value=(-?\d+)i,decimals=(\d+)i,)?raw=(\d+)i (\d+)$')
+
+
+class Sink:
+    def __init__(self, args):
+        self.args = args
+        self.lock = threading.Lock()
+        self.started = time.monotonic()
+        self.points = {}            # (device, type, address, timestamp) -> raw
+        self.requests = 0
+        self.duplicates = 0
+        self.bad_lines = 0
+        self.last_attempt = None
+        self.out = open(args.out, 'a') if args.out else None
+
+    def in_outage(self):
+        if not self.args.outage:
+            return False
+        start, seconds = (float(v) for v in self.args.outage.split(':'))
+        elapsed = time.monotonic() - self.started
+        return start <= elapsed < start + seconds
+
+    def handle(self, body, encoding):
+        if encoding == 'gzip':
+            body_raw = gzip.decompress(body)
+        elif encoding in (None, 'identity'):
+            body_raw = body
+        else:
+            return 415, 'unsupported encoding %s' % encoding
+
+        lines = body_raw.decode('utf-8').splitlines()
+        stamps = []
+        with self.lock:
+            for line in lines:
+                match = LINE.match(line)
+                if not match:
+                    self.bad_lines += 1
+                    print('  bad line: %r' % line)
+                    continue
+                device, reg_type, address = (int(g) for g in match.group(1, 2, 3))
+                raw, stamp = int(match.group(6)), int(match.group(7))
+                key = (device, reg_type, address, stamp)
+                if key in self.points:
+                    self.duplicates += 1
+                self.points[key] = raw
+                stamps.append(stamp)
+            if self.out:
+                self.out.write(body_raw.decode('utf-8'))
+                self.out.flush()
+            self.requests += 1
+            number = self.requests
+
+        span = (max(stamps) - min(stamps)) / 1e9 if stamps else 0
+        newest = time.time() - max(stamps) / 1e9 if stamps else float('nan')
+        print('#%d %4d samples  %6d bytes sent  %6d raw (%.1fx)  span %.1f s  newest %.1f s ago%s' % (
+            number, len(stamps), len(body), len(body_raw), len(body_raw) / max(len(body), 1),
+            span, newest, '  gzip' if encoding == 'gzip' else ''))
+        return 204, None
+
+    def summary(self):
+        print('%d requests, %d distinct points, %d duplicates, %d bad lines' % (
+            self.requests, len(self.points), self.duplicates, self.bad_lines))
+        series = {}
+        for device, reg_type, address, stamp in self.points:
+            series.setdefault((device, reg_type, address), []).append(stamp)
+        for key, stamps in sorted(series.items()):
+            stamps.sort()
+            gaps = [(b - a) / 1e9 for a, b in zip(stamps, stamps[1:])]
+            print('  device %d type %d address %d: %d points, largest gap %.1f s' % (
+                key + (len(stamps), max(gaps, default=0))))
+
+
+def make_handler(sink):
+    class Handler(BaseHTTPRequestHandler):
+        protocol_version = 'HTTP/1.1'
+
+        def do_POST(self):
+            length = int(self.headers.get('Content-Length', 0))
+            body = self.rfile.read(length)
+            now = time.monotonic()
+            if sink.last_attempt is not None and sink.in_outage():
+                print('  attempt after %.1f s' % (now - sink.last_attempt))
+            sink.last_attempt = now
+
+            if sink.in_outage():
+                if sink.args.outage_mode == 'drop':
+                    self.close_connection = True
+                    self.connection.close()
+                    return
+                self.reply(503, 'outage')
+                return
+            try:
+                status, message = sink.handle(body, self.headers.get('Content-Encoding'))
+            except (OSError, UnicodeDecodeError, EOFError) as e:
+                status, message = 400, str(e)
+            self.reply(status, message)
+
+        def reply(self, status, message):
+            payload = ('{"message":"%s"}' % message).encode() if message else b''
+            self.send_response(status)
+            if payload:
+                self.send_header('Content-Type', 'application/json')
+            self.send_header('Content-Length', str(len(payload)))
+            self.end_headers()
+            self.wfile.write(payload)
+
+        def log_message(self, fmt, *args):
+            pass
+
+    return Handler
+
+
+def stop(signum, frame):
+    raise KeyboardInterrupt
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split('\n')[0])
+    parser.add_argument('--bind', default='0.0.0.0')
+    parser.add_argument('--port', type=int, default=8086)
+    parser.add_argument('--out', help='append received lines to this file')
+    parser.add_argument('--outage', metavar='START:SECONDS',
+                        help='fail requests from START for SECONDS seconds after startup')
+    parser.add_argument('--outage-mode', choices=('503', 'drop'), default='503')
+    args = parser.parse_args()
+
+    sink = Sink(args)
+    server = ThreadingHTTPServer((args.bind, args.port), make_handler(sink))
+    signal.signal(signal.SIGTERM, stop)
+    print('Listening on %s:%d' % (args.bind, args.port))
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+    sink.summary()
+    return 1 if sink.bad_lines else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,540 @@
+#!/usr/bin/env python3
+"""Modbus RTU slave simulator on a pseudo-terminal or serial port.
+
+Emulates one or more slaves with the register maps of docs/devices/*.csv
+(read with the same parser as tools/gen_device_profiles.py), so the
+gateway's poller can be exercised and benchmarked without an HVAC unit:
+
+    modbus_rtu_sim.py --slave 1:eairmd --link /tmp/ttyMODBUS
+    modbus_rtu_sim.py --slave 1:eairmd --slave 2:ewind --serial /dev/ttyUSB0 --baud 19200
+
+With a pty the other end is printed (and linked with --link) for a host
+master such as mbpoll or pymodbus; with --serial a USB-RS485 adapter puts
+the simulated slaves on the bus of a real gateway. Replies are paced at the
+configured baud rate, so throughput matches a real line.
+
+Addresses that are not in a slave's map are illegal-address holes
+(exception 02), like reserved registers on the units; --hole adds more.
+Faults are drawn per request:
+
+    --latency 20:5       reply after 20 +- 5 ms
+    --char-gap 3         pause 3 ms between reply bytes (> 1.5 chars splits frames)
+    --crc-rate 0.01      corrupt the CRC of 1% of replies
+    --drop-rate 0.02     don't reply to 2% of requests
+    --busy-rate 0.05     answer 5% with exception 06 (slave device busy)
+
+Every request is counted by slave, function and outcome; totals and the
+request rate are printed every --stats-interval seconds and on exit
+(--stats-json writes them to a file). --selftest runs a built-in master
+against the simulator over a pty and exits non-zero on a mismatch.
+"""
+
+import argparse
+import json
+import os
+import random
+import select
+import signal
+import struct
+import sys
+import termios
+import threading
+import time
+import tty
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+from gen_device_profiles import parse_profile  # noqa: E402
+
+DEVICES_DIR = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'docs', 'devices')
+PROFILES = {
+    'eairmd': os.path.join(DEVICES_DIR, 'eAirMD-modbus-register-list-public-clean.csv'),
+    'ewind': os.path.join(DEVICES_DIR, 'eWind-modbus-register-list-public-clean.csv'),
+}
+
+COIL, DISCRETE, HOLDING, INPUT = 1, 2, 3, 4
+
+# What the unit itself accepts writes to, for lists without an R/W column.
+# The gateway's profile keeps these read-only until a user enables them, but
+# the simulated unit behaves like the real one: eAirMD settings start at
+# holding register 50 and its coils are switchable.
+DEVICE_WRITABLE = {
+    'eairmd': lambda reg_type, address: reg_type == COIL or (reg_type == HOLDING and address >= 50),
+}
+TYPE_NAMES = {
+    'REGISTER_TYPE_COIL': COIL,
+    'REGISTER_TYPE_DISCRETE': DISCRETE,
+    'REGISTER_TYPE_HOLDING': HOLDING,
+    'REGISTER_TYPE_INPUT': INPUT,
+}
+READ_TYPES = {1: COIL, 2: DISCRETE, 3: HOLDING, 4: INPUT}
+READ_LIMITS = {1: 2000, 2: 2000, 3: 125, 4: 125}
+
+ILLEGAL_FUNCTION = 0x01
+ILLEGAL_ADDRESS = 0x02
+ILLEGAL_VALUE = 0x03
+DEVICE_BUSY = 0x06
+
+BAUDS = {9600: termios.B9600, 19200: termios.B19200, 38400: termios.B38400,
+         57600: termios.B57600, 115200: termios.B115200}
+
+
+def crc16(data):
+    crc = 0xFFFF
+    for byte in data:
+        crc ^= byte
+        for _ in range(8):
+            crc = (crc >> 1) ^ 0xA001 if crc & 1 else crc >> 1
+    return crc
+
+
+def frame(body):
+    return body + struct.pack('<H', crc16(body))
+
+
+def request_length(buf):
+    """Length of the request at the start of buf, or None until it's known."""
+    if len(buf) < 2:
+        return None
+    function = buf[1]
+    if function in (1, 2, 3, 4, 5, 6):
+        return 8
+    if function in (15, 16):
+        return 9 + buf[6] if len(buf) >= 7 else None
+    # Unknown function: take what arrived before the line went quiet
+    return -1
+
+
+def initial_value(reg):
+    """A plausible raw value so dashboards show something sensible."""
+    unit = reg['unit']
+    if unit == '°C':
+        return 200 + reg['address'] % 50
+    if unit == '%RH':
+        return 45
+    if unit == 'ppm':
+        return 600
+    if unit == '%':
+        return 50
+    return 0
+
+
+class Slave:
+    def __init__(self, slave_id, profile, holes, fill):
+        self.id = slave_id
+        self.profile = profile
+        self.fill = fill
+        self.values = {COIL: {}, DISCRETE: {}, HOLDING: {}, INPUT: {}}
+        self.writable = set()
+        self.measurements = []
+        if profile != 'empty':
+            path = PROFILES.get(profile, profile)
+            device_writable = DEVICE_WRITABLE.get(profile)
+            for reg in parse_profile(path):
+                reg_type = TYPE_NAMES[reg['type']]
+                self.values[reg_type][reg['address']] = initial_value(reg)
+                if reg['writable'] or (device_writable and device_writable(reg_type, reg['address'])):
+                    self.writable.add((reg_type, reg['address']))
+                elif reg_type in (HOLDING, INPUT) and reg['unit']:
+                    self.measurements.append((reg_type, reg['address']))
+        for reg_type, first, last in holes:
+            for address in range(first, last + 1):
+                self.values[reg_type].pop(address, None)
+                self.writable.discard((reg_type, address))
+
+    def known(self, reg_type, address):
+        return self.fill or address in self.values[reg_type]
+
+    def drift(self, rng):
+        # Measurements wander a little so change-based logging has work
+        for reg_type, address in self.measurements:
+            if address in self.values[reg_type] and rng.random() < 0.3:
+                value = self.values[reg_type][address] + rng.choice((-1, 1))
+                self.values[reg_type][address] = value & 0xFFFF
+
+    def serve(self, request):
+        """Returns the reply PDU (without address and CRC)."""
+        function = request[1]
+        if function in READ_TYPES:
+            address, count = struct.unpack('>HH', request[2:6])
+            reg_type = READ_TYPES[function]
+            if not 1 <= count <= READ_LIMITS[function]:
+                return exception(function, ILLEGAL_VALUE)
+            if not all(self.known(reg_type, a) for a in range(address, address + count)):
+                return exception(function, ILLEGAL_ADDRESS)
+            values = [self.values[reg_type].get(a, 0) for a in range(address, address + count)]
+            if reg_type in (COIL, DISCRETE):
+                data = bytearray((count + 7) // 8)
+                for i, bit in enumerate(values):
+                    if bit:
+                        data[i // 8] |= 1 << (i % 8)
+                return bytes([function, len(data)]) + bytes(data)
+            return bytes([function, 2 * count]) + struct.pack('>%dH' % count, *values)
+
+        if function in (5, 6):
+            address, value = struct.unpack('>HH', request[2:6])
+            reg_type = COIL if function == 5 else HOLDING
+            if function == 5 and value not in (0x0000, 0xFF00):
+                return exception(function, ILLEGAL_VALUE)
+            if (reg_type, address) not in self.writable and not (self.fill and address not in self.values[reg_type]):
+                return exception(function, ILLEGAL_ADDRESS)
+            self.values[reg_type][address] = 1 if value == 0xFF00 and function == 5 else value
+            return request[1:6]
+
+        if function in (15, 16):
+            address, count, byte_count = struct.unpack('>HHB', request[2:7])
+            reg_type = COIL if function == 15 else HOLDING
+            expected = (count + 7) // 8 if function == 15 else 2 * count
+            if count < 1 or byte_count != expected:
+                return exception(function, ILLEGAL_VALUE)
+            addresses = range(address, address + count)
+            if not all((reg_type, a) in self.writable or (self.fill and a not in self.values[reg_type])
+                       for a in addresses):
+                return exception(function, ILLEGAL_ADDRESS)
+            data = request[7:7 + byte_count]
+            for i, a in enumerate(addresses):
+                if function == 15:
+                    self.values[COIL][a] = (data[i // 8] >> (i % 8)) & 1
+                else:
+                    self.values[HOLDING][a] = struct.unpack('>H', data[2 * i:2 * i + 2])[0]
+            return request[1:6]
+
+        return exception(function, ILLEGAL_FUNCTION)
+
+
+def exception(function, code):
+    return bytes([function | 0x80, code])
+
+
+class Stats:
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.counts = {}
+        self.total = 0
+        self.started = time.monotonic()
+
+    def count(self, *key):
+        with self.lock:
+            self.counts[key] = self.counts.get(key, 0) + 1
+            if key[0] == 'request':
+                self.total += 1
+
+    def snapshot(self):
+        with self.lock:
+            elapsed = time.monotonic() - self.started
+            out = {'elapsed_s': round(elapsed, 1), 'requests': self.total,
+                   'requests_per_s': round(self.total / elapsed, 2) if elapsed > 0 else 0,
+                   'by_slave': {}, 'events': {}}
+            for key, n in sorted(self.counts.items(), key=str):
+                if key[0] == 'request':
+                    _, slave, function = key
+                    out['by_slave'].setdefault(str(slave), {})['fc%02d' % function] = n
+                else:
+                    out['events']['_'.join(str(k) for k in key)] = n
+            return out
+
+    def report(self):
+        s = self.snapshot()
+        per_slave = ', '.join('%s: %s' % (slave, ' '.join('%s=%d' % kv for kv in sorted(fcs.items())))
+                              for slave, fcs in sorted(s['by_slave'].items()))
+        events = ' '.join('%s=%d' % kv for kv in sorted(s['events'].items()))
+        print('[%7.1f s] %d requests (%.1f/s)  %s  %s' % (
+            s['elapsed_s'], s['requests'], s['requests_per_s'], per_slave or '-', events), flush=True)
+
+
+class Simulator:
+    def __init__(self, fd, slaves, args, rng):
+        self.fd = fd
+        self.slaves = {slave.id: slave for slave in slaves}
+        self.args = args
+        self.rng = rng
+        self.stats = Stats()
+        # 11 bits per character (8 data, parity or second stop, start, stop)
+        self.char_time = 11.0 / args.baud
+        self.silence = max(3.5 * self.char_time, 0.00175)
+        self.stop = threading.Event()
+
+    def send(self, data):
+        if self.args.char_gap > 0:
+            for byte in data:
+                self.pace(1)
+                os.write(self.fd, bytes([byte]))
+                time.sleep(self.args.char_gap / 1000.0)
+        else:
+            self.pace(len(data))
+            os.write(self.fd, data)
+
+    def pace(self, chars):
+        if not self.args.no_pacing:
+            time.sleep(chars * self.char_time)
+
+    def handle(self, request):
+        if crc16(request[:-2]) != struct.unpack('<H', request[-2:])[0]:
+            self.stats.count('bad_crc_in')
+            return
+        slave_id, function = request[0], request[1]
+        slave = self.slaves.get(slave_id)
+        if slave_id != 0 and slave is None:
+            self.stats.count('other_slave')
+            return
+        self.stats.count('request', slave_id, function)
+
+        if self.rng.random() < self.args.drop_rate:
+            self.stats.count('dropped')
+            return
+        if self.rng.random() < self.args.busy_rate:
+            pdu = exception(function, DEVICE_BUSY)
+        elif slave_id == 0:
+            # Broadcast: writes apply to every slave, nobody answers
+            for each in self.slaves.values():
+                if function in (5, 6, 15, 16):
+                    each.serve(request)
+            self.stats.count('broadcast')
+            return
+        else:
+            pdu = slave.serve(request)
+        if pdu[0] & 0x80:
+            self.stats.count('exception', pdu[1])
+
+        reply = frame(bytes([slave_id]) + pdu)
+        if self.rng.random() < self.args.crc_rate:
+            reply = reply[:-2] + bytes([reply[-2] ^ 0xFF, reply[-1]])
+            self.stats.count('crc_corrupted')
+
+        latency, jitter = self.args.latency
+        delay = max(0.0, latency + self.rng.uniform(-jitter, jitter)) / 1000.0
+        # The master needs the line quiet for 3.5 characters anyway
+        time.sleep(max(delay, self.silence))
+        self.send(reply)
+
+    def run(self):
+        buf = b''
+        last_rx = time.monotonic()
+        next_report = time.monotonic() + self.args.stats_interval if self.args.stats_interval else None
+        next_drift = time.monotonic() + 1.0
+        while not self.stop.is_set():
+            ready, _, _ = select.select([self.fd], [], [], 0.05)
+            now = time.monotonic()
+            if ready:
+                try:
+                    chunk = os.read(self.fd, 256)
+                except OSError:
+                    # pty without a reader on the other end yet
+                    time.sleep(0.05)
+                    continue
+                if buf and now - last_rx > self.silence * 4:
+                    # A silent gap ends a frame; leftovers were garbage
+                    self.stats.count('discarded_bytes')
+                    buf = b''
+                buf += chunk
+                last_rx = now
+            elif buf and now - last_rx > max(self.silence * 4, 0.02):
+                length = request_length(buf)
+                if length == -1 and len(buf) >= 4:
+                    self.handle(buf)
+                else:
+                    self.stats.count('incomplete_frame')
+                buf = b''
+
+            while buf:
+                length = request_length(buf)
+                if length is None or length == -1 or len(buf) < length:
+                    break
+                request, buf = buf[:length], buf[length:]
+                self.handle(request)
+
+            if self.args.drift and now >= next_drift:
+                for slave in self.slaves.values():
+                    slave.drift(self.rng)
+                next_drift = now + 1.0
+            if next_report is not None and now >= next_report:
+                self.stats.report()
+                next_report = now + self.args.stats_interval
+
+
+def open_pty(link):
+    master, slave = os.openpty()
+    tty.setraw(master)
+    tty.setraw(slave)
+    path = os.ttyname(slave)
+    if link:
+        if os.path.islink(link):
+            os.unlink(link)
+        os.symlink(path, link)
+    return master, slave, path
+
+
+def open_serial(device, baud):
+    fd = os.open(device, os.O_RDWR | os.O_NOCTTY)
+    tty.setraw(fd)
+    attrs = termios.tcgetattr(fd)
+    speed = BAUDS[baud]
+    attrs[4] = attrs[5] = speed
+    termios.tcsetattr(fd, termios.TCSANOW, attrs)
+    return fd
+
+
+class Master:
+    """Minimal RTU master over a file descriptor, for --selftest."""
+
+    def __init__(self, fd, timeout=0.5):
+        self.fd = fd
+        self.timeout = timeout
+
+    def transact(self, slave_id, pdu):
+        os.write(self.fd, frame(bytes([slave_id]) + pdu))
+        data = b''
+        deadline = time.monotonic() + self.timeout
+        while time.monotonic() < deadline:
+            ready, _, _ = select.select([self.fd], [], [], 0.02)
+            if ready:
+                data += os.read(self.fd, 256)
+                deadline = time.monotonic() + 0.02
+        if len(data) < 5:
+            return None
+        if crc16(data[:-2]) != struct.unpack('<H', data[-2:])[0]:
+            return 'crc'
+        return data[1:-2]
+
+
+def selftest(args):
+    """Checks the simulator's answers with a master on the other pty end."""
+    master_fd, slave_fd, path = open_pty(None)
+    slaves = [Slave(1, 'eairmd', [(HOLDING, 900, 901)], False), Slave(2, 'ewind', [], False)]
+    args.baud, args.no_pacing, args.char_gap, args.drift = 19200, False, 0, False
+    args.latency, args.stats_interval = (0.0, 0.0), 0
+    args.crc_rate = args.drop_rate = args.busy_rate = 0.0
+    sim = Simulator(master_fd, slaves, args, random.Random(1))
+    thread = threading.Thread(target=sim.run, daemon=True)
+    thread.start()
+    client = Master(slave_fd)
+
+    failures = []
+
+    def check(name, got, expected):
+        if got != expected:
+            failures.append('%s: got %r, expected %r' % (name, got, expected))
+
+    temp = slaves[0].values[HOLDING][6]
+    check('read hreg 6', client.transact(1, bytes([3]) + struct.pack('>HH', 6, 1)),
+          bytes([3, 2]) + struct.pack('>H', temp))
+    check('hole', client.transact(1, bytes([3]) + struct.pack('>HH', 900, 1)), bytes([0x83, ILLEGAL_ADDRESS]))
+    check('unknown slave', client.transact(9, bytes([3]) + struct.pack('>HH', 6, 1)), None)
+    check('bad function', client.transact(1, bytes([0x2B, 0x0E, 1, 0])), bytes([0xAB, ILLEGAL_FUNCTION]))
+    check('read-only write', client.transact(1, bytes([6]) + struct.pack('>HH', 6, 1)),
+          bytes([0x86, ILLEGAL_ADDRESS]))
+    writable = sorted(a for t, a in slaves[0].writable if t == HOLDING)[0]
+    check('write', client.transact(1, bytes([6]) + struct.pack('>HH', writable, 42)),
+          bytes([6]) + struct.pack('>HH', writable, 42))
+    check('read back', client.transact(1, bytes([3]) + struct.pack('>HH', writable, 1)),
+          bytes([3, 2, 0, 42]))
+    coil = sorted(a for t, a in slaves[1].writable if t == COIL)[0]
+    check('write coil', client.transact(2, bytes([5]) + struct.pack('>HH', coil, 0xFF00)),
+          bytes([5]) + struct.pack('>HH', coil, 0xFF00))
+    check('read coil', client.transact(2, bytes([1]) + struct.pack('>HH', coil, 1)), bytes([1, 1, 1]))
+
+    sim.args.busy_rate = 1.0
+    check('busy', client.transact(1, bytes([3]) + struct.pack('>HH', 6, 1)), bytes([0x83, DEVICE_BUSY]))
+    sim.args.busy_rate, sim.args.crc_rate = 0.0, 1.0
+    check('crc corruption', client.transact(1, bytes([3]) + struct.pack('>HH', 6, 1)), 'crc')
+    sim.args.crc_rate, sim.args.drop_rate = 0.0, 1.0
+    check('dropout', client.transact(1, bytes([3]) + struct.pack('>HH', 6, 1)), None)
+    sim.args.drop_rate = 0.0
+    sim.args.char_gap = 2.0
+    check('char gap', client.transact(1, bytes([3]) + struct.pack('>HH', 6, 1)),
+          bytes([3, 2]) + struct.pack('>H', temp))
+
+    sim.stop.set()
+    thread.join(timeout=1)
+    stats = sim.stats.snapshot()
+    check('requests counted', stats['requests'], 12)
+    for failure in failures:
+        print('FAIL ' + failure)
+    print('selftest on %s: %d checks failed' % (path, len(failures)))
+    return 1 if failures else 0
+
+
+def parse_slave(text):
+    slave_id, _, profile = text.partition(':')
+    slave_id = int(slave_id)
+    if not 1 <= slave_id <= 247:
+        raise argparse.ArgumentTypeError('slave id must be 1-247')
+    profile = profile or 'eairmd'
+    if profile not in PROFILES and profile != 'empty' and not os.path.exists(profile):
+        raise argparse.ArgumentTypeError('unknown profile %s (eairmd, ewind, empty or a CSV path)' % profile)
+    return slave_id, profile
+
+
+def parse_hole(text):
+    kind, _, addresses = text.partition(':')
+    kinds = {'coil': COIL, 'discrete': DISCRETE, 'hreg': HOLDING, 'ireg': INPUT}
+    if kind not in kinds:
+        raise argparse.ArgumentTypeError('hole type must be coil, discrete, hreg or ireg')
+    first, _, last = addresses.partition('-')
+    return kinds[kind], int(first), int(last or first)
+
+
+def parse_latency(text):
+    latency, _, jitter = text.partition(':')
+    return float(latency), float(jitter or 0)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split('\n')[0],
+                                     formatter_class=argparse.RawDescriptionHelpFormatter,
+                                     epilog=__doc__.split('\n', 2)[2])
+    parser.add_argument('--slave', type=parse_slave, action='append', metavar='ID[:PROFILE]',
+                        help='slave id and register map: eairmd (default), ewind, empty or a CSV path')
+    port = parser.add_mutually_exclusive_group()
+    port.add_argument('--link', help='symlink this path to the pty for the master')
+    port.add_argument('--serial', help='serve on a serial device instead of a pty')
+    parser.add_argument('--baud', type=int, default=19200, choices=sorted(BAUDS))
+    parser.add_argument('--no-pacing', action='store_true', help='reply as fast as possible')
+    parser.add_argument('--hole', type=parse_hole, action='append', default=[], metavar='TYPE:FIRST[-LAST]',
+                        help='make addresses illegal, e.g. hreg:40-45')
+    parser.add_argument('--fill', action='store_true', help='answer unmapped addresses with 0 instead')
+    parser.add_argument('--latency', type=parse_latency, default=(5.0, 0.0), metavar='MS[:JITTER]')
+    parser.add_argument('--char-gap', type=float, default=0.0, metavar='MS')
+    parser.add_argument('--crc-rate', type=float, default=0.0)
+    parser.add_argument('--drop-rate', type=float, default=0.0)
+    parser.add_argument('--busy-rate', type=float, default=0.0)
+    parser.add_argument('--drift', action='store_true', help='let measurement registers wander')
+    parser.add_argument('--seed', type=int, help='fault and drift random seed')
+    parser.add_argument('--stats-interval', type=float, default=10.0, metavar='S', help='0 to disable')
+    parser.add_argument('--stats-json', help='write the final counters to this file')
+    parser.add_argument('--selftest', action='store_true')
+    args = parser.parse_args()
+
+    if args.selftest:
+        return selftest(args)
+
+    slaves = [Slave(slave_id, profile, args.hole, args.fill) for slave_id, profile in (args.slave or [(1, 'eairmd')])]
+    if args.serial:
+        fd = open_serial(args.serial, args.baud)
+        where = args.serial
+    else:
+        fd, _, where = open_pty(args.link)
+        if args.link:
+            where = '%s -> %s' % (args.link, where)
+    for slave in slaves:
+        counts = ', '.join('%d %s' % (len(slave.values[t]), n)
+                           for t, n in ((COIL, 'coils'), (DISCRETE, 'discrete'), (HOLDING, 'hreg'), (INPUT, 'ireg')))
+        print('slave %d (%s): %s' % (slave.id, slave.profile, counts))
+    print('serving on %s at %d baud' % (where, args.baud), flush=True)
+
+    sim = Simulator(fd, slaves, args, random.Random(args.seed))
+    signal.signal(signal.SIGTERM, lambda signum, frame: sim.stop.set())
+    try:
+        sim.run()
+    except KeyboardInterrupt:
+        pass
+    sim.stats.report()
+    if args.stats_json:
+        with open(args.stats_json, 'w') as f:
+            json.dump(sim.stats.snapshot(), f, indent=2)
+    if args.link and os.path.islink(args.link):
+        os.unlink(args.link)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,366 @@
+// Host test of the flash log against a file-backed image with NOR semantics
+// (writes only clear bits, erases set whole sectors to 0xFF): record and read
+// back, reopen and resume from a cursor, wrap around the ring, and recover
+// from a corrupt block. Also checks that recording never touches flash.
+//
+// Build and run from the repository root:
+//     cc -O2 -Imain -Itools/host -o test_ts_log tools/test_ts_log.c main/ts_log.c -lm
+//     ./test_ts_log [image]
+#include "ts_log.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define SEGMENTS 4
+#define IMAGE_SIZE (SEGMENTS * TS_LOG_SEGMENT_SIZE)
+#define SECTOR_SIZE 4096
+#define SLOTS 16
+#define POLL_MS 10
+#define MAX_SAMPLES 40000
+
+typedef struct {
+    uint8_t *image;
+    unsigned writes;
+    unsigned erases;
+} flash_t;
+
+typedef struct {
+    ts_log_sample_t samples[MAX_SAMPLES];
+    size_t count;
+    ts_log_cursor_t last;
+} collected_t;
+
+static const char *path = "test_ts_log.img";
+static int image_fd = -1;
+static flash_t flash;
+static collected_t got;
+static bool wake_pending;
+static uint32_t clock_ms;
+static uint32_t next_raw;
+static int failures;
+
+#define CHECK(cond, ...) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "FAIL %s:%d: ", __FILE__, __LINE__); \
+            fprintf(stderr, __VA_ARGS__); \
+            fputc('\n', stderr); \
+            failures++; \
+        } \
+    } while (0)
+
+static esp_err_t flash_write(void *ctx, size_t offset, const void *data, size_t len)
+{
+    flash_t *f = ctx;
+    if (offset + len > IMAGE_SIZE) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    for (size_t i = 0; i < len; i++) {
+        f->image[offset + i] &= ((const uint8_t *)data)[i];
+    }
+    f->writes++;
+    return ESP_OK;
+}
+
+static esp_err_t flash_erase(void *ctx, size_t offset, size_t len)
+{
+    flash_t *f = ctx;
+    if (offset % SECTOR_SIZE != 0 || len % SECTOR_SIZE != 0 || offset + len > IMAGE_SIZE) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    memset(f->image + offset, 0xFF, len);
+    f->erases++;
+    return ESP_OK;
+}
+
+// Maps the image file; a fresh image starts out erased
+static void map_image(bool fresh)
+{
+    image_fd = open(path, O_RDWR | O_CREAT | (fresh ? O_TRUNC : 0), 0644);
+    if (image_fd < 0 || ftruncate(image_fd, IMAGE_SIZE) != 0) {
+        perror(path);
+        exit(1);
+    }
+    flash.image = mmap(NULL, IMAGE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, image_fd, 0);
+    if (flash.image == MAP_FAILED) {
+        perror("mmap");
+        exit(1);
+    }
+    if (fresh) {
+        memset(flash.image, 0xFF, IMAGE_SIZE);
+    }
+}
+
+static void unmap_image(void)
+{
+    msync(flash.image, IMAGE_SIZE, MS_SYNC);
+    munmap(flash.image, IMAGE_SIZE);
+    close(image_fd);
+}
+
+// Opens the log on the image, as a boot would
+static esp_err_t boot_log(bool fresh)
+{
+    if (image_fd >= 0) {
+        unmap_image();
+    }
+    map_image(fresh);
+    ts_log_storage_t storage = {
+        .mapped = flash.image,
+        .size = IMAGE_SIZE,
+        .erase_size = SECTOR_SIZE,
+        .write = flash_write,
+        .erase = flash_erase,
+        .ctx = &flash,
+    };
+    clock_ms = 0;
+    return ts_log_open(&storage);
+}
+
+static void wake(void)
+{
+    wake_pending = true;
+}
+
+// One poll of every slot, each with a new value; the writer runs after the
+// poll when woken, as the flush task would
+static void poll_once(void)
+{
+    for (uint16_t slot = 0; slot < SLOTS; slot++) {
+        ts_log_record(1 + slot / 8, 3, 100 + slot, slot, clock_ms, next_raw++);
+    }
+    clock_ms += POLL_MS;
+    if (wake_pending) {
+        wake_pending = false;
+        ts_log_write_pending();
+    }
+}
+
+static esp_err_t collect(void *ctx, const ts_log_sample_t *samples, size_t count, const ts_log_cursor_t *next)
+{
+    collected_t *c = ctx;
+    for (size_t i = 0; i < count && c->count < MAX_SAMPLES; i++) {
+        c->samples[c->count++] = samples[i];
+    }
+    c->last = *next;
+    return ESP_OK;
+}
+
+static esp_err_t read_after(const ts_log_cursor_t *after, bool *gap, ts_log_cursor_t *start)
+{
+    ts_log_cursor_t end;
+    got.count = 0;
+    esp_err_t err = ts_log_begin(after, start, &end, gap);
+    if (err == ESP_OK) {
+        got.last = *start;
+        err = ts_log_read(start, &end, collect, &got);
+    }
+    return err;
+}
+
+// Raw values are unique and increasing, so they identify samples
+static bool raws_consecutive(uint32_t first, uint32_t last)
+{
+    if (got.count != last - first + 1) {
+        return false;
+    }
+    for (size_t i = 0; i < got.count; i++) {
+        if (got.samples[i].raw != first + i) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void test_record_and_read(void)
+{
+    bool gap;
+    ts_log_cursor_t start;
+
+    CHECK(boot_log(true) == ESP_OK, "open of a blank image failed");
+    CHECK(ts_log_boot() == 1, "blank image opened as boot %u", ts_log_boot());
+    ts_log_set_wake(wake);
+
+    next_raw = 0;
+    for (int i = 0; i < 100; i++) {
+        poll_once();
+    }
+    CHECK(ts_log_flush() == ESP_OK, "flush failed");
+    CHECK(read_after(NULL, &gap, &start) == ESP_OK, "read failed");
+    CHECK(!gap, "gap reported on a fresh log");
+    CHECK(raws_consecutive(0, next_raw - 1), "read %zu samples, expected %u", got.count, next_raw);
+    CHECK(got.count > 0 && got.samples[0].boot == 1 && got.samples[0].timestamp == 0 &&
+          got.samples[got.count - 1].timestamp == 99 * POLL_MS && got.samples[17].address == 101,
+          "sample fields did not round-trip");
+
+    // Unchanged values inside the heartbeat interval are filtered
+    uint32_t before = next_raw;
+    ts_log_record(1, 3, 100, 0, clock_ms, before - SLOTS);
+    ts_log_flush();
+    ts_log_cursor_t cursor = got.last;
+    CHECK(read_after(&cursor, &gap, &start) == ESP_OK && got.count == 0, "unchanged value was logged");
+}
+
+static void test_record_stays_in_ram(void)
+{
+    bool gap;
+    ts_log_cursor_t start, cursor;
+
+    read_after(NULL, &gap, &start);
+    cursor = got.last;
+
+    // With no writer running, recording fills the queue and then drops
+    ts_log_set_wake(NULL);
+    unsigned writes = flash.writes;
+    unsigned erases = flash.erases;
+    uint32_t first = next_raw;
+    for (int i = 0; i < 400; i++) {
+        poll_once();
+    }
+    CHECK(flash.writes == writes && flash.erases == erases,
+          "recording wrote flash (%u writes, %u erases)", flash.writes - writes, flash.erases - erases);
+
+    CHECK(ts_log_flush() == ESP_OK, "flush failed");
+    CHECK(read_after(&cursor, &gap, &start) == ESP_OK, "read failed");
+    CHECK(got.count > 0 && got.count <= (size_t)TS_LOG_QUEUE_BLOCKS * TS_LOG_BLOCK_SIZE / 5,
+          "%zu samples held with the writer stalled", got.count);
+    CHECK(got.count > 0 && got.samples[0].raw == first, "queued samples out of order");
+    ts_log_set_wake(wake);
+}
+
+static void test_reopen_resume(void)
+{
+    bool gap;
+    ts_log_cursor_t start, cursor;
+
+    read_after(NULL, &gap, &start);
+    cursor = got.last;
+    uint32_t first = next_raw;
+
+    CHECK(boot_log(false) == ESP_OK, "reopen failed");
+    CHECK(ts_log_boot() == 2, "reopened as boot %u", ts_log_boot());
+    ts_log_set_wake(wake);
+    for (int i = 0; i < 50; i++) {
+        poll_once();
+    }
+    ts_log_flush();
+
+    CHECK(read_after(&cursor, &gap, &start) == ESP_OK, "resume read failed");
+    CHECK(!gap, "gap reported on resume");
+    CHECK(raws_consecutive(first, next_raw - 1), "resumed with %zu samples, expected %u",
+          got.count, next_raw - first);
+    CHECK(got.count > 0 && got.samples[0].boot == 2, "resumed samples not tagged with the new boot");
+
+    // A cursor from beyond the log, e.g. after a reflash, is refused
+    ts_log_cursor_t bogus = { got.last.seq + 10, got.last.offset };
+    CHECK(read_after(&bogus, &gap, &start) == ESP_ERR_INVALID_ARG, "cursor past the head accepted");
+}
+
+static void test_wrap_around(void)
+{
+    bool gap;
+    ts_log_cursor_t start, stale, current;
+
+    read_after(NULL, &gap, &start);
+    stale = got.last;
+    uint32_t first_seq = start.seq;
+
+    // Far more than the ring holds
+    for (int i = 0; i < 2000; i++) {
+        poll_once();
+        if (i == 1990) {
+            ts_log_flush();
+            read_after(NULL, &gap, &start);
+            current = got.last;
+        }
+    }
+    ts_log_flush();
+
+    CHECK(read_after(&stale, &gap, &start) == ESP_OK, "read after wrap failed");
+    CHECK(gap, "overwritten data not reported as a gap");
+    CHECK(start.seq > first_seq + SEGMENTS - 1, "read restarted at segment %u, which was overwritten", start.seq);
+    CHECK(got.count > 0 && got.samples[got.count - 1].raw == next_raw - 1, "newest sample missing after wrap");
+    for (size_t i = 1; i < got.count; i++) {
+        if (got.samples[i].raw != got.samples[i - 1].raw + 1) {
+            CHECK(false, "samples skipped inside the ring at %zu", i);
+            break;
+        }
+    }
+
+    CHECK(read_after(&current, &gap, &start) == ESP_OK && !gap, "recent cursor reported a gap");
+    CHECK(got.count == 9 * SLOTS, "recent cursor read %zu samples, expected %d", got.count, 9 * SLOTS);
+}
+
+// Flips a payload byte of the block at cursor
+static void corrupt_block(const ts_log_cursor_t *at)
+{
+    size_t base = (size_t)(at->seq % SEGMENTS) * TS_LOG_SEGMENT_SIZE + at->offset;
+    flash.image[base + 20] ^= 0x01;
+}
+
+static void test_corrupt_block(void)
+{
+    bool gap;
+    ts_log_cursor_t start, torn, cursor;
+
+    // The newest block torn, as by a power cut mid-write: the reopen seals
+    // the head before it and logging continues in the next segment
+    read_after(NULL, &gap, &start);
+    cursor = got.last;
+    for (int i = 0; i < 20; i++) {
+        poll_once();
+    }
+    ts_log_flush();
+    read_after(&cursor, &gap, &start);
+    uint32_t last_good = got.count > 0 ? got.samples[got.count - 1].raw : 0;
+    torn = got.last;
+    poll_once();
+    ts_log_flush();
+    corrupt_block(&torn);
+
+    uint32_t first = next_raw;
+    CHECK(boot_log(false) == ESP_OK, "reopen with a torn block failed");
+    ts_log_set_wake(wake);
+    poll_once();
+    ts_log_flush();
+    CHECK(read_after(&cursor, &gap, &start) == ESP_OK, "read across a torn block failed");
+    CHECK(got.count > 0 && got.samples[got.count - 1].raw == next_raw - 1, "samples after the reopen missing");
+    bool skipped = true;
+    for (size_t i = 0; i < got.count; i++) {
+        if (got.samples[i].raw > last_good && got.samples[i].raw < first) {
+            skipped = false;
+        }
+    }
+    CHECK(skipped, "samples from the torn block were returned");
+
+    // A bad block inside a sealed segment stops the reader with an error
+    // instead of returning garbage
+    read_after(NULL, &gap, &start);
+    ts_log_cursor_t oldest = start;
+    corrupt_block(&oldest);
+    CHECK(read_after(NULL, &gap, &start) == ESP_ERR_INVALID_STATE, "corrupt sealed block not reported");
+    CHECK(got.count == 0, "%zu samples returned past a corrupt block", got.count);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 1) {
+        path = argv[1];
+    }
+
+    test_record_and_read();
+    test_record_stays_in_ram();
+    test_reopen_resume();
+    test_wrap_around();
+    test_corrupt_block();
+
+    unmap_image();
+    if (argc <= 1) {
+        unlink(path);
+    }
+    printf("%s: %s\n", path, failures ? "FAILED" : "ok");
+    return failures ? 1 : 0;
+}
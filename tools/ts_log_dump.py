@@ -0,0 +1,122 @@
+#!/usr/bin/env python3
+"""Decode a time-series log partition image to NDJSON or CSV.
+
+The image can be read from a device with
+    parttool.py read_partition --partition-name tslog --output tslog.bin
+and is decoded with the same rules the firmware uses (main/ts_log.c), so the
+tool also serves to check images produced by a host build of the log.
+
+Usage:
+    ts_log_dump.py tslog.bin [--csv] [--after SEQ:OFFSET]
+"""
+
+import argparse
+import binascii
+import json
+import struct
+import sys
+
+SEGMENT_SIZE = 32 * 1024
+SEGMENT_MAGIC = 0x314C5354
+SEGMENT_HEADER = struct.Struct('<IIHHII12x')
+SEGMENT_UNSEALED = 0xFFFFFFFF
+BLOCK_MAGIC = 0x4B42
+BLOCK_ERASED = 0xFFFF
+BLOCK_HEADER = struct.Struct('<HHHHII')
+
+
+def crc32(data, crc=0):
+    # esp_rom_crc32_le(crc, ...) matches zlib's crc32 seeded the same way
+    return binascii.crc32(data, crc)
+
+
+def varint(data, pos):
+    value = shift = 0
+    while True:
+        byte = data[pos]
+        pos += 1
+        value |= (byte & 0x7F) << shift
+        if not byte & 0x80:
+            return value, pos
+        shift += 7
+
+
+def segments(image):
+    count = len(image) // SEGMENT_SIZE
+    found = []
+    for index in range(count):
+        base = index * SEGMENT_SIZE
+        magic, seq, boot, _, crc, sealed = SEGMENT_HEADER.unpack_from(image, base)
+        if magic == SEGMENT_MAGIC and seq % count == index and crc == crc32(image[base:base + 12]):
+            found.append((seq, base, sealed))
+    found.sort()
+    # Only the newest ring length of segments is live
+    if found:
+        head = found[-1][0]
+        found = [s for s in found if s[0] + count > head]
+    return found
+
+
+def blocks(image, base, sealed, start):
+    offset = start
+    end = SEGMENT_SIZE if sealed == SEGMENT_UNSEALED else sealed
+    while offset + BLOCK_HEADER.size <= end:
+        magic, length, count, boot, base_ms, crc = BLOCK_HEADER.unpack_from(image, base + offset)
+        if magic == BLOCK_ERASED:
+            return
+        payload = image[base + offset + BLOCK_HEADER.size:base + offset + BLOCK_HEADER.size + length]
+        if magic != BLOCK_MAGIC or len(payload) != length or \
+                crc != crc32(payload, crc32(image[base + offset:base + offset + 12])):
+            print(f'corrupt block at {base + offset:#x}, skipping rest of segment', file=sys.stderr)
+            return
+        offset += (BLOCK_HEADER.size + length + 3) & ~3
+        yield boot, base_ms, count, payload, offset
+
+
+def samples(payload, count, boot, base_ms):
+    pos = 0
+    timestamp = base_ms
+    for _ in range(count):
+        delta, pos = varint(payload, pos)
+        device_id, reg_type = payload[pos], payload[pos + 1]
+        address, pos = varint(payload, pos + 2)
+        raw, pos = varint(payload, pos)
+        timestamp += delta
+        yield {'boot': boot, 't': timestamp, 'device_id': device_id, 'type': reg_type,
+               'address': address, 'raw': raw}
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('image')
+    parser.add_argument('--csv', action='store_true')
+    parser.add_argument('--after', help='resume cursor SEQ:OFFSET')
+    args = parser.parse_args()
+
+    with open(args.image, 'rb') as f:
+        image = f.read()
+
+    after = tuple(int(x) for x in args.after.split(':')) if args.after else (0, 0)
+    fields = ['boot', 't', 'device_id', 'type', 'address', 'raw']
+    if args.csv:
+        print(','.join(fields))
+
+    cursor = None
+    for seq, base, sealed in segments(image):
+        if seq < after[0]:
+            continue
+        start = after[1] if seq == after[0] else SEGMENT_HEADER.size
+        for boot, base_ms, count, payload, offset in blocks(image, base, sealed, start):
+            for sample in samples(payload, count, boot, base_ms):
+                if args.csv:
+                    print(','.join(str(sample[k]) for k in fields))
+                else:
+                    print(json.dumps(sample))
+            cursor = f'{seq}:{offset}'
+
+    if cursor:
+        print(f'cursor {cursor}', file=sys.stderr)
+
+
+if __name__ == '__main__':
+    main()